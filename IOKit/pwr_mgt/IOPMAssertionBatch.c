@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Client side of the batch assertion routines in powermanagement.defs.
+ * Tools link this alongside the MIG user stubs and PMAssertionWire.c.
+ */
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <SystemConfiguration/SCValidation.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <servers/bootstrap.h>
+#include <bootstrap_priv.h>
+#include <mach/mach.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "powermanagement.h"
+#include "../../pmconfigd/PMAssertionWire.h"
+
+typedef struct {
+    CFStringRef     key;
+    int             tag;
+} wireKeyMap_t;
+
+static const wireKeyMap_t kWireStringKeys[] = {
+    { kIOPMAssertionTypeKey,                    kPMWireTagType },
+    { kIOPMAssertionNameKey,                    kPMWireTagName },
+    { kIOPMAssertionDetailsKey,                 kPMWireTagDetails },
+    { kIOPMAssertionHumanReadableReasonKey,     kPMWireTagHumanReadableReason },
+    { kIOPMAssertionLocalizationBundlePathKey,  kPMWireTagLocalizationBundlePath },
+    { kIOPMAssertionTimeoutActionKey,           kPMWireTagTimeoutAction }
+};
+
+static IOReturn _pm_connect(mach_port_t *newConnection)
+{
+    kern_return_t       kern_result = KERN_SUCCESS;
+    
+    if(!newConnection) return kIOReturnBadArgument;
+
+    // open reference to PM configd
+    kern_result = bootstrap_look_up2(bootstrap_port, 
+                                    kIOPMServerBootstrapName, 
+                                    newConnection, 
+                                    0, 
+                                    BOOTSTRAP_PRIVILEGED_SERVER);    
+
+    if(KERN_SUCCESS != kern_result) {
+        return kIOReturnError;
+    }
+    return kIOReturnSuccess;
+}
+
+static IOReturn _pm_disconnect(mach_port_t connection)
+{
+    if(!connection) return kIOReturnBadArgument;
+    mach_port_destroy(mach_task_self(), connection);
+    return kIOReturnSuccess;
+}
+
+static pmWireString_t *wireStringForTag(pmWireAssertion_t *wire, int tag)
+{
+    switch (tag) {
+        case kPMWireTagType:                    return &wire->type;
+        case kPMWireTagName:                    return &wire->name;
+        case kPMWireTagDetails:                 return &wire->details;
+        case kPMWireTagHumanReadableReason:     return &wire->humanReadableReason;
+        case kPMWireTagLocalizationBundlePath:  return &wire->localizationBundlePath;
+        case kPMWireTagTimeoutAction:           return &wire->timeoutAction;
+        default:                                return NULL;
+    }
+}
+
+/*
+ * Points 'str' at the UTF-8 bytes of 'val'. If CF can't hand them out
+ * directly, a copy is made and parked in 'keepAlive'.
+ */
+static bool getWireString(CFStringRef val, pmWireString_t *str, CFMutableArrayRef keepAlive)
+{
+    const char      *ptr;
+    CFDataRef       utf8;
+
+    if ((ptr = CFStringGetCStringPtr(val, kCFStringEncodingUTF8))) {
+        str->ptr = ptr;
+        str->len = (uint32_t)strlen(ptr);
+        return true;
+    }
+
+    utf8 = CFStringCreateExternalRepresentation(0, val, kCFStringEncodingUTF8, 0);
+    if (!utf8) {
+        return false;
+    }
+    CFArrayAppendValue(keepAlive, utf8);
+    CFRelease(utf8);
+
+    str->ptr = (const char *)CFDataGetBytePtr(utf8);
+    str->len = (uint32_t)CFDataGetLength(utf8);
+    return true;
+}
+
+/*
+ * Appends one description to 'buf'. Keys with a wire tag are written as
+ * native fields, everything else is bundled into a binary plist.
+ */
+static bool encodeDescription(pmWireBuffer_t *buf, CFDictionaryRef description)
+{
+    pmWireAssertion_t       wire;
+    CFMutableDictionaryRef  others = NULL;
+    CFMutableArrayRef       keepAlive = NULL;
+    CFDataRef               othersData = NULL;
+    CFIndex                 count, i;
+    const void              **keys = NULL;
+    const void              **values = NULL;
+    pmWireString_t          *str;
+    unsigned                k;
+    bool                    tagged;
+    bool                    ok = false;
+
+    if (!isA_CFDictionary(description)) {
+        return false;
+    }
+
+    memset(&wire, 0, sizeof(wire));
+    count = CFDictionaryGetCount(description);
+    keys = malloc(2 * count * sizeof(void *));
+    keepAlive = CFArrayCreateMutable(0, 0, &kCFTypeArrayCallBacks);
+    others = CFDictionaryCreateMutable(0, 0, 
+                &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if ((count && !keys) || !keepAlive || !others) {
+        goto exit;
+    }
+    values = keys + count;
+    CFDictionaryGetKeysAndValues(description, keys, values);
+
+    for (i = 0; i < count; i++)
+    {
+        tagged = false;
+
+        if (isA_CFString(values[i])) {
+            for (k = 0; k < sizeof(kWireStringKeys)/sizeof(kWireStringKeys[0]); k++) {
+                if (!CFEqual(keys[i], kWireStringKeys[k].key))
+                    continue;
+                str = wireStringForTag(&wire, kWireStringKeys[k].tag);
+                if (!getWireString(values[i], str, keepAlive))
+                    goto exit;
+                wire.present |= (1U << kWireStringKeys[k].tag);
+                tagged = true;
+
+                // Saves powerd looking up a type name it knows
+                if ((kWireStringKeys[k].tag == kPMWireTagType)
+                    && (wire.typeToken = PMWireTypeTokenForName(str->ptr, str->len)))
+                {
+                    wire.present |= (1U << kPMWireTagTypeToken);
+                }
+                break;
+            }
+        }
+        else if (isA_CFNumber(values[i])) {
+            if (CFEqual(keys[i], kIOPMAssertionLevelKey)) {
+                tagged = CFNumberGetValue(values[i], kCFNumberSInt32Type, &wire.level);
+                if (tagged) wire.present |= (1U << kPMWireTagLevel);
+            }
+            else if (CFEqual(keys[i], kIOPMAssertionTimeoutKey)) {
+                tagged = CFNumberGetValue(values[i], kCFNumberDoubleType, &wire.timeout);
+                if (tagged) wire.present |= (1U << kPMWireTagTimeout);
+            }
+        }
+
+        if (!tagged) {
+            CFDictionarySetValue(others, keys[i], values[i]);
+        }
+    }
+
+    if (CFDictionaryGetCount(others)) {
+        othersData = CFPropertyListCreateData(0, others, kCFPropertyListBinaryFormat_v1_0, 0, NULL);
+        if (!othersData) {
+            goto exit;
+        }
+        wire.plist = CFDataGetBytePtr(othersData);
+        wire.plistLen = (uint32_t)CFDataGetLength(othersData);
+        wire.present |= (1U << kPMWireTagPlist);
+    }
+
+    PMWireEncodeAssertion(buf, &wire);
+    ok = !buf->failed;
+
+exit:
+    if (othersData) CFRelease(othersData);
+    if (others) CFRelease(others);
+    if (keepAlive) CFRelease(keepAlive);
+    free(keys);
+
+    return ok;
+}
+
+IOReturn IOPMAssertionsCreateWithDescriptions(
+    CFArrayRef          descriptions,
+    IOPMAssertionID     *assertionIDs)
+{
+    mach_port_t             pm_server = MACH_PORT_NULL;
+    pmWireBuffer_t          wireBuf = { 0 };
+    CFIndex                 count = 0;
+    CFIndex                 i;
+    int                     ids[kIOPMAssertionBatchMax];
+    mach_msg_type_number_t  idsCnt = kIOPMAssertionBatchMax;
+    kern_return_t           kern_result = KERN_SUCCESS;
+    IOReturn                return_code = kIOReturnError;
+
+    if (!descriptions || !assertionIDs) {
+        return kIOReturnBadArgument;
+    }
+
+    count = CFArrayGetCount(descriptions);
+    if ((count == 0) || (count > kIOPMAssertionBatchMax)) {
+        return kIOReturnBadArgument;
+    }
+
+    for (i = 0; i < count; i++) {
+        assertionIDs[i] = kIOPMNullAssertionID;
+    }
+
+    PMWireEncodeBegin(&wireBuf);
+    for (i = 0; i < count; i++) {
+        if (!encodeDescription(&wireBuf, CFArrayGetValueAtIndex(descriptions, i))) {
+            return_code = kIOReturnBadArgument;
+            goto exit;
+        }
+    }
+    if (!PMWireEncodeEnd(&wireBuf, (uint32_t)count)) {
+        return_code = kIOReturnNoMemory;
+        goto exit;
+    }
+
+    return_code = _pm_connect(&pm_server);
+    if (kIOReturnSuccess != return_code) {
+        goto exit;
+    }
+
+    kern_result = io_pm_assertion_create_batch(pm_server,
+                            (vm_offset_t)wireBuf.bytes,
+                            (mach_msg_type_number_t)wireBuf.len,
+                            ids, &idsCnt,
+                            &return_code);
+
+    if (KERN_SUCCESS != kern_result) {
+        return_code = kIOReturnInternalError;
+        goto exit;
+    }
+
+    if (kIOReturnSuccess == return_code) {
+        if (idsCnt != (mach_msg_type_number_t)count) {
+            return_code = kIOReturnInternalError;
+            goto exit;
+        }
+        for (i = 0; i < count; i++) {
+            assertionIDs[i] = (IOPMAssertionID)ids[i];
+        }
+    }
+
+exit:
+    if (MACH_PORT_NULL != pm_server) {
+        _pm_disconnect(pm_server);
+    }
+    PMWireBufferFree(&wireBuf);
+
+    return return_code;
+}
+
+IOReturn IOPMAssertionsRelease(
+    const IOPMAssertionID   *assertionIDs,
+    CFIndex                 count)
+{
+    mach_port_t             pm_server = MACH_PORT_NULL;
+    int                     ids[kIOPMAssertionBatchMax];
+    CFIndex                 i;
+    kern_return_t           kern_result = KERN_SUCCESS;
+    IOReturn                return_code = kIOReturnError;
+
+    if (!assertionIDs || (count <= 0) || (count > kIOPMAssertionBatchMax)) {
+        return kIOReturnBadArgument;
+    }
+
+    for (i = 0; i < count; i++) {
+        ids[i] = (int)assertionIDs[i];
+    }
+
+    return_code = _pm_connect(&pm_server);
+    if (kIOReturnSuccess != return_code) {
+        return return_code;
+    }
+
+    kern_result = io_pm_assertion_release_batch(pm_server,
+                            ids, (mach_msg_type_number_t)count,
+                            &return_code);
+
+    if (KERN_SUCCESS != kern_result) {
+        return_code = kIOReturnInternalError;
+    }
+
+    _pm_disconnect(pm_server);
+
+    return return_code;
+}
@@ -346,6 +346,10 @@ __BEGIN_DECLS
  * @constant        kIOPMAssertionsAnyChangedNotifyString
  * @discussion      Assertion notify(3) string
  *                  Fires when any individual assertion is created, released, or modified.
+ *                  Changes close together are coalesced into one notification; see
+ *                  kIOPMAssertionTunableNotifyWindow. The notification's state (notify_get_state)
+ *                  counts the changes made so far, so a subscriber can tell how many changes
+ *                  one notification covers.
  */
 #define kIOPMAssertionsAnyChangedNotifyString         "com.apple.system.powermanagement.assertions.anychange"
 
@@ -355,9 +359,139 @@ __BEGIN_DECLS
  * @discussion      Assertion notify(3) string
  *                  Fires when global assertion levels change. This notification doesn't necessarily fire
  *                  when any individual assertion is created, released, or modified.
+ *                  Coalesced and sequenced like kIOPMAssertionsAnyChangedNotifyString.
  */
 #define kIOPMAssertionsChangedNotifyString          "com.apple.system.powermanagement.assertions"
 
+/*!
+ * @enum            Assertion tunables
+ * @discussion      Selectors for the io_pm_assertion_set_tunable MIG routine, used by pmset.
+ *                  Any caller may read a tunable; changing one requires root.
+ * @constant        kIOPMAssertionTunableNotifyWindow
+ *                  Milliseconds over which assertion change notifications are coalesced.
+ *                  The first change after a quiet period is posted at once. Later changes are
+ *                  posted together at the end of the window. 0 posts every change.
+ * @constant        kIOPMAssertionTunableTimedOutHistory
+ *                  Number of timed out assertions kept for IOPMCopyTimedOutAssertions(), 1 to 16384.
+ *                  Shrinking the history keeps the most recent entries.
+ * @constant        kIOPMAssertionTunableProcessLimit
+ *                  Most assertions one process may hold at once. Creating one more fails with
+ *                  kIOPMAssertionReturnQuotaExceeded. 0 removes the limit.
+ * @constant        kIOPMAssertionTunableProcessRate
+ *                  Assertion creates and property changes one process may make per second,
+ *                  on average. Calls past the limit fail with kIOPMAssertionReturnRateLimited.
+ *                  0 removes the limit.
+ * @constant        kIOPMAssertionTunableProcessBurst
+ *                  Calls a process may make at once, above kIOPMAssertionTunableProcessRate,
+ *                  after a quiet period. At least 1.
+ * @constant        kIOPMAssertionTunableQuotaRejects
+ *                  Number of creates refused by kIOPMAssertionTunableProcessLimit.
+ *                  Can only be reset to 0.
+ * @constant        kIOPMAssertionTunableRateRejects
+ *                  Number of calls refused by kIOPMAssertionTunableProcessRate.
+ *                  Can only be reset to 0.
+ * @constant        kIOPMAssertionTunablePropertyLimit
+ *                  Largest size, in bytes as estimated by powerd, of the properties one assertion
+ *                  may carry. Larger creates and property changes fail with
+ *                  kIOPMAssertionReturnPropertiesTooLarge. 0 removes the limit.
+ */
+enum {
+    kIOPMAssertionTunableNotifyWindow               = 1,
+    kIOPMAssertionTunableTimedOutHistory            = 2,
+    kIOPMAssertionTunableProcessLimit               = 3,
+    kIOPMAssertionTunableProcessRate                = 4,
+    kIOPMAssertionTunableProcessBurst               = 5,
+    kIOPMAssertionTunableQuotaRejects               = 6,
+    kIOPMAssertionTunableRateRejects                = 7,
+    kIOPMAssertionTunablePropertyLimit              = 8
+};
+
+/*!
+ * @define          kIOPMAssertionReturnQuotaExceeded
+ * @discussion      Returned when creating an assertion would take the calling process past
+ *                  kIOPMAssertionTunableProcessLimit live assertions.
+ */
+#define kIOPMAssertionReturnQuotaExceeded           kIOReturnNoResources
+
+/*!
+ * @define          kIOPMAssertionReturnRateLimited
+ * @discussion      Returned when the calling process creates or changes assertions faster
+ *                  than kIOPMAssertionTunableProcessRate allows. The call may be retried later.
+ */
+#define kIOPMAssertionReturnRateLimited             kIOReturnBusy
+
+/*!
+ * @define          kIOPMAssertionReturnPropertiesTooLarge
+ * @discussion      Returned when an assertion's properties would grow past
+ *                  kIOPMAssertionTunablePropertyLimit.
+ */
+#define kIOPMAssertionReturnPropertiesTooLarge      kIOReturnMessageTooLarge
+
+/*!
+ * @enum            Assertion events
+ * @discussion      Values of the <code>event</code> field of IOPMAssertionEventRecord.
+ * @constant        kIOPMAssertionEventCreated          An assertion was created.
+ * @constant        kIOPMAssertionEventReleased         An assertion was released by its creator.
+ * @constant        kIOPMAssertionEventTimedOut         An assertion's timeout fired.
+ * @constant        kIOPMAssertionEventTurnedOn         An assertion's level was set to kIOPMAssertionLevelOn.
+ * @constant        kIOPMAssertionEventTurnedOff        An assertion's level was set to kIOPMAssertionLevelOff.
+ * @constant        kIOPMAssertionEventProcessExited    An assertion was released because its creator exited.
+ */
+enum {
+    kIOPMAssertionEventCreated                      = 1,
+    kIOPMAssertionEventReleased                     = 2,
+    kIOPMAssertionEventTimedOut                     = 3,
+    kIOPMAssertionEventTurnedOn                     = 4,
+    kIOPMAssertionEventTurnedOff                    = 5,
+    kIOPMAssertionEventProcessExited                = 6
+};
+
+/*!
+ * @define          kIOPMAssertionEventsMaxBatch
+ * @discussion      The most records returned by one io_pm_assertion_copy_events call.
+ *                  A caller that receives this many should call again with the returned cursor.
+ */
+#define kIOPMAssertionEventsMaxBatch                512
+
+/*!
+ * @struct          IOPMAssertionEventRecord
+ * @discussion      One entry of powerd's assertion event stream, as returned by the
+ *                  io_pm_assertion_copy_events MIG routine. powerd keeps the most recent events
+ *                  in a ring. A caller passes the cursor it got back from its previous call and
+ *                  receives every event since, oldest first. Cursor 0 starts at the oldest event
+ *                  still held; a cursor past the newest event returns nothing and the current
+ *                  position. If events were dropped before the caller read them, the routine
+ *                  says so with its overflow flag.
+ *                  Strings are UTF-8, NUL terminated, and truncated to fit.
+ */
+typedef struct {
+    uint64_t        cursor;             /* Position of this event in the stream */
+    double          time;               /* CFAbsoluteTime of the event */
+    uint32_t        assertionID;
+    int32_t         pid;
+    uint16_t        event;              /* kIOPMAssertionEvent* */
+    uint16_t        level;              /* Assertion level after the event */
+    uint32_t        reserved;
+    char            type[32];           /* Assertion type */
+    char            name[64];           /* Assertion name */
+} IOPMAssertionEventRecord;
+
+/*!
+ * @struct          IOPMAssertionPropertyUsageRecord
+ * @discussion      Memory held for the properties of one process's assertions, as returned by
+ *                  the io_pm_assertion_copy_property_usage MIG routine, one record per process
+ *                  holding assertions. Bytes are powerd's estimate for the properties clients
+ *                  attach, not counting those it keeps decoded, such as the level and timeout.
+ */
+typedef struct {
+    uint64_t        bytes;              /* All of the process's assertions */
+    int32_t         pid;
+    uint32_t        assertionCount;
+    uint32_t        largestBytes;       /* The process's largest assertion */
+    uint32_t        largestID;          /* ...and its assertion ID */
+    char            name[32];           /* Process name */
+} IOPMAssertionPropertyUsageRecord;
+
 /*! 
  * @define          kIOPMAssertionTimeoutActionKillProcess
  *
@@ -381,10 +515,40 @@ IOReturn IOPMAssertionSetTimeout(IOPMAssertionID whichAssertion, CFTimeInterval
 
 /*! @function IOPMCopyTimedOutAssertions
  *  @abstract Returns a CFArray of assertions (as CFDictionary's) that have timed out.
- *  @discussion Only the 5 most recent assertions are recorded.
+ *  @discussion The array is ordered newest first. Only the most recent timeouts are recorded;
+ *      256 by default, or as set with "pmset assertiontunable timedouthistory".
  */
 IOReturn IOPMCopyTimedOutAssertions(CFArrayRef *timedOutAssertions);
 
+/*!
+ * @define          kIOPMAssertionBatchMax
+ * @discussion      The most assertions that can be created or released in a single
+ *                  IOPMAssertionsCreateWithDescriptions() or IOPMAssertionsRelease() call.
+ */
+#define kIOPMAssertionBatchMax                      32
+
+/*! @function IOPMAssertionsCreateWithDescriptions
+ *  @abstract Creates several assertions with one request to powerd.
+ *  @discussion Each element of <code>descriptions</code> is a CFDictionary of assertion properties,
+ *  as passed to IOPMAssertionCreateWithProperties(). Either every assertion is created, or none is.
+ *  Each affected assertion type is evaluated once and a single
+ *  kIOPMAssertionsAnyChangedNotifyString notification is posted for the whole batch.
+ *  @param descriptions Up to kIOPMAssertionBatchMax assertion property dictionaries.
+ *  @param assertionIDs On success, holds the new assertion IDs in the order of <code>descriptions</code>.
+ *  Must have room for CFArrayGetCount(descriptions) IDs. Set to kIOPMNullAssertionID on failure.
+ *  @result kIOReturnSuccess, or the error that stopped the batch.
+ */
+IOReturn IOPMAssertionsCreateWithDescriptions(CFArrayRef descriptions, IOPMAssertionID *assertionIDs);
+
+/*! @function IOPMAssertionsRelease
+ *  @abstract Releases several assertions with one request to powerd.
+ *  @discussion Every assertion is released even if an earlier one in the list fails.
+ *  @param assertionIDs Up to kIOPMAssertionBatchMax assertion IDs.
+ *  @param count Number of IDs in <code>assertionIDs</code>.
+ *  @result kIOReturnSuccess, or the first error encountered.
+ */
+IOReturn IOPMAssertionsRelease(const IOPMAssertionID *assertionIDs, CFIndex count);
+
 CFStringRef IOPMAssertionCreateTimeOutKey(void);
 CFStringRef IOPMAssertionCreatePIDMappingKey(void);
 CFStringRef IOPMAssertionCreateAggregateAssertionKey(void);
@@ -1694,6 +1858,60 @@ typedef void (*IOPMEventHandlerType)(
  */
 #define kIOPMAckClientInfoKey                                   CFSTR("ClientInfo")
 
+/*!
+ * @struct          IOPMConnectionNotificationStatsRecord
+ * @discussion      Delivery of sleep/wake notifications to one open IOPMConnection, as returned by
+ *                  the io_pm_connection_copy_notification_stats MIG routine. A notification is
+ *                  delayed if the client's queue was full when first sent, and dropped if it was
+ *                  never delivered; powerd then stops waiting for that client's acknowledgement.
+ */
+typedef struct {
+    int32_t         pid;
+    uint32_t        connectionID;
+    uint32_t        sent;
+    uint32_t        delayed;
+    uint32_t        dropped;
+    uint32_t        reserved;
+    char            name[32];           /* Name the connection was created with */
+} IOPMConnectionNotificationStatsRecord;
+
+#define kIOPMConnectionTransitionHistory    16
+
+/*!
+ * @struct          IOPMConnectionTransitionRecord
+ * @discussion      One system capability change delivered to IOPMConnection clients. Latency runs
+ *                  from the kernel's message to the last client acknowledging or timing out.
+ */
+typedef struct {
+    double          receivedTime;       /* CFAbsoluteTime of the kernel message */
+    double          latency;            /* Seconds */
+    uint32_t        capabilityBits;     /* kIOPMCapability bits clients were told about */
+    uint32_t        responseCount;      /* Clients notified */
+    uint32_t        mergedCount;        /* Kernel messages merged into this one */
+    uint32_t        timedOutCount;      /* Clients that didn't acknowledge */
+} IOPMConnectionTransitionRecord;
+
+/*!
+ * @struct          IOPMConnectionTransitionStats
+ * @discussion      Returned by the io_pm_connection_copy_transition_stats MIG routine. Capability
+ *                  changes that arrive while clients are still acknowledging an earlier one are
+ *                  queued. A change in the same direction as the one queued before it is merged
+ *                  into it; once the queue is full, changes are merged regardless and the state in
+ *                  between is dropped. Kernel acknowledgements are never dropped.
+ */
+typedef struct {
+    uint64_t        transitions;        /* Delivered to clients */
+    uint64_t        merged;
+    uint64_t        dropped;
+    double          totalLatency;       /* Seconds, over all transitions */
+    double          maxLatency;
+    uint32_t        queueDepth;         /* Queued right now */
+    uint32_t        queueHighWater;
+    uint32_t        historyCount;       /* Valid entries in history, oldest first */
+    uint32_t        reserved;
+    IOPMConnectionTransitionRecord  history[kIOPMConnectionTransitionHistory];
+} IOPMConnectionTransitionStats;
+
 /*****************************************************************************/
 /*****************************************************************************/
 
@@ -85,6 +85,20 @@ static CFStringRef createLongAssertionName(void)
                         kCFStringEncodingMacRoman);
 }
 
+static CFDictionaryRef createAssertionDescription(CFStringRef type, CFStringRef name)
+{
+    CFMutableDictionaryRef  description = NULL;
+    
+    description = CFDictionaryCreateMutable(0, 0, 
+                        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    CFDictionarySetValue(description, kIOPMAssertionTypeKey, type);
+    if (name) {
+        CFDictionarySetValue(description, kIOPMAssertionNameKey, name);
+    }
+    
+    return description;
+}
+
 static bool AssertionIsSupported(CFStringRef assertionname)
 {
     // Assertion type EnableIdleSleep is unsupported on desktop. Do not run it.
@@ -141,7 +155,8 @@ void Test_runthroughonce(void)
 
     listAssertions = (CFStringRef *)calloc(assertionsCount, sizeof(void *));
 
-    assertionIDArray = (IOPMAssertionID *)calloc(assertionsCount, sizeof(IOPMAssertionID));
+    // One extra slot for the failing batch create below
+    assertionIDArray = (IOPMAssertionID *)calloc(assertionsCount + 1, sizeof(IOPMAssertionID));
 
     CFDictionaryGetKeysAndValues(
                         editedAssertionsStatus, 
@@ -230,6 +245,63 @@ void Test_runthroughonce(void)
     PMTestPass("AssertAndReleaseSimultaneousTest");
 
 
+/***** All at once in one batch *****/
+
+
+    PMTestLog("Creating all %d assertions in one batch, then releasing them.", assertionsCount);
+
+    CFMutableArrayRef   descriptions = CFArrayCreateMutable(0, 0, &kCFTypeArrayCallBacks);
+
+    for (i=0; i<assertionsCount; i++)
+    {
+        CFDictionaryRef description = createAssertionDescription(listAssertions[i], NULL);
+
+        CFArrayAppendValue(descriptions, description);
+        CFRelease(description);
+    }
+
+    // One request creates every type; powerd evaluates each type once.
+    ret = IOPMAssertionsCreateWithDescriptions(descriptions, assertionIDArray);
+    if (kIOReturnSuccess != ret)
+    {
+        PMTestFail("Batch create of %d assertions returns 0x%08x", assertionsCount, ret);
+    }
+
+    ret = IOPMAssertionsRelease(assertionIDArray, assertionsCount);
+    if (kIOReturnSuccess != ret) 
+    {
+        PMTestFail("Batch release of %d assertions returns 0x%08x", assertionsCount, ret);    
+    }
+
+    // Releasing them again must fail; they're all gone.
+    ret = IOPMAssertionsRelease(assertionIDArray, assertionsCount);
+    if (kIOReturnSuccess == ret) 
+    {
+        PMTestFail("Second batch release of %d assertions succeeded", assertionsCount);    
+    }
+
+    // An unknown type anywhere in the batch must leave no assertion behind.
+    CFDictionaryRef bogus = createAssertionDescription(CFSTR("NotAnAssertionType"), NULL);
+    CFArrayAppendValue(descriptions, bogus);
+    CFRelease(bogus);
+
+    ret = IOPMAssertionsCreateWithDescriptions(descriptions, assertionIDArray);
+    if (kIOReturnSuccess == ret)
+    {
+        PMTestFail("Batch create with a bogus assertion type succeeded");
+    }
+    for (i=0; i<assertionsCount; i++)
+    {
+        if (kIOPMNullAssertionID != assertionIDArray[i]) {
+            PMTestFail("Failed batch create left assertion #%d set to %d", i, assertionIDArray[i]);
+        }
+    }
+
+    CFRelease(descriptions);
+    
+    PMTestPass("AssertAndReleaseBatchTest");
+
+
 /***** Assert Bogus Names *****/
     PMTestLog("Creating %d assertions with long names.", kLongNamesCount);
 
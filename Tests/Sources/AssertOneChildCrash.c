@@ -25,9 +25,33 @@
 #include <IOKit/pwr_mgt/IOPM.h>
 #include <IOKit/pwr_mgt/IOPMLib.h>
 #include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 #include "PMTestLib.h"
 
+#define kReapPollCount      20
+#define kReapPollUSecs      100000
+
+/* Returns true while powerd still lists assertions for 'pid' */
+static bool pidHasAssertions(pid_t pid)
+{
+    CFDictionaryRef     byProcess = NULL;
+    CFNumberRef         pidNum = NULL;
+    bool                found = false;
+    
+    if (kIOReturnSuccess != IOPMCopyAssertionsByProcess(&byProcess) || !byProcess) {
+        return false;
+    }
+    
+    pidNum = CFNumberCreate(0, kCFNumberIntType, &pid);
+    found = CFDictionaryContainsKey(byProcess, pidNum);
+    
+    CFRelease(pidNum);
+    CFRelease(byProcess);
+    return found;
+}
 
 int main(int argc, char **argv)
 {
@@ -72,6 +96,18 @@ int main(int argc, char **argv)
             PMTestFail("IOPMAssertionCreate() failed, error = 0x%08x", ret);
             exit(1);
         }
+
+        // One untimed and one inactive assertion too, so every list holds one of ours
+        ret = IOPMAssertionCreateWithName(kIOPMAssertionTypePreventUserIdleDisplaySleep,
+                                    kIOPMAssertionLevelOn, CFSTR("AssertOneChildCrash"), &_id);
+        if (ret == kIOReturnSuccess) {
+            ret = IOPMAssertionCreateWithName(kIOPMAssertionTypePreventSystemSleep,
+                                    kIOPMAssertionLevelOff, CFSTR("AssertOneChildCrash"), &_id);
+        }
+        if (ret != kIOReturnSuccess) {
+            PMTestFail("IOPMAssertionCreateWithName() failed, error = 0x%08x", ret);
+            exit(1);
+        }
         exit(0);
 
     }
@@ -82,6 +118,8 @@ int main(int argc, char **argv)
     }
     
     
+    int childPID = _pid;
+    
     _pid = wait4(_pid, &wait_status, 0, NULL);
     if ((_pid == -1) ||
         !WIFEXITED(wait_status) ||
@@ -90,7 +128,18 @@ int main(int argc, char **argv)
         return 0;
     }
     
-    PMTestPass("Child exited cleanly; however this test does not verify that PM reaped child's assertion.\n");
+    // powerd reaps on its process exit source, which may land a moment later
+    int i;
+    for (i = 0; (i < kReapPollCount) && pidHasAssertions(childPID); i++) {
+        usleep(kReapPollUSecs);
+    }
+    
+    if (i == kReapPollCount) {
+        PMTestFail("PM did not reap the assertions of exited child pid %d", childPID);
+        return 0;
+    }
+    
+    PMTestPass("Child exited cleanly and PM reaped its assertions.\n");
 
     return 0;
 }
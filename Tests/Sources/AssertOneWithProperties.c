@@ -40,6 +40,30 @@
  *
  */
 
+/* Returns this process's only assertion, as seen by IOPMCopyAssertionsByProcess */
+static CFDictionaryRef copyMyAssertion(void)
+{
+    CFDictionaryRef     byProcess = NULL;
+    CFArrayRef          mine = NULL;
+    CFNumberRef         pidNum = NULL;
+    CFDictionaryRef     result = NULL;
+    int                 pid = getpid();
+
+    if (kIOReturnSuccess != IOPMCopyAssertionsByProcess(&byProcess) || !byProcess)
+        return NULL;
+
+    pidNum = CFNumberCreate(0, kCFNumberIntType, &pid);
+    mine = CFDictionaryGetValue(byProcess, pidNum);
+    if (isA_CFArray(mine) && (CFArrayGetCount(mine) == 1)) {
+        result = CFArrayGetValueAtIndex(mine, 0);
+        CFRetain(result);
+    }
+
+    CFRelease(pidNum);
+    CFRelease(byProcess);
+    return result;
+}
+
 
 int main()
 {
@@ -85,6 +109,28 @@ int main()
         exit(1);
     }
 
+    /* powerd serves these copies from a cached snapshot; check it follows changes */
+    _props = copyMyAssertion();
+    if (!_props || !isA_CFString(CFDictionaryGetValue(_props, kIOPMAssertionProcessNameKey))) {
+        PMTestFail("IOPMCopyAssertionsByProcess is missing the new assertion or its process name\n");
+        exit(1);
+    }
+    CFRelease(_props);
+
+    ret = IOPMAssertionSetProperty(_id, kIOPMAssertionHumanReadableReasonKey, CFSTR("Changed my mind."));
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("IOPMAssertionSetProperty returns non-success 0x%08x\n", ret);
+        exit(1);
+    }
+
+    _props = copyMyAssertion();
+    if (!_props || !CFEqual(CFSTR("Changed my mind."), 
+                            CFDictionaryGetValue(_props, kIOPMAssertionHumanReadableReasonKey))) {
+        PMTestFail("IOPMCopyAssertionsByProcess returns stale properties after IOPMAssertionSetProperty\n");
+        exit(1);
+    }
+    CFRelease(_props);
+
     ret = IOPMAssertionRelease(_id);
     
     if (kIOReturnSuccess != ret) {
@@ -92,6 +138,13 @@ int main()
         exit(1);
     }
     
+    _props = copyMyAssertion();
+    if (_props) {
+        CFRelease(_props);
+        PMTestFail("IOPMCopyAssertionsByProcess still returns the released assertion\n");
+        exit(1);
+    }
+
     PMTestPass("Successfully created and released via IOPMAssertionCrateWithProperties\n");
     
     return 0;
@@ -26,6 +26,7 @@
 #include <IOKit/pwr_mgt/IOPMLibPrivate.h>
 #include <stdlib.h>
 #include <notify.h>
+#include <unistd.h>
 #include <stdio.h>
 #include "PMTestLib.h"
 
@@ -239,6 +240,40 @@ int main(int argc, char *argv[])
                            */
                        }
                   }
+
+                  /* The timed out history should hold every one of ours, newest first.
+                   */
+                  CFArrayRef    timedOut = NULL;
+                  CFDateRef     newer = NULL;
+                  int           ours = 0;
+
+                  if ((kIOReturnSuccess != IOPMCopyTimedOutAssertions(&timedOut)) || !timedOut) {
+                      PMTestFail("IOPMCopyTimedOutAssertions returned no timeouts.");
+                  } else {
+                      for (k=0; k<CFArrayGetCount(timedOut); k++) {
+                          CFDictionaryRef   asrt = CFArrayGetValueAtIndex(timedOut, k);
+                          CFDateRef         when = CFDictionaryGetValue(asrt, kIOPMAssertionTimedOutDateKey);
+                          CFNumberRef       pidNum = CFDictionaryGetValue(asrt, kIOPMAssertionPIDKey);
+                          int               pid = 0;
+
+                          if (!when || !CFDictionaryGetValue(asrt, kIOPMAssertionCreateDateKey)) {
+                              PMTestFail("Timed out history entry %d is missing its dates.", k);
+                              continue;
+                          }
+                          if (newer && (CFDateCompare(when, newer, NULL) == kCFCompareGreaterThan)) {
+                              PMTestFail("Timed out history entry %d is newer than the entry before it.", k);
+                          }
+                          newer = when;
+
+                          if (pidNum) CFNumberGetValue(pidNum, kCFNumberIntType, &pid);
+                          if (pid == getpid()) ours++;
+                      }
+                      CFRelease(timedOut);
+
+                      if (ours < fEnd) {
+                          PMTestFail("IOPMCopyTimedOutAssertions returned %d of our %d timeouts.", ours, fEnd);
+                      }
+                  }
                           
                   exit(exitStatus);
               });
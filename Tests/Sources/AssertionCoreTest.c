@@ -0,0 +1,608 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "../../pmconfigd/PMAssertionCore.h"
+
+
+/*
+ * Assertion state machine test.
+ * Runs pmconfigd/PMAssertionCore.c against a fake platform: a virtual clock,
+ * a deadline timer that fires only when the test moves the clock, and a
+ * kernel and smart battery that record what they are sent. Needs no
+ * CoreFoundation and no powerd, so it builds and runs on any host:
+ *      make AssertionCoreTest && ./AssertionCoreTest [iterations]
+ *
+ * Checks kernel assertion bits across raises, releases, linked types,
+ * battery power, type changes and batches, expires timed assertions in
+ * deadline order, enforces global time caps from the same timer, checks
+ * the per-process call token bucket, and reports the cost of a
+ * create/release and of a timeout.
+ */
+
+#define kDefaultIterations      1000000
+
+static int  failures = 0;
+
+#define CHECK(cond, ...)    do { if (!(cond)) { failures++; \
+                                fprintf(stderr, "FAIL: " __VA_ARGS__); \
+                                fprintf(stderr, "\n"); } } while (0)
+
+static uint64_t nowNsecs(void)
+{
+#if __APPLE__
+    static mach_timebase_info_data_t    timebase;
+
+    if (!timebase.denom) mach_timebase_info(&timebase);
+    return (mach_absolute_time() * timebase.numer) / timebase.denom;
+#else
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#pragma mark -
+#pragma mark Fake platform
+
+static uint64_t     gVirtualTime = 1000;    /* getMonotonicTime(), in seconds */
+static uint64_t     gTimerDeadline = 0;     /* As last armed, 0 if disarmed */
+static uint32_t     gTimerArms = 0;
+static bool         gOnBattery = false;
+static uint32_t     gKernelBits = 0;
+static uint32_t     gKernelSends = 0;
+static uint32_t     gBatteryLevels[2];      /* By kSBUC selector */
+static uint32_t     gBatterySends = 0;
+
+uint64_t getMonotonicTime(void)
+{
+    return gVirtualTime;
+}
+
+bool assertionsOnBatteryPower(void)
+{
+    return gOnBattery;
+}
+
+void armDeadlineTimerAt(uint64_t deadline)
+{
+    gTimerDeadline = deadline;
+    gTimerArms++;
+}
+
+void sendUserAssertionsToKernel(uint32_t user_assertions)
+{
+    gKernelBits = user_assertions;
+    gKernelSends++;
+}
+
+void sendSmartBatteryCommand(uint32_t which, uint32_t level)
+{
+    if (which < 2) gBatteryLevels[which] = level;
+    gBatterySends++;
+}
+
+static void kernelHandler(assertionType_t *assertType, assertionOps op)
+{
+    setKernelAssertionBits(assertType, op);
+}
+
+static void batteryHandler(assertionType_t *assertType, assertionOps op)
+{
+    setBatteryAssertionLevel(assertType, op);
+}
+
+/* As configAssertionType() sets up the types this test uses */
+static void configTypes(void)
+{
+    int     i;
+
+    memset(gAssertionTypes, 0, sizeof(gAssertionTypes));
+    kerAssertionBits = 0;
+    aggregate_assertions = 0;
+    gKernelBits = 0;
+    for (i = 0; i < kIOPMNumAssertionTypes; i++) {
+        gAssertionTypes[i].kassert = i;
+        LIST_INIT(&gAssertionTypes[i].active);
+        LIST_INIT(&gAssertionTypes[i].activeTimed);
+        LIST_INIT(&gAssertionTypes[i].inactive);
+    }
+
+    gAssertionTypes[kPreventDisplaySleepIndex].handler = kernelHandler;
+    gAssertionTypes[kPreventDisplaySleepIndex].linkedTypes = 1 << kDeclareUserActivity;
+    gAssertionTypes[kDeclareUserActivity].handler = kernelHandler;
+    gAssertionTypes[kDeclareUserActivity].linkedTypes = 1 << kPreventDisplaySleepIndex;
+    gAssertionTypes[kPreventSleepIndex].handler = kernelHandler;
+    gAssertionTypes[kPreventSleepIndex].flags |= kAssertionTypeNotValidOnBatt;
+    gAssertionTypes[kExternalMediaIndex].handler = kernelHandler;
+    gAssertionTypes[kDisableInflowIndex].handler = batteryHandler;
+    gAssertionTypes[kInhibitChargeIndex].handler = batteryHandler;
+
+    initAssertionSlots();
+}
+
+static assertion_t *create(kerAssertionType type, int level, double timeoutSecs,
+                           assertionTimeoutAction action, uint32_t flags)
+{
+    assertion_t     *assertion = calloc(1, sizeof(assertion_t));
+
+    if (!assertion || !allocAssertionSlot(assertion)) {
+        free(assertion);
+        return NULL;
+    }
+    assertion->pid = 100;
+    assertion->kassert = type;
+    assertion->level = level;
+    assertion->timeoutSecs = timeoutSecs;
+    assertion->timeoutAction = action;
+    assertion->flags = flags;
+    assertion->retainCnt = 1;
+
+    if (activateAssertion(assertion) != kIOReturnSuccess) {
+        freeAssertionSlot(assertion);
+        free(assertion);
+        return NULL;
+    }
+    return assertion;
+}
+
+static void destroy(assertion_t *assertion)
+{
+    deactivateAssertion(assertion, true);
+    freeAssertionSlot(assertion);
+    free(assertion);
+}
+
+static uint32_t gExpiredCnt = 0;
+
+static void expired(assertion_t *assertion, void *context __unused)
+{
+    gExpiredCnt++;
+    if (assertion->timeoutAction == kAssertionTimeoutActionRelease) {
+        freeAssertionSlot(assertion);
+        free(assertion);
+    }
+}
+
+static uint32_t gCapsEnforced = 0;
+
+/* As handleAssertionTimeouts() does, less the logging */
+void handleAssertionTimeouts(void)
+{
+    uint32_t        types;
+    int             i;
+
+    types = expireTimedAssertions(getMonotonicTime(), expired, NULL);
+    for (i = 0; i < kIOPMNumAssertionTypes; i++) {
+        if ((types & (1 << i)) && gAssertionTypes[i].handler)
+            (*gAssertionTypes[i].handler)(&gAssertionTypes[i], kAssertionOpRelease);
+    }
+}
+
+/* As enforceAssertionTypeTimeCap() does, less the logging */
+void enforceAssertionTypeTimeCap(assertionType_t *assertType)
+{
+    assertion_t     *assertion;
+
+    gCapsEnforced++;
+    while ( (assertion = LIST_FIRST(&assertType->active)) ) {
+        removeActiveAssertion(assertion, assertType);
+        insertInactiveAssertion(assertion, assertType);
+    }
+    while ( (assertion = LIST_FIRST(&assertType->activeTimed)) ) {
+        unlinkTimedAssertion(assertion, assertType);
+        insertInactiveAssertion(assertion, assertType);
+    }
+    armAssertionTimer();
+
+    if (assertType->handler)
+        (*assertType->handler)(assertType, kAssertionOpRelease);
+}
+
+/* Moves the virtual clock, firing the deadline timer as powerd would */
+static void advance(uint64_t secs)
+{
+    gVirtualTime += secs;
+    if (!gTimerDeadline || (gTimerDeadline > gVirtualTime))
+        return;
+
+    // A one shot timer, like powerd's
+    gTimerDeadline = 0;
+    fireDeadlines(gVirtualTime);
+}
+
+#pragma mark -
+#pragma mark Tests
+
+static void checkKernelBits(void)
+{
+    assertion_t     *a, *b, *user;
+    uint32_t        sends;
+
+    configTypes();
+
+    a = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    CHECK(a && (gKernelBits == kIOPMDriverAssertionPreventDisplaySleepBit), "display bit not raised");
+    CHECK(getAggregateAssertions(NULL) & (1 << kPreventDisplaySleepIndex), "aggregate not raised");
+
+    sends = gKernelSends;
+    b = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    CHECK(gKernelSends == sends, "second assertion of a raised type sent to the kernel");
+
+    destroy(a);
+    CHECK(gKernelBits & kIOPMDriverAssertionPreventDisplaySleepBit, "display bit dropped with one left");
+
+    // A linked type keeps the shared bit up
+    user = create(kDeclareUserActivity, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    destroy(b);
+    CHECK(gKernelBits & kIOPMDriverAssertionPreventDisplaySleepBit, "display bit dropped with a linked type raised");
+    CHECK(!(getAggregateAssertions(NULL) & (1 << kPreventDisplaySleepIndex)), "aggregate kept without assertions");
+
+    destroy(user);
+    CHECK(!gKernelBits, "display bit left raised, bits 0x%x", gKernelBits);
+
+    // An assertion created at level off is filed inactive, and raises nothing
+    sends = gKernelSends;
+    a = create(kExternalMediaIndex, kIOPMAssertionLevelOff, 0, kAssertionTimeoutActionTurnOff, 0);
+    CHECK(a && (a->state & kAssertionStateInactive) && (gKernelSends == sends), "level off assertion raised");
+    destroy(a);
+
+    CHECK(gLiveAssertionCnt == 0, "%u slots leaked", gLiveAssertionCnt);
+}
+
+static void checkBatteryPower(void)
+{
+    assertion_t     *plain, *limited;
+
+    configTypes();
+    gOnBattery = true;
+
+    plain = create(kPreventSleepIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    CHECK(!(gKernelBits & kIOPMDriverAssertionCPUBit), "PreventSystemSleep honored on battery");
+
+    limited = create(kPreventSleepIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff,
+                     kAssertionFlagAppliesToLimitedPower);
+    CHECK(gKernelBits & kIOPMDriverAssertionCPUBit, "AppliesToLimitedPower ignored on battery");
+
+    destroy(limited);
+    CHECK(!(gKernelBits & kIOPMDriverAssertionCPUBit), "CPU bit kept on battery");
+
+    // Back on AC, evaluating the type raises it again
+    gOnBattery = false;
+    gAssertionTypes[kPreventSleepIndex].handler(&gAssertionTypes[kPreventSleepIndex], kAssertionOpEval);
+    CHECK(gKernelBits & kIOPMDriverAssertionCPUBit, "CPU bit not raised on AC");
+    CHECK(systemBlockedInS0Dark(), "system not blocked in dark wake");
+
+    destroy(plain);
+    CHECK(!gKernelBits && !systemBlockedInS0Dark(), "CPU bit left raised");
+
+    gBatterySends = 0;
+    plain = create(kDisableInflowIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    CHECK((gBatterySends == 1) && (gBatteryLevels[kSBUCInflowDisable] == 1), "inflow not disabled");
+    destroy(plain);
+    CHECK((gBatterySends == 2) && (gBatteryLevels[kSBUCInflowDisable] == 0), "inflow not re-enabled");
+}
+
+static void checkTypeChange(void)
+{
+    assertionType_t *displayType, *mediaType;
+    assertion_t     *a, *b;
+
+    configTypes();
+    displayType = &gAssertionTypes[kPreventDisplaySleepIndex];
+    mediaType = &gAssertionTypes[kExternalMediaIndex];
+
+    a = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    b = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 60, kAssertionTimeoutActionTurnOff, 0);
+
+    // Moved assertions are counted against the type they are listed on
+    changeAssertionType(a, kExternalMediaIndex);
+    CHECK((a->kassert == kExternalMediaIndex) && (displayType->activeCount == 0)
+            && (mediaType->activeCount == 1), "untimed assertion counted against the wrong type");
+    CHECK(gKernelBits == (kIOPMDriverAssertionPreventDisplaySleepBit|kIOPMDriverAssertionExternalMediaMountedBit),
+            "bits 0x%x after moving one of two", gKernelBits);
+
+    changeAssertionType(b, kExternalMediaIndex);
+    CHECK((displayType->activeTimedCount == 0) && (mediaType->activeTimedCount == 1)
+            && (b->state & kAssertionStateTimed), "timed assertion counted against the wrong type");
+    CHECK(gKernelBits == kIOPMDriverAssertionExternalMediaMountedBit,
+            "display bit not dropped with its last assertion moved, bits 0x%x", gKernelBits);
+
+    // Releasing under the new type leaves no count behind
+    destroy(a);
+    destroy(b);
+    CHECK(!mediaType->activeCount && !mediaType->activeTimedCount && !gKernelBits,
+            "counts %u/%u, bits 0x%x left", mediaType->activeCount, mediaType->activeTimedCount, gKernelBits);
+
+    // A type change on battery moves the valid-on-battery count with it
+    gOnBattery = true;
+    a = create(kPreventSleepIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff,
+               kAssertionFlagAppliesToLimitedPower);
+    CHECK(gKernelBits & kIOPMDriverAssertionCPUBit, "CPU bit not raised on battery");
+    changeAssertionType(a, kExternalMediaIndex);
+    CHECK((gAssertionTypes[kPreventSleepIndex].validOnBattCount == 0) && !(gKernelBits & kIOPMDriverAssertionCPUBit),
+            "CPU bit kept after its assertion moved");
+    destroy(a);
+    gOnBattery = false;
+
+    CHECK(changeAssertionType(NULL, kIOPMNumAssertionTypes) == kIOReturnBadArgument, "bad type accepted");
+    CHECK(!gKernelBits && (gLiveAssertionCnt == 0), "bits 0x%x, %u slots left", gKernelBits, gLiveAssertionCnt);
+}
+
+static void checkTimeouts(void)
+{
+    assertion_t         *a[4];
+    IOPMAssertionID     releasedID;
+    uint64_t            start = gVirtualTime;
+
+    configTypes();
+    gExpiredCnt = 0;
+
+    a[0] = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 30, kAssertionTimeoutActionTurnOff, 0);
+    a[1] = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 10, kAssertionTimeoutActionRelease, 0);
+    a[2] = create(kExternalMediaIndex, kIOPMAssertionLevelOn, 20, kAssertionTimeoutActionTurnOff, 0);
+    a[3] = create(kExternalMediaIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    releasedID = a[1]->assertionId;
+
+    CHECK(gTimerDeadline == start + 10, "timer armed for %llu, not the earliest timeout",
+            (unsigned long long)(gTimerDeadline - start));
+
+    advance(9);
+    CHECK(gExpiredCnt == 0, "expired before its timeout");
+
+    advance(1);
+    CHECK(gExpiredCnt == 1, "%u expired at the first timeout", gExpiredCnt);
+    CHECK(!assertionForID(releasedID), "released assertion still resolves");
+    CHECK(gTimerDeadline == start + 20, "timer not re-armed for the next timeout");
+    CHECK(gKernelBits & kIOPMDriverAssertionPreventDisplaySleepBit, "display bit dropped early");
+
+    // Moving the deadline of a timed assertion in place
+    a[2]->timeout = start + 40;
+    timedHeapUpdate(a[2]);
+    armAssertionTimer();
+    CHECK(gTimerDeadline == start + 30, "timer not moved with the deadline");
+
+    advance(20);
+    CHECK((gExpiredCnt == 2) && (a[0]->state & kAssertionStateInactive), "turn off timeout not inactive");
+    CHECK(!(gKernelBits & kIOPMDriverAssertionPreventDisplaySleepBit), "display bit kept after timeout");
+
+    advance(10);
+    CHECK(gExpiredCnt == 3, "%u expired", gExpiredCnt);
+    CHECK(gKernelBits & kIOPMDriverAssertionExternalMediaMountedBit, "untimed assertion lost its bit");
+    CHECK(gTimerDeadline == 0, "timer armed with nothing timed");
+
+    destroy(a[0]);
+    destroy(a[2]);
+    destroy(a[3]);
+    CHECK(!gKernelBits && (gLiveAssertionCnt == 0), "bits 0x%x, %u slots left", gKernelBits, gLiveAssertionCnt);
+}
+
+static void checkTimeCaps(void)
+{
+    assertionType_t     *pushType = &gAssertionTypes[kPushServiceTaskIndex];
+    assertion_t         *push, *timed;
+    uint64_t            start = gVirtualTime;
+    uint32_t            arms;
+
+    configTypes();
+    pushType->handler = kernelHandler;
+    gCapsEnforced = 0;
+
+    // A cap and an assertion timeout share the one timer, earliest first
+    push = create(kPushServiceTaskIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    timed = create(kExternalMediaIndex, kIOPMAssertionLevelOn, 10, kAssertionTimeoutActionTurnOff, 0);
+    setSleepServicesTimeCap(30 * 1000);
+    CHECK(gTimerDeadline == start + 10, "timer armed for %llu, not the earliest deadline",
+            (unsigned long long)(gTimerDeadline - start));
+
+    advance(10);
+    CHECK((timed->state & kAssertionStateInactive) && !gCapsEnforced, "timeout didn't fire alone");
+    CHECK(gTimerDeadline == start + 30, "timer not re-armed for the cap");
+
+    advance(20);
+    CHECK((gCapsEnforced == 1) && (push->state & kAssertionStateInactive), "cap not enforced");
+    CHECK(!(gKernelBits & kIOPMDriverAssertionCPUBit), "CPU bit kept past the cap");
+    CHECK((pushType->globalTimeout == 0) && (gTimerDeadline == 0), "cap left armed");
+    destroy(push);
+    destroy(timed);
+
+    // A cap is cancelled once the type has nothing left to cap
+    push = create(kPushServiceTaskIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    setSleepServicesTimeCap(30 * 1000);
+    destroy(push);
+    CHECK((pushType->globalTimeout == 0) && (gTimerDeadline == 0), "cap outlived its assertions");
+    advance(30);
+    CHECK(gCapsEnforced == 1, "cancelled cap enforced");
+
+    // A cap of 0 is enforced from the timer, not from within the caller
+    push = create(kPushServiceTaskIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    setSleepServicesTimeCap(60 * 1000);
+    setSleepServicesTimeCap(0);
+    CHECK((gCapsEnforced == 1) && (gTimerDeadline == gVirtualTime), "cap of 0 not deferred to the timer");
+    advance(0);
+    CHECK((gCapsEnforced == 2) && (push->state & kAssertionStateInactive), "cap of 0 not enforced");
+    destroy(push);
+
+    // Everything due together fires in one pass, and re-arms the timer once at most
+    push = create(kPushServiceTaskIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    setSleepServicesTimeCap(20 * 1000);
+    timed = create(kExternalMediaIndex, kIOPMAssertionLevelOn, 20, kAssertionTimeoutActionTurnOff, 0);
+    arms = gTimerArms;
+    advance(20);
+    CHECK((gCapsEnforced == 3) && (timed->state & kAssertionStateInactive), "deadlines due together not fired");
+    CHECK((gTimerArms == arms) && (gTimerDeadline == 0), "timer re-armed %u times", gTimerArms - arms);
+    destroy(push);
+    destroy(timed);
+
+    CHECK(!gKernelBits && (gLiveAssertionCnt == 0), "bits 0x%x, %u slots left", gKernelBits, gLiveAssertionCnt);
+}
+
+static void checkSlotsAndBatches(void)
+{
+    assertion_t         *a, *b;
+    assertion_t         **many;
+    IOPMAssertionID     staleID;
+    uint32_t            sends, i;
+
+    configTypes();
+
+    a = create(kExternalMediaIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    staleID = a->assertionId;
+    CHECK((staleID != kIOPMNullAssertionID) && (assertionForID(staleID) == a), "ID doesn't resolve");
+    destroy(a);
+    CHECK(!assertionForID(staleID), "stale ID resolves");
+
+    many = calloc(kMaxAssertions + 1, sizeof(*many));
+    for (i = 0; i < kMaxAssertions; i++) {
+        many[i] = create(kExternalMediaIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    }
+    CHECK(many[kMaxAssertions - 1] && !create(kExternalMediaIndex, kIOPMAssertionLevelOn, 0,
+            kAssertionTimeoutActionTurnOff, 0), "slot table didn't fill at kMaxAssertions");
+    CHECK(!assertionForID(staleID), "stale ID resolves after its slot was reused");
+    for (i = 0; i < kMaxAssertions; i++) {
+        if (many[i]) destroy(many[i]);
+    }
+    free(many);
+
+    // A batch sends the kernel one update however many assertions it raises
+    sends = gKernelSends;
+    openAssertionBatch();
+    a = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    b = create(kExternalMediaIndex, kIOPMAssertionLevelOn, 0, kAssertionTimeoutActionTurnOff, 0);
+    CHECK(gKernelSends == sends, "kernel updated inside a batch");
+    closeAssertionBatch();
+    CHECK((gKernelSends == sends + 2) && (gKernelBits == (kIOPMDriverAssertionPreventDisplaySleepBit
+            | kIOPMDriverAssertionExternalMediaMountedBit)), "batch applied %u updates, bits 0x%x",
+            gKernelSends - sends, gKernelBits);
+
+    // Releasing both in a batch leaves the kernel bits matching the now empty lists
+    openAssertionBatch();
+    destroy(a);
+    destroy(b);
+    closeAssertionBatch();
+    CHECK(!gKernelBits, "batch release left bits 0x%x", gKernelBits);
+}
+
+static void checkRateLimit(void)
+{
+    const uint64_t  sec = 1000000000ULL;
+    uint64_t        fullAt = 0;
+    uint64_t        now = 5000 * sec;
+    uint32_t        taken = 0, i;
+
+    // A full bucket allows a burst, then nothing until it refills
+    for (i = 0; i < 20; i++) {
+        if (takeRateToken(&fullAt, now, 10, 5)) taken++;
+    }
+    CHECK(taken == 5, "burst of %u calls, not 5", taken);
+
+    CHECK(!takeRateToken(&fullAt, now + sec / 20, 10, 5), "token before the refill interval");
+    CHECK(takeRateToken(&fullAt, now + sec / 10, 10, 5), "no token after the refill interval");
+    CHECK(!takeRateToken(&fullAt, now + sec / 10, 10, 5), "two tokens from one refill");
+
+    // A steady caller at the rate is never refused
+    for (taken = 0, i = 1; i <= 100; i++) {
+        if (takeRateToken(&fullAt, now + sec + i * (sec / 10), 10, 5)) taken++;
+    }
+    CHECK(taken == 100, "%u of 100 calls at the rate taken", taken);
+
+    // After a quiet period the bucket is full again, but no more than full
+    now += 60 * sec;
+    for (taken = 0, i = 0; i < 20; i++) {
+        if (takeRateToken(&fullAt, now, 10, 5)) taken++;
+    }
+    CHECK(taken == 5, "burst of %u calls after a quiet period", taken);
+}
+
+static void benchmark(long iterations)
+{
+    assertion_t     **batch;
+    uint64_t        start, createNs, expireNs;
+    long            i, j, n;
+
+    configTypes();
+
+    start = nowNsecs();
+    for (i = 0; i < iterations; i++) {
+        destroy(create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, (i & 1) ? 60 : 0,
+                       kAssertionTimeoutActionTurnOff, 0));
+    }
+    createNs = nowNsecs() - start;
+
+    // Timeouts, in rounds of as many timed assertions as the slot table holds
+    batch = calloc(kMaxAssertions, sizeof(*batch));
+    gExpiredCnt = 0;
+    expireNs = 0;
+    for (i = 0; i < iterations; i += kMaxAssertions) {
+        n = (iterations - i < kMaxAssertions) ? iterations - i : kMaxAssertions;
+        for (j = 0; j < n; j++) {
+            batch[j] = create(kPreventDisplaySleepIndex, kIOPMAssertionLevelOn, 1 + (j % 600),
+                              kAssertionTimeoutActionRelease, 0);
+        }
+        start = nowNsecs();
+        advance(600);
+        expireNs += nowNsecs() - start;
+    }
+    free(batch);
+    CHECK((long)gExpiredCnt == iterations, "%u of %ld timed assertions expired", gExpiredCnt, iterations);
+    CHECK(gLiveAssertionCnt == 0, "%u slots leaked", gLiveAssertionCnt);
+
+    printf("%-30s %6.1f ns\n", "create and release", (double)createNs / iterations);
+    printf("%-30s %6.1f ns\n", "timeout", (double)expireNs / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+    long        iterations = kDefaultIterations;
+
+    if (argc > 1) {
+        iterations = strtol(argv[1], NULL, 0);
+        if (iterations <= 0) iterations = kDefaultIterations;
+    }
+
+    printf("Assertion state machine, %ld iterations per measurement\n", iterations);
+
+    checkKernelBits();
+    checkBatteryPower();
+    checkTypeChange();
+    checkTimeouts();
+    checkTimeCaps();
+    checkSlotsAndBatches();
+    checkRateLimit();
+    benchmark(iterations);
+
+    if (failures) {
+        printf("FAIL: %d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2012 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOReturn.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <servers/bootstrap.h>
+#include <bootstrap_priv.h>
+#include <mach/mach.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "PMTestLib.h"
+#include "powermanagement.h"
+
+/*
+ * Reads powerd's assertion event stream through io_pm_assertion_copy_events.
+ * Creates an assertion, turns it off and on, releases it, and checks that
+ * exactly those events come back, in order, for this process.
+ */
+
+#define kEventTestName          "AssertionEventStream"
+
+static const uint16_t kExpectedEvents[] = {
+    kIOPMAssertionEventCreated,
+    kIOPMAssertionEventTurnedOff,
+    kIOPMAssertionEventTurnedOn,
+    kIOPMAssertionEventReleased
+};
+#define kExpectedEventCount     (sizeof(kExpectedEvents) / sizeof(kExpectedEvents[0]))
+
+static void setLevel(IOPMAssertionID id, int level)
+{
+    CFNumberRef     levelNum = CFNumberCreate(0, kCFNumberIntType, &level);
+    IOReturn        ret;
+
+    ret = IOPMAssertionSetProperty(id, kIOPMAssertionLevelKey, levelNum);
+    CFRelease(levelNum);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("IOPMAssertionSetProperty(level %d) returns 0x%08x\n", level, ret);
+        exit(1);
+    }
+}
+
+int main()
+{
+    IOReturn                    ret;
+    kern_return_t               kr;
+    mach_port_t                 pm_server = MACH_PORT_NULL;
+    IOPMAssertionID             _id = kIOPMNullAssertionID;
+    IOPMAssertionEventRecord    *rec;
+    vm_offset_t                 events = 0;
+    mach_msg_type_number_t      eventsCnt = 0;
+    uint64_t                    cursor = UINT64_MAX;
+    int                         overflowed = 0;
+    int                         rc = kIOReturnSuccess;
+    unsigned int                count, i, seen = 0;
+
+    ret = PMTestInitialize("Assertion event stream", "com.apple.iokit.powermanagement");
+    if (kIOReturnSuccess != ret)
+    {
+        fprintf(stderr,"PMTestInitialize failed with IOReturn error code 0x%08x\n", ret);
+        exit(-1);
+    }
+
+    kr = bootstrap_look_up2(bootstrap_port, kIOPMServerBootstrapName, &pm_server, 
+                            0, BOOTSTRAP_PRIVILEGED_SERVER);
+    if (KERN_SUCCESS != kr) {
+        PMTestFail("bootstrap_look_up2 returns 0x%08x\n", kr);
+        exit(1);
+    }
+
+    // A cursor past the newest event returns nothing, and the current position
+    kr = io_pm_assertion_copy_events(pm_server, cursor, &events, &eventsCnt, &cursor, &overflowed, &rc);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc) || eventsCnt || overflowed) {
+        PMTestFail("Initial io_pm_assertion_copy_events returns kr 0x%08x rc 0x%08x, %u bytes, overflowed %d\n",
+                   kr, rc, eventsCnt, overflowed);
+        exit(1);
+    }
+
+    ret = IOPMAssertionCreateWithName(kIOPMAssertionTypePreventUserIdleSystemSleep,
+                        kIOPMAssertionLevelOn, CFSTR(kEventTestName), &_id);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("IOPMAssertionCreateWithName returns 0x%08x\n", ret);
+        exit(1);
+    }
+    setLevel(_id, kIOPMAssertionLevelOff);
+    setLevel(_id, kIOPMAssertionLevelOn);
+    ret = IOPMAssertionRelease(_id);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("IOPMAssertionRelease returns 0x%08x\n", ret);
+        exit(1);
+    }
+
+    kr = io_pm_assertion_copy_events(pm_server, cursor, &events, &eventsCnt, &cursor, &overflowed, &rc);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc)) {
+        PMTestFail("io_pm_assertion_copy_events returns kr 0x%08x rc 0x%08x\n", kr, rc);
+        exit(1);
+    }
+    if (overflowed) {
+        PMTestFail("Event stream overflowed while reading a handful of events\n");
+    }
+
+    // Other processes may have added events of their own; only look at ours
+    rec = (IOPMAssertionEventRecord *)events;
+    count = eventsCnt / sizeof(IOPMAssertionEventRecord);
+    for (i = 0; i < count; i++, rec++)
+    {
+        if ((rec->pid != getpid()) || (rec->assertionID != _id))
+            continue;
+
+        if ((seen >= kExpectedEventCount) || (rec->event != kExpectedEvents[seen])) {
+            PMTestFail("Event %u is %u; expected %u\n", seen, rec->event, 
+                       (seen < kExpectedEventCount) ? kExpectedEvents[seen] : 0);
+        } else if (strcmp(rec->name, kEventTestName) 
+                    || strcmp(rec->type, "PreventUserIdleSystemSleep")) {
+            PMTestFail("Event %u has type \"%s\" name \"%s\"\n", seen, rec->type, rec->name);
+        }
+        seen++;
+    }
+    if (events)
+        vm_deallocate(mach_task_self(), events, eventsCnt);
+
+    if (seen != kExpectedEventCount) {
+        PMTestFail("Saw %u events for the assertion; expected %u\n", seen, (unsigned)kExpectedEventCount);
+    } else {
+        PMTestPass("Assertion events were returned in order\n");
+    }
+
+    mach_port_deallocate(mach_task_self(), pm_server);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2012 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOReturn.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <dispatch/dispatch.h>
+#include <stdlib.h>
+#include <notify.h>
+#include <stdio.h>
+#include "PMTestLib.h"
+
+/*
+ * Creates and releases assertions back to back, and checks that
+ * kIOPMAssertionsAnyChangedNotifyString is coalesced: fewer notifications
+ * than changes, a notify state that counts every change, and a final
+ * notification once the burst is over.
+ */
+
+#define kChurnIterations            200
+#define kChangesPerIteration        2       /* One create, one release */
+#define kSettleSeconds              2
+
+int main()
+{
+    IOReturn            ret;
+    int                 token;
+    int                 status;
+    __block int         notifications = 0;
+    __block uint64_t    lastState = 0;
+    __block uint64_t    startState = 0;
+
+    ret = PMTestInitialize("Assertion change notifications are coalesced and sequenced", 
+                           "com.apple.iokit.powermanagement");
+    if (kIOReturnSuccess != ret)
+    {
+        fprintf(stderr,"PMTestInitialize failed with IOReturn error code 0x%08x\n", ret);
+        exit(-1);
+    }
+
+    status = notify_register_dispatch(kIOPMAssertionsAnyChangedNotifyString, &token, 
+                                      dispatch_get_main_queue(), 
+                                      ^(int t) {
+                                          notifications++;
+                                          notify_get_state(t, &lastState);
+                                      });
+    if (NOTIFY_STATUS_OK != status) {
+        PMTestFail("notify_register_dispatch returns %d\n", status);
+        exit(1);
+    }
+    notify_get_state(token, &startState);
+    lastState = startState;
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        IOPMAssertionID     _id;
+        IOReturn            err;
+        int                 i;
+
+        for (i = 0; i < kChurnIterations; i++)
+        {
+            err = IOPMAssertionCreateWithName(kIOPMAssertionTypePreventUserIdleSystemSleep,
+                                kIOPMAssertionLevelOn, CFSTR("AssertionNotifyCoalesce"), &_id);
+            if (kIOReturnSuccess != err) {
+                PMTestFail("IOPMAssertionCreateWithName returns 0x%08x\n", err);
+                exit(1);
+            }
+            err = IOPMAssertionRelease(_id);
+            if (kIOReturnSuccess != err) {
+                PMTestFail("IOPMAssertionRelease returns 0x%08x\n", err);
+                exit(1);
+            }
+        }
+    });
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kSettleSeconds * NSEC_PER_SEC), 
+                   dispatch_get_main_queue(), ^{
+        uint64_t    changes = lastState - startState;
+
+        PMTestLog("%d notifications for %llu changes\n", notifications, changes);
+
+        if (changes < kChurnIterations * kChangesPerIteration) {
+            PMTestFail("Notify state advanced by %llu; expected at least %d\n", 
+                       changes, kChurnIterations * kChangesPerIteration);
+        } else if (notifications >= kChurnIterations * kChangesPerIteration) {
+            PMTestFail("%d notifications were not coalesced\n", notifications);
+        } else {
+            PMTestPass("Changes were coalesced and the final state was delivered\n");
+        }
+        exit(0);
+    });
+
+    dispatch_main();
+    return 0;
+}
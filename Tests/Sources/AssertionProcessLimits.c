@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOReturn.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <servers/bootstrap.h>
+#include <bootstrap_priv.h>
+#include <mach/mach.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "PMTestLib.h"
+#include "powermanagement.h"
+
+/*
+ * Checks powerd's per-process assertion limits. Lowers the live assertion
+ * limit and the create/set properties rate with io_pm_assertion_set_tunable,
+ * checks that calls past them are refused with kIOPMAssertionReturnQuotaExceeded
+ * and kIOPMAssertionReturnRateLimited and counted, then restores the tunables.
+ * Must be run as root.
+ */
+
+#define kTestLimit          8
+#define kTestRate           10
+#define kTestBurst          5
+#define kRateCalls          50
+
+static mach_port_t  pm_server = MACH_PORT_NULL;
+
+/* Returns the old value of tunable 'selector', and sets it if 'value' isn't negative */
+static int tunable(int selector, int value)
+{
+    kern_return_t   kr;
+    int             oldValue = 0;
+    int             rc = kIOReturnSuccess;
+
+    kr = io_pm_assertion_set_tunable(pm_server, selector, value, &oldValue, &rc);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc)) {
+        PMTestFail("Tunable %d set to %d returns kr 0x%08x rc 0x%08x\n", selector, value, kr, rc);
+        exit(1);
+    }
+    return oldValue;
+}
+
+static IOReturn createOne(IOPMAssertionID *outID)
+{
+    return IOPMAssertionCreateWithName(kIOPMAssertionTypePreventUserIdleSystemSleep,
+                        kIOPMAssertionLevelOn, CFSTR("AssertionProcessLimits"), outID);
+}
+
+int main()
+{
+    IOReturn            ret;
+    kern_return_t       kr;
+    IOPMAssertionID     ids[kTestLimit];
+    IOPMAssertionID     extra = kIOPMNullAssertionID;
+    CFNumberRef         levels[2];
+    int                 levelValues[2] = { kIOPMAssertionLevelOff, kIOPMAssertionLevelOn };
+    int                 savedLimit, savedRate, savedBurst;
+    int                 quotaRejects, rateRejects;
+    int                 taken = 0, limited = 0;
+    int                 i;
+
+    ret = PMTestInitialize("Assertion per-process limits", "com.apple.iokit.powermanagement");
+    if (kIOReturnSuccess != ret)
+    {
+        fprintf(stderr,"PMTestInitialize failed with IOReturn error code 0x%08x\n", ret);
+        exit(-1);
+    }
+
+    if (geteuid() != 0) {
+        PMTestFail("This test changes assertion tunables and must be run as root\n");
+        exit(1);
+    }
+
+    kr = bootstrap_look_up2(bootstrap_port, kIOPMServerBootstrapName, &pm_server, 
+                            0, BOOTSTRAP_PRIVILEGED_SERVER);
+    if (KERN_SUCCESS != kr) {
+        PMTestFail("bootstrap_look_up2 returns 0x%08x\n", kr);
+        exit(1);
+    }
+
+    savedLimit = tunable(kIOPMAssertionTunableProcessLimit, kTestLimit);
+    savedRate = tunable(kIOPMAssertionTunableProcessRate, 0);
+    savedBurst = tunable(kIOPMAssertionTunableProcessBurst, kTestBurst);
+    quotaRejects = tunable(kIOPMAssertionTunableQuotaRejects, -1);
+    rateRejects = tunable(kIOPMAssertionTunableRateRejects, -1);
+
+    /* Live assertion limit */
+    for (i = 0; i < kTestLimit; i++) {
+        ret = createOne(&ids[i]);
+        if (kIOReturnSuccess != ret) {
+            PMTestFail("Create %d of %d returns 0x%08x\n", i + 1, kTestLimit, ret);
+            exit(1);
+        }
+    }
+
+    ret = createOne(&extra);
+    if (kIOPMAssertionReturnQuotaExceeded != ret) {
+        PMTestFail("Create past the limit returns 0x%08x; expected 0x%08x\n", 
+                   ret, kIOPMAssertionReturnQuotaExceeded);
+    }
+    if (tunable(kIOPMAssertionTunableQuotaRejects, -1) != quotaRejects + 1) {
+        PMTestFail("Refused create not counted\n");
+    }
+
+    IOPMAssertionRelease(ids[kTestLimit - 1]);
+    ret = createOne(&ids[kTestLimit - 1]);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("Create after a release returns 0x%08x\n", ret);
+    }
+
+    /* Call rate limit, charged to property changes as well as creates */
+    levels[0] = CFNumberCreate(0, kCFNumberIntType, &levelValues[0]);
+    levels[1] = CFNumberCreate(0, kCFNumberIntType, &levelValues[1]);
+
+    tunable(kIOPMAssertionTunableProcessRate, kTestRate);
+    for (i = 0; i < kRateCalls; i++) {
+        ret = IOPMAssertionSetProperty(ids[0], kIOPMAssertionLevelKey, levels[i & 1]);
+        if (kIOReturnSuccess == ret) {
+            taken++;
+        } else if (kIOPMAssertionReturnRateLimited == ret) {
+            limited++;
+        } else {
+            PMTestFail("IOPMAssertionSetProperty returns 0x%08x\n", ret);
+        }
+    }
+    PMTestLog("%d of %d property changes taken, %d rate limited\n", taken, kRateCalls, limited);
+
+    if ((taken < kTestBurst) || (limited == 0)) {
+        PMTestFail("Burst of %d calls not limited to about %d\n", kRateCalls, kTestBurst);
+    }
+    if (tunable(kIOPMAssertionTunableRateRejects, -1) != rateRejects + limited) {
+        PMTestFail("Rate limited calls not counted\n");
+    }
+
+    sleep(1);
+    ret = IOPMAssertionSetProperty(ids[0], kIOPMAssertionLevelKey, levels[1]);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("Property change after the bucket refilled returns 0x%08x\n", ret);
+    }
+
+    tunable(kIOPMAssertionTunableProcessLimit, savedLimit);
+    tunable(kIOPMAssertionTunableProcessRate, savedRate);
+    tunable(kIOPMAssertionTunableProcessBurst, savedBurst);
+    CFRelease(levels[0]);
+    CFRelease(levels[1]);
+
+    for (i = 0; i < kTestLimit; i++) {
+        IOPMAssertionRelease(ids[i]);
+    }
+
+    PMTestPass("Per-process assertion limits\n");
+
+    mach_port_deallocate(mach_task_self(), pm_server);
+    return 0;
+}
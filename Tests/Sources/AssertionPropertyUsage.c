@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOReturn.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <servers/bootstrap.h>
+#include <bootstrap_priv.h>
+#include <mach/mach.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "PMTestLib.h"
+#include "powermanagement.h"
+
+/*
+ * Checks powerd's accounting of assertion property memory. Creates an
+ * assertion with a large details string, finds it in the records returned
+ * by io_pm_assertion_copy_property_usage, and checks that creates and
+ * property changes past kIOPMAssertionTunablePropertyLimit are refused
+ * with kIOPMAssertionReturnPropertiesTooLarge.
+ */
+
+#define kDetailsBytes       2048
+
+static mach_port_t  pm_server = MACH_PORT_NULL;
+
+/* Returns this process's usage record in *out, false if it has none */
+static bool copyOwnUsage(IOPMAssertionPropertyUsageRecord *out)
+{
+    IOPMAssertionPropertyUsageRecord    *rec;
+    vm_offset_t                         usage = 0;
+    mach_msg_type_number_t              usageCnt = 0;
+    kern_return_t                       kr;
+    int                                 rc = kIOReturnSuccess;
+    bool                                found = false;
+    unsigned int                        i;
+
+    kr = io_pm_assertion_copy_property_usage(pm_server, &usage, &usageCnt, &rc);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc)) {
+        PMTestFail("io_pm_assertion_copy_property_usage returns kr 0x%08x rc 0x%08x\n", kr, rc);
+        exit(1);
+    }
+
+    rec = (IOPMAssertionPropertyUsageRecord *)usage;
+    for (i = 0; i < usageCnt / sizeof(*rec); i++) {
+        if (rec[i].pid == getpid()) {
+            *out = rec[i];
+            found = true;
+        }
+    }
+    if (usage)
+        vm_deallocate(mach_task_self(), usage, usageCnt);
+    return found;
+}
+
+/* Returns a string of 'len' characters */
+static CFStringRef createLongString(size_t len)
+{
+    char            *buf = malloc(len + 1);
+    CFStringRef     str;
+
+    memset(buf, 'x', len);
+    buf[len] = '\0';
+    str = CFStringCreateWithCString(0, buf, kCFStringEncodingUTF8);
+    free(buf);
+    return str;
+}
+
+int main()
+{
+    IOReturn                            ret;
+    kern_return_t                       kr;
+    IOPMAssertionID                     _id = kIOPMNullAssertionID;
+    IOPMAssertionID                     tooLarge = kIOPMNullAssertionID;
+    IOPMAssertionPropertyUsageRecord    usage;
+    CFStringRef                         details, oversized;
+    int                                 limit = 0;
+    int                                 rc = kIOReturnSuccess;
+
+    ret = PMTestInitialize("Assertion property usage", "com.apple.iokit.powermanagement");
+    if (kIOReturnSuccess != ret)
+    {
+        fprintf(stderr,"PMTestInitialize failed with IOReturn error code 0x%08x\n", ret);
+        exit(-1);
+    }
+
+    kr = bootstrap_look_up2(bootstrap_port, kIOPMServerBootstrapName, &pm_server, 
+                            0, BOOTSTRAP_PRIVILEGED_SERVER);
+    if (KERN_SUCCESS != kr) {
+        PMTestFail("bootstrap_look_up2 returns 0x%08x\n", kr);
+        exit(1);
+    }
+
+    kr = io_pm_assertion_set_tunable(pm_server, kIOPMAssertionTunablePropertyLimit, -1, &limit, &rc);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc)) {
+        PMTestFail("Reading the property limit returns kr 0x%08x rc 0x%08x\n", kr, rc);
+        exit(1);
+    }
+    PMTestLog("Property limit is %d bytes\n", limit);
+
+    details = createLongString(kDetailsBytes);
+    ret = IOPMAssertionCreateWithDescription(kIOPMAssertionTypePreventUserIdleSystemSleep,
+                        CFSTR("AssertionPropertyUsage"), details, NULL, NULL, 0, NULL, &_id);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("Create with %d bytes of details returns 0x%08x\n", kDetailsBytes, ret);
+        exit(1);
+    }
+
+    if (!copyOwnUsage(&usage)) {
+        PMTestFail("No property usage record for this process\n");
+    } else if ((usage.assertionCount != 1) || (usage.largestID != _id) 
+               || (usage.bytes < kDetailsBytes) || (usage.largestBytes != usage.bytes)) {
+        PMTestFail("Usage record: %u assertions, %llu bytes, largest %u bytes [0x%08x]\n", 
+                   usage.assertionCount, usage.bytes, usage.largestBytes, usage.largestID);
+    } else {
+        PMTestLog("%llu bytes accounted for %d bytes of details\n", usage.bytes, kDetailsBytes);
+    }
+
+    if (limit > 0) {
+        oversized = createLongString(limit);
+
+        ret = IOPMAssertionCreateWithDescription(kIOPMAssertionTypePreventUserIdleSystemSleep,
+                            CFSTR("AssertionPropertyUsage"), oversized, NULL, NULL, 0, NULL, &tooLarge);
+        if (kIOPMAssertionReturnPropertiesTooLarge != ret) {
+            PMTestFail("Create with %d bytes of details returns 0x%08x\n", limit, ret);
+            if (kIOReturnSuccess == ret) IOPMAssertionRelease(tooLarge);
+        }
+
+        ret = IOPMAssertionSetProperty(_id, kIOPMAssertionDetailsKey, oversized);
+        if (kIOPMAssertionReturnPropertiesTooLarge != ret) {
+            PMTestFail("Setting %d bytes of details returns 0x%08x\n", limit, ret);
+        }
+        CFRelease(oversized);
+    }
+
+    // Replacing the details charges the new size, not both
+    ret = IOPMAssertionSetProperty(_id, kIOPMAssertionDetailsKey, CFSTR("short"));
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("Setting short details returns 0x%08x\n", ret);
+    } else if (copyOwnUsage(&usage) && (usage.bytes >= kDetailsBytes)) {
+        PMTestFail("%llu bytes still accounted after shortening the details\n", usage.bytes);
+    }
+
+    IOPMAssertionRelease(_id);
+    if (copyOwnUsage(&usage)) {
+        PMTestFail("Usage record left after the last release\n");
+    }
+    CFRelease(details);
+
+    PMTestPass("Assertion property usage\n");
+
+    mach_port_deallocate(mach_task_self(), pm_server);
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <servers/bootstrap.h>
+#include <bootstrap_priv.h>
+
+#include <mach/mach_time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "PMTestLib.h"
+#include "powermanagement.h"
+
+
+/*
+ * IOPMAssertions slot table benchmark.
+ * Fills powerd's assertion table up to kFillCount live assertions, then
+ * times create & release of one more assertion while the table is full.
+ * Also verifies that a released assertion ID is rejected once its slot
+ * is reused. Run as root: the per-process assertion limit and call rate
+ * are lifted for the run, and restored after.
+ */
+
+#define kFillCount          10240
+#define kFullTableRuns      1000
+
+static mach_timebase_info_data_t    timebase;
+
+static uint64_t nsecsSince(uint64_t start)
+{
+    return ((mach_absolute_time() - start) * timebase.numer) / timebase.denom;
+}
+
+/* Sets tunable 'selector' to 'value', returning its old value in *oldValue */
+static bool setTunable(mach_port_t pm_server, int selector, int value, int *oldValue)
+{
+    int     rc = kIOReturnSuccess;
+
+    return (KERN_SUCCESS == io_pm_assertion_set_tunable(pm_server, selector, value, oldValue, &rc))
+        && (kIOReturnSuccess == rc);
+}
+
+static IOReturn createOne(IOPMAssertionID *outID)
+{
+    return IOPMAssertionCreateWithDescription(
+                    kIOPMAssertionTypePreventUserIdleSystemSleep,
+                    CFSTR("com.apple.iokit.assertions.slotbenchmark"),
+                    NULL, NULL, NULL, 0, NULL, outID);
+}
+
+int main()
+{
+    IOPMAssertionID     *ids = NULL;
+    IOPMAssertionID     staleID = kIOPMNullAssertionID;
+    IOPMAssertionID     _id = kIOPMNullAssertionID;
+    IOReturn            ret = 0;
+    uint64_t            start, elapsed;
+    uint64_t            createTotal = 0, createMax = 0;
+    uint64_t            releaseTotal = 0, releaseMax = 0;
+    int                 live = 0;
+    int                 i;
+    mach_port_t         pm_server = MACH_PORT_NULL;
+    int                 savedLimit = 0, savedRate = 0, unused;
+    bool                lifted = false;
+
+    ret = PMTestInitialize("PMAssertions slot table benchmark", "com.apple.iokit.powertesting");
+    if(kIOReturnSuccess != ret)
+    {
+        fprintf(stderr,"PMTestInitialize failed with IOReturn error code 0x%08x\n", ret);
+        exit(-1);
+    }
+
+    if (KERN_SUCCESS == bootstrap_look_up2(bootstrap_port, kIOPMServerBootstrapName, &pm_server, 
+                                           0, BOOTSTRAP_PRIVILEGED_SERVER))
+    {
+        lifted = setTunable(pm_server, kIOPMAssertionTunableProcessLimit, 0, &savedLimit)
+              && setTunable(pm_server, kIOPMAssertionTunableProcessRate, 0, &savedRate);
+    }
+    if (!lifted) {
+        PMTestLog("Couldn't lift the per-process assertion limits; not running as root?");
+    }
+
+    mach_timebase_info(&timebase);
+    ids = calloc(kFillCount, sizeof(IOPMAssertionID));
+    if (!ids) {
+        PMTestFail("Can't allocate %d assertion IDs\n", kFillCount);
+        exit(1);
+    }
+
+    PMTestLog("Filling the assertion table with up to %d live assertions.", kFillCount);
+
+    start = mach_absolute_time();
+    for (live = 0; live < kFillCount; live++)
+    {
+        if (kIOReturnSuccess != createOne(&ids[live]))
+            break;
+    }
+    elapsed = nsecsSince(start);
+
+    PMTestLog("Created %d live assertions in %llu usecs (%llu nsecs/create)",
+                live, elapsed / 1000, live ? elapsed / live : 0);
+
+    if (live == 0) {
+        PMTestFail("Couldn't create any assertions\n");
+        exit(1);
+    }
+
+    /* Make room for the timed create/release pairs below */
+    IOPMAssertionRelease(ids[--live]);
+
+    for (i = 0; i < kFullTableRuns; i++)
+    {
+        start = mach_absolute_time();
+        ret = createOne(&_id);
+        elapsed = nsecsSince(start);
+        if (kIOReturnSuccess != ret) {
+            PMTestFail("Create with a full table returns 0x%08x on run %d\n", ret, i);
+            break;
+        }
+        createTotal += elapsed;
+        if (elapsed > createMax) createMax = elapsed;
+
+        start = mach_absolute_time();
+        ret = IOPMAssertionRelease(_id);
+        elapsed = nsecsSince(start);
+        if (kIOReturnSuccess != ret) {
+            PMTestFail("Release with a full table returns 0x%08x on run %d\n", ret, i);
+            break;
+        }
+        releaseTotal += elapsed;
+        if (elapsed > releaseMax) releaseMax = elapsed;
+
+        if (i == 0) staleID = _id;
+    }
+
+    if (i) {
+        PMTestLog("Full table create:  avg %llu nsecs, max %llu nsecs over %d runs",
+                    createTotal / i, createMax, i);
+        PMTestLog("Full table release: avg %llu nsecs, max %llu nsecs over %d runs",
+                    releaseTotal / i, releaseMax, i);
+    }
+
+    /* staleID's slot has been released and handed out again since */
+    if (kIOPMNullAssertionID != staleID)
+    {
+        ret = IOPMAssertionRelease(staleID);
+        if (kIOReturnSuccess == ret) {
+            PMTestFail("Releasing stale assertion ID 0x%08x succeeded\n", staleID);
+        } else {
+            PMTestPass("Stale assertion ID 0x%08x rejected with 0x%08x\n", staleID, ret);
+        }
+    }
+
+    start = mach_absolute_time();
+    for (i = 0; i < live; i++)
+    {
+        IOPMAssertionRelease(ids[i]);
+    }
+    elapsed = nsecsSince(start);
+
+    PMTestLog("Released %d live assertions in %llu usecs", live, elapsed / 1000);
+
+    free(ids);
+
+    if (lifted) {
+        setTunable(pm_server, kIOPMAssertionTunableProcessLimit, savedLimit, &unused);
+        setTunable(pm_server, kIOPMAssertionTunableProcessRate, savedRate, &unused);
+    }
+    if (MACH_PORT_NULL != pm_server) {
+        mach_port_deallocate(mach_task_self(), pm_server);
+    }
+
+    PMTestPass("Slot table benchmark complete with %d live assertions\n", live + 1);
+
+    return 0;
+}
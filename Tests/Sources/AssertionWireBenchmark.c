@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "../../pmconfigd/PMAssertionWire.h"
+#include "AssertionWirePayloads.h"
+
+
+/*
+ * Assertion wire encoding microbenchmark.
+ * Needs no CoreFoundation and no powerd, so it builds and runs on any host:
+ *      make AssertionWireBenchmark && ./AssertionWireBenchmark [iterations]
+ *
+ * For each recorded request payload, encodes and decodes the wire form,
+ * checks that it round trips, and reports its size next to the binary
+ * plist sent today. Also decodes a caffeinate -disu style batch, checks
+ * that every truncation of a message is rejected, and checks the assertion
+ * type token lookup.
+ */
+
+#define kDefaultIterations      1000000
+
+static int  failures = 0;
+
+#define CHECK(cond, ...)    do { if (!(cond)) { failures++; \
+                                fprintf(stderr, "FAIL: " __VA_ARGS__); \
+                                fprintf(stderr, "\n"); } } while (0)
+
+static uint64_t nowNsecs(void)
+{
+#if __APPLE__
+    static mach_timebase_info_data_t    timebase;
+
+    if (!timebase.denom) mach_timebase_info(&timebase);
+    return (mach_absolute_time() * timebase.numer) / timebase.denom;
+#else
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void setString(pmWireAssertion_t *wire, int tag, pmWireString_t *str, const char *val)
+{
+    if (!val) return;
+    str->ptr = val;
+    str->len = (uint32_t)strlen(val);
+    wire->present |= (1U << tag);
+}
+
+static void wireFromPayload(const capturedPayload_t *p, pmWireAssertion_t *wire)
+{
+    memset(wire, 0, sizeof(*wire));
+
+    setString(wire, kPMWireTagType, &wire->type, p->type);
+    if (p->type && (wire->typeToken = PMWireTypeTokenForName(p->type, strlen(p->type))))
+        wire->present |= (1U << kPMWireTagTypeToken);
+    setString(wire, kPMWireTagName, &wire->name, p->name);
+    setString(wire, kPMWireTagDetails, &wire->details, p->details);
+    setString(wire, kPMWireTagHumanReadableReason, &wire->humanReadableReason, p->reason);
+    setString(wire, kPMWireTagLocalizationBundlePath, &wire->localizationBundlePath, p->bundlePath);
+    setString(wire, kPMWireTagTimeoutAction, &wire->timeoutAction, p->timeoutAction);
+    if (p->hasLevel) {
+        wire->level = p->level;
+        wire->present |= (1U << kPMWireTagLevel);
+    }
+    if (p->timeout) {
+        wire->timeout = p->timeout;
+        wire->present |= (1U << kPMWireTagTimeout);
+    }
+    if (p->extra) {
+        wire->plist = p->extra;
+        wire->plistLen = p->extraLen;
+        wire->present |= (1U << kPMWireTagPlist);
+    }
+}
+
+static int stringsEqual(const pmWireString_t *a, const pmWireString_t *b)
+{
+    return (a->len == b->len) && (!a->len || !memcmp(a->ptr, b->ptr, a->len));
+}
+
+static int wireEqual(const pmWireAssertion_t *a, const pmWireAssertion_t *b)
+{
+    return (a->present == b->present)
+        && stringsEqual(&a->type, &b->type)
+        && stringsEqual(&a->name, &b->name)
+        && stringsEqual(&a->details, &b->details)
+        && stringsEqual(&a->humanReadableReason, &b->humanReadableReason)
+        && stringsEqual(&a->localizationBundlePath, &b->localizationBundlePath)
+        && stringsEqual(&a->timeoutAction, &b->timeoutAction)
+        && (a->level == b->level)
+        && (a->timeout == b->timeout)
+        && (a->typeToken == b->typeToken)
+        && (a->plistLen == b->plistLen)
+        && (!a->plistLen || !memcmp(a->plist, b->plist, a->plistLen));
+}
+
+static void encodeOne(pmWireBuffer_t *buf, const pmWireAssertion_t *wire)
+{
+    PMWireEncodeBegin(buf);
+    PMWireEncodeAssertion(buf, wire);
+    PMWireEncodeEnd(buf, 1);
+}
+
+static void benchPayload(const capturedPayload_t *p, long iterations)
+{
+    pmWireBuffer_t      buf = { 0 };
+    pmWireAssertion_t   wire, decoded;
+    pmWireReader_t      reader;
+    uint32_t            count = 0;
+    uint64_t            start, encodeNs, decodeNs;
+    uint64_t            sink = 0;
+    long                i;
+
+    wireFromPayload(p, &wire);
+
+    encodeOne(&buf, &wire);
+    CHECK(!buf.failed, "%s: encode failed", p->label);
+    CHECK(PMWireDecodeBegin(&reader, buf.bytes, buf.len, &count) && (count == 1)
+            && PMWireDecodeNext(&reader, &decoded) && wireEqual(&wire, &decoded),
+            "%s: round trip mismatch", p->label);
+    CHECK(!PMWireIsEncoded(p->plist, p->plistLen),
+            "%s: plist payload mistaken for wire format", p->label);
+
+    start = nowNsecs();
+    for (i = 0; i < iterations; i++) {
+        encodeOne(&buf, &wire);
+        sink += buf.len;
+    }
+    encodeNs = nowNsecs() - start;
+
+    start = nowNsecs();
+    for (i = 0; i < iterations; i++) {
+        PMWireDecodeBegin(&reader, buf.bytes, buf.len, &count);
+        PMWireDecodeNext(&reader, &decoded);
+        sink += decoded.present + decoded.type.len + decoded.name.len;
+    }
+    decodeNs = nowNsecs() - start;
+
+    printf("%-30s plist %4u bytes  wire %4zu bytes  encode %6.1f ns  decode %6.1f ns  (%llu)\n",
+            p->label, p->plistLen, buf.len,
+            (double)encodeNs / iterations, (double)decodeNs / iterations,
+            (unsigned long long)(sink & 0xf));
+
+    PMWireBufferFree(&buf);
+}
+
+static void benchBatch(long iterations)
+{
+    pmWireBuffer_t      buf = { 0 };
+    pmWireAssertion_t   wire[kCapturedPayloadCount], decoded;
+    pmWireReader_t      reader;
+    uint32_t            count = 0, j;
+    uint32_t            plistBytes = 0;
+    uint64_t            start, decodeNs;
+    uint64_t            sink = 0;
+    long                i;
+
+    PMWireEncodeBegin(&buf);
+    for (j = 0; j < kCapturedPayloadCount; j++) {
+        wireFromPayload(&kCapturedPayloads[j], &wire[j]);
+        PMWireEncodeAssertion(&buf, &wire[j]);
+        plistBytes += kCapturedPayloads[j].plistLen;
+    }
+    CHECK(PMWireEncodeEnd(&buf, kCapturedPayloadCount), "batch: encode failed");
+
+    CHECK(PMWireDecodeBegin(&reader, buf.bytes, buf.len, &count)
+            && (count == kCapturedPayloadCount), "batch: bad header");
+    for (j = 0; j < count; j++) {
+        CHECK(PMWireDecodeNext(&reader, &decoded) && wireEqual(&wire[j], &decoded),
+                "batch: record %u mismatch", j);
+    }
+    CHECK(!PMWireDecodeNext(&reader, &decoded), "batch: decoded past the last record");
+
+    // Every strict prefix of a valid message must be rejected
+    for (j = 0; j < buf.len; j++) {
+        uint32_t    got = 0, k;
+        bool        ok = PMWireDecodeBegin(&reader, buf.bytes, j, &count);
+
+        for (k = 0; ok && (k < count); k++) {
+            if ((ok = PMWireDecodeNext(&reader, &decoded))) got++;
+        }
+        CHECK(!ok || (got < kCapturedPayloadCount), "batch: %u byte prefix accepted", j);
+    }
+
+    start = nowNsecs();
+    for (i = 0; i < iterations; i++) {
+        PMWireDecodeBegin(&reader, buf.bytes, buf.len, &count);
+        while (PMWireDecodeNext(&reader, &decoded))
+            sink += decoded.present;
+    }
+    decodeNs = nowNsecs() - start;
+
+    printf("%-30s plist %4u bytes  wire %4zu bytes                    decode %6.1f ns  (%llu)\n",
+            "batch of all payloads", plistBytes, buf.len,
+            (double)decodeNs / iterations, (unsigned long long)(sink & 0xf));
+
+    PMWireBufferFree(&buf);
+}
+
+static void checkTypeTokens(long iterations)
+{
+    static const char   *unknown[] = { "", "Foo", "CPUBoundAssertio", "BackgroundTasks", "preventSystemSleep" };
+    const char          *name;
+    uint64_t            start, lookupNs;
+    uint64_t            sink = 0;
+    unsigned            token, i;
+    long                n;
+
+    for (token = kPMWireTypeTokenNone + 1; token < kPMWireTypeTokenCount; token++) {
+        name = PMWireTypeNameForToken(token);
+        CHECK(name && (PMWireTypeTokenForName(name, strlen(name)) == token),
+                "type token %u doesn't round trip", token);
+    }
+    CHECK(!PMWireTypeNameForToken(kPMWireTypeTokenNone) && !PMWireTypeNameForToken(kPMWireTypeTokenCount),
+            "name returned for a bad type token");
+    for (i = 0; i < sizeof(unknown)/sizeof(unknown[0]); i++) {
+        CHECK(PMWireTypeTokenForName(unknown[i], strlen(unknown[i])) == kPMWireTypeTokenNone,
+                "\"%s\" matched a type token", unknown[i]);
+    }
+
+    name = PMWireTypeNameForToken(kPMWireTypeTokenPreventUserIdleDisplaySleep);
+    start = nowNsecs();
+    for (n = 0; n < iterations; n++) {
+        sink += PMWireTypeTokenForName(name, strlen(name));
+    }
+    lookupNs = nowNsecs() - start;
+
+    printf("%-30s %6.1f ns  (%llu)\n", "type token lookup",
+            (double)lookupNs / iterations, (unsigned long long)(sink & 0xf));
+}
+
+int main(int argc, char *argv[])
+{
+    long        iterations = kDefaultIterations;
+    unsigned    i;
+
+    if (argc > 1) {
+        iterations = strtol(argv[1], NULL, 0);
+        if (iterations <= 0) iterations = kDefaultIterations;
+    }
+
+    printf("Assertion wire encoding, %ld iterations per measurement\n", iterations);
+
+    for (i = 0; i < kCapturedPayloadCount; i++) {
+        benchPayload(&kCapturedPayloads[i], iterations);
+    }
+    benchBatch(iterations);
+    checkTypeTokens(iterations);
+
+    if (failures) {
+        printf("FAIL: %d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Assertion request payloads for AssertionWireBenchmark.
+ *
+ * kPayload<n>Plist is the binary plist a client sends today for that
+ * request. kPayload<n>Extra is the binary plist of just the keys that have
+ * no wire tag, i.e. what travels in kPMWireTagPlist.
+ */
+
+#ifndef _AssertionWirePayloads_h_
+#define _AssertionWirePayloads_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* caffeinate -i */
+static const uint8_t kPayload0Plist[315] = {
+    0x62, 0x70, 0x6c, 0x69, 0x73, 0x74, 0x30, 0x30, 0xd5, 0x01, 0x02, 0x03,
+    0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x5a, 0x41, 0x73, 0x73, 0x65,
+    0x72, 0x74, 0x54, 0x79, 0x70, 0x65, 0x5a, 0x41, 0x73, 0x73, 0x65, 0x72,
+    0x74, 0x4e, 0x61, 0x6d, 0x65, 0x57, 0x44, 0x65, 0x74, 0x61, 0x69, 0x6c,
+    0x73, 0x5f, 0x10, 0x13, 0x48, 0x75, 0x6d, 0x61, 0x6e, 0x52, 0x65, 0x61,
+    0x64, 0x61, 0x62, 0x6c, 0x65, 0x52, 0x65, 0x61, 0x73, 0x6f, 0x6e, 0x5a,
+    0x42, 0x75, 0x6e, 0x64, 0x6c, 0x65, 0x50, 0x61, 0x74, 0x68, 0x5f, 0x10,
+    0x1a, 0x50, 0x72, 0x65, 0x76, 0x65, 0x6e, 0x74, 0x55, 0x73, 0x65, 0x72,
+    0x49, 0x64, 0x6c, 0x65, 0x53, 0x79, 0x73, 0x74, 0x65, 0x6d, 0x53, 0x6c,
+    0x65, 0x65, 0x70, 0x5f, 0x10, 0x1c, 0x63, 0x61, 0x66, 0x66, 0x65, 0x69,
+    0x6e, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6d, 0x6d, 0x61, 0x6e, 0x64,
+    0x2d, 0x6c, 0x69, 0x6e, 0x65, 0x20, 0x74, 0x6f, 0x6f, 0x6c, 0x5f, 0x10,
+    0x1c, 0x63, 0x61, 0x66, 0x66, 0x65, 0x69, 0x6e, 0x61, 0x74, 0x65, 0x20,
+    0x61, 0x73, 0x73, 0x65, 0x72, 0x74, 0x69, 0x6e, 0x67, 0x20, 0x66, 0x6f,
+    0x72, 0x65, 0x76, 0x65, 0x72, 0x5f, 0x10, 0x28, 0x54, 0x48, 0x45, 0x20,
+    0x43, 0x41, 0x46, 0x46, 0x45, 0x49, 0x4e, 0x41, 0x54, 0x45, 0x20, 0x54,
+    0x4f, 0x4f, 0x4c, 0x20, 0x49, 0x53, 0x20, 0x50, 0x52, 0x45, 0x56, 0x45,
+    0x4e, 0x54, 0x49, 0x4e, 0x47, 0x20, 0x53, 0x4c, 0x45, 0x45, 0x50, 0x2e,
+    0x5f, 0x10, 0x2a, 0x2f, 0x53, 0x79, 0x73, 0x74, 0x65, 0x6d, 0x2f, 0x4c,
+    0x69, 0x62, 0x72, 0x61, 0x72, 0x79, 0x2f, 0x43, 0x6f, 0x72, 0x65, 0x53,
+    0x65, 0x72, 0x76, 0x69, 0x63, 0x65, 0x73, 0x2f, 0x70, 0x6f, 0x77, 0x65,
+    0x72, 0x64, 0x2e, 0x62, 0x75, 0x6e, 0x64, 0x6c, 0x65, 0x00, 0x08, 0x00,
+    0x13, 0x00, 0x1e, 0x00, 0x29, 0x00, 0x31, 0x00, 0x47, 0x00, 0x52, 0x00,
+    0x6f, 0x00, 0x8e, 0x00, 0xad, 0x00, 0xd8, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x02, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0b, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x05,
+};
+
+/* caffeinate -d -t 3600 */
+static const uint8_t kPayload1Plist[395] = {
+    0x62, 0x70, 0x6c, 0x69, 0x73, 0x74, 0x30, 0x30, 0xd7, 0x01, 0x02, 0x03,
+    0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x5a,
+    0x41, 0x73, 0x73, 0x65, 0x72, 0x74, 0x54, 0x79, 0x70, 0x65, 0x5a, 0x41,
+    0x73, 0x73, 0x65, 0x72, 0x74, 0x4e, 0x61, 0x6d, 0x65, 0x57, 0x44, 0x65,
+    0x74, 0x61, 0x69, 0x6c, 0x73, 0x5f, 0x10, 0x13, 0x48, 0x75, 0x6d, 0x61,
+    0x6e, 0x52, 0x65, 0x61, 0x64, 0x61, 0x62, 0x6c, 0x65, 0x52, 0x65, 0x61,
+    0x73, 0x6f, 0x6e, 0x5a, 0x42, 0x75, 0x6e, 0x64, 0x6c, 0x65, 0x50, 0x61,
+    0x74, 0x68, 0x5e, 0x54, 0x69, 0x6d, 0x65, 0x6f, 0x75, 0x74, 0x53, 0x65,
+    0x63, 0x6f, 0x6e, 0x64, 0x73, 0x5d, 0x54, 0x69, 0x6d, 0x65, 0x6f, 0x75,
+    0x74, 0x41, 0x63, 0x74, 0x69, 0x6f, 0x6e, 0x5f, 0x10, 0x1b, 0x50, 0x72,
+    0x65, 0x76, 0x65, 0x6e, 0x74, 0x55, 0x73, 0x65, 0x72, 0x49, 0x64, 0x6c,
+    0x65, 0x44, 0x69, 0x73, 0x70, 0x6c, 0x61, 0x79, 0x53, 0x6c, 0x65, 0x65,
+    0x70, 0x5f, 0x10, 0x1c, 0x63, 0x61, 0x66, 0x66, 0x65, 0x69, 0x6e, 0x61,
+    0x74, 0x65, 0x20, 0x63, 0x6f, 0x6d, 0x6d, 0x61, 0x6e, 0x64, 0x2d, 0x6c,
+    0x69, 0x6e, 0x65, 0x20, 0x74, 0x6f, 0x6f, 0x6c, 0x5f, 0x10, 0x22, 0x63,
+    0x61, 0x66, 0x66, 0x65, 0x69, 0x6e, 0x61, 0x74, 0x65, 0x20, 0x61, 0x73,
+    0x73, 0x65, 0x72, 0x74, 0x69, 0x6e, 0x67, 0x20, 0x66, 0x6f, 0x72, 0x20,
+    0x33, 0x36, 0x30, 0x30, 0x20, 0x73, 0x65, 0x63, 0x73, 0x5f, 0x10, 0x28,
+    0x54, 0x48, 0x45, 0x20, 0x43, 0x41, 0x46, 0x46, 0x45, 0x49, 0x4e, 0x41,
+    0x54, 0x45, 0x20, 0x54, 0x4f, 0x4f, 0x4c, 0x20, 0x49, 0x53, 0x20, 0x50,
+    0x52, 0x45, 0x56, 0x45, 0x4e, 0x54, 0x49, 0x4e, 0x47, 0x20, 0x53, 0x4c,
+    0x45, 0x45, 0x50, 0x2e, 0x5f, 0x10, 0x2a, 0x2f, 0x53, 0x79, 0x73, 0x74,
+    0x65, 0x6d, 0x2f, 0x4c, 0x69, 0x62, 0x72, 0x61, 0x72, 0x79, 0x2f, 0x43,
+    0x6f, 0x72, 0x65, 0x53, 0x65, 0x72, 0x76, 0x69, 0x63, 0x65, 0x73, 0x2f,
+    0x70, 0x6f, 0x77, 0x65, 0x72, 0x64, 0x2e, 0x62, 0x75, 0x6e, 0x64, 0x6c,
+    0x65, 0x23, 0x40, 0xac, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5f, 0x10,
+    0x14, 0x54, 0x69, 0x6d, 0x65, 0x6f, 0x75, 0x74, 0x41, 0x63, 0x74, 0x69,
+    0x6f, 0x6e, 0x52, 0x65, 0x6c, 0x65, 0x61, 0x73, 0x65, 0x00, 0x08, 0x00,
+    0x17, 0x00, 0x22, 0x00, 0x2d, 0x00, 0x35, 0x00, 0x4b, 0x00, 0x56, 0x00,
+    0x65, 0x00, 0x73, 0x00, 0x91, 0x00, 0xb0, 0x00, 0xd5, 0x01, 0x00, 0x01,
+    0x2d, 0x01, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x4d,
+};
+
+/* IOPMAssertionCreateWithName */
+static const uint8_t kPayload2Plist[140] = {
+    0x62, 0x70, 0x6c, 0x69, 0x73, 0x74, 0x30, 0x30, 0xd3, 0x01, 0x02, 0x03,
+    0x04, 0x05, 0x06, 0x5a, 0x41, 0x73, 0x73, 0x65, 0x72, 0x74, 0x54, 0x79,
+    0x70, 0x65, 0x5b, 0x41, 0x73, 0x73, 0x65, 0x72, 0x74, 0x4c, 0x65, 0x76,
+    0x65, 0x6c, 0x5a, 0x41, 0x73, 0x73, 0x65, 0x72, 0x74, 0x4e, 0x61, 0x6d,
+    0x65, 0x5f, 0x10, 0x14, 0x4e, 0x6f, 0x49, 0x64, 0x6c, 0x65, 0x53, 0x6c,
+    0x65, 0x65, 0x70, 0x41, 0x73, 0x73, 0x65, 0x72, 0x74, 0x69, 0x6f, 0x6e,
+    0x10, 0xff, 0x5f, 0x10, 0x18, 0x63, 0x6f, 0x6d, 0x2e, 0x61, 0x70, 0x70,
+    0x6c, 0x65, 0x2e, 0x62, 0x61, 0x63, 0x6b, 0x75, 0x70, 0x64, 0x2e, 0x62,
+    0x61, 0x63, 0x6b, 0x75, 0x70, 0x08, 0x0f, 0x1a, 0x26, 0x31, 0x48, 0x4a,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x65,
+};
+
+/* DeclareUserActivity */
+static const uint8_t kPayload3Plist[132] = {
+    0x62, 0x70, 0x6c, 0x69, 0x73, 0x74, 0x30, 0x30, 0xd3, 0x01, 0x02, 0x03,
+    0x04, 0x05, 0x06, 0x5a, 0x41, 0x73, 0x73, 0x65, 0x72, 0x74, 0x4e, 0x61,
+    0x6d, 0x65, 0x5b, 0x41, 0x73, 0x73, 0x65, 0x72, 0x74, 0x4c, 0x65, 0x76,
+    0x65, 0x6c, 0x5f, 0x10, 0x11, 0x41, 0x70, 0x70, 0x6c, 0x69, 0x65, 0x73,
+    0x4f, 0x6e, 0x4c, 0x69, 0x64, 0x43, 0x6c, 0x6f, 0x73, 0x65, 0x5f, 0x10,
+    0x1d, 0x63, 0x6f, 0x6d, 0x2e, 0x61, 0x70, 0x70, 0x6c, 0x65, 0x2e, 0x73,
+    0x63, 0x72, 0x65, 0x65, 0x6e, 0x73, 0x68, 0x61, 0x72, 0x69, 0x6e, 0x67,
+    0x2e, 0x61, 0x67, 0x65, 0x6e, 0x74, 0x10, 0xff, 0x09, 0x08, 0x0f, 0x1a,
+    0x26, 0x3a, 0x5a, 0x5c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5d,
+};
+static const uint8_t kPayload3Extra[67] = {
+    0x62, 0x70, 0x6c, 0x69, 0x73, 0x74, 0x30, 0x30, 0xd1, 0x01, 0x02, 0x5f,
+    0x10, 0x11, 0x41, 0x70, 0x70, 0x6c, 0x69, 0x65, 0x73, 0x4f, 0x6e, 0x4c,
+    0x69, 0x64, 0x43, 0x6c, 0x6f, 0x73, 0x65, 0x09, 0x08, 0x0b, 0x1f, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20,
+};
+
+/* app with extra keys */
+static const uint8_t kPayload4Plist[214] = {
+    0x62, 0x70, 0x6c, 0x69, 0x73, 0x74, 0x30, 0x30, 0xd6, 0x01, 0x02, 0x03,
+    0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0a, 0x0b, 0x5a, 0x41, 0x73,
+    0x73, 0x65, 0x72, 0x74, 0x54, 0x79, 0x70, 0x65, 0x5b, 0x41, 0x73, 0x73,
+    0x65, 0x72, 0x74, 0x4c, 0x65, 0x76, 0x65, 0x6c, 0x5a, 0x41, 0x73, 0x73,
+    0x65, 0x72, 0x74, 0x4e, 0x61, 0x6d, 0x65, 0x57, 0x44, 0x65, 0x74, 0x61,
+    0x69, 0x6c, 0x73, 0x5f, 0x10, 0x11, 0x46, 0x72, 0x61, 0x6d, 0x65, 0x77,
+    0x6f, 0x72, 0x6b, 0x42, 0x75, 0x6e, 0x64, 0x6c, 0x65, 0x49, 0x44, 0x5f,
+    0x10, 0x13, 0x41, 0x6c, 0x6c, 0x6f, 0x77, 0x73, 0x44, 0x65, 0x76, 0x69,
+    0x63, 0x65, 0x52, 0x65, 0x73, 0x74, 0x61, 0x72, 0x74, 0x5f, 0x10, 0x1a,
+    0x50, 0x72, 0x65, 0x76, 0x65, 0x6e, 0x74, 0x55, 0x73, 0x65, 0x72, 0x49,
+    0x64, 0x6c, 0x65, 0x53, 0x79, 0x73, 0x74, 0x65, 0x6d, 0x53, 0x6c, 0x65,
+    0x65, 0x70, 0x10, 0xff, 0x5d, 0x50, 0x6c, 0x61, 0x79, 0x69, 0x6e, 0x67,
+    0x20, 0x61, 0x75, 0x64, 0x69, 0x6f, 0x5f, 0x10, 0x10, 0x63, 0x6f, 0x6d,
+    0x2e, 0x61, 0x70, 0x70, 0x6c, 0x65, 0x2e, 0x69, 0x54, 0x75, 0x6e, 0x65,
+    0x73, 0x08, 0x08, 0x15, 0x20, 0x2c, 0x37, 0x3f, 0x53, 0x69, 0x86, 0x88,
+    0x96, 0xa9, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xaa,
+};
+static const uint8_t kPayload4Extra[112] = {
+    0x62, 0x70, 0x6c, 0x69, 0x73, 0x74, 0x30, 0x30, 0xd2, 0x01, 0x02, 0x03,
+    0x04, 0x5f, 0x10, 0x11, 0x46, 0x72, 0x61, 0x6d, 0x65, 0x77, 0x6f, 0x72,
+    0x6b, 0x42, 0x75, 0x6e, 0x64, 0x6c, 0x65, 0x49, 0x44, 0x5f, 0x10, 0x13,
+    0x41, 0x6c, 0x6c, 0x6f, 0x77, 0x73, 0x44, 0x65, 0x76, 0x69, 0x63, 0x65,
+    0x52, 0x65, 0x73, 0x74, 0x61, 0x72, 0x74, 0x5f, 0x10, 0x10, 0x63, 0x6f,
+    0x6d, 0x2e, 0x61, 0x70, 0x70, 0x6c, 0x65, 0x2e, 0x69, 0x54, 0x75, 0x6e,
+    0x65, 0x73, 0x08, 0x08, 0x0d, 0x21, 0x37, 0x4a, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x4b,
+};
+
+typedef struct {
+    const char      *label;
+    const uint8_t   *plist;
+    uint32_t        plistLen;
+    const char      *type;
+    const char      *name;
+    const char      *details;
+    const char      *reason;
+    const char      *bundlePath;
+    const char      *timeoutAction;
+    int             hasLevel;
+    int32_t         level;
+    double          timeout;
+    const uint8_t   *extra;
+    uint32_t        extraLen;
+} capturedPayload_t;
+
+static const capturedPayload_t kCapturedPayloads[] = {
+    { "caffeinate -i",
+      kPayload0Plist, sizeof(kPayload0Plist),
+      "PreventUserIdleSystemSleep", "caffeinate command-line tool",
+      "caffeinate asserting forever", "THE CAFFEINATE TOOL IS PREVENTING SLEEP.",
+      "/System/Library/CoreServices/powerd.bundle", NULL,
+      0, 0, 0.0,
+      NULL, 0 },
+    { "caffeinate -d -t 3600",
+      kPayload1Plist, sizeof(kPayload1Plist),
+      "PreventUserIdleDisplaySleep", "caffeinate command-line tool",
+      "caffeinate asserting for 3600 secs", "THE CAFFEINATE TOOL IS PREVENTING SLEEP.",
+      "/System/Library/CoreServices/powerd.bundle", "TimeoutActionRelease",
+      0, 0, 3600.0,
+      NULL, 0 },
+    { "IOPMAssertionCreateWithName",
+      kPayload2Plist, sizeof(kPayload2Plist),
+      "NoIdleSleepAssertion", "com.apple.backupd.backup",
+      NULL, NULL,
+      NULL, NULL,
+      1, 255, 0.0,
+      NULL, 0 },
+    { "DeclareUserActivity",
+      kPayload3Plist, sizeof(kPayload3Plist),
+      NULL, "com.apple.screensharing.agent",
+      NULL, NULL,
+      NULL, NULL,
+      1, 255, 0.0,
+      kPayload3Extra, sizeof(kPayload3Extra) },
+    { "app with extra keys",
+      kPayload4Plist, sizeof(kPayload4Plist),
+      "PreventUserIdleSystemSleep", "Playing audio",
+      "com.apple.iTunes", NULL,
+      NULL, NULL,
+      1, 255, 0.0,
+      kPayload4Extra, sizeof(kPayload4Extra) },
+};
+
+#define kCapturedPayloadCount   (sizeof(kCapturedPayloads) / sizeof(kCapturedPayloads[0]))
+
+#endif /* _AssertionWirePayloads_h_ */
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOReturn.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <servers/bootstrap.h>
+#include <bootstrap_priv.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "PMTestLib.h"
+#include "powermanagement.h"
+
+/*
+ * Extends a declared user activity with io_pm_declare_user_active_extend,
+ * and checks that the routine refuses IDs that aren't a live UserIsActive
+ * assertion of this process. Reports the cost of an extend next to that of
+ * repeating IOPMAssertionDeclareUserActivity with the same ID.
+ */
+
+// Both timed loops together stay within the default per-process call burst
+#define kIterations     400
+
+static double nsPerCall(uint64_t start, uint64_t end)
+{
+    static mach_timebase_info_data_t    timebase;
+
+    if (!timebase.denom) mach_timebase_info(&timebase);
+    return (double)((end - start) * timebase.numer / timebase.denom) / kIterations;
+}
+
+static void extendExpecting(mach_port_t pm_server, IOPMAssertionID _id, IOReturn expected, const char *what)
+{
+    kern_return_t   kr;
+    int             rc = kIOReturnSuccess;
+
+    kr = io_pm_declare_user_active_extend(pm_server, (int)_id, &rc);
+    if ((KERN_SUCCESS != kr) || (rc != expected)) {
+        PMTestFail("Extending %s returns kr 0x%08x rc 0x%08x; expected rc 0x%08x\n", what, kr, rc, expected);
+    }
+}
+
+int main()
+{
+    IOReturn                    ret;
+    kern_return_t               kr;
+    mach_port_t                 pm_server = MACH_PORT_NULL;
+    IOPMAssertionID             userActive = kIOPMNullAssertionID;
+    IOPMAssertionID             other = kIOPMNullAssertionID;
+    IOPMAssertionID             repeat;
+    uint64_t                    start, extendEnd, declareEnd;
+    int                         rc = kIOReturnSuccess;
+    int                         i;
+
+    ret = PMTestInitialize("Declare user activity extend", "com.apple.iokit.powermanagement");
+    if (kIOReturnSuccess != ret)
+    {
+        fprintf(stderr,"PMTestInitialize failed with IOReturn error code 0x%08x\n", ret);
+        exit(-1);
+    }
+
+    kr = bootstrap_look_up2(bootstrap_port, kIOPMServerBootstrapName, &pm_server, 
+                            0, BOOTSTRAP_PRIVILEGED_SERVER);
+    if (KERN_SUCCESS != kr) {
+        PMTestFail("bootstrap_look_up2 returns 0x%08x\n", kr);
+        exit(1);
+    }
+
+    ret = IOPMAssertionDeclareUserActivity(CFSTR("DeclareUserActivityExtend"),
+                        kIOPMUserActiveLocal, &userActive);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("IOPMAssertionDeclareUserActivity returns 0x%08x\n", ret);
+        exit(1);
+    }
+
+    ret = IOPMAssertionCreateWithName(kIOPMAssertionTypePreventUserIdleSystemSleep,
+                        kIOPMAssertionLevelOn, CFSTR("DeclareUserActivityExtend"), &other);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("IOPMAssertionCreateWithName returns 0x%08x\n", ret);
+        exit(1);
+    }
+
+    extendExpecting(pm_server, userActive, kIOReturnSuccess, "the user activity");
+    extendExpecting(pm_server, kIOPMNullAssertionID, kIOReturnBadArgument, "a null ID");
+    extendExpecting(pm_server, other, kIOReturnBadArgument, "a PreventUserIdleSystemSleep assertion");
+
+    start = mach_absolute_time();
+    for (i = 0; i < kIterations; i++) {
+        io_pm_declare_user_active_extend(pm_server, (int)userActive, &rc);
+    }
+    extendEnd = mach_absolute_time();
+    for (i = 0; i < kIterations; i++) {
+        repeat = userActive;
+        IOPMAssertionDeclareUserActivity(CFSTR("DeclareUserActivityExtend"),
+                        kIOPMUserActiveLocal, &repeat);
+    }
+    declareEnd = mach_absolute_time();
+    PMTestLog("Extend %.0f ns per call, repeated declare %.0f ns per call\n",
+              nsPerCall(start, extendEnd), nsPerCall(extendEnd, declareEnd));
+
+    IOPMAssertionRelease(other);
+    ret = IOPMAssertionRelease(userActive);
+    if (kIOReturnSuccess != ret) {
+        PMTestFail("IOPMAssertionRelease returns 0x%08x\n", ret);
+    }
+    extendExpecting(pm_server, userActive, kIOReturnBadArgument, "a released assertion");
+
+    PMTestPass("io_pm_declare_user_active_extend\n");
+
+    mach_port_deallocate(mach_task_self(), pm_server);
+    return 0;
+}
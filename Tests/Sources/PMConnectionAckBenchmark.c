@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/pwr_mgt/IOPMLibPrivate.h>
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#include <servers/bootstrap.h>
+#include <bootstrap_priv.h>
+
+#include <mach/mach_time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "PMTestLib.h"
+#include "powermanagement.h"
+
+
+/*
+ * IOPMConnection acknowledge latency benchmark.
+ * Opens up to kMaxConnections PMConnections, and at each step in
+ * kConnectionSteps times acknowledgements against the oldest and the
+ * newest open connection. There is no transition in flight, so each ack
+ * is expected to fail with kIOReturnNotFound after powerd has looked
+ * up the connection; what's measured is that lookup plus the MIG round
+ * trip. Latency should stay flat as the number of connections grows.
+ */
+
+#define kMaxConnections     4096
+#define kAcksPerStep        2000
+#define kBogusToken         0x7fff
+
+static const int kConnectionSteps[] = { 1, 16, 128, 1024, kMaxConnections };
+
+static mach_timebase_info_data_t    timebase;
+
+static uint64_t nsecsSince(uint64_t start)
+{
+    return ((mach_absolute_time() - start) * timebase.numer) / timebase.denom;
+}
+
+/* Returns the average acknowledge latency in nsecs against 'connection_id' */
+static uint64_t timeAcks(mach_port_t pm_server, uint32_t connection_id, uint64_t *outMax)
+{
+    uint64_t    start, elapsed, total = 0;
+    int         rc;
+    int         i;
+
+    *outMax = 0;
+    for (i = 0; i < kAcksPerStep; i++)
+    {
+        rc = kIOReturnSuccess;
+        start = mach_absolute_time();
+        io_pm_connection_acknowledge_event(pm_server, connection_id, kBogusToken, 0, 0, &rc);
+        elapsed = nsecsSince(start);
+
+        if (kIOReturnNotFound != rc) {
+            PMTestFail("Ack on connection %u returned 0x%08x; expected kIOReturnNotFound\n",
+                        connection_id, rc);
+        }
+        total += elapsed;
+        if (elapsed > *outMax) *outMax = elapsed;
+    }
+    return total / kAcksPerStep;
+}
+
+int main()
+{
+    uint32_t            *ids = NULL;
+    mach_port_t         pm_server = MACH_PORT_NULL;
+    uint64_t            oldestAvg, oldestMax, newestAvg, newestMax;
+    IOReturn            ret = 0;
+    int                 opened = 0;
+    int                 rc;
+    int                 step, i;
+
+    ret = PMTestInitialize("IOPMConnection acknowledge latency benchmark", "com.apple.iokit.powertesting");
+    if(kIOReturnSuccess != ret)
+    {
+        fprintf(stderr,"PMTestInitialize failed with IOReturn error code 0x%08x\n", ret);
+        exit(-1);
+    }
+
+    if (KERN_SUCCESS != bootstrap_look_up2(bootstrap_port, kIOPMServerBootstrapName, &pm_server, 
+                                           0, BOOTSTRAP_PRIVILEGED_SERVER))
+    {
+        PMTestFail("Can't look up %s\n", kIOPMServerBootstrapName);
+        exit(1);
+    }
+
+    mach_timebase_info(&timebase);
+    ids = calloc(kMaxConnections, sizeof(uint32_t));
+    if (!ids) {
+        PMTestFail("Can't allocate %d connection IDs\n", kMaxConnections);
+        exit(1);
+    }
+
+    for (step = 0; step < (int)(sizeof(kConnectionSteps)/sizeof(kConnectionSteps[0])); step++)
+    {
+        for (; opened < kConnectionSteps[step]; opened++)
+        {
+            rc = kIOReturnError;
+            if ((KERN_SUCCESS != io_pm_connection_create(pm_server, mach_task_self(),
+                                        "com.apple.iokit.connectionackbenchmark",
+                                        kIOPMSystemPowerStateCapabilityCPU, &ids[opened], &rc))
+                || (kIOReturnSuccess != rc))
+            {
+                PMTestFail("Couldn't opened connection %d: 0x%08x\n", opened, rc);
+                goto exit;
+            }
+        }
+
+        oldestAvg = timeAcks(pm_server, ids[0], &oldestMax);
+        newestAvg = timeAcks(pm_server, ids[opened - 1], &newestMax);
+
+        PMTestLog("%5d connections: ack oldest avg %llu nsecs (max %llu), newest avg %llu nsecs (max %llu)",
+                    opened, oldestAvg, oldestMax, newestAvg, newestMax);
+    }
+
+    PMTestPass("Acknowledge latency measured with up to %d opened connections\n", opened);
+
+exit:
+    for (i = 0; i < opened; i++)
+    {
+        io_pm_connection_release(pm_server, ids[i], &rc);
+    }
+    free(ids);
+    mach_port_deallocate(mach_task_self(), pm_server);
+
+    return 0;
+}
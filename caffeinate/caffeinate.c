@@ -60,6 +60,8 @@ static CFStringRef        kLocalizationBundlePath = CFSTR("/System/Library/CoreS
 #define kAssertionNameString    "caffeinate command-line tool"
 
 int createAssertions(const char *progname, AssertionFlag flags, long timeout);
+static CFDictionaryRef createAssertionDescription(CFStringRef type,
+        CFStringRef details, long timeout);
 void forkChild(char *argv[], AssertionFlag flag);
 void usage(void);
 
@@ -129,7 +131,9 @@ createAssertions(const char *progname, AssertionFlag flags, long timeout)
     IOReturn result = 1;
     char assertionDetails[128];
     CFStringRef assertionDetailsString = NULL;
-    IOPMAssertionID assertionID = 0;
+    CFMutableArrayRef descriptions = NULL;
+    CFDictionaryRef description = NULL;
+    IOPMAssertionID assertionIDs[kIOPMAssertionBatchMax];
     u_int i = 0;
 
     if (progname) {
@@ -150,6 +154,12 @@ createAssertions(const char *progname, AssertionFlag flags, long timeout)
         goto finish;
     }
 
+    descriptions = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    if (!descriptions) {
+        fprintf(stderr, "Failed to create assertion descriptions\n");
+        goto finish;
+    }
+
     for (i = 0; i < sizeof(assertionMap)/sizeof(AssertionMapEntry); ++i)
     {
         AssertionMapEntry *entry = assertionMap + i;
@@ -158,27 +168,64 @@ createAssertions(const char *progname, AssertionFlag flags, long timeout)
         if ( (entry->assertionFlag == kUserActiveAssertionFlag) && (timeout == 0))
             timeout = 5;  /* Force a 5sec timeout on user active assertions */
 
-        result = IOPMAssertionCreateWithDescription(entry->assertionType,
-                    CFSTR(kAssertionNameString), assertionDetailsString,
-                    kHumanReadableReason, kLocalizationBundlePath,
-                    (CFTimeInterval)timeout, kIOPMAssertionTimeoutActionRelease,
-                    &assertionID);
-
-        if (result != kIOReturnSuccess)
-        {
+        description = createAssertionDescription(entry->assertionType,
+                    assertionDetailsString, timeout);
+        if (!description) {
             fprintf(stderr, "Failed to create %s assertion\n",
                 CFStringGetCStringPtr(entry->assertionType, kCFStringEncodingMacRoman));
             goto finish;
         }
+        CFArrayAppendValue(descriptions, description);
+        CFRelease(description);
+    }
+
+    /* All requested assertions are taken in a single round trip to powerd */
+    result = IOPMAssertionsCreateWithDescriptions(descriptions, assertionIDs);
+    if (result != kIOReturnSuccess)
+    {
+        fprintf(stderr, "Failed to create assertions (0x%08x)\n", result);
+        goto finish;
     }
 
     result = kIOReturnSuccess;
 finish:
+    if (descriptions) CFRelease(descriptions);
     if (assertionDetailsString) CFRelease(assertionDetailsString);
 
     return result;
 }
 
+static CFDictionaryRef
+createAssertionDescription(CFStringRef type, CFStringRef details, long timeout)
+{
+    CFMutableDictionaryRef description = NULL;
+    CFNumberRef timeoutNum = NULL;
+    CFTimeInterval timeoutInterval = (CFTimeInterval)timeout;
+
+    description = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                    &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if (!description) {
+        return NULL;
+    }
+
+    CFDictionarySetValue(description, kIOPMAssertionTypeKey, type);
+    CFDictionarySetValue(description, kIOPMAssertionNameKey, CFSTR(kAssertionNameString));
+    CFDictionarySetValue(description, kIOPMAssertionDetailsKey, details);
+    CFDictionarySetValue(description, kIOPMAssertionHumanReadableReasonKey, kHumanReadableReason);
+    CFDictionarySetValue(description, kIOPMAssertionLocalizationBundlePathKey, kLocalizationBundlePath);
+
+    if (timeout) {
+        timeoutNum = CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &timeoutInterval);
+        if (timeoutNum) {
+            CFDictionarySetValue(description, kIOPMAssertionTimeoutKey, timeoutNum);
+            CFRelease(timeoutNum);
+        }
+        CFDictionarySetValue(description, kIOPMAssertionTimeoutActionKey, kIOPMAssertionTimeoutActionRelease);
+    }
+
+    return description;
+}
+
 void
 forkChild(char *argv[], AssertionFlag flags)
 {
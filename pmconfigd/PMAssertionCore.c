@@ -0,0 +1,866 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <stddef.h>
+
+#include "PMAssertionCore.h"
+
+/* IOPMAssertionID encoding
+ * Low 16 bits carry the slot index (offset by 300, as IDs always have been),
+ * high 16 bits carry the slot's generation at the time the ID was handed out.
+ * A stale ID whose slot has since been released and reused fails the
+ * generation check in assertionForID().
+ */
+#define ID_FROM_SLOT(idx, gen)      ((IOPMAssertionID)((((uint32_t)(gen) & 0xffff) << 16) | (((idx) + 300) & 0xffff)))
+#define SLOT_FROM_ID(id)            ((int)((uint32_t)(id) & 0xffff) - 300)
+#define GEN_FROM_ID(id)             (((uint32_t)(id) >> 16) & 0xffff)
+#define kAssertionSlotNone          ((uint32_t)-1)
+
+/* Slot table backing every live assertion.
+ * Free slots are chained through 'nextFree' in FIFO order, so a released
+ * slot is reused as late as possible. 'generation' is bumped on every
+ * release and is never 0, so no valid ID equals kIOPMNullAssertionID.
+ */
+typedef struct {
+    assertion_t     *assertion;         // NULL when the slot is free
+    uint32_t        nextFree;           // Next free slot; valid only when free
+    uint16_t        generation;         // Encoded into the IOPMAssertionID
+} assertionSlot_t;
+
+assertionType_t                     gAssertionTypes[kIOPMNumAssertionTypes];
+__private_extern__ uint32_t         kerAssertionBits = 0;
+__private_extern__ int              aggregate_assertions;
+__private_extern__ uint64_t         gAggregateGeneration = 1;
+__private_extern__ uint64_t         gAssertionsGeneration = 1;
+__private_extern__ uint32_t         gLiveAssertionCnt = 0;
+
+static assertionSlot_t              gAssertionSlots[kMaxAssertions];
+static uint32_t                     gFreeSlotHead = kAssertionSlotNone;
+static uint32_t                     gFreeSlotTail = kAssertionSlotNone;
+
+/* Min-heap of every timed assertion, across all assertion types, ordered
+ * by 'timeout'. gAssertionTimeouts is always scheduled for the heap's root.
+ */
+static assertion_t                  *gTimedHeap[kMaxAssertions];
+static uint32_t                     gTimedHeapCnt = 0;
+
+static void                         assertionTimeoutsDue(deadline_t *deadline);
+static deadline_t                   gAssertionTimeouts = { .handler = assertionTimeoutsDue };
+
+/* Scheduled deadlines, earliest first */
+static LIST_HEAD(, deadline)        gDeadlines = LIST_HEAD_INITIALIZER(gDeadlines);
+static uint64_t                     gArmedDeadline = 0;     /* As passed to armDeadlineTimerAt() */
+static bool                         gFiringDeadlines = false;
+
+/* While a batch is open, type handlers are deferred, then run once per
+ * affected type by closeAssertionBatch().
+ */
+__private_extern__ bool             gAssertionBatchOpen = false;
+static uint32_t                     gBatchRaisedTypes = 0;
+static uint32_t                     gBatchReleasedTypes = 0;
+
+#pragma mark -
+#pragma mark Slots
+
+__private_extern__ void initAssertionSlots(void)
+{
+    uint32_t    i;
+
+    for (i = 0; i < kMaxAssertions; i++) {
+        gAssertionSlots[i].assertion = NULL;
+        gAssertionSlots[i].generation = 1;
+        gAssertionSlots[i].nextFree = (i+1 < kMaxAssertions) ? i+1 : kAssertionSlotNone;
+    }
+    gFreeSlotHead = 0;
+    gFreeSlotTail = kMaxAssertions - 1;
+    gLiveAssertionCnt = 0;
+}
+
+/*
+ * Takes a slot off the head of the free list and binds it to 'assertion'.
+ * Returns false if all kMaxAssertions slots are in use.
+ */
+__private_extern__ bool allocAssertionSlot(assertion_t *assertion)
+{
+    uint32_t        idx = gFreeSlotHead;
+    assertionSlot_t *slot;
+
+    if (idx == kAssertionSlotNone)
+        return false;
+
+    slot = &gAssertionSlots[idx];
+    gFreeSlotHead = slot->nextFree;
+    if (gFreeSlotHead == kAssertionSlotNone)
+        gFreeSlotTail = kAssertionSlotNone;
+
+    slot->assertion = assertion;
+    slot->nextFree = kAssertionSlotNone;
+    gLiveAssertionCnt++;
+
+    assertion->assertionId = ID_FROM_SLOT(idx, slot->generation);
+    return true;
+}
+
+/*
+ * Returns the assertion's slot to the tail of the free list and bumps its
+ * generation, invalidating every ID previously handed out for it.
+ */
+__private_extern__ void freeAssertionSlot(assertion_t *assertion)
+{
+    uint32_t        idx = SLOT_FROM_ID(assertion->assertionId);
+    assertionSlot_t *slot = &gAssertionSlots[idx];
+
+    slot->assertion = NULL;
+    if (++slot->generation == 0)
+        slot->generation = 1;
+
+    slot->nextFree = kAssertionSlotNone;
+    if (gFreeSlotTail == kAssertionSlotNone)
+        gFreeSlotHead = idx;
+    else
+        gAssertionSlots[gFreeSlotTail].nextFree = idx;
+    gFreeSlotTail = idx;
+
+    if (gLiveAssertionCnt) gLiveAssertionCnt--;
+}
+
+__private_extern__ assertion_t *assertionForID(IOPMAssertionID id)
+{
+    int             idx = SLOT_FROM_ID(id);
+    assertionSlot_t *slot;
+
+    if ((idx < 0) || (idx >= kMaxAssertions))
+        return NULL;
+
+    slot = &gAssertionSlots[idx];
+    if (!slot->assertion || (slot->generation != GEN_FROM_ID(id)))
+        return NULL;
+
+    return slot->assertion;
+}
+
+#pragma mark -
+#pragma mark Lists
+
+__private_extern__ void insertInactiveAssertion(assertion_t *assertion, assertionType_t *assertType)
+{
+    LIST_INSERT_HEAD(&assertType->inactive, assertion, link);
+    BUMP_GENERATION(gAssertionsGeneration);
+    assertion->state &= ~kAssertionStateTimed;
+    assertion->state |= kAssertionStateInactive;
+}
+
+__private_extern__ void removeInactiveAssertion(assertion_t *assertion, assertionType_t *assertType __unused)
+{
+    LIST_REMOVE(assertion, link);
+    BUMP_GENERATION(gAssertionsGeneration);
+    assertion->state &= ~kAssertionStateInactive;
+}
+
+__private_extern__ void insertActiveAssertion(assertion_t *assertion, assertionType_t *assertType)
+{
+    LIST_INSERT_HEAD(&assertType->active, assertion, link);
+    assertType->activeCount++;
+    BUMP_GENERATION(gAssertionsGeneration);
+    assertion->state &= ~(kAssertionStateTimed|kAssertionStateInactive);
+
+    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) &&
+            (assertion->state & kAssertionStateValidOnBatt) )
+            assertType->validOnBattCount++;
+
+    if (assertion->state & kAssertionLidStateModifier)
+       assertType->lidSleepCount++;
+}
+
+__private_extern__ void removeActiveAssertion(assertion_t *assertion, assertionType_t *assertType)
+{
+    LIST_REMOVE(assertion, link);
+    if (assertType->activeCount) assertType->activeCount--;
+    BUMP_GENERATION(gAssertionsGeneration);
+
+    if ( (assertion->state & kAssertionStateValidOnBatt) && assertType->validOnBattCount)
+            assertType->validOnBattCount--;
+
+    if ( (assertion->state & kAssertionLidStateModifier) && assertType->lidSleepCount)
+       assertType->lidSleepCount--;
+}
+
+
+static inline void timedHeapSet(uint32_t idx, assertion_t *assertion)
+{
+    gTimedHeap[idx] = assertion;
+    assertion->timedIdx = idx;
+}
+
+static void timedHeapSiftUp(uint32_t idx)
+{
+    assertion_t *assertion = gTimedHeap[idx];
+    uint32_t    parent;
+
+    while (idx) {
+        parent = (idx - 1) / 2;
+        if (gTimedHeap[parent]->timeout <= assertion->timeout)
+            break;
+        timedHeapSet(idx, gTimedHeap[parent]);
+        idx = parent;
+    }
+    timedHeapSet(idx, assertion);
+}
+
+static void timedHeapSiftDown(uint32_t idx)
+{
+    assertion_t *assertion = gTimedHeap[idx];
+    uint32_t    child;
+
+    while ((child = 2*idx + 1) < gTimedHeapCnt) {
+        if ((child+1 < gTimedHeapCnt) && (gTimedHeap[child+1]->timeout < gTimedHeap[child]->timeout))
+            child++;
+        if (gTimedHeap[child]->timeout >= assertion->timeout)
+            break;
+        timedHeapSet(idx, gTimedHeap[child]);
+        idx = child;
+    }
+    timedHeapSet(idx, assertion);
+}
+
+static void timedHeapInsert(assertion_t *assertion)
+{
+    timedHeapSet(gTimedHeapCnt++, assertion);
+    timedHeapSiftUp(assertion->timedIdx);
+}
+
+static void timedHeapRemove(assertion_t *assertion)
+{
+    uint32_t    idx = assertion->timedIdx;
+    assertion_t *last = gTimedHeap[--gTimedHeapCnt];
+
+    if (idx < gTimedHeapCnt) {
+        timedHeapSet(idx, last);
+        timedHeapSiftUp(idx);
+        timedHeapSiftDown(last->timedIdx);
+    }
+}
+
+/* Re-position an assertion whose 'timeout' changed in place */
+__private_extern__ void timedHeapUpdate(assertion_t *assertion)
+{
+    timedHeapSiftUp(assertion->timedIdx);
+    timedHeapSiftDown(assertion->timedIdx);
+}
+
+/*
+ * Schedules gAssertionTimeouts for the earliest timeout across all
+ * assertion types.
+ */
+__private_extern__ void armAssertionTimer(void)
+{
+    if (gTimedHeapCnt)
+        scheduleDeadline(&gAssertionTimeouts, gTimedHeap[0]->timeout);
+    else
+        cancelDeadline(&gAssertionTimeouts);
+}
+
+static void assertionTimeoutsDue(deadline_t *deadline __unused)
+{
+    handleAssertionTimeouts();
+}
+
+/* Takes a timed assertion off its type's activeTimed list and the timeout heap */
+__private_extern__ void unlinkTimedAssertion(assertion_t *assertion, assertionType_t *assertType)
+{
+    LIST_REMOVE(assertion, link);
+    if (assertType->activeTimedCount) assertType->activeTimedCount--;
+    BUMP_GENERATION(gAssertionsGeneration);
+    timedHeapRemove(assertion);
+    assertion->state &= ~kAssertionStateTimed;
+
+    if ( (assertion->state & kAssertionStateValidOnBatt) && assertType->validOnBattCount)
+            assertType->validOnBattCount--;
+
+    if ( (assertion->state & kAssertionLidStateModifier) && assertType->lidSleepCount)
+            assertType->lidSleepCount--;
+}
+
+__private_extern__ void removeTimedAssertion(assertion_t *assertion, assertionType_t *assertType)
+{
+    bool adjustTimer = (assertion->timedIdx == 0);
+
+    unlinkTimedAssertion(assertion, assertType);
+
+    if (adjustTimer) armAssertionTimer();
+
+}
+
+__private_extern__ void insertTimedAssertion(assertion_t *assertion, assertionType_t *assertType, bool updateTimer)
+{
+    LIST_INSERT_HEAD(&assertType->activeTimed, assertion, link);
+    assertType->activeTimedCount++;
+    BUMP_GENERATION(gAssertionsGeneration);
+    timedHeapInsert(assertion);
+
+    assertion->state |= kAssertionStateTimed;
+    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) &&
+            (assertion->state & kAssertionStateValidOnBatt) )
+            assertType->validOnBattCount++;
+
+    if (assertion->state & kAssertionLidStateModifier)
+            assertType->lidSleepCount++;
+    /*
+     * If this assertion is not the one with earliest timeout,
+     * there is nothing to do.
+     */
+    if (assertion->timedIdx != 0)
+        return;
+
+    if (updateTimer) armAssertionTimer();
+
+    return;
+}
+
+__private_extern__ uint32_t expireTimedAssertions(uint64_t currTime,
+                                void (*expired)(assertion_t *assertion, void *context),
+                                void *context)
+{
+    assertion_t             *assertion;
+    assertionType_t         *assertType;
+    assertionTimeoutAction  action;
+    uint32_t                timedoutTypes = 0;
+
+    while( gTimedHeapCnt && ((assertion = gTimedHeap[0])->timeout <= currTime) )
+    {
+        assertType = &gAssertionTypes[assertion->kassert];
+        timedoutTypes |= (1 << assertion->kassert);
+
+        unlinkTimedAssertion(assertion, assertType);
+
+        action = assertion->timeoutAction;
+        (*expired)(assertion, context);
+
+        // Default timeout action is to turn off; leave it on the inactive list
+        if (action != kAssertionTimeoutActionRelease)
+            insertInactiveAssertion(assertion, assertType);
+    }
+
+    armAssertionTimer();
+
+    return timedoutTypes;
+}
+
+#pragma mark -
+#pragma mark Deadlines
+
+/*
+ * Arms the platform timer for the first scheduled deadline. Nothing is done
+ * if the timer is already armed for that time, or while deadlines are
+ * firing; fireDeadlines() arms it once they are done.
+ */
+static void armDeadlineTimer(void)
+{
+    deadline_t  *first = LIST_FIRST(&gDeadlines);
+    uint64_t    when = first ? first->when : 0;
+
+    if (gFiringDeadlines || (when == gArmedDeadline))
+        return;
+
+    armDeadlineTimerAt(when);
+    gArmedDeadline = when;
+}
+
+__private_extern__ void scheduleDeadline(deadline_t *deadline, uint64_t when)
+{
+    deadline_t  *prev = NULL, *next;
+
+    if (deadline->scheduled) {
+        if (deadline->when == when)
+            return;
+        LIST_REMOVE(deadline, link);
+    }
+    deadline->when = when;
+    deadline->scheduled = true;
+
+    // Deadlines due together keep the order they were scheduled in
+    LIST_FOREACH(next, &gDeadlines, link) {
+        if (next->when > when)
+            break;
+        prev = next;
+    }
+    if (prev)
+        LIST_INSERT_AFTER(prev, deadline, link);
+    else
+        LIST_INSERT_HEAD(&gDeadlines, deadline, link);
+
+    armDeadlineTimer();
+}
+
+__private_extern__ void cancelDeadline(deadline_t *deadline)
+{
+    if (!deadline->scheduled)
+        return;
+
+    LIST_REMOVE(deadline, link);
+    deadline->scheduled = false;
+    armDeadlineTimer();
+}
+
+/*
+ * Runs the handler of every deadline due at 'currTime', earliest first,
+ * then re-arms the timer once for whatever is left.
+ */
+__private_extern__ void fireDeadlines(uint64_t currTime)
+{
+    deadline_t  *deadline;
+
+    // The timer has fired, and must be re-armed even for the same deadline
+    gArmedDeadline = 0;
+    gFiringDeadlines = true;
+
+    while ( (deadline = LIST_FIRST(&gDeadlines)) && (deadline->when <= currTime) )
+    {
+        LIST_REMOVE(deadline, link);
+        deadline->scheduled = false;
+        (*deadline->handler)(deadline);
+    }
+
+    gFiringDeadlines = false;
+    armDeadlineTimer();
+}
+
+static void timeCapDue(deadline_t *deadline)
+{
+    enforceAssertionTypeTimeCap((assertionType_t *)deadline->context);
+}
+
+__private_extern__ void resetGlobalTimer(assertionType_t *assertType, uint64_t timeout)
+{
+    assertType->globalTimeout = timeout;
+    if (assertType->globalTimeout == 0) {
+        cancelDeadline(&assertType->globalDeadline);
+        return;
+    }
+
+    assertType->globalDeadline.handler = timeCapDue;
+    assertType->globalDeadline.context = assertType;
+    scheduleDeadline(&assertType->globalDeadline, getMonotonicTime() + assertType->globalTimeout);
+}
+
+__private_extern__ void setSleepServicesTimeCap(uint32_t  timeoutInMS)
+{
+    assertionType_t *assertType;
+
+    assertType = &gAssertionTypes[kPushServiceTaskIndex];
+
+    // Avoid duplicate resets to 0
+    if ( (timeoutInMS == 0) && (assertType->globalTimeout == 0) )
+        return;
+
+    resetGlobalTimer(assertType, timeoutInMS/1000);
+    if (timeoutInMS == 0) {
+        // Enforce now, but from the timer rather than from within the caller
+        assertType->globalDeadline.handler = timeCapDue;
+        assertType->globalDeadline.context = assertType;
+        scheduleDeadline(&assertType->globalDeadline, getMonotonicTime());
+    }
+}
+
+#pragma mark -
+#pragma mark Raise and release
+
+__private_extern__ IOReturn activateAssertion(assertion_t *assertion)
+{
+    uint64_t            currTime = getMonotonicTime();
+    assertionType_t     *assertType;
+
+    /* The type and other properties have been decoded by the caller */
+    if ((unsigned)assertion->kassert >= kIOPMNumAssertionTypes)
+        return kIOReturnBadArgument;
+    assertType = &gAssertionTypes[assertion->kassert];
+
+    assertion->createTime = currTime;
+
+    /* Is level set to 0 */
+    if (assertion->level == kIOPMAssertionLevelOff) {
+        /* Dump this assertion in inactive list */
+        insertInactiveAssertion(assertion, assertType);
+        return kIOReturnSuccess;
+    }
+
+    /* Check if this is appplicable on battery power also */
+    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) &&
+         (assertion->flags & kAssertionFlagAppliesToLimitedPower) ) {
+        assertion->state |= kAssertionStateValidOnBatt;
+    }
+
+    if ( (assertion->kassert == kDeclareUserActivity) &&
+         (assertion->flags & kAssertionFlagAppliesOnLidClose) ) {
+        assertion->state |= kAssertionLidStateModifier;
+    }
+
+    /* Is this timed */
+    if (assertion->timeoutSecs) {
+
+        assertion->timeout = (uint64_t)assertion->timeoutSecs+currTime; // Absolute time at which assertion expires
+        insertTimedAssertion(assertion, assertType, true);
+    }
+    else {
+        /* Insert into active assertion list */
+        insertActiveAssertion(assertion, assertType);
+    }
+
+    callAssertionHandler(assertType, kAssertionOpRaise);
+
+    return kIOReturnSuccess;
+}
+
+__private_extern__ void deactivateAssertion(assertion_t *assertion, bool callHandler)
+{
+    assertionType_t     *assertType = &gAssertionTypes[assertion->kassert];
+
+    if (assertion->state & kAssertionStateTimed)
+        removeTimedAssertion(assertion, assertType);
+    else if (assertion->state & kAssertionStateInactive)
+        removeInactiveAssertion(assertion, assertType);
+    else
+        removeActiveAssertion(assertion, assertType);
+
+    if (!callHandler) return;
+
+    callAssertionHandler(assertType, kAssertionOpRelease);
+}
+
+/*
+ * Moves an assertion to type 'kassert'. It is released under the type
+ * whose lists it is on, then raised again as a new assertion of the new
+ * type.
+ */
+__private_extern__ IOReturn changeAssertionType(assertion_t *assertion, int kassert)
+{
+    if ((unsigned)kassert >= kIOPMNumAssertionTypes)
+        return kIOReturnBadArgument;
+
+    deactivateAssertion(assertion, true);
+
+    assertion->state &= kAssertionStateLogged;
+    assertion->kassert = kassert;
+    return activateAssertion(assertion);
+}
+
+#pragma mark -
+#pragma mark Handlers
+
+__private_extern__ void callAssertionHandler(assertionType_t *assertType, assertionOps op)
+{
+    if (!assertType->handler)
+        return;
+
+    if (gAssertionBatchOpen) {
+        if (op == kAssertionOpRaise)
+            gBatchRaisedTypes |= (1 << assertType->kassert);
+        else
+            gBatchReleasedTypes |= (1 << assertType->kassert);
+        return;
+    }
+
+    (*assertType->handler)(assertType, op);
+}
+
+__private_extern__ void openAssertionBatch(void)
+{
+    gAssertionBatchOpen = true;
+    gBatchRaisedTypes = gBatchReleasedTypes = 0;
+}
+
+/*
+ * Runs the handler calls deferred since openAssertionBatch(), once per type.
+ * Handlers act on the current contents of the type's lists, so a type that
+ * saw both raises and releases gets one of each and ends up consistent.
+ */
+__private_extern__ void closeAssertionBatch(void)
+{
+    assertionType_t     *assertType;
+    int                 i;
+
+    gAssertionBatchOpen = false;
+
+    for (i = 0; i < kIOPMNumAssertionTypes; i++)
+    {
+        assertType = &gAssertionTypes[i];
+        if (!assertType->handler)
+            continue;
+
+        if (gBatchRaisedTypes & (1 << i))
+            (*assertType->handler)(assertType, kAssertionOpRaise);
+        if (gBatchReleasedTypes & (1 << i))
+            (*assertType->handler)(assertType, kAssertionOpRelease);
+    }
+}
+
+/*
+ * Check for active assertions of the specified type and also for active
+ * assertions of linked types.
+ * Returns true if active assertions exist either in the specified type or
+ * in the linked  types to the specified type.
+ */
+static inline bool typeHasActives(assertionType_t *assertType)
+{
+    /* A disabled assertion type never has active assertions */
+    if (assertType->flags & kAssertionTypeDisabled)
+        return false;
+
+    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) && assertionsOnBatteryPower() )
+        return (assertType->validOnBattCount > 0);
+
+    return (assertType->activeCount + assertType->activeTimedCount) > 0;
+}
+
+__private_extern__ bool checkForActives(assertionType_t *assertType, bool *existsInThisType )
+{
+    bool activeExists = false;
+    uint32_t idx = 0, linked = assertType->linkedTypes;
+
+    /* Check for active assertions of this assertionType */
+    activeExists = typeHasActives(assertType);
+
+    if (existsInThisType)
+        *existsInThisType = activeExists;
+    if (activeExists) return true;
+
+    /* Check for active ones in the linked assertion types */
+    for ( ; linked !=0; linked >>=1, idx++) {
+        if ((linked & 1) == 0) continue;
+
+        if (typeHasActives(&gAssertionTypes[idx]))
+            return true;
+    }
+
+    return false;
+}
+
+__private_extern__ void updateAggregates(assertionType_t *assertType, bool activesForTheType)
+{
+    if (activesForTheType) {
+        SET_AGGREGATE_LEVEL(assertType->kassert,  1 );
+    }
+    else  {
+        if (LEVEL_FOR_BIT(assertType->kassert) && assertType->globalTimeout) {
+           resetGlobalTimer(assertType, 0);
+        }
+        SET_AGGREGATE_LEVEL(assertType->kassert,  0 );
+    }
+}
+
+static uint32_t kernelBitForType(kerAssertionType type)
+{
+    switch(type) {
+        case kPushServiceTaskIndex:
+        case kPreventSleepIndex:
+        case kBackgroundTaskIndex:
+            return kIOPMDriverAssertionCPUBit;
+
+        case kDeclareUserActivity:
+        case kPreventDisplaySleepIndex:
+            return kIOPMDriverAssertionPreventDisplaySleepBit;
+
+        case kExternalMediaIndex:
+            return kIOPMDriverAssertionExternalMediaMountedBit;
+
+        default:
+            return 0;
+    }
+}
+
+__private_extern__ bool setKernelAssertionBits(assertionType_t *assertType, assertionOps op)
+{
+    uint32_t    assertBit = kernelBitForType(assertType->kassert);
+    bool    activeExists, activesForTheType;
+
+    if (!assertBit)
+        return false;
+
+    /*
+     * active assertions exists if one of the active list is not empty and
+     * the assertion is not globally disabled.
+     */
+    activeExists = checkForActives(assertType, &activesForTheType);
+
+    updateAggregates(assertType, activesForTheType);
+
+    if (op == kAssertionOpRaise)  {
+        /*
+         * if already raised with kernel or if there are no active ones,
+         * nothing to do
+         */
+        if ( (kerAssertionBits & assertBit) || !activeExists )
+            return false;
+
+    }
+    else if (op == kAssertionOpRelease)  {
+        /*
+         * If this assertionType is not raised with kernel
+         * or if there are active ones, nothing to do
+         */
+        if ( !(kerAssertionBits & assertBit) || activeExists)
+            return false;
+
+    }
+    else { // op == kAssertionOpEval
+        if (activeExists && (kerAssertionBits & assertBit))
+            return false;
+        else if ( !activeExists && !(kerAssertionBits & assertBit) )
+            return false;
+    }
+
+    if (activeExists)
+        kerAssertionBits |= assertBit;
+    else
+        kerAssertionBits &= ~assertBit;
+    sendUserAssertionsToKernel(kerAssertionBits);
+
+    return true;
+}
+
+__private_extern__ bool setBatteryAssertionLevel(assertionType_t *assertType, assertionOps op)
+{
+    bool    activeExists;
+
+    if (op == kAssertionOpEval)
+        return false; // Nothing to evaluate
+
+    activeExists = checkForActives(assertType, NULL);
+
+    if (op == kAssertionOpRaise) {
+        /*
+         * if already raised with kernel or if there are no active ones,
+         * nothing to do
+         */
+        if ( LEVEL_FOR_BIT(assertType->kassert) || !activeExists )
+            return false;
+        SET_AGGREGATE_LEVEL(assertType->kassert, 1);
+    }
+    else {
+        /*
+         * If this assertionType is not raised with kernel
+         * or if there are active ones, nothing to do
+         */
+        if ( !LEVEL_FOR_BIT(assertType->kassert) || activeExists)
+            return false;
+
+        SET_AGGREGATE_LEVEL(assertType->kassert, 0);
+    }
+
+    switch(assertType->kassert) {
+        case kDisableInflowIndex:
+            sendSmartBatteryCommand( kSBUCInflowDisable,
+                    op == kAssertionOpRaise ? 1 : 0);
+            break;
+
+        case kInhibitChargeIndex:
+            sendSmartBatteryCommand( kSBUCChargeInhibit,
+                    op == kAssertionOpRaise ? 1 : 0);
+            break;
+
+        default:
+            break;
+    }
+
+    return true;
+}
+
+#pragma mark -
+#pragma mark Queries
+
+/*
+ * Checks if there are assertions preventing system going from S0dark to S3.
+ * Returns true if S3 sleep is prevented.
+ */
+__private_extern__ bool systemBlockedInS0Dark( )
+{
+
+   /* PreventSystemSleep assertion and its linked types are the only ones
+    * that can keep the system in S0dark.
+    */
+   return checkForActives(&gAssertionTypes[kPreventSleepIndex], NULL);
+}
+
+/*
+ * Check for active assertions of the specified type.
+ * Returns true if specified type assertions are active
+ */
+__private_extern__ bool checkForActivesByType(kerAssertionType type)
+{
+   bool activesForTheType = false;
+
+   checkForActives(&gAssertionTypes[type], &activesForTheType);
+   return activesForTheType;
+}
+
+/*
+ * Check for assertions of the specified type, even if assertion type is disabled.
+ * Returns true if there any assertions of specified type raised
+ */
+__private_extern__ bool checkForEntriesByType(kerAssertionType type)
+{
+    assertionType_t *assertType = &gAssertionTypes[type];
+
+    return (assertType->activeCount + assertType->activeTimedCount) > 0;
+}
+
+/* Disable the specified assertion type */
+__private_extern__ void disableAssertionType(kerAssertionType type)
+{
+   gAssertionTypes[type].flags |= kAssertionTypeDisabled;
+   if (gAssertionTypes[type].handler)
+      gAssertionTypes[type].handler(&gAssertionTypes[type], kAssertionOpEval);
+}
+
+/* Enablee the specified assertion type */
+__private_extern__ void enableAssertionType(kerAssertionType type)
+{
+   gAssertionTypes[type].flags &= ~kAssertionTypeDisabled;
+   if (gAssertionTypes[type].handler)
+      gAssertionTypes[type].handler(&gAssertionTypes[type], kAssertionOpEval);
+}
+
+__private_extern__ bool takeRateToken(uint64_t *fullAt, uint64_t now, uint32_t rate, uint32_t burst)
+{
+    uint64_t    interval = 1000000000ULL / (rate ? rate : 1);
+    uint64_t    start = (*fullAt > now) ? *fullAt : now;
+
+    // Each call pushes the refill 'interval' further out
+    if (start + interval > now + (uint64_t)(burst ? burst : 1) * interval)
+        return false;
+
+    *fullAt = start + interval;
+    return true;
+}
+
+/*
+ * Returns the aggregate assertion levels, one bit per assertion type.
+ * If 'generation' is non-NULL, it is set to a number that changes
+ * whenever the returned bits do.
+ */
+__private_extern__ uint32_t getAggregateAssertions(uint64_t *generation)
+{
+    if (generation)
+        *generation = LOAD_GENERATION(gAggregateGeneration);
+    return (uint32_t)aggregate_assertions;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _PMAssertionCore_h_
+#define _PMAssertionCore_h_
+
+/*
+ * Assertion state machine.
+ *
+ * The part of the assertion code that only moves assertions between lists
+ * and decides what the kernel must be told: the slot table handing out
+ * assertion IDs, the per-type lists, the timeout heap, the deadlines, the
+ * aggregate levels and the kernel assertion bits. PMAssertions.c wraps it with everything
+ * else: properties, processes, logging and notifications.
+ *
+ * The core reaches the rest of the system only through the functions
+ * listed under "Platform" at the end of this file. powerd implements them
+ * in PMAssertions.c. Tests/Sources/AssertionCoreTest.c implements them with
+ * a virtual clock and a kernel that records what it is sent, so the core
+ * also builds and runs on hosts without CoreFoundation, dispatch or IOKit.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#if __APPLE__
+#include <IOKit/pwr_mgt/IOPMLib.h>
+#else
+typedef uint32_t                    IOPMAssertionID;
+typedef int                         IOReturn;
+typedef double                      CFTimeInterval;
+typedef double                      CFAbsoluteTime;
+typedef const struct __CFString     *CFStringRef;
+typedef const struct __CFDictionary *CFDictionaryRef;
+
+#define __private_extern__          __attribute__((visibility("hidden")))
+#ifndef __unused
+#define __unused                    __attribute__((unused))
+#endif
+
+#define kIOReturnSuccess            0
+#define kIOReturnNoMemory           ((IOReturn)0xe00002bd)
+#define kIOReturnBadArgument        ((IOReturn)0xe00002c2)
+
+#define kIOPMNullAssertionID        0
+#define kIOPMAssertionLevelOff      0
+#define kIOPMAssertionLevelOn       255
+
+#define kIOPMDriverAssertionCPUBit                      0x01
+#define kIOPMDriverAssertionExternalMediaMountedBit     0x10
+#define kIOPMDriverAssertionPreventDisplaySleepBit      0x40
+#endif
+
+#define kMaxAssertions              10240
+
+/* IOPMAssertion levels
+ *
+ * Each assertion type has a corresponding bitfield index, here.
+ * Also as found under the "Bitfields" property in assertion CFDictionaries.
+ */
+typedef enum {
+    // These must be consecutive integers beginning at 0
+    kHighPerfIndex                  = 0,
+    kPreventIdleIndex               = 1,
+    kDisableInflowIndex             = 2,
+    kInhibitChargeIndex             = 3,
+    kDisableWarningsIndex           = 4,
+    kPreventDisplaySleepIndex       = 5,
+    kEnableIdleIndex                = 6,
+    kNoRealPowerSourcesDebugIndex   = 7,
+    kPreventSleepIndex              = 8,
+    kExternalMediaIndex             = 9,
+    kDeclareUserActivity            = 10,
+    kPushServiceTaskIndex           = 11,
+    kBackgroundTaskIndex            = 12,
+    // Make sure this is the last enum element, as it tells us the total
+    // number of elements in the enum definition
+    kIOPMNumAssertionTypes
+} kerAssertionType;
+
+
+
+/* Values for assertion_t.timeoutAction */
+typedef enum {
+    kAssertionTimeoutActionTurnOff  = 0,    // Also kIOPMAssertionTimeoutActionLog, or no action given
+    kAssertionTimeoutActionRelease,
+    kAssertionTimeoutActionKillProcess
+} assertionTimeoutAction;
+
+typedef struct assertion {
+    LIST_ENTRY(assertion) link;
+    LIST_ENTRY(assertion) pidLink;      // Entry in the creating process's list of assertions
+    CFDictionaryRef props;              // client provided properties, less those kept in the fields below.
+                                        // Immutable; replaced as a whole when the client changes it.
+                                        // See copyAssertionProperties() for the full dictionary.
+    uint32_t        propBytes;          // Estimated size of 'props', see propertyBytes()
+    pid_t           pid;                // PID creating the assertion
+    uint32_t        state;              // assertion state bits
+    uint64_t        createTime;         // Time at which assertion is created
+    uint64_t        timeout;            // absolute time at which assertion will timeout
+
+    int             level;              // kIOPMAssertionLevelKey, as last set by the client
+    uint32_t        flags;              // kAssertionFlag bits, from boolean properties
+    CFTimeInterval  timeoutSecs;        // kIOPMAssertionTimeoutKey, 0 if not timed
+    assertionTimeoutAction timeoutAction; // Parsed kIOPMAssertionTimeoutActionKey
+    CFAbsoluteTime  createDate;         // kIOPMAssertionCreateDateKey
+    CFAbsoluteTime  timedOutDate;       // kIOPMAssertionTimedOutDateKey, 0 until the assertion times out
+
+    kerAssertionType    kassert;        // Assertion type, also index into gAssertionTypes
+    uint8_t             typeToken;      // kPMWireTypeToken for the type name the client used
+    IOPMAssertionID     assertionId;    // Assertion Id returned to client
+
+    uint32_t        mods;               // Modifcation bits for most recent SetProperties call
+
+    uint32_t        retainCnt;          // Number of retain calls
+
+    uint32_t        timedIdx;           // Index into the timeout heap, valid with kAssertionStateTimed
+} assertion_t;
+
+/* State bits for assertion_t structure */
+#define kAssertionStateTimed                0x1
+#define kAssertionStateInactive             0x2
+#define kAssertionStateValidOnBatt          0x4
+#define kAssertionStateLogged               0x8
+#define kAssertionLidStateModifier          0x10
+#define kAssertionStateProcessExited        0x20    /* Being released because its process exited */
+
+/* Flag bits for assertion_t structure */
+#define kAssertionFlagAppliesToLimitedPower 0x1     /* kIOPMAssertionAppliesToLimitedPowerKey is true */
+#define kAssertionFlagAppliesOnLidClose     0x2     /* kIOPMAssertionAppliesOnLidClose is true */
+
+/* Mods bits for assertion_t structure */
+#define kAssertionModTimer              0x1
+#define kAssertionModLevel              0x2
+#define kAssertionModType               0x4
+#define kAssertionModPowerConstraint    0x8
+#define kAssertionModLidState           0x10
+
+typedef enum {
+    kAssertionOpRaise,
+    kAssertionOpRelease,
+    kAssertionOpEval,    // Evaluate for any changes to be sent to kernel due to enviromental changes
+    kAssertionOpGlobalTimeout
+} assertionOps;
+
+
+typedef struct assertionType assertionType_t;
+typedef void (*assertionHandler_f)(assertionType_t *a, assertionOps op);
+
+
+/*
+ * Deadlines. Every timer of the assertion code is a deadline_t on one list,
+ * kept in deadline order: the earliest assertion timeout, each type's
+ * global time cap, and so on. The one platform timer is armed for the
+ * first of them, and fireDeadlines() runs every handler due when it fires.
+ * A deadline_t is owned by its user and costs nothing while not scheduled.
+ */
+typedef struct deadline deadline_t;
+typedef void (*deadlineHandler_f)(deadline_t *deadline);
+
+struct deadline {
+    LIST_ENTRY(deadline) link;
+    uint64_t            when;           /* getMonotonicTime() to fire at, valid while scheduled */
+    bool                scheduled;
+    deadlineHandler_f   handler;
+    void                *context;
+};
+
+
+/* Structure per kernel assertion type */
+struct assertionType {
+    uint32_t        flags;              /* Specific to this assertion type */
+
+    LIST_HEAD(, assertion) activeTimed;  /* Active assertions with timeout, unordered. See gTimedHeap */
+    LIST_HEAD(, assertion) active;       /* Active assertions without timeout */
+    LIST_HEAD(, assertion) inactive;     /* timed out assertions/Level 0 assertions etc */
+
+    kerAssertionType    kassert;
+    deadline_t          globalDeadline; /* Enforces 'globalTimeout' on all assertions of this type */
+
+    uint64_t        globalTimeout;      /* Relative time at which assertion is timedout */
+    uint32_t        forceTimedoutCnt;   /* Count of assertions turned off due to global timer */
+    CFStringRef     uuid;               /* Assertion type specific UUID */
+
+    assertionHandler_f  handler;        /* Function changing the required settings in the kernel for this assertion type */
+    uint32_t            linkedTypes;    /* Assertion types that need same kernel settings as this one, but different behavior
+                                           in powerd.  This field bits are indices into 'gAssertionTypes' array */
+
+    // Fields changed by properties set on assertion.
+    // Not all fields are valid for all assertion types
+    uint32_t   validOnBattCount;        /* Count of assertions requesting to be active on Battery power */
+    uint32_t   lidSleepCount;           /* Count of assertions changing clamshellSleep state(For kDeclareUserActivity only) */
+
+    uint32_t   activeCount;             /* Number of assertions on the 'active' list */
+    uint32_t   activeTimedCount;        /* Number of assertions on the 'activeTimed' list */
+} ;
+
+/* Flag bits for assertionType_t structure */
+#define kAssertionTypeNotValidOnBatt        0x1     /* By default, this assertion type is not valid on battery power */
+#define kAssertionTypeGloballyTimed         0x2     /* A global timer releases all assertions of this type */
+#define kAssertionTypeDisabled              0x4     /* All assertion requests of this type are ignored */
+
+// Selectors for AppleSmartBatteryManagerUserClient
+enum {
+    kSBUCInflowDisable              = 0,
+    kSBUCChargeInhibit              = 1
+};
+
+/*
+ * Generations are bumped on the main queue and read by the reader threads
+ * that serve published snapshots, so both sides use atomics.
+ */
+#define BUMP_GENERATION(g)          ((void)__atomic_fetch_add(&(g), 1, __ATOMIC_RELEASE))
+#define LOAD_GENERATION(g)          __atomic_load_n(&(g), __ATOMIC_ACQUIRE)
+
+#define SET_AGGREGATE_LEVEL(idx, val)   { int _prev = aggregate_assertions; \
+                                          if (val)  aggregate_assertions |= (1 << idx); \
+                                          else      aggregate_assertions &= ~(1<<idx); \
+                                          if (_prev != aggregate_assertions) BUMP_GENERATION(gAggregateGeneration); }
+#define LEVEL_FOR_BIT(idx)          ((aggregate_assertions & (1 << idx)) ? 1:0)
+
+
+extern assertionType_t                  gAssertionTypes[kIOPMNumAssertionTypes];
+__private_extern__ extern uint32_t      kerAssertionBits;       /* Bits last sent to the kernel */
+__private_extern__ extern int           aggregate_assertions;   /* One bit per raised assertion type */
+__private_extern__ extern uint64_t      gAggregateGeneration;   /* Bumped on every change to aggregate_assertions */
+__private_extern__ extern uint64_t      gAssertionsGeneration;  /* Bumped on every assertion change */
+__private_extern__ extern uint32_t      gLiveAssertionCnt;      /* Slots in use */
+__private_extern__ extern bool          gAssertionBatchOpen;
+
+/*
+ * Slot table. allocAssertionSlot() sets the assertion's 'assertionId', and
+ * fails once kMaxAssertions assertions are live. assertionForID() returns
+ * NULL for an ID whose assertion has been freed, even if its slot has
+ * since been reused.
+ */
+__private_extern__ void initAssertionSlots(void);
+__private_extern__ bool allocAssertionSlot(assertion_t *assertion);
+__private_extern__ void freeAssertionSlot(assertion_t *assertion);
+__private_extern__ assertion_t *assertionForID(IOPMAssertionID id);
+
+/* Type lists. The timed list also keeps the timeout heap and timer up to date. */
+__private_extern__ void insertActiveAssertion(assertion_t *assertion, assertionType_t *assertType);
+__private_extern__ void removeActiveAssertion(assertion_t *assertion, assertionType_t *assertType);
+__private_extern__ void insertInactiveAssertion(assertion_t *assertion, assertionType_t *assertType);
+__private_extern__ void removeInactiveAssertion(assertion_t *assertion, assertionType_t *assertType);
+__private_extern__ void insertTimedAssertion(assertion_t *assertion, assertionType_t *assertType, bool updateTimer);
+__private_extern__ void removeTimedAssertion(assertion_t *assertion, assertionType_t *assertType);
+__private_extern__ void unlinkTimedAssertion(assertion_t *assertion, assertionType_t *assertType);
+__private_extern__ void timedHeapUpdate(assertion_t *assertion);
+__private_extern__ void armAssertionTimer(void);
+
+/*
+ * scheduleDeadline() (re)schedules 'deadline' to fire at 'when', and
+ * cancelDeadline() unschedules it; either may be called from a handler.
+ * Call fireDeadlines() when the platform timer fires.
+ */
+__private_extern__ void scheduleDeadline(deadline_t *deadline, uint64_t when);
+__private_extern__ void cancelDeadline(deadline_t *deadline);
+__private_extern__ void fireDeadlines(uint64_t currTime);
+
+/*
+ * Global time caps. resetGlobalTimer() has enforceAssertionTypeTimeCap()
+ * called for the type 'timeout' seconds from now, or cancels that if
+ * 'timeout' is 0. The cap is also cancelled once the type has no active
+ * assertions left.
+ */
+__private_extern__ void resetGlobalTimer(assertionType_t *assertType, uint64_t timeout);
+__private_extern__ void setSleepServicesTimeCap(uint32_t  timeoutInMS);
+
+/*
+ * Raising and releasing. activateAssertion() files a new or re-raised
+ * assertion by its level and timeout and runs the type handler;
+ * deactivateAssertion() takes it off whichever list it is on.
+ * changeAssertionType() does both, releasing under the old type and
+ * raising under the new one.
+ */
+__private_extern__ IOReturn activateAssertion(assertion_t *assertion);
+__private_extern__ void deactivateAssertion(assertion_t *assertion, bool callHandler);
+__private_extern__ IOReturn changeAssertionType(assertion_t *assertion, int kassert);
+
+/*
+ * Call from handleAssertionTimeouts(). Takes every assertion whose timeout
+ * is at or before 'currTime' off its lists, then passes it to 'expired'.
+ * Unless its timeout action is kAssertionTimeoutActionRelease, in which
+ * case 'expired' must free it, it is then left on the inactive list.
+ * Re-arms the timer and returns a bit for each type that had a timeout;
+ * the handlers of those types haven't been called.
+ */
+__private_extern__ uint32_t expireTimedAssertions(uint64_t currTime,
+                                void (*expired)(assertion_t *assertion, void *context),
+                                void *context);
+
+/* Handlers. Type handlers run through callAssertionHandler(), deferred while a batch is open. */
+__private_extern__ void callAssertionHandler(assertionType_t *assertType, assertionOps op);
+__private_extern__ void openAssertionBatch(void);
+__private_extern__ void closeAssertionBatch(void);
+
+__private_extern__ bool checkForActives(assertionType_t *assertType, bool *existsInThisType);
+__private_extern__ void updateAggregates(assertionType_t *assertType, bool activesForTheType);
+
+/*
+ * The kernel facing half of the setKernelAssertions() and
+ * handleBatteryAssertions() type handlers. Each returns true if it
+ * changed what the kernel, or the battery, was told.
+ */
+__private_extern__ bool setKernelAssertionBits(assertionType_t *assertType, assertionOps op);
+__private_extern__ bool setBatteryAssertionLevel(assertionType_t *assertType, assertionOps op);
+
+__private_extern__ bool systemBlockedInS0Dark( );
+__private_extern__ bool checkForActivesByType(kerAssertionType type);
+__private_extern__ bool checkForEntriesByType(kerAssertionType type);
+__private_extern__ uint32_t getAggregateAssertions(uint64_t *generation);
+__private_extern__ void disableAssertionType(kerAssertionType type);
+__private_extern__ void enableAssertionType(kerAssertionType type);
+
+/*
+ * Token bucket holding up to 'burst' calls, refilled at 'rate' calls a
+ * second. The whole bucket is kept in *fullAt, the time in nanoseconds at
+ * which it is full again; 0 is a full bucket. Returns false, leaving
+ * *fullAt alone, if a call at 'now' would overdraw the bucket.
+ */
+__private_extern__ bool takeRateToken(uint64_t *fullAt, uint64_t now, uint32_t rate, uint32_t burst);
+
+
+/*
+ * Platform. Implemented by powerd in PMAssertions.c, and by the host tests.
+ */
+
+/* Seconds on a clock that doesn't jump */
+__private_extern__ uint64_t getMonotonicTime(void);
+
+__private_extern__ bool assertionsOnBatteryPower(void);
+
+/* Call fireDeadlines() at 'deadline', in getMonotonicTime() seconds. 0 disarms. */
+__private_extern__ void armDeadlineTimerAt(uint64_t deadline);
+
+/* Deadline handlers: the earliest assertion timeout, and a type's global time cap */
+__private_extern__ void handleAssertionTimeouts(void);
+__private_extern__ void enforceAssertionTypeTimeCap(assertionType_t *assertType);
+
+__private_extern__ void sendUserAssertionsToKernel(uint32_t user_assertions);
+__private_extern__ void sendSmartBatteryCommand(uint32_t which, uint32_t level);
+
+#endif /* _PMAssertionCore_h_ */
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "PMAssertionWire.h"
+
+#define kPMWireInitialCapacity      256
+
+/******************************************************************************
+ * Type tokens
+ ******************************************************************************/
+
+static const char * const kTypeTokenNames[kPMWireTypeTokenCount] = {
+    [kPMWireTypeTokenNeedsCPU]                      = "CPUBoundAssertion",
+    [kPMWireTypeTokenPreventUserIdleSystemSleep]    = "PreventUserIdleSystemSleep",
+    [kPMWireTypeTokenNoIdleSleep]                   = "NoIdleSleepAssertion",
+    [kPMWireTypeTokenDisableInflow]                 = "DisableInflow",
+    [kPMWireTypeTokenInhibitCharging]               = "ChargeInhibit",
+    [kPMWireTypeTokenDisableLowBatteryWarnings]     = "DisableLowPowerBatteryWarnings",
+    [kPMWireTypeTokenPreventUserIdleDisplaySleep]   = "PreventUserIdleDisplaySleep",
+    [kPMWireTypeTokenNoDisplaySleep]                = "NoDisplaySleepAssertion",
+    [kPMWireTypeTokenEnableIdleSleep]               = "EnableIdleSleep",
+    [kPMWireTypeTokenDisableRealPowerSources]       = "NoRealPowerSources_debug",
+    [kPMWireTypeTokenPreventSystemSleep]            = "PreventSystemSleep",
+    [kPMWireTypeTokenDenySystemSleep]               = "DenySystemSleep",
+    [kPMWireTypeTokenExternalMedia]                 = "ExternalMedia",
+    [kPMWireTypeTokenUserIsActive]                  = "UserIsActive",
+    [kPMWireTypeTokenApplePushServiceTask]          = "ApplePushServiceTask",
+    [kPMWireTypeTokenBackgroundTask]                = "BackgroundTask"
+};
+
+/*
+ * Perfect hash over kTypeTokenNames: every name lands in its own slot of
+ * kTypeTokenSlots. Adding a name means finding new constants for
+ * TYPE_NAME_HASH, so that no two names share a slot.
+ */
+#define TYPE_NAME_HASH(name, len)   (((len) + 11 * (uint8_t)(name)[0] + (uint8_t)(name)[(len) - 1]) & 31)
+
+static const uint8_t kTypeTokenSlots[32] = {
+    [0]  = kPMWireTypeTokenNeedsCPU,
+    [2]  = kPMWireTypeTokenInhibitCharging,
+    [5]  = kPMWireTypeTokenExternalMedia,
+    [10] = kPMWireTypeTokenApplePushServiceTask,
+    [11] = kPMWireTypeTokenDenySystemSleep,
+    [15] = kPMWireTypeTokenBackgroundTask,
+    [16] = kPMWireTypeTokenDisableInflow,
+    [18] = kPMWireTypeTokenPreventSystemSleep,
+    [22] = kPMWireTypeTokenEnableIdleSleep,
+    [24] = kPMWireTypeTokenUserIsActive,
+    [25] = kPMWireTypeTokenDisableRealPowerSources,
+    [26] = kPMWireTypeTokenPreventUserIdleSystemSleep,
+    [27] = kPMWireTypeTokenPreventUserIdleDisplaySleep,
+    [28] = kPMWireTypeTokenNoIdleSleep,
+    [29] = kPMWireTypeTokenDisableLowBatteryWarnings,
+    [31] = kPMWireTypeTokenNoDisplaySleep
+};
+
+uint8_t PMWireTypeTokenForName(const char *name, size_t len)
+{
+    uint8_t     token;
+    const char  *candidate;
+
+    if (!name || !len)
+        return kPMWireTypeTokenNone;
+
+    token = kTypeTokenSlots[TYPE_NAME_HASH(name, len)];
+    if (token == kPMWireTypeTokenNone)
+        return kPMWireTypeTokenNone;
+
+    candidate = kTypeTokenNames[token];
+    if ((strlen(candidate) != len) || memcmp(candidate, name, len))
+        return kPMWireTypeTokenNone;
+
+    return token;
+}
+
+const char *PMWireTypeNameForToken(uint8_t token)
+{
+    if ((token == kPMWireTypeTokenNone) || (token >= kPMWireTypeTokenCount))
+        return NULL;
+    return kTypeTokenNames[token];
+}
+
+/******************************************************************************
+ * Encoding
+ ******************************************************************************/
+
+static bool reserve(pmWireBuffer_t *buf, size_t more)
+{
+    size_t      newCap;
+    uint8_t     *newBytes;
+
+    if (buf->failed)
+        return false;
+    if (buf->len + more <= buf->cap)
+        return true;
+
+    newCap = buf->cap ? buf->cap : kPMWireInitialCapacity;
+    while (newCap < buf->len + more)
+        newCap *= 2;
+
+    newBytes = realloc(buf->bytes, newCap);
+    if (!newBytes) {
+        buf->failed = true;
+        return false;
+    }
+    buf->bytes = newBytes;
+    buf->cap = newCap;
+    return true;
+}
+
+static void putVarint(pmWireBuffer_t *buf, uint32_t val)
+{
+    if (!reserve(buf, 5))
+        return;
+
+    while (val >= 0x80) {
+        buf->bytes[buf->len++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    buf->bytes[buf->len++] = (uint8_t)val;
+}
+
+static void putField(pmWireBuffer_t *buf, uint8_t tag, const void *val, uint32_t len)
+{
+    if (!reserve(buf, 1))
+        return;
+    buf->bytes[buf->len++] = tag;
+
+    putVarint(buf, len);
+
+    if (!reserve(buf, len))
+        return;
+    if (len) memcpy(buf->bytes + buf->len, val, len);
+    buf->len += len;
+}
+
+static void putString(pmWireBuffer_t *buf, uint8_t tag, const pmWireString_t *str)
+{
+    putField(buf, tag, str->ptr, str->len);
+}
+
+static void putUInt64(pmWireBuffer_t *buf, uint8_t tag, uint64_t val, uint32_t size)
+{
+    uint8_t     le[8];
+    uint32_t    i;
+
+    for (i = 0; i < size; i++)
+        le[i] = (uint8_t)(val >> (8 * i));
+
+    putField(buf, tag, le, size);
+}
+
+void PMWireEncodeBegin(pmWireBuffer_t *buf)
+{
+    buf->len = 0;
+    buf->failed = false;
+
+    if (!reserve(buf, kPMWireHeaderSize))
+        return;
+
+    buf->bytes[0] = (uint8_t)(kPMWireMagic);
+    buf->bytes[1] = (uint8_t)(kPMWireMagic >> 8);
+    buf->bytes[2] = (uint8_t)(kPMWireMagic >> 16);
+    buf->bytes[3] = (uint8_t)(kPMWireMagic >> 24);
+    buf->bytes[4] = kPMWireVersion;
+    buf->bytes[5] = 0;
+    buf->bytes[6] = 0;
+    buf->bytes[7] = 0;
+    buf->len = kPMWireHeaderSize;
+}
+
+void PMWireEncodeAssertion(pmWireBuffer_t *buf, const pmWireAssertion_t *a)
+{
+    uint64_t    bits;
+
+    if (PMWIRE_HAS(a, kPMWireTagType))
+        putString(buf, kPMWireTagType, &a->type);
+    if (PMWIRE_HAS(a, kPMWireTagTypeToken))
+        putUInt64(buf, kPMWireTagTypeToken, a->typeToken, 1);
+    if (PMWIRE_HAS(a, kPMWireTagLevel))
+        putUInt64(buf, kPMWireTagLevel, (uint32_t)a->level, 4);
+    if (PMWIRE_HAS(a, kPMWireTagTimeout)) {
+        memcpy(&bits, &a->timeout, sizeof(bits));
+        putUInt64(buf, kPMWireTagTimeout, bits, 8);
+    }
+    if (PMWIRE_HAS(a, kPMWireTagTimeoutAction))
+        putString(buf, kPMWireTagTimeoutAction, &a->timeoutAction);
+    if (PMWIRE_HAS(a, kPMWireTagName))
+        putString(buf, kPMWireTagName, &a->name);
+    if (PMWIRE_HAS(a, kPMWireTagDetails))
+        putString(buf, kPMWireTagDetails, &a->details);
+    if (PMWIRE_HAS(a, kPMWireTagHumanReadableReason))
+        putString(buf, kPMWireTagHumanReadableReason, &a->humanReadableReason);
+    if (PMWIRE_HAS(a, kPMWireTagLocalizationBundlePath))
+        putString(buf, kPMWireTagLocalizationBundlePath, &a->localizationBundlePath);
+    if (PMWIRE_HAS(a, kPMWireTagPlist))
+        putField(buf, kPMWireTagPlist, a->plist, a->plistLen);
+
+    if (reserve(buf, 1))
+        buf->bytes[buf->len++] = kPMWireTagEnd;
+}
+
+bool PMWireEncodeEnd(pmWireBuffer_t *buf, uint32_t count)
+{
+    if (buf->failed || (buf->len < kPMWireHeaderSize) || (count > kPMWireMaxRecords))
+        return false;
+
+    buf->bytes[5] = (uint8_t)count;
+    return true;
+}
+
+void PMWireBufferFree(pmWireBuffer_t *buf)
+{
+    free(buf->bytes);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/******************************************************************************
+ * Decoding
+ ******************************************************************************/
+
+bool PMWireIsEncoded(const void *bytes, size_t len)
+{
+    const uint8_t   *p = bytes;
+
+    if (!bytes || (len < kPMWireHeaderSize))
+        return false;
+
+    return (p[0] == (uint8_t)(kPMWireMagic))
+        && (p[1] == (uint8_t)(kPMWireMagic >> 8))
+        && (p[2] == (uint8_t)(kPMWireMagic >> 16))
+        && (p[3] == (uint8_t)(kPMWireMagic >> 24));
+}
+
+static bool getVarint(pmWireReader_t *r, uint32_t *val)
+{
+    uint32_t    result = 0;
+    int         shift;
+
+    for (shift = 0; shift < 35; shift += 7) {
+        if (r->cur >= r->end)
+            return false;
+        result |= (uint32_t)(*r->cur & 0x7f) << shift;
+        if (!(*r->cur++ & 0x80)) {
+            *val = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t getLE(const uint8_t *p, uint32_t size)
+{
+    uint64_t    val = 0;
+
+    while (size--)
+        val = (val << 8) | p[size];
+    return val;
+}
+
+bool PMWireDecodeBegin(pmWireReader_t *r, const void *bytes, size_t len, uint32_t *count)
+{
+    const uint8_t   *p = bytes;
+
+    if (!PMWireIsEncoded(bytes, len) || (p[4] != kPMWireVersion))
+        return false;
+
+    r->cur = p + kPMWireHeaderSize;
+    r->end = p + len;
+    r->remaining = p[5];
+
+    if (count) *count = r->remaining;
+    return true;
+}
+
+bool PMWireDecodeNext(pmWireReader_t *r, pmWireAssertion_t *a)
+{
+    uint8_t         tag;
+    uint32_t        len;
+    const uint8_t   *val;
+    pmWireString_t  *str;
+    uint64_t        bits;
+
+    if (!r->remaining)
+        return false;
+
+    memset(a, 0, sizeof(*a));
+
+    while (r->cur < r->end) {
+        tag = *r->cur++;
+        if (tag == kPMWireTagEnd) {
+            r->remaining--;
+            return true;
+        }
+
+        if (!getVarint(r, &len) || (len > (size_t)(r->end - r->cur)))
+            return false;
+        val = r->cur;
+        r->cur += len;
+
+        str = NULL;
+        switch (tag) {
+            case kPMWireTagType:                    str = &a->type; break;
+            case kPMWireTagTimeoutAction:           str = &a->timeoutAction; break;
+            case kPMWireTagName:                    str = &a->name; break;
+            case kPMWireTagDetails:                 str = &a->details; break;
+            case kPMWireTagHumanReadableReason:     str = &a->humanReadableReason; break;
+            case kPMWireTagLocalizationBundlePath:  str = &a->localizationBundlePath; break;
+
+            case kPMWireTagLevel:
+                if (len != 4) return false;
+                a->level = (int32_t)(uint32_t)getLE(val, 4);
+                break;
+
+            case kPMWireTagTimeout:
+                if (len != 8) return false;
+                bits = getLE(val, 8);
+                memcpy(&a->timeout, &bits, sizeof(bits));
+                break;
+
+            case kPMWireTagTypeToken:
+                if (len != 1) return false;
+                a->typeToken = val[0];
+                break;
+
+            case kPMWireTagPlist:
+                a->plist = val;
+                a->plistLen = len;
+                break;
+
+            default:
+                continue;   // Newer tag; skip it
+        }
+
+        if (str) {
+            str->ptr = (const char *)val;
+            str->len = len;
+        }
+        if (tag < 32)
+            a->present |= (1U << tag);
+    }
+
+    return false;   // Ran off the end without a record terminator
+}
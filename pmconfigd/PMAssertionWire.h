@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2012 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _PMAssertionWire_h_
+#define _PMAssertionWire_h_
+
+/*
+ * Binary wire encoding for assertion properties.
+ *
+ * Clients may send this in place of a serialized CF property list on the
+ * assertion create, set-properties and declare-user-active routines. powerd
+ * tells the two apart by the leading magic; a binary plist always starts
+ * with "bplist".
+ *
+ * Layout, all integers little-endian:
+ *
+ *   header  : magic (4) | version (1) | record count (1) | reserved (2)
+ *   record  : field* | kPMWireTagEnd
+ *   field   : tag (1) | length (LEB128 varint) | value (length bytes)
+ *
+ * Strings are UTF-8 and not NUL terminated. Level is an int32, timeout is
+ * an IEEE double in seconds, the type token a single byte. Keys without a
+ * tag travel together as a single binary plist dictionary in
+ * kPMWireTagPlist. Unknown tags are skipped, so new tags can be added
+ * without bumping the version.
+ *
+ * This file has no CoreFoundation dependency; the CF conversions live with
+ * the code on each side of the connection.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define kPMWireMagic                0x57414d50      /* "PMAW" */
+#define kPMWireVersion              1
+#define kPMWireHeaderSize           8
+#define kPMWireMaxRecords           255
+
+enum {
+    kPMWireTagEnd                       = 0,
+    kPMWireTagType                      = 1,
+    kPMWireTagLevel                     = 2,
+    kPMWireTagTimeout                   = 3,
+    kPMWireTagTimeoutAction             = 4,
+    kPMWireTagName                      = 5,
+    kPMWireTagDetails                   = 6,
+    kPMWireTagHumanReadableReason       = 7,
+    kPMWireTagLocalizationBundlePath    = 8,
+    kPMWireTagTypeToken                 = 9,
+    kPMWireTagPlist                     = 31
+};
+
+/*
+ * Type tokens, one per assertion type name powerd knows. A client that
+ * recognises the type name sends its token as well as the name; powerd then
+ * needn't look at the name, and older servers skip the token. A token
+ * stands for the name rather than for a kernel assertion type, since powerd
+ * decides which names are aliases.
+ */
+enum {
+    kPMWireTypeTokenNone                    = 0,
+    kPMWireTypeTokenNeedsCPU                = 1,    /* CPUBoundAssertion */
+    kPMWireTypeTokenPreventUserIdleSystemSleep,     /* PreventUserIdleSystemSleep */
+    kPMWireTypeTokenNoIdleSleep,                    /* NoIdleSleepAssertion */
+    kPMWireTypeTokenDisableInflow,                  /* DisableInflow */
+    kPMWireTypeTokenInhibitCharging,                /* ChargeInhibit */
+    kPMWireTypeTokenDisableLowBatteryWarnings,      /* DisableLowPowerBatteryWarnings */
+    kPMWireTypeTokenPreventUserIdleDisplaySleep,    /* PreventUserIdleDisplaySleep */
+    kPMWireTypeTokenNoDisplaySleep,                 /* NoDisplaySleepAssertion */
+    kPMWireTypeTokenEnableIdleSleep,                /* EnableIdleSleep */
+    kPMWireTypeTokenDisableRealPowerSources,        /* NoRealPowerSources_debug */
+    kPMWireTypeTokenPreventSystemSleep,             /* PreventSystemSleep */
+    kPMWireTypeTokenDenySystemSleep,                /* DenySystemSleep */
+    kPMWireTypeTokenExternalMedia,                  /* ExternalMedia */
+    kPMWireTypeTokenUserIsActive,                   /* UserIsActive */
+    kPMWireTypeTokenApplePushServiceTask,           /* ApplePushServiceTask */
+    kPMWireTypeTokenBackgroundTask,                 /* BackgroundTask */
+    kPMWireTypeTokenCount
+};
+
+#define PMWIRE_HAS(w, tag)          (((w)->present & (1U << (tag))) != 0)
+
+typedef struct {
+    const char      *ptr;
+    uint32_t        len;
+} pmWireString_t;
+
+/*
+ * One assertion's properties. On decode every pointer refers into the
+ * message buffer, which must outlive the structure.
+ */
+typedef struct {
+    uint32_t        present;        /* (1 << tag) for each field carried */
+    pmWireString_t  type;
+    pmWireString_t  name;
+    pmWireString_t  details;
+    pmWireString_t  humanReadableReason;
+    pmWireString_t  localizationBundlePath;
+    pmWireString_t  timeoutAction;
+    int32_t         level;
+    double          timeout;
+    uint8_t         typeToken;      /* kPMWireTypeToken*, sent with 'type' */
+    const uint8_t   *plist;         /* binary plist of the remaining keys */
+    uint32_t        plistLen;
+} pmWireAssertion_t;
+
+typedef struct {
+    uint8_t         *bytes;
+    size_t          len;
+    size_t          cap;
+    bool            failed;         /* set once an allocation fails */
+} pmWireBuffer_t;
+
+typedef struct {
+    const uint8_t   *cur;
+    const uint8_t   *end;
+    uint32_t        remaining;      /* records not yet returned */
+} pmWireReader_t;
+
+/* Returns true if 'bytes' starts with the wire magic */
+bool PMWireIsEncoded(const void *bytes, size_t len);
+
+/*
+ * Type tokens. PMWireTypeTokenForName() returns kPMWireTypeTokenNone for a
+ * name it doesn't know; PMWireTypeNameForToken() returns NULL for a bad token.
+ */
+uint8_t PMWireTypeTokenForName(const char *name, size_t len);
+const char *PMWireTypeNameForToken(uint8_t token);
+
+/*
+ * Encoding. Call PMWireEncodeBegin(), then PMWireEncodeAssertion() once per
+ * record, then PMWireEncodeEnd() to patch the record count into the header.
+ * A buffer may be reused; Begin() keeps its allocation. Free with
+ * PMWireBufferFree().
+ */
+void PMWireEncodeBegin(pmWireBuffer_t *buf);
+void PMWireEncodeAssertion(pmWireBuffer_t *buf, const pmWireAssertion_t *assertion);
+bool PMWireEncodeEnd(pmWireBuffer_t *buf, uint32_t count);
+void PMWireBufferFree(pmWireBuffer_t *buf);
+
+/*
+ * Decoding. PMWireDecodeBegin() validates the header and returns the record
+ * count; PMWireDecodeNext() fills in the next record. Both return false on
+ * a malformed or truncated message.
+ */
+bool PMWireDecodeBegin(pmWireReader_t *reader, const void *bytes, size_t len, uint32_t *count);
+bool PMWireDecodeNext(pmWireReader_t *reader, pmWireAssertion_t *assertion);
+
+#endif /* _PMAssertionWire_h_ */
@@ -24,6 +24,7 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <notify.h>
 #include <asl.h>
 #include <mach/mach.h>
@@ -35,6 +36,8 @@
 #include <mach/mach.h>
 #include <mach/mach_time.h>
 #include <libproc.h>
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
 
 
 
@@ -45,13 +48,13 @@
 #include "BatteryTimeRemaining.h"
 #include "PMStore.h"
 #include "powermanagementServer.h"
+#include "PMAssertionWire.h"
 
 #define kIOPMAppName                "Power Management configd plugin"
 #define kIOPMPrefsPath              "com.apple.PowerManagement.xml"
 #define FMMD_WIPE_BOOT_ARG          "fmm-wipe-system-status"
 
 
-#define kMaxAssertions              10240
 #define kMaxTaskAssertions          1024
 #define kIOPMTaskPortKey            CFSTR("task")
 #define kIOPMTaskPIDKey             CFSTR("pid")
@@ -62,13 +65,9 @@
 // CAST_PID_TO_KEY casts a mach_port_t into a void * for CF containers
 #define CAST_PID_TO_KEY(x)          ((void *)(uintptr_t)(x))
 
+// Value of kIOPMAssertionGlobalUniqueIDKey for an assertion_t
+#define ASSERTION_UNIQUE_ID(a)      ((((uint64_t)(a)->kassert) << 32) | (a)->assertionId)
 
-/* kIOPMAssertionTimerRefKey
- * For internal use only.
- * Key into Assertion dictionary.
- * Records the CFRunLoopTimerRef (if any) associated with a given assertion.
- */
-#define kIOPMAssertionTimerRefKey   CFSTR("AssertTimerRef")
 
 /* kIOPMAssertionLevelsBitfield
  * For PM internal use only.
@@ -83,38 +82,67 @@
 #define kIOPMAssertionLevelsBits    CFSTR("LevelsBitfield")
 
 
-// Selectors for AppleSmartBatteryManagerUserClient
-enum {
-    kSBUCInflowDisable              = 0,
-    kSBUCChargeInhibit              = 1
-};
-
 typedef enum {
     kTimerTypeTimedOut              = 0,
     kTimerTypeReleased              = 1
 } TimerType;
 
-#define ID_FROM_INDEX(idx)          (idx + 300)
-#define INDEX_FROM_ID(id)           (id - 300)
 #define MAKE_UNIQAID(pid, assertId, id_cnt) ((uint64_t)(pid) << 32) | ((assertId) & 0xffff) << 16 | ((id_cnt) & 0xffff)
 #define GET_ASSERTID(uniqaid)       (((uniqaid) >> 16) & 0xffff)
 #define GET_ASSERTPID(uniqaid)      (((uniqaid) >> 32) & 0xffffffff) 
 
-#define SET_AGGREGATE_LEVEL(idx, val)   { if (val)  aggregate_assertions |= (1 << idx); \
-                                          else      aggregate_assertions &= ~(1<<idx); }
-#define LEVEL_FOR_BIT(idx)          ((aggregate_assertions & (1 << idx)) ? 1:0)
 #define LAST_LEVEL_FOR_BIT(idx)     ((last_aggregate_assertions & (1 << idx)) ? 1:0)
 
 #define ASSERTION_LOG_DELAY         (5LL)
 
+// Default for kIOPMAssertionTunableNotifyWindow
+#define kDefaultNotifyWindowMS      (100)
+
+// Number of IOPMAssertionEventRecords kept for io_pm_assertion_copy_events. Power of 2.
+#define kAssertionEventRingSize     (2048)
+
+// Default and limit for kIOPMAssertionTunableTimedOutHistory
+#define kDefaultTimedOutHistory     (256)
+#define kMaxTimedOutHistory         (16384)
+
+// Defaults for kIOPMAssertionTunableProcessRate and kIOPMAssertionTunableProcessBurst.
+// kIOPMAssertionTunableProcessLimit defaults to kMaxTaskAssertions.
+#define kDefaultProcessCallRate     (200)
+#define kDefaultProcessCallBurst    (1000)
+
+// Default for kIOPMAssertionTunablePropertyLimit, in bytes
+#define kDefaultPropertyLimit       (16 * 1024)
+
+// What propertyBytes() charges for each property list object on top of its payload
+#define kPropertyObjectBytes        (16)
+
+// Slack given to the assertion timeout timer, so expiries close together
+// are handled by a single wakeup.
+#define kAssertionTimerLeeway       (NSEC_PER_SEC / 2)
+
+// Number of log records queued for the assertion log writer. Power of 2.
+#define kAssertionLogRingSize       (1024)
+
 
 CFArrayRef copyScheduledPowerEvents(void);
 CFDictionaryRef copyRepeatPowerEvents(void);
 
 // forward
 
-static void                         sendSmartBatteryCommand(uint32_t which, uint32_t level);
-static void                         sendUserAssertionsToKernel(uint32_t user_assertions);
+/* Book-keeping for each process holding assertions, see gProcTable */
+typedef struct {
+    pid_t                   pid;
+    uint32_t                refCnt;         /* One per live assertion of this process */
+    dispatch_source_t       disp_src;       /* Process exit source */
+    LIST_HEAD(, assertion)  assertions;     /* Every assertion created by this process */
+    uint32_t                createCnt;      /* Assertions created by this process */
+    uint32_t                timeoutCnt;     /* Assertions of this process that timed out */
+    uint64_t                callsFullAt;    /* Create/set properties token bucket, see takeRateToken() */
+    uint64_t                propBytes;      /* Sum of propBytes of this process's assertions */
+    CFStringRef             nameRef;        /* Copy of 'name'; may be retained past the record */
+    char                    name[kProcNameBufLen];
+} processInfo_t;
+
 static void                         evaluateAssertions(void);
 static void                         HandleProcessExit(pid_t deadPID);
 
@@ -122,8 +150,10 @@ static void                         HandleProcessExit(pid_t deadPID);
 static void logASLAssertionEvent(
     const char      *assertionAction,
     assertion_t     *assertion);
+static void queueAssertionForLog(assertion_t *assertion);
 #else
 #define                             logASLAssertionEvent(X1, X2)    
+#define                             queueAssertionForLog(X1)
 #define                             logASLAssertionSummary()
 #define                             logASLAssertionsAggregate()
 #endif
@@ -143,43 +173,150 @@ static CFArrayRef                   copyTimedOutAssertionsArray(void);
 
 static IOReturn                     doCreate(pid_t pid, CFMutableDictionaryRef newProperties,
                                                         IOPMAssertionID *assertion_id);
+static IOReturn                     newAssertion(CFMutableDictionaryRef newProperties,
+                                                        assertion_t **outAssertion);
+static IOReturn                     newAssertionFromWire(const pmWireAssertion_t *wire,
+                                                        assertion_t **outAssertion);
+static uint32_t                     propertyBytes(CFTypeRef value);
+static IOReturn                     admitAssertion(pid_t pid, assertion_t *assertion);
+static void                         discardAssertion(assertion_t *assertion);
+static IOReturn                     createAssertion(pid_t pid, assertion_t *assertion, IOPMAssertionID *assertion_id);
+static IOReturn                     commitAssertion(assertion_t *assertion, IOPMAssertionID *assertion_id);
 static IOReturn copyAssertionForID(
         pid_t inPID, int inID,
         CFMutableDictionaryRef  *outAssertion);
 
-static void                         processInfoCreate(pid_t p, dispatch_source_t d);
-static bool                         processInfoRetain(pid_t p);
+static processInfo_t                *processInfoCreate(pid_t p, dispatch_source_t d);
+static processInfo_t                *processInfoGet(pid_t p);
 static void                         processInfoRelease(pid_t p);
 static void                         sendActivityTickle ();
 static void                         setClamshellSleepState(int clamshellSleepState);
 
 
+/* What IOPMCopyTimedOutAssertions() reports about one timed out assertion.
+ * Strings are retained from the assertion's properties at the time it timed out.
+ */
+typedef struct {
+    CFStringRef         name;
+    CFStringRef         details;
+    CFStringRef         humanReadableReason;
+    CFStringRef         bundlePath;
+    CFStringRef         processName;
+    CFStringRef         timeoutAction;
+    CFAbsoluteTime      createTime;
+    CFAbsoluteTime      timedOutTime;
+    CFTimeInterval      timeout;
+    uint64_t            uniqueID;
+    pid_t               pid;
+    int                 level;
+    kerAssertionType    kassert;
+} timedOutRecord_t;
+
 // globals
-static const int                    kMaxCountTimedOut = 5;
 extern CFMachPortRef                pmServerMachPort;
 
-static CFMutableArrayRef            gTimedOutArray = NULL;
+/* Ring of the most recent timeouts. Timeout number 'n' (from 0) lives at
+ * gTimedOutRing[n % gTimedOutCapacity]. The ring is allocated on the first
+ * timeout, and the CF form is only built when a client asks for it.
+ */
+static timedOutRecord_t             *gTimedOutRing = NULL;
+static uint32_t                     gTimedOutCapacity = kDefaultTimedOutHistory;
+static uint64_t                     gTimedOutCnt = 0;           /* Timeouts recorded since powerd started */
+static uint64_t                     gTimedOutGeneration = 1;    /* Bumped whenever the ring's contents change */
+
+/* Serialized replies to the read-only io_pm_assertion_copy_details queries.
+ * See copyPublishedData().
+ */
+typedef enum {
+    kPublishedAssertions,           /* kIOPMAssertionMIGCopyAll */
+    kPublishedStatus,               /* kIOPMAssertionMIGCopyStatus */
+    kPublishedTimedOut,             /* kIOPMAssertionMIGCopyTimedOutAssertions */
+    kPublishedCount
+} publishedKind;
 
-static uint32_t                     kerAssertionBits = 0;
-static int                          aggregate_assertions;
+typedef struct {
+    CFDataRef       data;
+    uint64_t        generation;     /* Source generation 'data' was built from */
+    uint64_t        queuedTicket;   /* Last rebuild queued on the main queue */
+    uint64_t        doneTicket;     /* Last rebuild finished */
+    bool            queued;         /* queuedTicket hasn't started yet */
+} published_t;
+
+static published_t                  gPublished[kPublishedCount];
+static pthread_mutex_t              gPublishedLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t               gPublishedCond = PTHREAD_COND_INITIALIZER;
+
+static CFDataRef                    copyPublishedData(publishedKind kind);
+static void                         performOnMainQueue(dispatch_block_t block);
 static CFStringRef                  assertion_types_arr[kIOPMNumAssertionTypes];
 
 __private_extern__ bool isDisplayAsleep( );
 __private_extern__ void logASLMessageSleepServiceTerminated(int forcedTimeoutCnt);
 
-static CFMutableDictionaryRef       gAssertionsArray = NULL;
-static CFMutableDictionaryRef       gProcessDict = NULL;
-static CFMutableDictionaryRef       gUserAssertionTypesDict = NULL;
-assertionType_t     gAssertionTypes[kIOPMNumAssertionTypes];
+/* The one timer, armed by armDeadlineTimerAt() for the earliest deadline */
+static dispatch_source_t            gDeadlineTimer = NULL;
+
+/* Set while a batch is open if the AnyChanged notification is due at its end */
+static bool                         gBatchNotify = false;
+
+/* Coalescing state for one assertion change notification, see flushChanges() */
+typedef struct {
+    const char          *name;
+    int                 token;          /* Publishes 'seq' through notify_set_state() */
+    bool                registered;     /* 'token' is valid */
+    uint64_t            seq;            /* Changes so far */
+    uint64_t            postedSeq;      /* 'seq' at the most recent post */
+    uint64_t            lastPost;       /* getMonotonicTimeNS() at the most recent post */
+    dispatch_source_t   timer;          /* Posts changes held back by the window */
+    bool                timerArmed;
+} changeNotifier_t;
+
+static changeNotifier_t             gAnyChangeNotifier = { kIOPMAssertionsAnyChangedNotifyString };
+static changeNotifier_t             gLevelChangeNotifier = { kIOPMAssertionsChangedNotifyString };
+static uint32_t                     gNotifyWindowMS = kDefaultNotifyWindowMS;
+
+/* Per process limits, see chargeProcessCall() */
+static uint32_t                     gProcessAssertionLimit = kMaxTaskAssertions;
+static uint32_t                     gProcessCallRate = kDefaultProcessCallRate;
+static uint32_t                     gProcessCallBurst = kDefaultProcessCallBurst;
+static uint32_t                     gQuotaRejectCnt = 0;
+static uint32_t                     gRateRejectCnt = 0;
+
+/* Largest properties, in propertyBytes(), an assertion may carry. 0 for no limit */
+static uint32_t                     gPropertyLimit = kDefaultPropertyLimit;
+
+/* Ring of the most recent assertion events. Event number 'n' lives at
+ * gEventRing[n % kAssertionEventRingSize]; gEventHead is the number the next
+ * event gets. Numbering starts at 1, so a cursor of 0 means "oldest".
+ */
+static IOPMAssertionEventRecord     *gEventRing = NULL;
+static uint64_t                     gEventHead = 1;
+static char                         gEventTypeNames[kIOPMNumAssertionTypes][sizeof(((IOPMAssertionEventRecord *)0)->type)];
+
+/* pointerTable_t of processInfo_t, keyed by pid */
+static uint32_t                     processInfoKey(const void *info);
+static pointerTable_t               gProcTable = POINTER_TABLE_INITIALIZER(processInfoKey);
+/* Assertion type accepted for each type name, or -1. Set by configAssertionType() */
+static int8_t                       gTypeTokenIndex[kPMWireTypeTokenCount];
+static CFStringRef                  gTypeTokenNames[kPMWireTypeTokenCount];
+static bool                         gTypeTokensReady = false;
 uint32_t            gDisplaySleepTimer = 0;      /* Display Sleep timer value in mins */
 
 
-void handleAssertionTimeout(assertionType_t *assertType);
-void resetGlobalTimer(assertionType_t *assertType, uint64_t timer);
 static IOReturn raiseAssertion(assertion_t *assertion);
+static void releaseAssertion(assertion_t *assertion, bool callHandler);
+static void releaseAssertionMemory(assertion_t *assertion);
+static void postAssertionsChanged(void);
+static void postAssertionLevelsChanged(void);
+static void recordAssertionEvent(uint16_t event, assertion_t *assertion);
+static void beginAssertionBatch(void);
+static CFMutableDictionaryRef copyPropertiesFromMessage(vm_offset_t props, mach_msg_type_number_t propsCnt);
+static IOReturn newAssertionsFromMessage(vm_offset_t props, mach_msg_type_number_t propsCnt, bool batch,
+                                         assertion_t **created, uint32_t *outCount);
+static void endAssertionBatch(void);
+static IOReturn chargeProcessCall(processInfo_t *proc, bool create);
 
 dispatch_source_t       logDispatch = NULL;
-static uint32_t         gNextAssertionIdx = 0;
 extern uint32_t         gDebugFlags;
 
 // Maximum delay allowed(in Mins) for turning off the display after the
@@ -207,41 +344,33 @@ kern_return_t _io_pm_assertion_create
     int                 *return_code
 )
 {
-    CFMutableDictionaryRef     newAssertionProperties = NULL;
-    CFDataRef           unfolder = NULL;
+    assertion_t         *assertion = NULL;
+    uint32_t            count = 0;
     pid_t               callerPID = -1;
     uid_t               callerUID = -1;
     gid_t               callerGID = -1;
     
     audit_token_to_au32(token, NULL, NULL, NULL, &callerUID, &callerGID, &callerPID, NULL, NULL);    
-        
-    unfolder = CFDataCreateWithBytesNoCopy(0, (const UInt8 *)props, propsCnt, kCFAllocatorNull);
-    if (unfolder) {
-        newAssertionProperties = (CFMutableDictionaryRef)CFPropertyListCreateWithData(
-                            0, unfolder, kCFPropertyListMutableContainersAndLeaves, NULL, NULL);
-        CFRelease(unfolder);
-    }
-    
-    if (!newAssertionProperties) {
-        *return_code = kIOReturnBadArgument;
+
+    *assertion_id = kIOPMNullAssertionID;
+
+    *return_code = newAssertionsFromMessage(props, propsCnt, false, &assertion, &count);
+    if (kIOReturnSuccess != *return_code) {
         goto exit;
     }
 
     // Check for privileges if the assertion requires it.
-    if (propertiesDictRequiresRoot(newAssertionProperties)
+    if (propertiesDictRequiresRoot(assertion->props)
         && ( !(callerIsRoot(callerUID) || callerIsAdmin(callerUID, callerGID))))
     {
+        discardAssertion(assertion);
         *return_code = kIOReturnNotPrivileged;
         goto exit;
     }
 
-    *return_code = doCreate(callerPID, newAssertionProperties, (IOPMAssertionID *)assertion_id);
+    *return_code = createAssertion(callerPID, assertion, (IOPMAssertionID *)assertion_id);
     
 exit:
-    if (newAssertionProperties) {
-        CFRelease(newAssertionProperties);
-    }
-    
     vm_deallocate(mach_task_self(), props, propsCnt);
     
     return KERN_SUCCESS;
@@ -261,17 +390,11 @@ kern_return_t _io_pm_assertion_set_properties
  ) 
 {
     CFDictionaryRef     setProperties = NULL;
-    CFDataRef           unfolder = NULL;
     pid_t               callerPID = -1;
 
     audit_token_to_au32(token, NULL, NULL, NULL, NULL, NULL, &callerPID, NULL, NULL);
     
-    unfolder = CFDataCreateWithBytesNoCopy(0, (const UInt8 *)props, propsCnt, kCFAllocatorNull);
-    if (unfolder) {
-        setProperties = (CFDictionaryRef)CFPropertyListCreateWithData(0, unfolder, 0, NULL, NULL);
-        CFRelease(unfolder);
-    }
-    
+    setProperties = copyPropertiesFromMessage(props, propsCnt);
     if (!setProperties) {
         *return_code = kIOReturnBadArgument;
         goto exit;
@@ -311,7 +434,123 @@ kern_return_t _io_pm_assertion_retain_release
     return KERN_SUCCESS;
 }
 
-/*****************************************************************************/
+/*
+ * Creates every assertion described in a serialized CFArray of property
+ * dictionaries, or none of them. Handlers and the AnyChanged notification
+ * run once for the whole batch.
+ */
+kern_return_t _io_pm_assertion_create_batch
+(
+    mach_port_t         server __unused,
+    audit_token_t       token,
+    vm_offset_t         props,
+    mach_msg_type_number_t  propsCnt,
+    int                 *assertion_ids,
+    mach_msg_type_number_t  *assertion_idsCnt,
+    int                 *return_code
+)
+{
+    assertion_t             *created[kIOPMAssertionBatchMax];
+    uint32_t                count = 0;
+    uint32_t                i;
+    processInfo_t           *proc = NULL;
+    uint64_t                callsFullAt = 0;
+    pid_t                   callerPID = -1;
+    uid_t                   callerUID = -1;
+    gid_t                   callerGID = -1;
+
+    audit_token_to_au32(token, NULL, NULL, NULL, &callerUID, &callerGID, &callerPID, NULL, NULL);    
+
+    *assertion_idsCnt = 0;
+
+    // Decode and validate every description before creating any of them
+    *return_code = newAssertionsFromMessage(props, propsCnt, true, created, &count);
+    if (kIOReturnSuccess != *return_code) {
+        goto exit;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (propertiesDictRequiresRoot(created[i]->props)
+            && ( !(callerIsRoot(callerUID) || callerIsAdmin(callerUID, callerGID))))
+        {
+            *return_code = kIOReturnNotPrivileged;
+            break;
+        }
+    }
+
+    // Admit all of them before raising any, so that a failure leaves
+    // nothing behind. The rate tokens taken are handed back too.
+    if ((proc = processInfoGet(callerPID)))
+        callsFullAt = proc->callsFullAt;
+
+    for (i = 0; (i < count) && (kIOReturnSuccess == *return_code); i++) {
+        *return_code = admitAssertion(callerPID, created[i]);
+    }
+
+    if (kIOReturnSuccess != *return_code) {
+        for (i = 0; i < count; i++)
+            discardAssertion(created[i]);
+        if (proc)
+            proc->callsFullAt = callsFullAt;
+        goto exit;
+    }
+
+    // Only a type that failed to resolve stops a raise, and that was checked when decoding
+    beginAssertionBatch();
+    for (i = 0; i < count; i++) {
+        commitAssertion(created[i], (IOPMAssertionID *)&assertion_ids[i]);
+    }
+    endAssertionBatch();
+
+    *assertion_idsCnt = (mach_msg_type_number_t)count;
+
+exit:
+    vm_deallocate(mach_task_self(), props, propsCnt);
+
+    return KERN_SUCCESS;
+}
+
+/*
+ * Releases a list of assertions. A release can't be undone, so every ID is
+ * released even if an earlier one fails; the first failure is returned.
+ */
+kern_return_t _io_pm_assertion_release_batch
+(
+    mach_port_t         server __unused,
+    audit_token_t       token,
+    int                 *assertion_ids,
+    mach_msg_type_number_t  assertion_idsCnt,
+    int                 *return_code
+)
+{
+    pid_t                   callerPID = -1;
+    IOReturn                ret;
+    mach_msg_type_number_t  i;
+
+    audit_token_to_au32(token, NULL, NULL, NULL, NULL, NULL, &callerPID, NULL, NULL);
+
+    if ((assertion_idsCnt == 0) || (assertion_idsCnt > kIOPMAssertionBatchMax)) {
+        *return_code = kIOReturnBadArgument;
+        return KERN_SUCCESS;
+    }
+
+    *return_code = kIOReturnSuccess;
+
+    beginAssertionBatch();
+    for (i = 0; i < assertion_idsCnt; i++) {
+        ret = doRelease(callerPID, assertion_ids[i]);
+        if ((kIOReturnSuccess != ret) && (kIOReturnSuccess == *return_code))
+            *return_code = ret;
+    }
+    endAssertionBatch();
+
+    return KERN_SUCCESS;
+}
+
+/*****************************************************************************
+ * Served on a reader thread, not the main queue. Anything other than a
+ * published snapshot has to be fetched on the main queue.
+ */
 kern_return_t _io_pm_assertion_copy_details
 (
     mach_port_t         server,
@@ -323,8 +562,8 @@ kern_return_t _io_pm_assertion_copy_details
     int                 *return_val
 ) 
 {
-    CFTypeRef           theCollection = NULL;
-    CFDataRef           serializedDetails = NULL;
+    __block CFDataRef   serializedDetails = NULL;
+    __block bool        found = false;
     pid_t               callerPID = -1;
     
 
@@ -332,46 +571,54 @@ kern_return_t _io_pm_assertion_copy_details
     
     if (kIOPMAssertionMIGCopyAll == whichData)
     {
-        theCollection = copyPIDAssertionDictionaryFlattened();
+        serializedDetails = copyPublishedData(kPublishedAssertions);
         
-    } else if (kIOPMAssertionMIGCopyOneAssertionProperties == whichData) 
-    {
-        audit_token_to_au32(token, NULL, NULL, NULL, NULL, NULL, &callerPID, NULL, NULL);
-
-        *return_val = copyAssertionForID(callerPID, assertion_id,  
-                                         (CFMutableDictionaryRef *)&theCollection);
-
     } else if (kIOPMAssertionMIGCopyStatus == whichData)
     {
-        theCollection = copyAggregateValuesDictionary();
+        serializedDetails = copyPublishedData(kPublishedStatus);
     
     } else if (kIOPMAssertionMIGCopyTimedOutAssertions == whichData) 
     {
-        theCollection = copyTimedOutAssertionsArray();
+        serializedDetails = copyPublishedData(kPublishedTimedOut);
     
-    }
-    else if (kIOPMPowerEventsMIGCopyScheduledEvents == whichData)
-    {
-        theCollection = copyScheduledPowerEvents();
-    }
-    else if (kIOPMPowerEventsMIGCopyRepeatEvents == whichData)
+    } else
     {
-        theCollection = copyRepeatPowerEvents();
+        audit_token_to_au32(token, NULL, NULL, NULL, NULL, NULL, &callerPID, NULL, NULL);
+
+        // Both the state and the collections copied from it belong to the main queue
+        performOnMainQueue(^{
+            CFTypeRef   theCollection = NULL;
+
+            if (kIOPMAssertionMIGCopyOneAssertionProperties == whichData) 
+            {
+                copyAssertionForID(callerPID, assertion_id,  
+                                   (CFMutableDictionaryRef *)&theCollection);
+            }
+            else if (kIOPMPowerEventsMIGCopyScheduledEvents == whichData)
+            {
+                theCollection = copyScheduledPowerEvents();
+            }
+            else if (kIOPMPowerEventsMIGCopyRepeatEvents == whichData)
+            {
+                theCollection = copyRepeatPowerEvents();
+            }
+
+            if (theCollection) {
+                found = true;
+                serializedDetails = CFPropertyListCreateData(0, theCollection, 
+                                                             kCFPropertyListBinaryFormat_v1_0, 0, NULL);            
+                CFRelease(theCollection);        
+            }
+        });
     }
         
-    if (!theCollection) {
+    if (!found && !serializedDetails) {
         *assertionsCnt = 0;
         *assertions = 0;
         *return_val = kIOReturnSuccess;
         return KERN_SUCCESS;
     }
     
-        
-    serializedDetails = CFPropertyListCreateData(0, theCollection, 
-                                                 kCFPropertyListBinaryFormat_v1_0, 0, NULL);            
-
-    CFRelease(theCollection);        
-        
     if (serializedDetails) 
     {
         *assertionsCnt = CFDataGetLength(serializedDetails);
@@ -390,6 +637,228 @@ kern_return_t _io_pm_assertion_copy_details
     return KERN_SUCCESS;
 }
 
+#pragma mark -
+#pragma mark Wire format
+
+static bool setWireString(
+    CFMutableDictionaryRef  props,
+    CFStringRef             key,
+    const pmWireString_t    *str)
+{
+    CFStringRef     val;
+
+    val = CFStringCreateWithBytes(0, (const UInt8 *)str->ptr, str->len, kCFStringEncodingUTF8, false);
+    if (!val)
+        return false;
+
+    CFDictionarySetValue(props, key, val);
+    CFRelease(val);
+    return true;
+}
+
+/*
+ * Builds an assertion properties dictionary from one wire record, for the
+ * requests that change an existing assertion's properties. Tagged fields
+ * are converted directly; any other keys arrive as one binary plist
+ * dictionary, which becomes the starting point. A new assertion is
+ * decoded by newAssertionFromWire() instead, with no dictionary in between.
+ */
+static CFMutableDictionaryRef createPropertiesFromWire(const pmWireAssertion_t *wire)
+{
+    CFMutableDictionaryRef  props = NULL;
+    CFDictionaryRef         others = NULL;
+    CFDataRef               unfolder = NULL;
+    CFNumberRef             num = NULL;
+    int                     level;
+    CFTimeInterval          timeout;
+
+    if (PMWIRE_HAS(wire, kPMWireTagPlist)) {
+        unfolder = CFDataCreateWithBytesNoCopy(0, wire->plist, wire->plistLen, kCFAllocatorNull);
+        if (unfolder) {
+            others = (CFDictionaryRef)CFPropertyListCreateWithData(
+                                0, unfolder, kCFPropertyListImmutable, NULL, NULL);
+            CFRelease(unfolder);
+        }
+        if (isA_CFDictionary(others)) {
+            props = CFDictionaryCreateMutableCopy(0, 0, others);
+        }
+        if (others) {
+            CFRelease(others);
+        }
+    }
+    else {
+        props = CFDictionaryCreateMutable(0, 0, 
+                    &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    }
+
+    if (!props)
+        return NULL;
+
+    // A known type token stands in for the type name
+    if (PMWIRE_HAS(wire, kPMWireTagTypeToken) && (wire->typeToken < kPMWireTypeTokenCount)
+            && gTypeTokenNames[wire->typeToken]) {
+        CFDictionarySetValue(props, kIOPMAssertionTypeKey, gTypeTokenNames[wire->typeToken]);
+    }
+    else if (PMWIRE_HAS(wire, kPMWireTagType) 
+                && !setWireString(props, kIOPMAssertionTypeKey, &wire->type)) {
+        CFRelease(props);
+        return NULL;
+    }
+
+    if ( (PMWIRE_HAS(wire, kPMWireTagName) 
+                && !setWireString(props, kIOPMAssertionNameKey, &wire->name))
+        || (PMWIRE_HAS(wire, kPMWireTagDetails) 
+                && !setWireString(props, kIOPMAssertionDetailsKey, &wire->details))
+        || (PMWIRE_HAS(wire, kPMWireTagHumanReadableReason) 
+                && !setWireString(props, kIOPMAssertionHumanReadableReasonKey, &wire->humanReadableReason))
+        || (PMWIRE_HAS(wire, kPMWireTagLocalizationBundlePath) 
+                && !setWireString(props, kIOPMAssertionLocalizationBundlePathKey, &wire->localizationBundlePath))
+        || (PMWIRE_HAS(wire, kPMWireTagTimeoutAction) 
+                && !setWireString(props, kIOPMAssertionTimeoutActionKey, &wire->timeoutAction)) )
+    {
+        CFRelease(props);
+        return NULL;
+    }
+
+    if (PMWIRE_HAS(wire, kPMWireTagLevel)) {
+        level = wire->level;
+        num = CFNumberCreate(0, kCFNumberIntType, &level);
+        if (num) {
+            CFDictionarySetValue(props, kIOPMAssertionLevelKey, num);
+            CFRelease(num);
+        }
+    }
+
+    if (PMWIRE_HAS(wire, kPMWireTagTimeout)) {
+        timeout = wire->timeout;
+        num = CFNumberCreate(0, kCFNumberDoubleType, &timeout);
+        if (num) {
+            CFDictionarySetValue(props, kIOPMAssertionTimeoutKey, num);
+            CFRelease(num);
+        }
+    }
+
+    return props;
+}
+
+/*
+ * Returns the properties dictionary carried by an assertion MIG request,
+ * either wire encoded or as a serialized CF property list.
+ */
+static CFMutableDictionaryRef copyPropertiesFromMessage(
+    vm_offset_t             props,
+    mach_msg_type_number_t  propsCnt)
+{
+    CFMutableDictionaryRef  properties = NULL;
+    CFDataRef               unfolder = NULL;
+    pmWireReader_t          reader;
+    pmWireAssertion_t       wire;
+    uint32_t                count = 0;
+
+    if (PMWireIsEncoded((const void *)props, propsCnt)) {
+        if (!PMWireDecodeBegin(&reader, (const void *)props, propsCnt, &count)
+            || (count != 1) || !PMWireDecodeNext(&reader, &wire))
+        {
+            return NULL;
+        }
+        return createPropertiesFromWire(&wire);
+    }
+
+    unfolder = CFDataCreateWithBytesNoCopy(0, (const UInt8 *)props, propsCnt, kCFAllocatorNull);
+    if (unfolder) {
+        properties = (CFMutableDictionaryRef)CFPropertyListCreateWithData(
+                            0, unfolder, kCFPropertyListMutableContainersAndLeaves, NULL, NULL);
+        CFRelease(unfolder);
+    }
+
+    if (properties && !isA_CFDictionary(properties)) {
+        CFRelease(properties);
+        properties = NULL;
+    }
+
+    return properties;
+}
+
+/*
+ * Decodes the assertions carried by a create request into new assertions,
+ * see newAssertion(). A wire encoded request carries one record, or up to
+ * kIOPMAssertionBatchMax for a batch. A serialized CF property list is a
+ * dictionary, or for a batch an array of them. On failure none are left.
+ */
+static IOReturn newAssertionsFromMessage(
+    vm_offset_t             props,
+    mach_msg_type_number_t  propsCnt,
+    bool                    batch,
+    assertion_t             **created,
+    uint32_t                *outCount)
+{
+    CFPropertyListRef       plist = NULL;
+    CFDataRef               unfolder = NULL;
+    CFTypeRef               description;
+    pmWireReader_t          reader;
+    pmWireAssertion_t       wire;
+    uint32_t                max = batch ? kIOPMAssertionBatchMax : 1;
+    uint32_t                count = 0;
+    uint32_t                i = 0;
+    IOReturn                ret = kIOReturnBadArgument;
+
+    *outCount = 0;
+
+    if (PMWireIsEncoded((const void *)props, propsCnt)) {
+        if (!PMWireDecodeBegin(&reader, (const void *)props, propsCnt, &count)
+            || (count == 0) || (count > max))
+        {
+            return kIOReturnBadArgument;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (!PMWireDecodeNext(&reader, &wire)) {
+                ret = kIOReturnBadArgument;
+                break;
+            }
+            if ((ret = newAssertionFromWire(&wire, &created[i])) != kIOReturnSuccess)
+                break;
+        }
+    }
+    else {
+        unfolder = CFDataCreateWithBytesNoCopy(0, (const UInt8 *)props, propsCnt, kCFAllocatorNull);
+        if (unfolder) {
+            plist = CFPropertyListCreateWithData(0, unfolder, kCFPropertyListMutableContainersAndLeaves, NULL, NULL);
+            CFRelease(unfolder);
+        }
+
+        if (batch && isA_CFArray(plist))
+            count = (uint32_t)CFArrayGetCount(plist);
+        else if (!batch && isA_CFDictionary(plist))
+            count = 1;
+
+        if ((count == 0) || (count > max)) {
+            if (plist) CFRelease(plist);
+            return kIOReturnBadArgument;
+        }
+
+        for (i = 0; i < count; i++) {
+            description = batch ? CFArrayGetValueAtIndex(plist, i) : plist;
+            if (!isA_CFDictionary(description)) {
+                ret = kIOReturnBadArgument;
+                break;
+            }
+            if ((ret = newAssertion((CFMutableDictionaryRef)description, &created[i])) != kIOReturnSuccess)
+                break;
+        }
+        CFRelease(plist);
+    }
+
+    if (i < count) {
+        while (i-- > 0)
+            discardAssertion(created[i]);
+        return ret;
+    }
+
+    *outCount = count;
+    return kIOReturnSuccess;
+}
+
 // Changes clamshell sleep state
 // 1 - disabled, 0 - enabled
 static void setClamshellSleepState(int clamshellSleepState)
@@ -451,7 +920,7 @@ exit:
     return;
 
 }
-static void sendUserAssertionsToKernel(uint32_t user_assertions)
+__private_extern__ void sendUserAssertionsToKernel(uint32_t user_assertions)
 {
     io_service_t                rootDomainService = IO_OBJECT_NULL;
     io_connect_t                gRootDomainConnect = IO_OBJECT_NULL;
@@ -504,7 +973,7 @@ __private_extern__ void PMAssertions_SettingsHaveChanged(void)
 }
 
 #if HAVE_SMART_BATTERY
-static void
+__private_extern__ void
 sendSmartBatteryCommand(uint32_t which, uint32_t level)
 {
     io_service_t    sbmanager = MACH_PORT_NULL;
@@ -553,7 +1022,7 @@ bail:
 }
 #else /* HAVE_SMART_BATTERY */
 
-static void
+__private_extern__ void
 sendSmartBatteryCommand(uint32_t which, uint32_t level)
 {
     kern_return_t       kr;
@@ -704,104 +1173,215 @@ void createOnBootAssertions( )
 
 static CFDictionaryRef copyAggregateValuesDictionary(void)
 {
-    CFDictionaryRef                 assertions_info = NULL;
+    static CFNumberRef              levels[2] = { NULL, NULL };
     CFNumberRef                     cf_agg_vals[kIOPMNumAssertionTypes];
+    uint32_t                        bits = getAggregateAssertions(NULL);
     int                             i;
-    
-    // Massage int values into CFNumbers for CFDictionaryCreate
+
+    if (!levels[0]) {
+        int zero = 0, one = 1;
+
+        levels[0] = CFNumberCreate(0, kCFNumberIntType, &zero);
+        levels[1] = CFNumberCreate(0, kCFNumberIntType, &one);
+    }
+
     for (i=0; i<kIOPMNumAssertionTypes; i++)
     {
-        int tmp_bit = LEVEL_FOR_BIT(i);
-
-        cf_agg_vals[i] = CFNumberCreate(0, kCFNumberIntType, &tmp_bit);
+        cf_agg_vals[i] = levels[(bits >> i) & 1];
     }
 
-    // We return the contents of aggregate_assertions packed into a CFDictionary.
-    assertions_info = CFDictionaryCreate(
+    // TODO: strip unsupported assertions?
+
+    // We return the aggregate assertion levels packed into a CFDictionary.
+    return CFDictionaryCreate(
         0,
         (const void **)assertion_types_arr,     // type: CFStringRef
         (const void **)cf_agg_vals,   // value: CFNumberRef
         kIOPMNumAssertionTypes,
         &kCFTypeDictionaryKeyCallBacks,
         &kCFTypeDictionaryValueCallBacks);
-        
-    // Release CFNumbers
-    for (i=0; i<kIOPMNumAssertionTypes; i++)
-    {
-        CFRelease(cf_agg_vals[i]);
-    }
-
-    // TODO: strip unsupported assertions?
-
-    return assertions_info;
 }
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
-static CFArrayRef copyTimedOutAssertionsArray(void)
+static void setDictValue(CFMutableDictionaryRef dict, CFStringRef key, CFTypeRef val)
 {
-    /* Strip out non-serializable private portions of the timed-out assertions */
+    if (val) CFDictionarySetValue(dict, key, val);
+}
 
-    if (gTimedOutArray)
-    {    
-        int                     arrayCount;
-        int                     i;
-        CFMutableArrayRef       newTimeOutArray;
-        newTimeOutArray = CFArrayCreateMutableCopy(0, 0, gTimedOutArray);
-        
-        arrayCount = CFArrayGetCount(newTimeOutArray);
-        for (i = 0; i<arrayCount; i++)
-        {
-            CFMutableDictionaryRef  assertionCopy = 
-                    CFDictionaryCreateMutableCopy(0, 0, CFArrayGetValueAtIndex(newTimeOutArray, i));
-    
-            CFDictionaryRemoveValue(assertionCopy, kIOPMAssertionTimerRefKey);
-    
-            CFArraySetValueAtIndex(newTimeOutArray, i, assertionCopy);
-            
-            CFRelease(assertionCopy);
-        }
+static void setDictNumber(CFMutableDictionaryRef dict, CFStringRef key, CFNumberType type, const void *val)
+{
+    CFNumberRef num = CFNumberCreate(0, type, val);
 
-        return newTimeOutArray;
+    if (num) {
+        CFDictionarySetValue(dict, key, num);
+        CFRelease(num);
     }
-    return NULL;
 }
 
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-
-static void appendTimedOutAssertion(CFDictionaryRef timedout)
+static void setDictDate(CFMutableDictionaryRef dict, CFStringRef key, CFAbsoluteTime t)
 {
-    int timedoutcount = 0;
+    CFDateRef date;
 
-    if (!gTimedOutArray) {
-        gTimedOutArray = CFArrayCreateMutable(0, kMaxCountTimedOut, &kCFTypeArrayCallBacks);    
+    if (!t) return;
+    if ((date = CFDateCreate(0, t))) {
+        CFDictionarySetValue(dict, key, date);
+        CFRelease(date);
     }
+}
 
-    if (!gTimedOutArray) 
-        return;
+static CFDictionaryRef createTimedOutDictionary(const timedOutRecord_t *rec)
+{
+    CFMutableDictionaryRef  dict;
 
-    timedoutcount = CFArrayGetCount(gTimedOutArray);
-    if (kMaxCountTimedOut == timedoutcount) {
-        // Ensure that we store no more than the kMaxCountTimedOut latest timeouts
-        // If we're over our tracking quota, pull the last entry off the end.
-        CFArrayRemoveValueAtIndex(gTimedOutArray, kMaxCountTimedOut - 1);
-    }
+    dict = CFDictionaryCreateMutable(0, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if (!dict)
+        return NULL;
 
-    // Always add new entries onto the front.
-    // The array starts with newest assertions at index 0.
-    CFArrayInsertValueAtIndex(gTimedOutArray, 0, timedout);
-    
+    setDictValue(dict, kIOPMAssertionTypeKey, assertion_types_arr[rec->kassert]);
+    setDictValue(dict, kIOPMAssertionNameKey, rec->name);
+    setDictValue(dict, kIOPMAssertionDetailsKey, rec->details);
+    setDictValue(dict, kIOPMAssertionHumanReadableReasonKey, rec->humanReadableReason);
+    setDictValue(dict, kIOPMAssertionLocalizationBundlePathKey, rec->bundlePath);
+    setDictValue(dict, kIOPMAssertionProcessNameKey, rec->processName);
+    setDictValue(dict, kIOPMAssertionTimeoutActionKey, rec->timeoutAction);
+    setDictNumber(dict, kIOPMAssertionPIDKey, kCFNumberIntType, &rec->pid);
+    setDictNumber(dict, kIOPMAssertionLevelKey, kCFNumberIntType, &rec->level);
+    setDictNumber(dict, kIOPMAssertionTimeoutKey, kCFNumberDoubleType, &rec->timeout);
+    setDictNumber(dict, kIOPMAssertionGlobalUniqueIDKey, kCFNumberSInt64Type, &rec->uniqueID);
+    setDictDate(dict, kIOPMAssertionCreateDateKey, rec->createTime);
+    setDictDate(dict, kIOPMAssertionTimedOutDateKey, rec->timedOutTime);
+
+    return dict;
 }
 
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-
-__private_extern__ void _PMAssertionsDriverAssertionsHaveChanged(uint32_t changedDriverAssertions)
+static CFArrayRef copyTimedOutAssertionsArray(void)
 {
-    notify_post( kIOPMAssertionsChangedNotifyString );
-}
+    CFMutableArrayRef   timedOut;
+    CFDictionaryRef     dict;
+    uint64_t            n, held;
 
-/*
-static int indexForAssertionName(CFStringRef assertionName) 
+    if (!gTimedOutCnt)
+        return NULL;
+
+    held = (gTimedOutCnt < gTimedOutCapacity) ? gTimedOutCnt : gTimedOutCapacity;
+    timedOut = CFArrayCreateMutable(0, (CFIndex)held, &kCFTypeArrayCallBacks);
+    if (!timedOut)
+        return NULL;
+
+    // The array starts with newest assertions at index 0.
+    for (n = gTimedOutCnt; n > gTimedOutCnt - held; n--)
+    {
+        if ((dict = createTimedOutDictionary(&gTimedOutRing[(n - 1) % gTimedOutCapacity]))) {
+            CFArrayAppendValue(timedOut, dict);
+            CFRelease(dict);
+        }
+    }
+
+    return timedOut;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void releaseTimedOutRecord(timedOutRecord_t *rec)
+{
+    if (rec->name) CFRelease(rec->name);
+    if (rec->details) CFRelease(rec->details);
+    if (rec->humanReadableReason) CFRelease(rec->humanReadableReason);
+    if (rec->bundlePath) CFRelease(rec->bundlePath);
+    if (rec->processName) CFRelease(rec->processName);
+    if (rec->timeoutAction) CFRelease(rec->timeoutAction);
+    memset(rec, 0, sizeof(*rec));
+}
+
+static CFStringRef retainString(CFDictionaryRef props, CFStringRef key)
+{
+    CFStringRef str = isA_CFString(CFDictionaryGetValue(props, key));
+
+    if (str) CFRetain(str);
+    return str;
+}
+
+static void appendTimedOutAssertion(assertion_t *assertion)
+{
+    timedOutRecord_t    *rec;
+    CFDictionaryRef     props = assertion->props;
+
+    if (!gTimedOutRing) {
+        gTimedOutRing = calloc(gTimedOutCapacity, sizeof(timedOutRecord_t));
+        if (!gTimedOutRing)
+            return;
+    }
+
+    // Overwrites the oldest record once the ring is full
+    rec = &gTimedOutRing[gTimedOutCnt++ % gTimedOutCapacity];
+    BUMP_GENERATION(gTimedOutGeneration);
+    releaseTimedOutRecord(rec);
+
+    rec->name = retainString(props, kIOPMAssertionNameKey);
+    rec->details = retainString(props, kIOPMAssertionDetailsKey);
+    rec->humanReadableReason = retainString(props, kIOPMAssertionHumanReadableReasonKey);
+    rec->bundlePath = retainString(props, kIOPMAssertionLocalizationBundlePathKey);
+    rec->timeoutAction = retainString(props, kIOPMAssertionTimeoutActionKey);
+    if ((rec->processName = processInfoGetName(assertion->pid)))
+        CFRetain(rec->processName);
+
+    rec->createTime = assertion->createDate;
+    rec->timedOutTime = assertion->timedOutDate;
+    rec->timeout = assertion->timeoutSecs;
+    rec->uniqueID = ASSERTION_UNIQUE_ID(assertion);
+    rec->level = assertion->level;
+    rec->pid = assertion->pid;
+    rec->kassert = assertion->kassert;
+}
+
+/*
+ * Changes the number of timeouts kept, keeping the most recent ones that
+ * still fit.
+ */
+static void setTimedOutHistoryCapacity(uint32_t capacity)
+{
+    timedOutRecord_t    *ring = NULL;
+    uint64_t            held, n;
+    uint32_t            i;
+
+    if (capacity == gTimedOutCapacity)
+        return;
+
+    if (gTimedOutRing) {
+        ring = calloc(capacity, sizeof(timedOutRecord_t));
+        if (!ring)
+            return;
+
+        held = (gTimedOutCnt < gTimedOutCapacity) ? gTimedOutCnt : gTimedOutCapacity;
+        for (n = gTimedOutCnt - held; n < gTimedOutCnt; n++)
+        {
+            timedOutRecord_t *rec = &gTimedOutRing[n % gTimedOutCapacity];
+
+            if (n + capacity >= gTimedOutCnt) {
+                ring[n % capacity] = *rec;              // Moves the references
+                memset(rec, 0, sizeof(*rec));
+            }
+        }
+        for (i = 0; i < gTimedOutCapacity; i++)
+            releaseTimedOutRecord(&gTimedOutRing[i]);
+        free(gTimedOutRing);
+    }
+
+    gTimedOutRing = ring;
+    gTimedOutCapacity = capacity;
+    BUMP_GENERATION(gTimedOutGeneration);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+__private_extern__ void _PMAssertionsDriverAssertionsHaveChanged(uint32_t changedDriverAssertions)
+{
+    postAssertionLevelsChanged();
+}
+
+/*
+static int indexForAssertionName(CFStringRef assertionName) 
 {
     if (CFEqual(assertionName, kIOPMAssertionTypeNeedsCPU))
        return kHighPerfIndex;
@@ -847,6 +1427,184 @@ __private_extern__ void logASLAssertionTypeSummary( kerAssertionType type)
              });
 }
 
+/*
+ * Assertion log records
+ *
+ * Formatting and sending an ASL message costs far more than the assertion
+ * operation being logged, so the main queue doesn't do it. It copies what the
+ * message needs into a fixed size record in gLogRing and wakes the log
+ * writer thread, which formats and sends every record queued since it last
+ * ran. The ring has a single producer, the main queue, and a single consumer,
+ * the writer; gLogHead is only written by the former and gLogTail by the
+ * latter, so neither side takes a lock. When the writer falls a full ring
+ * behind, records are dropped and counted, and the writer logs the count
+ * once it catches up.
+ */
+typedef struct {
+    const char      *action;            // kPMASLAssertionAction*, a string constant
+    pid_t           pid;                // 0 for an aggregate summary
+    uint32_t        retainCnt;
+    int32_t         age;                // Seconds since the assertion was created, -1 if unknown
+    uint32_t        aggregate;          // Value printed as "Aggregate:0x%x"
+    uint64_t        uniqueID;
+    bool            onBattery;          // Aggregate summary only
+    char            procName[kProcNameBufLen];
+    char            type[64];
+    char            name[128];
+} assertionLogRecord_t;
+
+static assertionLogRecord_t     *gLogRing       = NULL;
+static volatile uint32_t        gLogHead        = 0;    // Next record filled by the main queue
+static volatile uint32_t        gLogTail        = 0;    // Next record sent by the writer
+static volatile uint32_t        gLogDropped     = 0;    // Records dropped because the ring was full
+static dispatch_semaphore_t     gLogSignal      = NULL;
+
+#define LOG_AGGREGATE()     (((kerAssertionBits & 0xfff) << 16) | (aggregate_assertions & 0xffff))
+
+static void sendLogMessage(const char *action, const char *pid, const char *type,
+                           const char *retainCnt, const char *message)
+{
+    aslmsg      m = asl_new(ASL_TYPE_MSG);
+
+    asl_set(m, kMsgTracerDomainKey, kMsgTracerDomainPMAssertions);
+    if (pid)
+        asl_set(m, kPMASLPIDKey, pid);
+    asl_set(m, kPMASLActionKey, action);
+    if (type)
+        asl_set(m, kPMASLAssertionNameKey, type);
+    if (retainCnt)
+        asl_set(m, "RetainCount", retainCnt);
+
+    asl_set(m, ASL_KEY_MSG, message);
+    asl_set(m, ASL_KEY_LEVEL, ASL_STRING_NOTICE);
+
+    /* Facility = "internal"
+     * is required to make sure this message goes into ASL database, but not
+     * into system.log
+     */
+    asl_set(m, ASL_KEY_FACILITY, "internal");
+
+    asl_set(m, kPMASLMessageKey, kPMASLMessageLogValue);
+
+    asl_send(NULL, m);
+
+    asl_free(m);
+}
+
+static void sendLogRecord(const assertionLogRecord_t *rec)
+{
+    const int       kLongStringLen          = 400;
+    const int       kShortStringLen         = 12;
+    char            pid_buf[kShortStringLen];
+    char            retainCountBuf[kShortStringLen];
+    char            ageString[kShortStringLen];
+    char            aslMessageString[kLongStringLen];
+
+    if (rec->pid == 0) {
+        snprintf(aslMessageString, sizeof(aslMessageString), "Summary- Aggregate:0x%x Using %s",
+                 rec->aggregate, rec->onBattery ? "Batt" : "AC");
+        sendLogMessage(rec->action, NULL, NULL, NULL, aslMessageString);
+        return;
+    }
+
+    snprintf(pid_buf, sizeof(pid_buf), "%d", rec->pid);
+    if (rec->retainCnt != 1)
+        snprintf(retainCountBuf, sizeof(retainCountBuf), "%u", rec->retainCnt);
+    if (rec->age >= 0)
+        snprintf(ageString, sizeof(ageString), "%02d:%02d:%02d ",
+                 rec->age / 3600, (rec->age / 60) % 60, rec->age % 60);
+
+    snprintf(aslMessageString, sizeof(aslMessageString), "PID %s(%s) %s %s %s%s%s %s id:0x%llx Aggregate:0x%x",
+                pid_buf,
+                rec->procName[0] ? rec->procName : "?",
+                rec->action,
+                rec->type,
+                rec->name[0] ? "\"" : "", rec->name, rec->name[0] ? "\"" : "",
+                (rec->age >= 0) ? ageString : "",
+                rec->uniqueID,
+                rec->aggregate);
+
+    sendLogMessage(rec->action, pid_buf, rec->type[0] ? rec->type : NULL,
+                   (rec->retainCnt != 1) ? retainCountBuf : NULL, aslMessageString);
+}
+
+static void *assertionLogWriter(void *arg __unused)
+{
+    uint32_t    head;
+    uint32_t    reported = 0;
+    uint32_t    dropped;
+    char        message[64];
+
+    for (;;) {
+        dispatch_semaphore_wait(gLogSignal, DISPATCH_TIME_FOREVER);
+
+        // Send everything queued so far in one pass. Later signals for
+        // records sent here find the ring empty.
+        head = gLogHead;
+        OSMemoryBarrier();      // Read the records only after reading the head
+        while (gLogTail != head) {
+            sendLogRecord(&gLogRing[gLogTail & (kAssertionLogRingSize - 1)]);
+            OSMemoryBarrier();  // Done with the record before handing its slot back
+            gLogTail++;
+        }
+
+        if ((dropped = gLogDropped) != reported) {
+            snprintf(message, sizeof(message), "Summary- %u assertion log messages dropped",
+                     dropped - reported);
+            sendLogMessage(kPMASLAssertionActionSummary, NULL, NULL, NULL, message);
+            reported = dropped;
+        }
+    }
+    return NULL;
+}
+
+static void startAssertionLogWriter(void)
+{
+    pthread_attr_t      attr;
+    pthread_t           writer;
+
+    gLogRing = calloc(kAssertionLogRingSize, sizeof(assertionLogRecord_t));
+    gLogSignal = dispatch_semaphore_create(0);
+    if (!gLogRing || !gLogSignal)
+        goto fail;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&writer, &attr, assertionLogWriter, NULL) == 0) {
+        pthread_attr_destroy(&attr);
+        return;
+    }
+    pthread_attr_destroy(&attr);
+
+fail:
+    // Without a writer, nothing gets logged
+    if (gLogSignal)
+        dispatch_release(gLogSignal);
+    free(gLogRing);
+    gLogSignal = NULL;
+    gLogRing = NULL;
+}
+
+/* Returns the next free record, or NULL if the ring is full */
+static assertionLogRecord_t *beginLogRecord(void)
+{
+    if (!gLogRing)
+        return NULL;
+
+    if (gLogHead - gLogTail >= kAssertionLogRingSize) {
+        gLogDropped++;
+        return NULL;
+    }
+    return &gLogRing[gLogHead & (kAssertionLogRingSize - 1)];
+}
+
+static void commitLogRecord(void)
+{
+    OSMemoryBarrier();          // Fill in the record before publishing it
+    gLogHead++;
+    dispatch_semaphore_signal(gLogSignal);
+}
+
 /* logASLAssertionEvent
  *
  * Logs a message describing an assertion event that just occured.
@@ -858,151 +1616,70 @@ static void logASLAssertionEvent(
     const char      *assertionAction,
     assertion_t     *assertion)
 {
-    const int       kLongStringLen          = 200;
-    const int       kShortStringLen         = 10;
-    aslmsg          m;
-    CFStringRef     foundAssertionType      = NULL;
-    CFStringRef     foundAssertionName      = NULL;
-    CFDateRef       foundDate               = NULL;
-    CFStringRef     procName                = NULL;
-    char            proc_name_buf[kProcNameBufLen];
-    char            pid_buf[kShortStringLen];
-    char            assertionTypeCString[kLongStringLen];
-    char            assertionNameCString[kLongStringLen];
-    char            ageString[kShortStringLen];
-    char            aslMessageString[kLongStringLen];
-    CFMutableDictionaryRef assertionDictionary;
-    
+    assertionLogRecord_t    *rec;
+    processInfo_t           *procInfo;
+    const char              *typeName;
+    CFStringRef             name;
+    CFIndex                 used = 0;
+
     if ((gDebugFlags & kIOPMDebugEnableAssertionLogging) == 0) 
         return;
 
     if (assertionAction == kPMASLAssertionActionCreate) {
         if (assertion->state & kAssertionStateLogged)
            return;
-        assertion->state |= kAssertionStateLogged;
     }
     else if ( (assertion->state & kAssertionStateLogged) == 0) {
         return;
     }
 
-    m = asl_new(ASL_TYPE_MSG);
-    
-    asl_set(m, kMsgTracerDomainKey, kMsgTracerDomainPMAssertions);
-    pid_buf[0] = 0;
-    
-    if (0 < snprintf(pid_buf, kShortStringLen, "%d", assertion->pid)) {
-        asl_set(m, kPMASLPIDKey, pid_buf);
-    }
-
-    asl_set(m, kPMASLActionKey, assertionAction);
-
-    
-    assertionDictionary = assertion->props;
-    if (assertionDictionary)
-    {
-        /* 
-         * Log the assertion type:
-         */
-        foundAssertionType = CFDictionaryGetValue(assertionDictionary, kIOPMAssertionTypeKey);        
-        if (foundAssertionType) {
-            CFStringGetCString(foundAssertionType, assertionTypeCString, sizeof(assertionTypeCString), kCFStringEncodingUTF8);
-            asl_set(m, kPMASLAssertionNameKey, assertionTypeCString);
-        }
+    // A Create that does not fit in the ring is counted in gLogDropped and
+    // leaves the assertion unlogged, so none of its later events are logged
+    if ((rec = beginLogRecord()) == NULL)
+        return;
 
-        foundAssertionName = CFDictionaryGetValue(assertionDictionary, kIOPMAssertionNameKey);
-        if (foundAssertionName) {
-            CFStringGetCString(foundAssertionName, assertionNameCString, sizeof(assertionNameCString), kCFStringEncodingUTF8);            
-        }
+    if (assertionAction == kPMASLAssertionActionCreate)
+        assertion->state |= kAssertionStateLogged;
 
-        /*
-         * Assertion's age
-         */
-        if ((foundDate = CFDictionaryGetValue(assertionDictionary, kIOPMAssertionCreateDateKey)))
-        {
-            CFAbsoluteTime createdCFTime    = CFDateGetAbsoluteTime(foundDate);
-            int createdSince                = (int)(CFAbsoluteTimeGetCurrent() - createdCFTime);
-            int hours                       = createdSince / 3600;
-            int minutes                     = (createdSince / 60) % 60;
-            int seconds                     = createdSince % 60;
-            snprintf(ageString, sizeof(ageString), "%02d:%02d:%02d ", hours, minutes, seconds);
-        }
+    rec->action     = assertionAction;
+    rec->pid        = assertion->pid;
+    rec->retainCnt  = assertion->retainCnt;
+    rec->age        = assertion->createDate ? (int32_t)(CFAbsoluteTimeGetCurrent() - assertion->createDate) : -1;
+    rec->aggregate  = LOG_AGGREGATE();
+    rec->uniqueID   = ASSERTION_UNIQUE_ID(assertion);
 
-        /*
-         * Retain count
-         */
-        int retainCount = assertion->retainCnt;
-        if (1 != retainCount) 
-        {
-            char    retainCountBuf[kShortStringLen];
-            snprintf(retainCountBuf, sizeof(retainCountBuf), "%d", retainCount);
-            asl_set(m, "RetainCount", retainCountBuf);
-        }
-    }
+    typeName = PMWireTypeNameForToken(assertion->typeToken);
+    strlcpy(rec->type, typeName ? typeName : "", sizeof(rec->type));
 
-    if ((procName = processInfoGetName(assertion->pid)))
-    {
-        CFStringGetCString(procName, proc_name_buf, sizeof(proc_name_buf), kCFStringEncodingUTF8);
+    name = assertion->props ? CFDictionaryGetValue(assertion->props, kIOPMAssertionNameKey) : NULL;
+    if (isA_CFString(name)) {
+        CFStringGetBytes(name, CFRangeMake(0, CFStringGetLength(name)), kCFStringEncodingUTF8, '?',
+                         false, (UInt8 *)rec->name, sizeof(rec->name) - 1, &used);
     }
+    rec->name[used] = 0;
 
-    
-    snprintf(aslMessageString, sizeof(aslMessageString), "PID %s(%s) %s %s %s%s%s %s id:0x%llx Aggregate:0x%x",
-                pid_buf,
-                procName ? proc_name_buf:"?",
-                assertionAction,
-                foundAssertionType ? assertionTypeCString:"",
-                foundAssertionName?"\"":"", foundAssertionName ? assertionNameCString:"", 
-                foundAssertionName?"\"":"",
-                foundDate?ageString:"",
-                (((uint64_t)assertion->kassert) << 32) | (assertion->assertionId),
-                ((kerAssertionBits & 0xfff) << 16) | (aggregate_assertions & 0xffff));
-
-    asl_set(m, ASL_KEY_MSG, aslMessageString);    
-    
-    asl_set(m, ASL_KEY_LEVEL, ASL_STRING_NOTICE);    
-
-    /* Facility = "internal"
-     * is required to make sure this message goes into ASL database, but not
-     * into system.log
-     */
-    asl_set(m, ASL_KEY_FACILITY, "internal");
-
-    asl_set(m, kPMASLMessageKey, kPMASLMessageLogValue);
-
-    asl_send(NULL, m);
+    if ((procInfo = processInfoGet(assertion->pid)))
+        strlcpy(rec->procName, procInfo->name, sizeof(rec->procName));
+    else
+        rec->procName[0] = 0;
 
-    asl_free(m);
+    commitLogRecord();
 }
 
 static void 
 logASLAssertionsAggregate( )
 {
-    aslmsg m;
-    char            aslMessageString[100];
-
-    m = asl_new(ASL_TYPE_MSG);
-    asl_set(m, kMsgTracerDomainKey, kMsgTracerDomainPMAssertions);
-    asl_set(m, kPMASLActionKey, kPMASLAssertionActionSummary);
-
-    snprintf(aslMessageString, sizeof(aslMessageString), "Summary- Aggregate:0x%x Using %s", 
-                ((kerAssertionBits & 0xfff) << 16) | (aggregate_assertions & 0xffff),
-                  ( _getPowerSource() == kBatteryPowered) ? "Batt" : "AC");
+    assertionLogRecord_t    *rec;
 
-    asl_set(m, ASL_KEY_MSG, aslMessageString);    
-    
-    asl_set(m, ASL_KEY_LEVEL, ASL_STRING_NOTICE);    
-
-    /* Facility = "internal"
-     * is required to make sure this message goes into ASL database, but not
-     * into system.log
-     */
-    asl_set(m, ASL_KEY_FACILITY, "internal");
-
-    asl_set(m, kPMASLMessageKey, kPMASLMessageLogValue);
-
-    asl_send(NULL, m);
+    if ((rec = beginLogRecord()) == NULL)
+        return;
 
-    asl_free(m);
+    memset(rec, 0, sizeof(*rec));
+    rec->action     = kPMASLAssertionActionSummary;
+    rec->aggregate  = LOG_AGGREGATE();
+    rec->onBattery  = (_getPowerSource() == kBatteryPowered);
 
+    commitLogRecord();
 }
 
 
@@ -1595,96 +2272,68 @@ static bool propertiesDictRequiresRoot(CFDictionaryRef props)
 }
 
 
-typedef struct {
-    CFStringRef             name;
-    dispatch_source_t       disp_src;
-} ProcessInfoStruct;
+static uint32_t processInfoKey(const void *info)
+{
+    return (uint32_t)((const processInfo_t *)info)->pid;
+}
 
-/* Unwrap a pointer stored in a CFData, so we can place it an a CF container.
- */
-//static void dictionarySetDispatchSource(CFMutableDictionaryRef d, const void *k, dispatch_source_t p)
-static void processInfoCreate(pid_t p, dispatch_source_t d)
+static processInfo_t *processInfoGet(pid_t p)
 {
-    ProcessInfoStruct       proc;
-    CFDataRef               tmpData;
-    char                    name[kProcNameBufLen];
-    
-    proc.disp_src = d;
-    proc_name(p, name, sizeof(name));
-    proc.name = CFStringCreateWithCString(0, name, kCFStringEncodingUTF8);
-    
-    tmpData= CFDataCreate(0, (uint8_t *)(&proc), sizeof(ProcessInfoStruct));
-    if (tmpData) {
-        CFDictionarySetValue(gProcessDict, (const void *)p, tmpData);
-        CFRelease(tmpData);
-    }
+    return pointerTableFind(&gProcTable, (uint32_t)p);
 }
 
-/* Wrap a pointer to a non-CF object inside a CFData, so that 
- * we can place it an a CF container.
- */
+/* Creates the record for 'p' holding one reference, for its first assertion */
+static processInfo_t *processInfoCreate(pid_t p, dispatch_source_t d)
+{
+    processInfo_t   *info;
 
-static bool processInfoRetain(pid_t p)
-{    
-    CFDataRef tmpData = CFDictionaryGetValue(gProcessDict, (const void *)p);
-    
-    if (tmpData) {
-        CFRetain(tmpData);
-        return true;
+    if (!(info = calloc(1, sizeof(processInfo_t))))
+        return NULL;
+
+    info->pid = p;
+    if (!pointerTableInsert(&gProcTable, info)) {
+        free(info);
+        return NULL;
     }
-    
-    return false;
+
+    info->refCnt = 1;
+    info->disp_src = d;
+    LIST_INIT(&info->assertions);
+
+    proc_name(p, info->name, sizeof(info->name));
+    info->nameRef = CFStringCreateWithCString(0, info->name, kCFStringEncodingUTF8);
+
+    return info;
 }
 
 CFStringRef processInfoGetName(pid_t p)
 {
-    CFDataRef           tmpData = CFDictionaryGetValue(gProcessDict, (const void *)p);
-    ProcessInfoStruct   *proc = NULL;
-    CFStringRef         retString = NULL;
-    
-    if (tmpData && (proc = (ProcessInfoStruct *)CFDataGetBytePtr(tmpData))) {
-        retString = proc->name;
-    }
-    
-    return retString;
+    processInfo_t   *info = processInfoGet(p);
+
+    return info ? info->nameRef : NULL;
 }
 
 static void processInfoRelease(pid_t p)
 {
-    ProcessInfoStruct   *proc = NULL;
-    CFIndex cnt;
-    
-    CFDataRef tmpData = CFDictionaryGetValue(gProcessDict, (const void *)p);
-    
-    if (!tmpData) return;
-
-    cnt = CFGetRetainCount(tmpData);
+    processInfo_t   *info = processInfoGet(p);
 
+    if (!info || --info->refCnt)
+        return;
 
-    if (cnt == 1) {
-        proc = (ProcessInfoStruct *)CFDataGetBytePtr(tmpData);
+    // The cancel handler drops the source's last reference
+    dispatch_source_cancel(info->disp_src);
+    if (info->nameRef) CFRelease(info->nameRef);
 
-        dispatch_release(proc->disp_src);
-        if (proc->name) CFRelease(proc->name);
-        CFDictionaryRemoveValue(gProcessDict, (const void *)p);
-    }
-    else {
-        CFRelease(tmpData);
-    }
-    return ;
+    pointerTableRemove(&gProcTable, info);
+    free(info);
 }
 
 
 static IOReturn lookupAssertion(pid_t pid, IOPMAssertionID id, assertion_t **assertion)
 {
-    unsigned int idx = INDEX_FROM_ID(id);
-    assertion_t  *tmp_a = NULL;
-
-    if (idx >= kMaxAssertions)
-        return kIOReturnBadArgument;
+    assertion_t  *tmp_a = assertionForID(id);
 
-    if( CFDictionaryGetValueIfPresent(gAssertionsArray, 
-                  (void *)idx, (const void **)&tmp_a) == false)
+    if (!tmp_a)
         return kIOReturnBadArgument;
 
     if (tmp_a->pid != pid)
@@ -1710,7 +2359,6 @@ kern_return_t  _io_pm_declare_user_active
 
     CFMutableDictionaryRef      assertionProperties = NULL;
     assertion_t      *assertion = NULL;
-    CFDataRef           unfolder = NULL;
     pid_t               callerPID = -1;
     IOReturn            ret;
     bool                create_new = true;
@@ -1720,13 +2368,7 @@ kern_return_t  _io_pm_declare_user_active
     
     audit_token_to_au32(token, NULL, NULL, NULL, NULL, NULL, &callerPID, NULL, NULL);    
         
-    unfolder = CFDataCreateWithBytesNoCopy(0, (const UInt8 *)props, propsCnt, kCFAllocatorNull);
-    if (unfolder) {
-        assertionProperties = (CFMutableDictionaryRef)CFPropertyListCreateWithData(0, unfolder, 
-                                            kCFPropertyListMutableContainersAndLeaves, NULL, NULL);
-        CFRelease(unfolder);
-    }
-    
+    assertionProperties = copyPropertiesFromMessage(props, propsCnt);
     if (!assertionProperties) {
         *return_code = kIOReturnBadArgument;
         goto exit;
@@ -1756,10 +2398,7 @@ kern_return_t  _io_pm_declare_user_active
         /* Extend the timeout timer of this assertion by display sleep timer value */
 
         /* First set the assertion level to ON */
-        int k = kIOPMAssertionLevelOn;
-        CFNumberRef useLevelOnNum = CFNumberCreate(0, kCFNumberIntType, &k);
-        CFDictionarySetValue(assertion->props, kIOPMAssertionLevelKey, useLevelOnNum);
-        CFRelease(useLevelOnNum);
+        assertion->level = kIOPMAssertionLevelOn;
 
         /* Update the Create Time */
         start_date = CFDateCreate(0, CFAbsoluteTimeGetCurrent());
@@ -1789,8 +2428,90 @@ exit:
     return KERN_SUCCESS;
 }
 
+/*
+ * Extends a UserIsActive assertion returned by an earlier
+ * io_pm_declare_user_active call, as a repeat call with that ID would,
+ * without the client sending its properties again. In the usual case the
+ * assertion is already on, with the display sleep timeout and the release
+ * timeout action, and only its deadline and create date move. It is then
+ * re-positioned in the timeout heap in place. If it was the earliest
+ * deadline, the armed timer fires early and re-arms itself for the next one.
+ * Either way the call is charged to the caller's rate limit and posts
+ * AnyChanged, as a repeat io_pm_declare_user_active does.
+ *
+ * Returns kIOReturnBadArgument if the ID doesn't name a live UserIsActive
+ * assertion of the caller, e.g. because it timed out and was released; the
+ * client then declares the activity again with io_pm_declare_user_active.
+ */
+kern_return_t  _io_pm_declare_user_active_extend
+(
+    mach_port_t             server  __unused,
+    audit_token_t           token,
+    int                     assertion_id,
+    int                     *return_code
+)
+{
+    CFMutableDictionaryRef      assertionProperties = NULL;
+    assertion_t                 *assertion = NULL;
+    processInfo_t               *proc;
+    pid_t                       callerPID = -1;
+    int                         displaySleepTimerSecs;
+    int                         levelOn = kIOPMAssertionLevelOn;
+
+    audit_token_to_au32(token, NULL, NULL, NULL, NULL, NULL, &callerPID, NULL, NULL);
+
+    *return_code = lookupAssertion(callerPID, assertion_id, &assertion);
+    if (kIOReturnSuccess != *return_code)
+        return KERN_SUCCESS;
+
+    if (assertion->kassert != kDeclareUserActivity) {
+        *return_code = kIOReturnBadArgument;
+        return KERN_SUCCESS;
+    }
+
+    displaySleepTimerSecs = gDisplaySleepTimer * 60; /* Convert to secs */
+
+    if ( !(assertion->state & kAssertionStateInactive) &&
+         (assertion->timeoutAction == kAssertionTimeoutActionRelease) &&
+         (assertion->timeoutSecs == displaySleepTimerSecs) &&
+         ((displaySleepTimerSecs != 0) == ((assertion->state & kAssertionStateTimed) != 0)) )
+    {
+        // doSetProperties() charges the slow path
+        if ((proc = processInfoGet(callerPID)) && 
+            ((*return_code = chargeProcessCall(proc, false)) != kIOReturnSuccess))
+        {
+            return KERN_SUCCESS;
+        }
+
+        assertion->createDate = CFAbsoluteTimeGetCurrent();
+        if (assertion->state & kAssertionStateTimed) {
+            assertion->timeout = getMonotonicTime() + displaySleepTimerSecs;
+            timedHeapUpdate(assertion);
+        }
+        BUMP_GENERATION(gAssertionsGeneration);
+        postAssertionsChanged();
+        return KERN_SUCCESS;
+    }
+
+    /* The display sleep timer changed, or the client turned the assertion off */
+    assertionProperties = CFDictionaryCreateMutable(0, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if (!assertionProperties) {
+        *return_code = kIOReturnNoMemory;
+        return KERN_SUCCESS;
+    }
+    setDictNumber(assertionProperties, kIOPMAssertionLevelKey, kCFNumberIntType, &levelOn);
+    setDictNumber(assertionProperties, kIOPMAssertionTimeoutKey, kCFNumberIntType, &displaySleepTimerSecs);
+    CFDictionarySetValue(assertionProperties, kIOPMAssertionTimeoutActionKey, kIOPMAssertionTimeoutActionRelease);
+
+    assertion->createDate = CFAbsoluteTimeGetCurrent();
+    *return_code = doSetProperties(callerPID, assertion_id, assertionProperties);
+
+    CFRelease(assertionProperties);
+    return KERN_SUCCESS;
+}
+
 
-static uint64_t getMonotonicTime( )
+__private_extern__ uint64_t getMonotonicTime(void)
 {
     static mach_timebase_info_data_t    timebaseInfo;
 
@@ -1800,79 +2521,67 @@ static uint64_t getMonotonicTime( )
     return ( (mach_absolute_time( ) * timebaseInfo.numer) / (timebaseInfo.denom * NSEC_PER_SEC));
 }
 
-void insertInactiveAssertion(assertion_t *assertion, assertionType_t *assertType) 
+static uint64_t getMonotonicTimeNS( )
 {
-    LIST_INSERT_HEAD(&assertType->inactive, assertion, link);
-    assertion->state &= ~kAssertionStateTimed;
-    assertion->state |= kAssertionStateInactive;
+    static mach_timebase_info_data_t    timebaseInfo;
+
+    if (timebaseInfo.denom == 0) 
+        mach_timebase_info(&timebaseInfo);
+
+    return ( (mach_absolute_time( ) * timebaseInfo.numer) / timebaseInfo.denom );
 }
 
-void removeInactiveAssertion(assertion_t *assertion, assertionType_t *assertType)
+__private_extern__ bool assertionsOnBatteryPower(void)
 {
-    LIST_REMOVE(assertion, link);
-    assertion->state &= ~kAssertionStateInactive;
+    return (_getPowerSource() == kBatteryPowered);
 }
 
-void insertActiveAssertion(assertion_t *assertion, assertionType_t *assertType)
-{
-    LIST_INSERT_HEAD(&assertType->active, assertion, link);
-    assertion->state &= ~(kAssertionStateTimed|kAssertionStateInactive);
-
-    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) &&
-            (assertion->state & kAssertionStateValidOnBatt) )
-            assertType->validOnBattCount++;
-
-    if (assertion->state & kAssertionLidStateModifier)
-       assertType->lidSleepCount++;
-}
-
-void removeActiveAssertion(assertion_t *assertion, assertionType_t *assertType)
+/*
+ * Arms gDeadlineTimer to fire at 'deadline', or disarms it if 'deadline'
+ * is 0. Deadlines already due fire right away, without leeway.
+ */
+__private_extern__ void armDeadlineTimerAt(uint64_t deadline)
 {
-    LIST_REMOVE(assertion, link);
-
-    if ( (assertion->state & kAssertionStateValidOnBatt) && assertType->validOnBattCount)
-            assertType->validOnBattCount--;
+    uint64_t    currTime;
 
-    if ( (assertion->state & kAssertionLidStateModifier) && assertType->lidSleepCount)
-       assertType->lidSleepCount--;
-}
+    if (!deadline) {
+        if (gDeadlineTimer)
+            dispatch_source_set_timer(gDeadlineTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
 
+    if (gDeadlineTimer == NULL) {
+        gDeadlineTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
 
-void resetAssertionTimer(assertionType_t *assertType)
-{
-    uint64_t currTime, timeout ;
-    assertion_t *nextAssertion = NULL;
+        dispatch_source_set_event_handler(gDeadlineTimer, ^{
+            fireDeadlines(getMonotonicTime());
+        });
 
-    nextAssertion = LIST_FIRST(&assertType->activeTimed);
-    if (!nextAssertion) return;
+        dispatch_source_set_cancel_handler(gDeadlineTimer, ^{
+            dispatch_release(gDeadlineTimer);
+        });
+        dispatch_source_set_timer(gDeadlineTimer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_resume(gDeadlineTimer);
+    }
 
-    timeout = nextAssertion->timeout;
     currTime = getMonotonicTime();
-
-    if (nextAssertion->timeout <= currTime) {
-        CFRunLoopPerformBlock(_getPMRunLoop(), kCFRunLoopDefaultMode, ^{ handleAssertionTimeout(assertType); });
-        CFRunLoopWakeUp(_getPMRunLoop());
+    if (deadline > currTime) {
+        dispatch_source_set_timer(gDeadlineTimer, 
+                dispatch_time(DISPATCH_TIME_NOW, (deadline-currTime)*NSEC_PER_SEC), 
+                DISPATCH_TIME_FOREVER, kAssertionTimerLeeway);
     }
     else {
-        dispatch_suspend(assertType->timer);
-        
-        dispatch_source_set_timer(assertType->timer, 
-                dispatch_time(DISPATCH_TIME_NOW, (nextAssertion->timeout-currTime)*NSEC_PER_SEC), 
-                DISPATCH_TIME_FOREVER, 0);
-        dispatch_resume(assertType->timer);
+        dispatch_source_set_timer(gDeadlineTimer, DISPATCH_TIME_NOW, DISPATCH_TIME_FOREVER, 0);
     }
-
 }
 
 
 static void releaseAssertionMemory(assertion_t *assertion)
 {
-    int idx = INDEX_FROM_ID(assertion->assertionId);
-    assertion_t *tmp_a = NULL;
-    
-    if ( (idx < 0) || (idx >= kMaxAssertions) || 
-          (CFDictionaryGetValueIfPresent(gAssertionsArray, 
-                          (void *)idx, (const void **)&tmp_a) == false) || (tmp_a != assertion) ) {
+    pid_t           pid = assertion->pid;
+    processInfo_t   *procInfo;
+
+    if (assertionForID(assertion->assertionId) != assertion) {
 #ifdef DEBUG
         abort();
 #endif
@@ -1880,210 +2589,452 @@ static void releaseAssertionMemory(assertion_t *assertion)
     }
 
     logASLAssertionEvent(kPMASLAssertionActionRelease, assertion);
-    CFDictionaryRemoveValue(gAssertionsArray, (void *)idx);
+    recordAssertionEvent((assertion->state & kAssertionStateProcessExited) ? 
+                         kIOPMAssertionEventProcessExited : kIOPMAssertionEventReleased, assertion);
+    if (assertion->pidLink.le_prev)
+        LIST_REMOVE(assertion, pidLink);
+    freeAssertionSlot(assertion);
     if (assertion->props) CFRelease(assertion->props);
+    if ((procInfo = processInfoGet(pid)))
+        procInfo->propBytes -= assertion->propBytes;
 
     free(assertion);
 
-    processInfoRelease(assertion->pid);
+    processInfoRelease(pid);
 }
 
-void handleAssertionTimeout(assertionType_t *assertType)
+/* What handleAssertionTimeouts() gathers while assertions expire */
+typedef struct {
+    CFAbsoluteTime  dateNow;
+    bool            displayProxy;
+} timeoutPass_t;
+
+/* Called by expireTimedAssertions() for each assertion that timed out */
+static void assertionTimedOut(assertion_t *assertion, void *context)
 {
-    assertion_t     *assertion;
-    CFDateRef       dateNow = NULL;
-    uint64_t        currtime = getMonotonicTime( );
-    uint32_t        timedoutCnt = 0;
-    CFStringRef     timeoutAction = NULL;
-    bool            displayProxy = false;
+    timeoutPass_t   *pass = (timeoutPass_t *)context;
+    processInfo_t   *procInfo = NULL;
 
-    while( (assertion = LIST_FIRST(&assertType->activeTimed)) )
-    {
-        if (assertion->timeout > currtime) {
-            assertion = NULL;
-            break;
-        }
-        timedoutCnt++;
+    if (!pass->dateNow) pass->dateNow = CFAbsoluteTimeGetCurrent();
+    assertion->timedOutDate = pass->dateNow;
 
-        LIST_REMOVE(assertion, link);
-        assertion->state &= ~kAssertionStateTimed;
+    // Record this timeout for IOPMCopyTimedOutAssertions()
+    appendTimedOutAssertion(assertion);
 
-        if ( (assertion->state & kAssertionStateValidOnBatt) && assertType->validOnBattCount)
-                assertType->validOnBattCount--;
+    if ((procInfo = processInfoGet(assertion->pid)))
+        procInfo->timeoutCnt++;
 
-        if ( (assertion->state & kAssertionLidStateModifier) && assertType->lidSleepCount)
-                assertType->lidSleepCount--;
+    logASLAssertionEvent(kPMASLAssertionActionTimeOut, assertion);
+    recordAssertionEvent(kIOPMAssertionEventTimedOut, assertion);
 
-        if ((dateNow = CFDateCreate(0, CFAbsoluteTimeGetCurrent()))) {
-            CFDictionarySetValue(assertion->props, kIOPMAssertionTimedOutDateKey, dateNow);            
-            CFRelease(dateNow);
-        }
+    if ( (assertion->kassert == kPreventDisplaySleepIndex) && (assertion->pid != getpid()))
+       pass->displayProxy = true;
 
-        // Put a copy of this assertion into our "timeouts" array.        
-        appendTimedOutAssertion(assertion->props);
+    if (assertion->timeoutAction == kAssertionTimeoutActionRelease)
+    { 
+        releaseAssertionMemory(assertion);
+    }
+    else if (assertion->timeoutAction == kAssertionTimeoutActionKillProcess)
+    {
+        // Left in the inactive assertions list
+        kill(assertion->pid, SIGTERM);
+    }
+}
 
+/*
+ * Fires on gDeadlineTimer. Expires every assertion whose timeout has passed,
+ * whatever its type, then calls each affected type's handler once.
+ */
+__private_extern__ void handleAssertionTimeouts(void)
+{
+    assertionType_t *assertType;
+    timeoutPass_t   pass = { 0, false };
+    uint32_t        timedoutTypes;
+    int             i;
 
-        logASLAssertionEvent(kPMASLAssertionActionTimeOut, assertion);
+    timedoutTypes = expireTimedAssertions(getMonotonicTime(), assertionTimedOut, &pass);
 
-        if ( (assertion->kassert == kPreventDisplaySleepIndex) && (assertion->pid != getpid()))
-           displayProxy = true;
+    if ( !timedoutTypes ) return;
 
-        timeoutAction = CFDictionaryGetValue(assertion->props, kIOPMAssertionTimeoutActionKey);
-        if (isA_CFString(timeoutAction) && CFEqual(kIOPMAssertionTimeoutActionRelease, timeoutAction))
-        { 
-            releaseAssertionMemory(assertion);
-        }
-        else /* Default timeout action is to turn off */
-        {
-            // Leave this in the inactive assertions list
-            insertInactiveAssertion(assertion, assertType);
-            if (isA_CFString(timeoutAction) && CFEqual(kIOPMAssertionTimeoutActionKillProcess, timeoutAction))
-            {
-                kill(assertion->pid, SIGTERM);
-            }
+    if (pass.displayProxy) delayDisplayTurnOff( );
 
-        }
+    for (i = 0; i < kIOPMNumAssertionTypes; i++)
+    {
+        if ( !(timedoutTypes & (1 << i)) )
+            continue;
 
+        assertType = &gAssertionTypes[i];
+        if (assertType->handler)
+            (*assertType->handler)(assertType, kAssertionOpRelease);
     }
 
-    if ( !timedoutCnt ) return;
+    logASLAssertionsAggregate();
+    notify_post( kIOPMAssertionTimedOutNotifyString );
+    postAssertionsChanged();
 
-    resetAssertionTimer(assertType);
+}
 
-    if (displayProxy) delayDisplayTurnOff( );
+static void releaseAssertion(assertion_t *assertion, bool callHandler)
+{
+    if ( (assertion->kassert == kPreventDisplaySleepIndex) && (assertion->pid != getpid()))
+       delayDisplayTurnOff( );
 
-    if (assertType->handler)
-        (*assertType->handler)(assertType, kAssertionOpRelease);
+    deactivateAssertion(assertion, callHandler);
+}
 
-    logASLAssertionsAggregate();
-    notify_post( kIOPMAssertionTimedOutNotifyString );
-    notify_post( kIOPMAssertionsAnyChangedNotifyString );
+#pragma mark -
+#pragma mark Change notifications
+
+/*
+ * Registers the notifier's token. The sequence carries on from the state
+ * left by an earlier powerd, so it never goes backwards for subscribers.
+ */
+static void initChangeNotifier(changeNotifier_t *notifier)
+{
+    uint64_t    state = 0;
+
+    if (notifier->registered)
+        return;
+    if (NOTIFY_STATUS_OK != notify_register_check(notifier->name, &notifier->token))
+        return;
 
+    notifier->registered = true;
+    if (NOTIFY_STATUS_OK == notify_get_state(notifier->token, &state)) {
+        notifier->seq += state;
+        notifier->postedSeq += state;
+    }
 }
 
-void removeTimedAssertion(assertion_t *assertion, assertionType_t *assertType)
+static void publishChanges(changeNotifier_t *notifier)
+{
+    initChangeNotifier(notifier);
+    if (notifier->registered)
+        notify_set_state(notifier->token, notifier->seq);
+
+    notifier->postedSeq = notifier->seq;
+    notifier->lastPost = getMonotonicTimeNS();
+    notify_post(notifier->name);
+}
+
+/*
+ * Posts the changes counted on 'notifier' since its last post, at most once
+ * per gNotifyWindowMS. If the window since the last post has passed, posts
+ * right away; otherwise arms the notifier's timer for the end of the window.
+ */
+static void flushChanges(changeNotifier_t *notifier)
 {
-    bool adjustTimer = false;
+    uint64_t    window = (uint64_t)gNotifyWindowMS * NSEC_PER_MSEC;
+    uint64_t    elapsed;
+
+    if (notifier->timerArmed || (notifier->seq == notifier->postedSeq))
+        return;
 
-    if (LIST_FIRST(&assertType->activeTimed) == assertion) {
-        adjustTimer = true;
+    elapsed = getMonotonicTimeNS() - notifier->lastPost;
+    if (!window || !notifier->lastPost || (elapsed >= window)) {
+        publishChanges(notifier);
+        return;
+    }
+
+    if (!notifier->timer) {
+        notifier->timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+        if (!notifier->timer) {
+            publishChanges(notifier);
+            return;
+        }
+        dispatch_source_set_event_handler(notifier->timer, ^{
+            notifier->timerArmed = false;
+            if (notifier->seq != notifier->postedSeq)
+                publishChanges(notifier);
+        });
+        dispatch_source_set_timer(notifier->timer, DISPATCH_TIME_FOREVER, 0, 0);
+        dispatch_resume(notifier->timer);
     }
-    LIST_REMOVE(assertion, link);
-    assertion->state &= ~kAssertionStateTimed;
 
-    if ( (assertion->state & kAssertionStateValidOnBatt) && assertType->validOnBattCount)
-            assertType->validOnBattCount--;
+    dispatch_source_set_timer(notifier->timer, dispatch_time(DISPATCH_TIME_NOW, window - elapsed), 
+                              DISPATCH_TIME_FOREVER, 0);
+    notifier->timerArmed = true;
+}
 
-    if ( (assertion->state & kAssertionLidStateModifier) && assertType->lidSleepCount)
-            assertType->lidSleepCount--;
+static void postAssertionsChanged(void)
+{
+    BUMP_GENERATION(gAssertionsGeneration);
+    gAnyChangeNotifier.seq++;
 
-    if (adjustTimer) resetAssertionTimer(assertType);
+    if (gAssertionBatchOpen) {
+        gBatchNotify = true;
+        return;
+    }
 
+    flushChanges(&gAnyChangeNotifier);
 }
 
-void updateAssertionTimer(assertionType_t *assertType)
+static void postAssertionLevelsChanged(void)
 {
-    uint64_t    currTime;
-    assertion_t *assertion = NULL;
+    gLevelChangeNotifier.seq++;
+    flushChanges(&gLevelChangeNotifier);
+}
+
+/*
+ * Reads a tunable from IOPMLibPrivate.h and, if 'newValue' isn't negative,
+ * changes it. Only root can change tunables.
+ */
+kern_return_t _io_pm_assertion_set_tunable(
+    mach_port_t         server __unused,
+    audit_token_t       token,
+    int                 selector,
+    int                 newValue,
+    int                 *oldValue,
+    int                 *return_code)
+{
+    uid_t   callerUID = -1;
 
-    if ((assertion = LIST_FIRST(&assertType->activeTimed)) == NULL) return;
+    audit_token_to_au32(token, NULL, NULL, NULL, &callerUID, NULL, NULL, NULL, NULL);
 
-    /* Update/create the dispatch timer.  */
-    if (assertType->timer == NULL) {
-        assertType->timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    *oldValue = 0;
+    *return_code = kIOReturnSuccess;
 
-        dispatch_source_set_event_handler(assertType->timer, ^{
-            handleAssertionTimeout(assertType);
-        });
-    
-        dispatch_source_set_cancel_handler(assertType->timer, ^{
-            dispatch_release(assertType->timer);
-        });
-    
-    }
-    else {
-        dispatch_suspend(assertType->timer);
+    if ((newValue >= 0) && !callerIsRoot(callerUID)) {
+        *return_code = kIOReturnNotPrivileged;
+        return KERN_SUCCESS;
     }
-    currTime = getMonotonicTime();
 
+    switch (selector) {
+        case kIOPMAssertionTunableNotifyWindow:
+            *oldValue = (int)gNotifyWindowMS;
+            if (newValue >= 0) {
+                gNotifyWindowMS = (uint32_t)newValue;
+            }
+            break;
 
-    if (assertion->timeout <= currTime) {
-        /* This has already timed out. */
-        dispatch_resume(assertType->timer);
-        CFRunLoopPerformBlock(_getPMRunLoop(), kCFRunLoopDefaultMode, ^{ handleAssertionTimeout(assertType); });
-        CFRunLoopWakeUp(_getPMRunLoop());
+        case kIOPMAssertionTunableTimedOutHistory:
+            *oldValue = (int)gTimedOutCapacity;
+            if ((newValue == 0) || (newValue > kMaxTimedOutHistory)) {
+                *return_code = kIOReturnBadArgument;
+            } else if (newValue > 0) {
+                setTimedOutHistoryCapacity((uint32_t)newValue);
+            }
+            break;
+
+        case kIOPMAssertionTunableProcessLimit:
+            *oldValue = (int)gProcessAssertionLimit;
+            if (newValue > kMaxAssertions) {
+                *return_code = kIOReturnBadArgument;
+            } else if (newValue >= 0) {
+                gProcessAssertionLimit = (uint32_t)newValue;
+            }
+            break;
+
+        case kIOPMAssertionTunableProcessRate:
+            *oldValue = (int)gProcessCallRate;
+            if (newValue >= 0) {
+                gProcessCallRate = (uint32_t)newValue;
+            }
+            break;
+
+        case kIOPMAssertionTunableProcessBurst:
+            *oldValue = (int)gProcessCallBurst;
+            if (newValue == 0) {
+                *return_code = kIOReturnBadArgument;
+            } else if (newValue > 0) {
+                gProcessCallBurst = (uint32_t)newValue;
+            }
+            break;
+
+        case kIOPMAssertionTunableQuotaRejects:
+            *oldValue = (int)gQuotaRejectCnt;
+            if (newValue > 0) {
+                *return_code = kIOReturnBadArgument;
+            } else if (newValue == 0) {
+                gQuotaRejectCnt = 0;
+            }
+            break;
+
+        case kIOPMAssertionTunableRateRejects:
+            *oldValue = (int)gRateRejectCnt;
+            if (newValue > 0) {
+                *return_code = kIOReturnBadArgument;
+            } else if (newValue == 0) {
+                gRateRejectCnt = 0;
+            }
+            break;
+
+        case kIOPMAssertionTunablePropertyLimit:
+            *oldValue = (int)gPropertyLimit;
+            if (newValue >= 0) {
+                gPropertyLimit = (uint32_t)newValue;
+            }
+            break;
+
+        default:
+            *return_code = kIOReturnBadArgument;
+            break;
     }
-    else {
-        dispatch_source_set_timer(assertType->timer, 
-                dispatch_time(DISPATCH_TIME_NOW, (assertion->timeout-currTime)*NSEC_PER_SEC), 
-                DISPATCH_TIME_FOREVER, 0);
-        dispatch_resume(assertType->timer);
+
+    return KERN_SUCCESS;
+}
+
+#pragma mark -
+#pragma mark Event stream
+
+static void recordAssertionEvent(uint16_t event, assertion_t *assertion)
+{
+    IOPMAssertionEventRecord    *rec;
+    CFStringRef                 name;
+    CFIndex                     used = 0;
+
+    if (!gEventRing) {
+        gEventRing = calloc(kAssertionEventRingSize, sizeof(IOPMAssertionEventRecord));
+        if (!gEventRing)
+            return;
     }
 
+    rec = &gEventRing[gEventHead & (kAssertionEventRingSize - 1)];
+    rec->cursor = gEventHead++;
+    rec->time = CFAbsoluteTimeGetCurrent();
+    rec->assertionID = assertion->assertionId;
+    rec->pid = assertion->pid;
+    rec->event = event;
+    rec->level = kIOPMAssertionLevelOff;
+    if ( ((event == kIOPMAssertionEventCreated) || (event == kIOPMAssertionEventTurnedOn)) &&
+            !(assertion->state & kAssertionStateInactive) )
+        rec->level = kIOPMAssertionLevelOn;
+    rec->reserved = 0;
 
+    if (!gEventTypeNames[assertion->kassert][0] && assertion_types_arr[assertion->kassert]) {
+        CFStringGetCString(assertion_types_arr[assertion->kassert], gEventTypeNames[assertion->kassert],
+                           sizeof(gEventTypeNames[0]), kCFStringEncodingUTF8);
+    }
+    memcpy(rec->type, gEventTypeNames[assertion->kassert], sizeof(rec->type));
+
+    // Truncates long names rather than failing like CFStringGetCString()
+    name = CFDictionaryGetValue(assertion->props, kIOPMAssertionNameKey);
+    if (isA_CFString(name)) {
+        CFStringGetBytes(name, CFRangeMake(0, CFStringGetLength(name)), kCFStringEncodingUTF8, '?', 
+                         false, (UInt8 *)rec->name, sizeof(rec->name) - 1, &used);
+    }
+    rec->name[used] = 0;
 }
 
-void insertTimedAssertion(assertion_t *assertion, assertionType_t *assertType, bool updateTimer)
+kern_return_t _io_pm_assertion_copy_events(
+    mach_port_t             server __unused,
+    audit_token_t           token __unused,
+    uint64_t                cursor,
+    vm_offset_t             *events,
+    mach_msg_type_number_t  *eventsCnt,
+    uint64_t                *next_cursor,
+    int                     *overflowed,
+    int                     *return_code)
 {
-    assertion_t *a, *prev;
+    IOPMAssertionEventRecord    *out = NULL;
+    uint64_t                    oldest, count, i;
+
+    *events = 0;
+    *eventsCnt = 0;
+    *overflowed = 0;
+    *return_code = kIOReturnSuccess;
 
-    if (LIST_EMPTY(&assertType->activeTimed) ) {
-        LIST_INSERT_HEAD(&assertType->activeTimed, assertion, link);
+    oldest = (gEventHead > kAssertionEventRingSize) ? (gEventHead - kAssertionEventRingSize) : 1;
+    if (cursor > gEventHead) {
+        cursor = gEventHead;
     }
-    else {
-        LIST_FOREACH(a, &assertType->activeTimed, link) 
-        {
-            prev = a;
-            if (a->timeout > assertion->timeout)
-                break;
+    else if (cursor < oldest) {
+        *overflowed = (cursor != 0);
+        cursor = oldest;
+    }
+
+    count = gEventHead - cursor;
+    if (count > kIOPMAssertionEventsMaxBatch)
+        count = kIOPMAssertionEventsMaxBatch;
+
+    if (count) {
+        if (KERN_SUCCESS != vm_allocate(mach_task_self(), (vm_address_t *)&out, 
+                                        count * sizeof(IOPMAssertionEventRecord), TRUE)) {
+            *return_code = kIOReturnNoMemory;
+            count = 0;
         }
-        if (a)
-            LIST_INSERT_BEFORE(a, assertion, link);
-        else
-            LIST_INSERT_AFTER(prev, assertion, link);
+        for (i = 0; i < count; i++) {
+            out[i] = gEventRing[(cursor + i) & (kAssertionEventRingSize - 1)];
+        }
+        *events = (vm_offset_t)out;
+        *eventsCnt = (mach_msg_type_number_t)(count * sizeof(IOPMAssertionEventRecord));
     }
 
-    assertion->state |= kAssertionStateTimed;
-    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) &&
-            (assertion->state & kAssertionStateValidOnBatt) )
-            assertType->validOnBattCount++;
+    *next_cursor = cursor + count;
+    return KERN_SUCCESS;
+}
 
-    if (assertion->state & kAssertionLidStateModifier)
-            assertType->lidSleepCount++;
-    /*  
-     * If this assertion is not the one with earliest timeout,
-     * there is nothing to do.
-     */
-    if (LIST_FIRST(&assertType->activeTimed) != assertion)
-        return;
+/*
+ * Returns an IOPMAssertionPropertyUsageRecord for each process holding
+ * assertions, from the byte counts kept by storeProperties().
+ */
+kern_return_t _io_pm_assertion_copy_property_usage(
+    mach_port_t             server __unused,
+    audit_token_t           token __unused,
+    vm_offset_t             *usage,
+    mach_msg_type_number_t  *usageCnt,
+    int                     *return_code)
+{
+    IOPMAssertionPropertyUsageRecord    *out = NULL;
+    IOPMAssertionPropertyUsageRecord    *rec;
+    processInfo_t                       *info;
+    assertion_t                         *assertion;
+    uint32_t                            count = 0, i;
 
-    if (updateTimer) updateAssertionTimer(assertType);
+    *usage = 0;
+    *usageCnt = 0;
+    *return_code = kIOReturnSuccess;
 
-    return;
-}
+    if (!gProcTable.count)
+        return KERN_SUCCESS;
 
+    if (KERN_SUCCESS != vm_allocate(mach_task_self(), (vm_address_t *)&out, 
+                                    gProcTable.count * sizeof(IOPMAssertionPropertyUsageRecord), TRUE)) {
+        *return_code = kIOReturnNoMemory;
+        return KERN_SUCCESS;
+    }
 
-static void releaseAssertion(assertion_t *assertion, bool callHandler)
-{
-    assertionType_t     *assertType;
+    for (i = 0; i < gProcTable.size; i++)
+    {
+        if (!(info = gProcTable.slots[i]))
+            continue;
 
-    assertType = &gAssertionTypes[assertion->kassert]; 
+        rec = &out[count++];
+        rec->pid = info->pid;
+        rec->bytes = info->propBytes;
+        strlcpy(rec->name, info->name, sizeof(rec->name));
+        LIST_FOREACH(assertion, &info->assertions, pidLink) {
+            rec->assertionCount++;
+            if (assertion->propBytes > rec->largestBytes) {
+                rec->largestBytes = assertion->propBytes;
+                rec->largestID = assertion->assertionId;
+            }
+        }
+    }
 
-    if ( (assertion->kassert == kPreventDisplaySleepIndex) && (assertion->pid != getpid()))
-       delayDisplayTurnOff( );
-    if (assertion->state & kAssertionStateTimed)
-        removeTimedAssertion(assertion, assertType);
-    else if (assertion->state & kAssertionStateInactive)
-        removeInactiveAssertion(assertion, assertType);
-    else
-        removeActiveAssertion(assertion, assertType);
+    *usage = (vm_offset_t)out;
+    *usageCnt = (mach_msg_type_number_t)(count * sizeof(IOPMAssertionPropertyUsageRecord));
+    return KERN_SUCCESS;
+}
 
-    if (!callHandler) return;
+#pragma mark -
+#pragma mark Batches
 
-    if (assertType->handler)
-        (*assertType->handler)(assertType, kAssertionOpRelease);
+static void beginAssertionBatch(void)
+{
+    openAssertionBatch();
+    gBatchNotify = false;
+}
 
+/*
+ * Runs the handler calls deferred since beginAssertionBatch(), then posts
+ * the AnyChanged notification held back by the batch.
+ */
+static void endAssertionBatch(void)
+{
+    closeAssertionBatch();
 
+    if (gBatchNotify)
+        flushChanges(&gAnyChangeNotifier);
 }
 
 static IOReturn doRelease(pid_t pid, IOPMAssertionID id)
@@ -2106,7 +3057,7 @@ static IOReturn doRelease(pid_t pid, IOPMAssertionID id)
     releaseAssertion(assertion, true);
     releaseAssertionMemory(assertion);
 
-    notify_post( kIOPMAssertionsAnyChangedNotifyString );
+    postAssertionsChanged();
 
     return kIOReturnSuccess;
 }
@@ -2148,62 +3099,393 @@ applyToAllAssertionsSync(assertionType_t *assertType, bool applyToInactives,  vo
 __private_extern__ void
 HandleProcessExit(pid_t deadPID)
 {
-    int i;
-    assertionType_t *assertType = NULL;
-    assertion_t     *assertion = NULL;
-    __block LIST_HEAD(, assertion) list  = LIST_HEAD_INITIALIZER(list);     /* list of assertions released */
+    processInfo_t       *proc = NULL;
+    assertion_t         *assertion = NULL;
+    LIST_HEAD(, assertion) list  = LIST_HEAD_INITIALIZER(list);     /* list of assertions released */
 
-    /* Go thru each assertion type and release all assertion from its lists */
-    for (i=0; i < kIOPMNumAssertionTypes; i++)
+    if ( !(proc = processInfoGet(deadPID)) || LIST_EMPTY(&proc->assertions))
+        return;
+
+    /* Unlink this process's assertions. Only the types they belonged to get
+     * their handler called, once each, when the batch ends.
+     */
+    beginAssertionBatch();
+    LIST_FOREACH(assertion, &proc->assertions, pidLink)
     {
-        assertType = &gAssertionTypes[i]; 
+        assertion->state |= kAssertionStateProcessExited;
+        releaseAssertion(assertion, true);
+        LIST_INSERT_HEAD(&list, assertion, link);
+    }
+    postAssertionsChanged();
+    endAssertionBatch();
 
-        applyToAllAssertionsSync(assertType, true, ^(assertion_t *assertion)
-                {
-                    if (assertion->pid == deadPID) {
-                        releaseAssertion(assertion, false);
-                        LIST_INSERT_HEAD(&list, assertion, link);
-                    }
-                });
+    /* Release memory after calling the handlers to get proper aggregate_assertions value into log.
+     * The last release also frees 'proc'.
+     */
+    while( (assertion = LIST_FIRST(&list)) )
+    {
+        LIST_REMOVE(assertion, link);
+        releaseAssertionMemory(assertion);
+    }
+}
 
-        if (assertType->handler)
-            (*assertType->handler)(assertType, kAssertionOpRelease);
 
-        /* Release memory after calling the handler to get proper aggregate_assertions value into log */
-        while( (assertion = LIST_FIRST(&list)) )
-        {
-            LIST_REMOVE(assertion, link);
-            releaseAssertionMemory(assertion);
-        }
 
+
+/* Returns the kPMWireTypeToken for an assertion type name, or kPMWireTypeTokenNone */
+static uint8_t getTypeToken(CFStringRef type)
+{
+    char            buf[64];
+    const char      *name;
+    uint8_t         token;
+
+    if (!isA_CFString(type))
+        return kPMWireTypeTokenNone;
+
+    // powerd's own assertions, and those sent with a type token, use the constant strings
+    for (token = kPMWireTypeTokenNone + 1; token < kPMWireTypeTokenCount; token++) {
+        if (type == gTypeTokenNames[token])
+            return token;
+    }
+
+    if (!(name = CFStringGetCStringPtr(type, kCFStringEncodingUTF8))) {
+        if (!CFStringGetCString(type, buf, sizeof(buf), kCFStringEncodingUTF8))
+            return kPMWireTypeTokenNone;    // Longer than any known name
+        name = buf;
     }
-    notify_post( kIOPMAssertionsAnyChangedNotifyString );
+
+    return PMWireTypeTokenForName(name, strlen(name));
 }
 
+static int getTypeIndexForToken(uint8_t token)
+{
+    if ((token == kPMWireTypeTokenNone) || (token >= kPMWireTypeTokenCount))
+        return -1;
+
+    return gTypeTokenIndex[token];
+}
 
 static int getAssertionTypeIndex(CFStringRef type)
 {
-    int idx = -1;
-    CFNumberRef numRef = NULL;
+    return getTypeIndexForToken(getTypeToken(type));
+}
 
-    if (!isA_CFString(type))
-        return -1;
+static assertionTimeoutAction timeoutActionForString(CFTypeRef action)
+{
+    if (!isA_CFString(action))
+        return kAssertionTimeoutActionTurnOff;
+    if (CFEqual(action, kIOPMAssertionTimeoutActionRelease))
+        return kAssertionTimeoutActionRelease;
+    if (CFEqual(action, kIOPMAssertionTimeoutActionKillProcess))
+        return kAssertionTimeoutActionKillProcess;
+    return kAssertionTimeoutActionTurnOff;
+}
 
-    numRef = CFDictionaryGetValue(gUserAssertionTypesDict, type);
-    if (isA_CFNumber(numRef))
-        CFNumberGetValue(numRef, kCFNumberIntType, &idx);
+/* Properties powerd keeps in assertion_t fields rather than in assertion->props */
+static const CFStringRef kTypedPropertyKeys[] = {
+    kIOPMAssertionLevelKey,
+    kIOPMAssertionTimeoutKey,
+    kIOPMAssertionAppliesToLimitedPowerKey,
+    kIOPMAssertionAppliesOnLidClose,
+    kIOPMAssertionCreateDateKey,
+    kIOPMAssertionTimedOutDateKey,
+    kIOPMAssertionGlobalUniqueIDKey,
+    kIOPMAssertionProcessNameKey
+};
 
-    if (idx < 0 || idx >= kIOPMNumAssertionTypes)
-        return -1;
+/*
+ * Decodes one property of a new assertion into its field. Returns true if
+ * the property is kept only in the field, and so left out of
+ * assertion->props.
+ */
+static bool takeTypedProperty(assertion_t *assertion, CFTypeRef key, CFTypeRef val)
+{
+    unsigned                i;
+
+    if (CFEqual(key, kIOPMAssertionLevelKey)) {
+        if (isA_CFNumber(val))
+            CFNumberGetValue(val, kCFNumberIntType, &assertion->level);
+    }
+    else if (CFEqual(key, kIOPMAssertionTimeoutKey)) {
+        if (isA_CFNumber(val))
+            CFNumberGetValue(val, kCFNumberDoubleType, &assertion->timeoutSecs);
+    }
+    else if (CFEqual(key, kIOPMAssertionTimeoutActionKey)) {
+        assertion->timeoutAction = timeoutActionForString(val);
+        return false;
+    }
+    else if (CFEqual(key, kIOPMAssertionAppliesToLimitedPowerKey)) {
+        if (val == kCFBooleanTrue)
+            assertion->flags |= kAssertionFlagAppliesToLimitedPower;
+    }
+    else if (CFEqual(key, kIOPMAssertionAppliesOnLidClose)) {
+        if (val == kCFBooleanTrue)
+            assertion->flags |= kAssertionFlagAppliesOnLidClose;
+    }
+    else {
+        for (i = 0; i < sizeof(kTypedPropertyKeys)/sizeof(kTypedPropertyKeys[0]); i++) {
+            if (CFEqual(key, kTypedPropertyKeys[i]))
+                return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Decodes the properties of a new assertion into its fields, once. The
+ * decoded keys are dropped from 'props' before it is stored, and only put
+ * back by copyAssertionProperties() when a client asks for them.
+ */
+static void takeTypedProperties(assertion_t *assertion, CFMutableDictionaryRef props)
+{
+    CFTypeRef               val;
+    unsigned                i;
+
+    assertion->level = kIOPMAssertionLevelOn;
+    assertion->timeoutAction = timeoutActionForString(CFDictionaryGetValue(props, kIOPMAssertionTimeoutActionKey));
+
+    for (i = 0; i < sizeof(kTypedPropertyKeys)/sizeof(kTypedPropertyKeys[0]); i++) {
+        if ((val = CFDictionaryGetValue(props, kTypedPropertyKeys[i]))) {
+            takeTypedProperty(assertion, kTypedPropertyKeys[i], val);
+            CFDictionaryRemoveValue(props, kTypedPropertyKeys[i]);
+        }
+    }
+}
+
+/* String properties carried as wire tags, see newAssertionFromWire() */
+static const struct {
+    int             tag;
+    CFStringRef     key;
+    size_t          offset;         /* Of its pmWireString_t in pmWireAssertion_t */
+} kWireStringProperties[] = {
+    { kPMWireTagName,                   kIOPMAssertionNameKey,                  offsetof(pmWireAssertion_t, name) },
+    { kPMWireTagDetails,                kIOPMAssertionDetailsKey,               offsetof(pmWireAssertion_t, details) },
+    { kPMWireTagHumanReadableReason,    kIOPMAssertionHumanReadableReasonKey,   offsetof(pmWireAssertion_t, humanReadableReason) },
+    { kPMWireTagLocalizationBundlePath, kIOPMAssertionLocalizationBundlePathKey, offsetof(pmWireAssertion_t, localizationBundlePath) },
+    { kPMWireTagTimeoutAction,          kIOPMAssertionTimeoutActionKey,         offsetof(pmWireAssertion_t, timeoutAction) }
+};
+
+#define kWireStringPropertyCount    (sizeof(kWireStringProperties)/sizeof(kWireStringProperties[0]))
+
+/* Adds 'key' to the key and value lists built by newAssertionFromWire(), or replaces its value */
+static void setWireProperty(const void **keys, const void **values, CFIndex *count, 
+                            CFStringRef key, CFTypeRef value)
+{
+    CFIndex                 i;
+
+    for (i = 0; i < *count; i++) {
+        if (CFEqual(keys[i], key)) {
+            values[i] = value;
+            return;
+        }
+    }
+    keys[*count] = key;
+    values[(*count)++] = value;
+}
+
+/*
+ * newAssertion() for one wire record. The type, level and timeout go
+ * straight into the assertion's fields and need no CF objects. The tagged
+ * strings are created once, as values of the stored properties. Only the
+ * plist part, with the keys that have no tag, goes through CF decoding;
+ * its entries are merged into the same immutable dictionary, which is
+ * stored as is.
+ */
+static IOReturn newAssertionFromWire(const pmWireAssertion_t *wire, assertion_t **outAssertion)
+{
+    assertion_t             *assertion = NULL;
+    CFDictionaryRef         others = NULL;
+    CFDataRef               unfolder = NULL;
+    CFStringRef             strings[kWireStringPropertyCount];
+    const pmWireString_t    *str;
+    const void              **keys = NULL;
+    const void              **values = NULL;
+    CFIndex                 othersCount = 0, count = 0, i;
+    unsigned                s, stringCount = 0;
+    IOReturn                ret = kIOReturnNoMemory;
+    uint8_t                 token = kPMWireTypeTokenNone;
+    int                     idx;
+
+    *outAssertion = NULL;
+
+    // A known type token stands in for the type name
+    if (PMWIRE_HAS(wire, kPMWireTagTypeToken) && (wire->typeToken < kPMWireTypeTokenCount)
+            && gTypeTokenNames[wire->typeToken])
+        token = wire->typeToken;
+    else if (PMWIRE_HAS(wire, kPMWireTagType))
+        token = PMWireTypeTokenForName(wire->type.ptr, wire->type.len);
+
+    if ((idx = getTypeIndexForToken(token)) < 0)
+        return kIOReturnBadArgument;
+
+    if (PMWIRE_HAS(wire, kPMWireTagPlist)) {
+        unfolder = CFDataCreateWithBytesNoCopy(0, wire->plist, wire->plistLen, kCFAllocatorNull);
+        if (unfolder) {
+            others = (CFDictionaryRef)CFPropertyListCreateWithData(
+                                0, unfolder, kCFPropertyListImmutable, NULL, NULL);
+            CFRelease(unfolder);
+        }
+        if (!isA_CFDictionary(others)) {
+            if (others) CFRelease(others);
+            return kIOReturnBadArgument;
+        }
+        othersCount = CFDictionaryGetCount(others);
+    }
+
+    assertion = calloc(1, sizeof(assertion_t));
+    keys = malloc(2 * (othersCount + 1 + kWireStringPropertyCount) * sizeof(void *));
+    if (!assertion || !keys)
+        goto exit;
+    values = keys + othersCount + 1 + kWireStringPropertyCount;
 
-    return idx;
+    assertion->kassert = idx;
+    assertion->typeToken = token;
+    assertion->retainCnt = 1;
+    assertion->level = kIOPMAssertionLevelOn;
+
+    // Untagged keys, less those kept in fields
+    if (others) {
+        CFDictionaryGetKeysAndValues(others, keys, values);
+        for (i = 0; i < othersCount; i++) {
+            if (!takeTypedProperty(assertion, keys[i], values[i])) {
+                keys[count] = keys[i];
+                values[count++] = values[i];
+            }
+        }
+    }
+
+    // Tagged fields take precedence over the plist
+    if (PMWIRE_HAS(wire, kPMWireTagLevel))
+        assertion->level = wire->level;
+    if (PMWIRE_HAS(wire, kPMWireTagTimeout))
+        assertion->timeoutSecs = wire->timeout;
+
+    setWireProperty(keys, values, &count, kIOPMAssertionTypeKey, gTypeTokenNames[token]);
+
+    for (s = 0; s < kWireStringPropertyCount; s++) {
+        if (!PMWIRE_HAS(wire, kWireStringProperties[s].tag))
+            continue;
+
+        str = (const pmWireString_t *)((const char *)wire + kWireStringProperties[s].offset);
+        strings[stringCount] = CFStringCreateWithBytes(0, (const UInt8 *)str->ptr, str->len, 
+                                                       kCFStringEncodingUTF8, false);
+        if (!strings[stringCount]) {
+            ret = kIOReturnBadArgument;
+            goto exit;
+        }
+        setWireProperty(keys, values, &count, kWireStringProperties[s].key, strings[stringCount]);
+        takeTypedProperty(assertion, kWireStringProperties[s].key, strings[stringCount]);
+        stringCount++;
+    }
+
+    assertion->props = CFDictionaryCreate(0, keys, values, count, 
+                            &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if (!assertion->props)
+        goto exit;
+    assertion->propBytes = propertyBytes(assertion->props);
+
+    if (gPropertyLimit && (assertion->propBytes > gPropertyLimit)) {
+        ret = kIOPMAssertionReturnPropertiesTooLarge;
+        goto exit;
+    }
+
+    *outAssertion = assertion;
+    assertion = NULL;
+    ret = kIOReturnSuccess;
+
+exit:
+    while (stringCount)
+        CFRelease(strings[--stringCount]);
+    if (others)
+        CFRelease(others);
+    free(keys);
+    if (assertion) {
+        if (assertion->props) CFRelease(assertion->props);
+        free(assertion);
+    }
+
+    return ret;
+}
+
+static void addPropertyBytes(const void *key, const void *value, void *context);
+
+/*
+ * Estimates the bytes powerd holds for a property list value: the payload
+ * of its strings and data, plus kPropertyObjectBytes for every object.
+ */
+static uint32_t propertyBytes(CFTypeRef value)
+{
+    CFTypeID    type = CFGetTypeID(value);
+    uint32_t    bytes = kPropertyObjectBytes;
+    CFIndex     used = 0, count, i;
+
+    if (type == CFStringGetTypeID()) {
+        CFStringGetBytes(value, CFRangeMake(0, CFStringGetLength(value)), kCFStringEncodingUTF8, 
+                         0, false, NULL, 0, &used);
+        bytes += (uint32_t)used;
+    }
+    else if (type == CFDataGetTypeID()) {
+        bytes += (uint32_t)CFDataGetLength(value);
+    }
+    else if (type == CFDictionaryGetTypeID()) {
+        CFDictionaryApplyFunction(value, addPropertyBytes, &bytes);
+    }
+    else if (type == CFArrayGetTypeID()) {
+        count = CFArrayGetCount(value);
+        for (i = 0; i < count; i++)
+            bytes += propertyBytes(CFArrayGetValueAtIndex(value, i));
+    }
+    return bytes;
+}
+
+static void addPropertyBytes(const void *key, const void *value, void *context)
+{
+    *(uint32_t *)context += propertyBytes(key) + propertyBytes(value);
+}
+
+/*
+ * Makes an immutable deep copy of 'props' the stored properties of
+ * 'assertion', and charges its size to the assertion and to its process.
+ * The immutable copy holds its strings and numbers in compact form, and
+ * no client container stays mutable inside powerd.
+ */
+static bool storeProperties(assertion_t *assertion, CFDictionaryRef props)
+{
+    CFDictionaryRef     compact;
+    processInfo_t       *proc;
+    uint32_t            bytes;
+
+    compact = CFPropertyListCreateDeepCopy(0, props, kCFPropertyListImmutable);
+    if (!compact)
+        return false;
+
+    bytes = propertyBytes(compact);
+    if ((proc = processInfoGet(assertion->pid)))
+        proc->propBytes = proc->propBytes - assertion->propBytes + bytes;
+
+    if (assertion->props) CFRelease(assertion->props);
+    assertion->props = compact;
+    assertion->propBytes = bytes;
+    return true;
 }
+
+/* Context of forwardPropertiesToAssertion() */
+typedef struct {
+    assertion_t             *assertion;
+    CFMutableDictionaryRef  props;      /* Changed copy of assertion->props, created on first change */
+    int                     kassert;    /* New type, with kAssertionModType */
+    uint8_t                 typeToken;
+} setPropertiesContext_t;
+
 static void forwardPropertiesToAssertion(const void *key, const void *value, void *context)
 {
-    assertion_t *assertion = (assertion_t *)context;
+    setPropertiesContext_t *ctx = (setPropertiesContext_t *)context;
+    assertion_t *assertion = ctx->assertion;
     assertionType_t *assertType = NULL;
     CFTimeInterval      timeout = 0;
     int level, idx;
+    uint8_t token;
 
     if (!isA_CFString(key))
         return; /* Key has to be a string */
@@ -2212,6 +3494,7 @@ static void forwardPropertiesToAssertion(const void *key, const void *value, voi
     if (CFEqual(key, kIOPMAssertionLevelKey)) {
         if (!isA_CFNumber(value)) return;
         CFNumberGetValue(value, kCFNumberIntType, &level);
+        assertion->level = level;
         if ( (assertion->state & kAssertionStateInactive) && (level == kIOPMAssertionLevelOn) )
         {
             assertion->state &= ~kAssertionStateInactive;
@@ -2222,19 +3505,27 @@ static void forwardPropertiesToAssertion(const void *key, const void *value, voi
             assertion->state |= kAssertionStateInactive;
             assertion->mods |= kAssertionModLevel;
         }
+        return;
     }
     else if (CFEqual(key, kIOPMAssertionTimeoutKey)) {
         if (!isA_CFNumber(value)) return;
         CFNumberGetValue(value, kCFNumberDoubleType, &timeout);
+        assertion->timeoutSecs = timeout;
 
         if (timeout) {
             assertion->timeout = (uint64_t)timeout + getMonotonicTime(); // Absolute time at which assertion expires
         }
 
         assertion->mods |= kAssertionModTimer;
+        return;
     }
     else if (CFEqual(key, kIOPMAssertionAppliesToLimitedPowerKey)) {
         if (!isA_CFBoolean(value)) return;
+        if (value == kCFBooleanTrue)
+            assertion->flags |= kAssertionFlagAppliesToLimitedPower;
+        else
+            assertion->flags &= ~kAssertionFlagAppliesToLimitedPower;
+
         assertType = &gAssertionTypes[assertion->kassert];
         if ((assertType->flags & kAssertionTypeNotValidOnBatt) == 0) return;
         if ((value == kCFBooleanTrue) && !(assertion->state & kAssertionStateValidOnBatt))
@@ -2249,10 +3540,16 @@ static void forwardPropertiesToAssertion(const void *key, const void *value, voi
             assertion->state &= ~kAssertionStateValidOnBatt;
             assertion->mods |= kAssertionModPowerConstraint;
         }
-
+        return;
     }
-    else if ( (assertion->kassert == kDeclareUserActivity) && CFEqual(key, kIOPMAssertionAppliesOnLidClose)) {
+    else if (CFEqual(key, kIOPMAssertionAppliesOnLidClose)) {
         if (!isA_CFBoolean(value)) return;
+        if (value == kCFBooleanTrue)
+            assertion->flags |= kAssertionFlagAppliesOnLidClose;
+        else
+            assertion->flags &= ~kAssertionFlagAppliesOnLidClose;
+
+        if (assertion->kassert != kDeclareUserActivity) return;
         assertType = &gAssertionTypes[kDeclareUserActivity];
         if ((value == kCFBooleanTrue) && !(assertion->state & kAssertionLidStateModifier)) {
             assertType->lidSleepCount++;
@@ -2264,19 +3561,63 @@ static void forwardPropertiesToAssertion(const void *key, const void *value, voi
             assertion->state &= ~kAssertionLidStateModifier;
             assertion->mods |= kAssertionModLidState;
         }
+        return;
+    }
+    else if (CFEqual(key, kIOPMAssertionCreateDateKey)) {
+        if (isA_CFDate(value))
+            assertion->createDate = CFDateGetAbsoluteTime(value);
+        return;
+    }
+    else if ( CFEqual(key, kIOPMAssertionTimedOutDateKey) 
+           || CFEqual(key, kIOPMAssertionGlobalUniqueIDKey)
+           || CFEqual(key, kIOPMAssertionProcessNameKey) ) {
+        return; /* Only powerd sets these */
+    }
+    else if (CFEqual(key, kIOPMAssertionTimeoutActionKey)) {
+        assertion->timeoutAction = timeoutActionForString(value);
     }
     else if (CFEqual(key, kIOPMAssertionTypeKey)) {
-        idx = getAssertionTypeIndex(value);
+        token = getTypeToken(value);
+        idx = getTypeIndexForToken(token);
         if ( (idx < 0) || (idx == assertion->kassert) )return;
 
-        assertion->kassert = idx;
-        assertion->state |= kAssertionModType;
+        // Applied by doSetProperties(), once the assertion is off the old type's lists
+        ctx->kassert = idx;
+        ctx->typeToken = token;
+        assertion->mods |= kAssertionModType;
 
     }
 
-    CFDictionarySetValue(assertion->props, key, value);
+    if (!ctx->props && !(ctx->props = CFDictionaryCreateMutableCopy(0, 0, assertion->props)))
+        return;
+    CFDictionarySetValue(ctx->props, key, value);
+}
 
-    
+/*
+ * Charges one create or property change against the limits of 'proc'.
+ * A create past gProcessAssertionLimit live assertions is refused with
+ * kIOPMAssertionReturnQuotaExceeded, and any call with the process's
+ * token bucket empty with kIOPMAssertionReturnRateLimited. powerd's own
+ * assertions are never limited.
+ */
+static IOReturn chargeProcessCall(processInfo_t *proc, bool create)
+{
+    if (proc->pid == getpid())
+        return kIOReturnSuccess;
+
+    if (create && gProcessAssertionLimit && (proc->refCnt >= gProcessAssertionLimit)) {
+        gQuotaRejectCnt++;
+        return kIOPMAssertionReturnQuotaExceeded;
+    }
+
+    if (gProcessCallRate
+        && !takeRateToken(&proc->callsFullAt, getMonotonicTimeNS(), gProcessCallRate, gProcessCallBurst))
+    {
+        gRateRejectCnt++;
+        return kIOPMAssertionReturnRateLimited;
+    }
+
+    return kIOReturnSuccess;
 }
 
 static IOReturn doSetProperties(pid_t pid, 
@@ -2285,6 +3626,8 @@ static IOReturn doSetProperties(pid_t pid,
 {
     assertion_t                 *assertion = NULL;
     assertionType_t             *assertType;
+    processInfo_t               *proc;
+    setPropertiesContext_t      ctx;
     uint32_t                    oldState;
 
     IOReturn                    ret;
@@ -2297,22 +3640,47 @@ static IOReturn doSetProperties(pid_t pid,
     if ((kIOReturnSuccess != ret)) {
         return ret;
     }
+
+    if ((proc = processInfoGet(pid)) && ((ret = chargeProcessCall(proc, false)) != kIOReturnSuccess)) {
+        return ret;
+    }
+
+    // Checked against what the properties could grow to, before any is applied
+    if (gPropertyLimit && (assertion->propBytes + propertyBytes(inProps) > gPropertyLimit)) {
+        return kIOPMAssertionReturnPropertiesTooLarge;
+    }
     
     assertion->mods = 0;
     assertType = &gAssertionTypes[assertion->kassert];
     oldState = assertion->state;
+    ctx.assertion = assertion;
+    ctx.props = NULL;
     CFDictionaryApplyFunction(inProps, forwardPropertiesToAssertion,
-                assertion);
+                &ctx);
+    if (ctx.props) {
+        storeProperties(assertion, ctx.props);
+        CFRelease(ctx.props);
+    }
+    // Properties may change without the assertion moving between lists
+    BUMP_GENERATION(gAssertionsGeneration);
 
     if (assertion->mods & kAssertionModType) 
     {
-        /* Release the assertion completely */
-        /* And add it again as if this is a new assertion */
-        releaseAssertion(assertion, true);
-        assertion->state = 0;
-        assertion->kassert = 0;
-        raiseAssertion(assertion);
-        notify_post( kIOPMAssertionsAnyChangedNotifyString );
+        /* Release the assertion completely under the old type */
+        /* And add it again as if this is a new assertion of the new type */
+        if ( (assertion->kassert == kPreventDisplaySleepIndex) && (assertion->pid != getpid()))
+            delayDisplayTurnOff( );
+
+        // A level change in the same call moved the state, not the lists
+        assertion->state &= ~(kAssertionStateTimed|kAssertionStateInactive);
+        assertion->state |= oldState & (kAssertionStateTimed|kAssertionStateInactive);
+
+        changeAssertionType(assertion, ctx.kassert);
+        assertion->typeToken = ctx.typeToken;
+        assertion->createDate = CFAbsoluteTimeGetCurrent();
+        if ( !(assertion->state & kAssertionStateInactive) )
+            mt2RecordAssertionEvent(kAssertionOpRaise, assertion);
+        postAssertionsChanged();
         return kIOReturnSuccess;
     }
 
@@ -2336,6 +3704,7 @@ static IOReturn doSetProperties(pid_t pid,
                 (*assertType->handler)(assertType, kAssertionOpRelease);
 
             logASLAssertionEvent(kPMASLAssertionActionTurnOff, assertion);
+            recordAssertionEvent(kIOPMAssertionEventTurnedOff, assertion);
         }
         else 
         {
@@ -2343,8 +3712,9 @@ static IOReturn doSetProperties(pid_t pid,
             removeInactiveAssertion(assertion, assertType);
             raiseAssertion(assertion);
             logASLAssertionEvent(kPMASLAssertionActionTurnOn, assertion);
+            recordAssertionEvent(kIOPMAssertionEventTurnedOn, assertion);
         }
-        notify_post( kIOPMAssertionsAnyChangedNotifyString );
+        postAssertionsChanged();
         return kIOReturnSuccess;
     }
 
@@ -2388,123 +3758,12 @@ static IOReturn doSetProperties(pid_t pid,
 
     }
 
-    notify_post( kIOPMAssertionsAnyChangedNotifyString );
+    postAssertionsChanged();
     return kIOReturnSuccess;    
 }
 
 
 
-/*
- * Check for active assertions of the specified type and also for active
- * assertions of linked types.
- * Returns true if active assertions exist either in the specified type or
- * in the linked  types to the specified type.
- */
-bool checkForActives(assertionType_t *assertType, bool *existsInThisType )
-{
-    bool activeExists = false;
-    uint32_t idx = 0, linked = assertType->linkedTypes;
-
-    /* 
-     * Check for active assertions in this assertionType's 'active' & 'activeTimed' lists 
-     * This assertion type shouldn't be disabled using 'kAssertionTypeDisabled' flag
-     */
-    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) && ( _getPowerSource() == kBatteryPowered) )
-        activeExists = (!(assertType->flags & kAssertionTypeDisabled) && (assertType->validOnBattCount > 0));
-    else
-        activeExists = (LIST_FIRST(&assertType->active) || LIST_FIRST(&assertType->activeTimed)) &&
-                        !(assertType->flags & kAssertionTypeDisabled);
-
-    if (existsInThisType) 
-        *existsInThisType = activeExists;
-    if (activeExists) return true;
-
-    /* Check for active ones in the linked assertion types */
-    for ( ; linked !=0; linked >>=1, idx++) {
-        if ((linked & 1) == 0) continue;
-
-        assertType = &gAssertionTypes[idx];
-
-    if ( (assertType->flags & kAssertionTypeNotValidOnBatt) && ( _getPowerSource() == kBatteryPowered) )
-        activeExists |= (!(assertType->flags & kAssertionTypeDisabled) && (assertType->validOnBattCount > 0));
-    else
-        activeExists |= ((LIST_FIRST(&assertType->active) || LIST_FIRST(&assertType->activeTimed)) &&
-                        !(assertType->flags & kAssertionTypeDisabled) );
-
-        if (activeExists) return true;
-    }
-
-    return activeExists;
-}
-
-/*
- * Checks if there are assertions preventing system going from S0dark to S3.
- * Returns true if S3 sleep is prevented.
- */
-__private_extern__ bool systemBlockedInS0Dark( )
-{
-
-   /* PreventSystemSleep assertion and its linked types are the only ones
-    * that can keep the system in S0dark.
-    */
-   return checkForActives(&gAssertionTypes[kPreventSleepIndex], NULL);
-}
-
-/*
- * Check for active assertions of the specified type.
- * Returns true if specified type assertions are active
- */
-__private_extern__ bool checkForActivesByType(kerAssertionType type)
-{
-   bool activesForTheType = false;
-
-   checkForActives(&gAssertionTypes[type], &activesForTheType);
-   return activesForTheType;
-}
-
-/*
- * Check for assertions of the specified type, even if assertion type is disabled.
- * Returns true if there any assertions of specified type raised
- */
-__private_extern__ bool checkForEntriesByType(kerAssertionType type)
-{
-    assertionType_t *assertType = &gAssertionTypes[type];
-
-    if (LIST_FIRST(&assertType->active) || LIST_FIRST(&assertType->activeTimed))
-        return true;
-
-    return false;
-}
-
-/* Disable the specified assertion type */
-__private_extern__ void disableAssertionType(kerAssertionType type)
-{
-   gAssertionTypes[type].flags |= kAssertionTypeDisabled;
-   if (gAssertionTypes[type].handler)
-      gAssertionTypes[type].handler(&gAssertionTypes[type], kAssertionOpEval);
-}
-
-/* Enablee the specified assertion type */
-__private_extern__ void enableAssertionType(kerAssertionType type)
-{
-   gAssertionTypes[type].flags &= ~kAssertionTypeDisabled;
-   if (gAssertionTypes[type].handler)
-      gAssertionTypes[type].handler(&gAssertionTypes[type], kAssertionOpEval);
-}
-
-static inline void updateAggregates(assertionType_t *assertType, bool activesForTheType)
-{
-    if (activesForTheType) {
-        SET_AGGREGATE_LEVEL(assertType->kassert,  1 );
-    }
-    else  {
-        if (LEVEL_FOR_BIT(assertType->kassert) && assertType->globalTimeout) {
-           resetGlobalTimer(assertType, 0);
-        }
-        SET_AGGREGATE_LEVEL(assertType->kassert,  0 );
-    }
-}
-
 static void modifySettings(assertionType_t *assertType, assertionOps op)
 {
     bool    activeExists;
@@ -2566,50 +3825,16 @@ static void modifySettings(assertionType_t *assertType, assertionOps op)
     }
 
     activateSettingOverrides();
-    notify_post( kIOPMAssertionsChangedNotifyString );
-    return;
-}
-
-void handleBatteryAssertions(assertionType_t *assertType, assertionOps op)
-{
-    bool    activeExists;
-
-    if (op == kAssertionOpEval)
-        return; // Nothing to evaluate
-
-    activeExists = checkForActives(assertType, NULL);
-
-    if (op == kAssertionOpRaise) {
-        /* 
-         * if already raised with kernel or if there are no active ones,
-         * nothing to do
-         */
-        if ( LEVEL_FOR_BIT(assertType->kassert) || !activeExists )
-            return;
-        SET_AGGREGATE_LEVEL(assertType->kassert, 1);
-    }
-    else {
-        /*
-         * If this assertionType is not raised with kernel
-         * or if there are active ones, nothing to do
-         */
-        if ( !LEVEL_FOR_BIT(assertType->kassert) || activeExists)
-            return;
-
-        SET_AGGREGATE_LEVEL(assertType->kassert, 0);
-    }
-
-    switch(assertType->kassert) {
-        case kDisableInflowIndex:
-            sendSmartBatteryCommand( kSBUCInflowDisable, 
-                    op == kAssertionOpRaise ? 1 : 0);
-            break;
+    postAssertionLevelsChanged();
+    return;
+}
 
-        case kInhibitChargeIndex:
-            sendSmartBatteryCommand( kSBUCChargeInhibit, 
-                    op == kAssertionOpRaise ? 1 : 0);
-            break;
+void handleBatteryAssertions(assertionType_t *assertType, assertionOps op)
+{
+    if (!setBatteryAssertionLevel(assertType, op))
+        return;
 
+    switch(assertType->kassert) {
         case kDisableWarningsIndex:
             _setRootDomainProperty( CFSTR("BatteryWarningsDisabled"), kCFBooleanTrue);
             break;
@@ -2622,50 +3847,26 @@ void handleBatteryAssertions(assertionType_t *assertType, assertionOps op)
             break;
     }
 
-    notify_post( kIOPMAssertionsChangedNotifyString );
+    postAssertionLevelsChanged();
     return;
 }
 
+/*
+ * Handler for the assertion types backed by a kernel assertion bit. Acts on
+ * the display, clamshell and fan state that go with raising the type, then
+ * lets setKernelAssertionBits() update the bits sent to the kernel.
+ */
 void setKernelAssertions(assertionType_t *assertType, assertionOps op)
 {
-    uint32_t    assertBit = 0;
-    bool    activeExists, activesForTheType;
-
-    /* 
-     * active assertions exists if one of the active list is not empty and
-     * the assertion is not globally disabled.
-     */
-    activeExists = checkForActives(assertType, &activesForTheType);
+    bool    activesForTheType = false;
 
-    switch(assertType->kassert) {
+    checkForActives(assertType, &activesForTheType);
 
-        case kPushServiceTaskIndex:
 #if LOG_SLEEPSERVICES
-           if ( !activesForTheType && LEVEL_FOR_BIT(assertType->kassert) )
-                 logASLMessageSleepServiceTerminated(assertType->forceTimedoutCnt);
+    if ( (assertType->kassert == kPushServiceTaskIndex) &&
+         !activesForTheType && LEVEL_FOR_BIT(assertType->kassert) )
+        logASLMessageSleepServiceTerminated(assertType->forceTimedoutCnt);
 #endif
-            assertBit = kIOPMDriverAssertionCPUBit;
-            break;
-
-        case kPreventSleepIndex:
-        case kBackgroundTaskIndex:
-            assertBit = kIOPMDriverAssertionCPUBit;
-            break;
-
-        case kDeclareUserActivity:
-        case kPreventDisplaySleepIndex:
-            assertBit = kIOPMDriverAssertionPreventDisplaySleepBit;
-            break;
-
-        case kExternalMediaIndex:
-            assertBit = kIOPMDriverAssertionExternalMediaMountedBit;
-            break;
-
-        default:
-            return;
-    }
-
-    updateAggregates(assertType, activesForTheType);
 
     if (op == kAssertionOpRaise)  {
 
@@ -2682,25 +3883,10 @@ void setKernelAssertions(assertionType_t *assertType, assertionOps op)
         if ( (assertType->kassert == kPreventSleepIndex) && activesForTheType)
             _unclamp_silent_running();
 #endif
-        /*
-         * if already raised with kernel or if there are no active ones,
-         * nothing to do
-         */
-        if ( (kerAssertionBits & assertBit) || !activeExists )
-            return;
-
     }
     else if (op == kAssertionOpRelease)  {
         if ((assertType->kassert == kDeclareUserActivity) && (assertType->lidSleepCount == 0)) 
            setClamshellSleepState(0);
-
-        /*
-         * If this assertionType is not raised with kernel
-         * or if there are active ones, nothing to do
-         */
-        if ( !(kerAssertionBits & assertBit) || activeExists)
-            return;
-
     }
     else { // op == kAssertionOpEval
 
@@ -2708,24 +3894,10 @@ void setKernelAssertions(assertionType_t *assertType, assertionOps op)
         if ( (assertType->kassert == kPreventSleepIndex) && activesForTheType)
             _unclamp_silent_running();
 #endif
-        if (activeExists && (kerAssertionBits & assertBit))
-            return;
-        else if ( !activeExists && !(kerAssertionBits & assertBit) )
-            return;
     }
 
-
-
-
-    if (activeExists) {
-        kerAssertionBits |= assertBit;
-        sendUserAssertionsToKernel(kerAssertionBits);
-    }
-    else {
-        kerAssertionBits &= ~assertBit;
-        sendUserAssertionsToKernel(kerAssertionBits);
-    }
-    notify_post( kIOPMAssertionsChangedNotifyString );
+    if (setKernelAssertionBits(assertType, op))
+        postAssertionLevelsChanged();
 }
 
 static void enableIdleHandler(assertionType_t *assertType, assertionOps op)
@@ -2774,10 +3946,14 @@ static void enableIdleHandler(assertionType_t *assertType, assertionOps op)
 
     }
 
-    notify_post( kIOPMAssertionsChangedNotifyString );
+    postAssertionLevelsChanged();
 }
 
-void enforceAssertionTypeTimeCap(assertionType_t *assertType)
+/*
+ * Fires on gDeadlineTimer once the global time cap of 'assertType' is up.
+ * Releases every active assertion of the type, timed or not.
+ */
+__private_extern__ void enforceAssertionTypeTimeCap(assertionType_t *assertType)
 {
     assertion_t *assertion = NULL;
 
@@ -2789,22 +3965,23 @@ void enforceAssertionTypeTimeCap(assertionType_t *assertType)
         insertInactiveAssertion(assertion, assertType);
         assertType->forceTimedoutCnt++;
         logASLAssertionEvent(kPMASLAssertionActionTimeOut, assertion);
+        recordAssertionEvent(kIOPMAssertionEventTimedOut, assertion);
         mt2RecordAssertionEvent(kAssertionOpGlobalTimeout, assertion);
     }
 
     /* Timeout all timed assertions */
     while( (assertion = LIST_FIRST(&assertType->activeTimed)) )
     {
-        LIST_REMOVE(assertion, link);
-        assertion->state &= ~kAssertionStateTimed;
+        unlinkTimedAssertion(assertion, assertType);
 
         insertInactiveAssertion(assertion, assertType);
         assertType->forceTimedoutCnt++;
         logASLAssertionEvent(kPMASLAssertionActionTimeOut, assertion);
+        recordAssertionEvent(kIOPMAssertionEventTimedOut, assertion);
         mt2RecordAssertionEvent(kAssertionOpGlobalTimeout, assertion);
     }
 
-    resetAssertionTimer(assertType);
+    armAssertionTimer();
 
     if (assertType->handler)
         (*assertType->handler)(assertType, kAssertionOpRelease);
@@ -2815,145 +3992,182 @@ void enforceAssertionTypeTimeCap(assertionType_t *assertType)
     logASLAssertionsAggregate();
 }
 
-void resetGlobalTimer(assertionType_t *assertType, uint64_t timeout)
+static IOReturn raiseAssertion(assertion_t *assertion)
 {
+    IOReturn            ret;
 
-    assertType->globalTimeout = timeout;
-    if (assertType->globalTimeout == 0) {
-        if ( assertType->globalTimer)
-            dispatch_source_cancel(assertType->globalTimer);
-        return;
-    }
-
-    if (assertType->globalTimer == NULL) {
-        assertType->globalTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    /* Attach the Create Time */
+    assertion->createDate = CFAbsoluteTimeGetCurrent();
 
-        dispatch_source_set_event_handler(assertType->globalTimer, ^{
-            enforceAssertionTypeTimeCap(assertType);
-        });
-    
-        dispatch_source_set_cancel_handler(assertType->globalTimer, ^{
-            dispatch_release(assertType->globalTimer);
-            assertType->globalTimer = NULL;
-        });
-    
-    }
-    else {
-         dispatch_suspend(assertType->globalTimer);
-    }
+    ret = activateAssertion(assertion);
 
-    dispatch_source_set_timer(assertType->globalTimer, 
-            dispatch_time(DISPATCH_TIME_NOW, assertType->globalTimeout * NSEC_PER_SEC), 
-            DISPATCH_TIME_FOREVER, 0);
-    dispatch_resume(assertType->globalTimer);
+    if ( (kIOReturnSuccess == ret) && !(assertion->state & kAssertionStateInactive) )
+        mt2RecordAssertionEvent(kAssertionOpRaise, assertion);
 
+    return ret;
 }
 
 
-static IOReturn raiseAssertion(assertion_t *assertion)
+/*
+ * Creating an assertion takes three steps, so that a batch can take every
+ * step that may fail, for all of its assertions, before any is raised.
+ * newAssertion() decodes the properties into a new assertion_t,
+ * admitAssertion() charges it to its process and gives it an ID, and
+ * commitAssertion() raises it and makes it visible. Before it is
+ * committed, discardAssertion() takes it back without a trace: nothing is
+ * logged, recorded or sent to a handler.
+ */
+static IOReturn newAssertion(
+    CFMutableDictionaryRef  newProperties,
+    assertion_t             **outAssertion)
 {
-    int                 idx = -1;
-    int                 level;
-    bool                isFirstOne;
-    uint64_t            currTime = getMonotonicTime();
-    uint32_t            levelInt = 0;
-    CFDateRef           start_date = NULL;
-    CFStringRef         assertionTypeRef;
-    CFNumberRef         numRef = NULL;
-    CFNumberRef         levelNum = NULL;
-    CFTimeInterval      timeout = 0;
-    assertionType_t     *assertType;
-    uint64_t            assertion_id_64;
-
+    assertion_t             *assertion = NULL;
+    uint8_t                 token;
+    int                     idx;
 
-    assertionTypeRef = CFDictionaryGetValue(assertion->props, kIOPMAssertionTypeKey);
+    *outAssertion = NULL;
 
-    /* Find index for this assertion type */
-    idx = getAssertionTypeIndex(assertionTypeRef);
-    if (idx < 0 )
+    token = getTypeToken(CFDictionaryGetValue(newProperties, kIOPMAssertionTypeKey));
+    if ((idx = getTypeIndexForToken(token)) < 0)
         return kIOReturnBadArgument;
-    assertType = &gAssertionTypes[idx];
+
+    assertion = calloc(1, sizeof(assertion_t));
+    if (assertion == NULL)
+        return kIOReturnNoMemory;
+
     assertion->kassert = idx;
+    assertion->typeToken = token;
+    assertion->retainCnt = 1;
+    takeTypedProperties(assertion, newProperties);
 
-    assertion_id_64 = ((uint64_t)idx << 32) | assertion->assertionId;
-    CFNumberRef uniqueAID = CFNumberCreate(0, kCFNumberSInt64Type, &assertion_id_64);
-    if (uniqueAID) {
-        CFDictionarySetValue(assertion->props, kIOPMAssertionGlobalUniqueIDKey, uniqueAID);
-        CFRelease(uniqueAID);
+    if (gPropertyLimit && (propertyBytes(newProperties) > gPropertyLimit)) {
+        free(assertion);
+        return kIOPMAssertionReturnPropertiesTooLarge;
     }
 
-    /* Attach the Create Time */
-    start_date = CFDateCreate(0, CFAbsoluteTimeGetCurrent());
-    if (start_date) {
-        CFDictionarySetValue(assertion->props, kIOPMAssertionCreateDateKey, start_date);
-        CFRelease(start_date);
+    // Not charged to a process until admitAssertion()
+    assertion->props = CFPropertyListCreateDeepCopy(0, newProperties, kCFPropertyListImmutable);
+    if (!assertion->props) {
+        free(assertion);
+        return kIOReturnNoMemory;
     }
-    assertion->createTime = currTime;
+    assertion->propBytes = propertyBytes(assertion->props);
 
+    *outAssertion = assertion;
+    return kIOReturnSuccess;
+}
 
-    /* Is level set to 0 */
-    numRef = CFDictionaryGetValue(assertion->props, kIOPMAssertionLevelKey);
-    if (isA_CFNumber(numRef)) {
-        CFNumberGetValue(numRef, kCFNumberIntType, &level);
-        if (level == kIOPMAssertionLevelOff) {
-            /* Dump this assertion in inactive list */
-            insertInactiveAssertion(assertion, assertType);
-            goto exit;
+static IOReturn admitAssertion(pid_t pid, assertion_t *assertion)
+{
+    dispatch_source_t       proc_exit_source = NULL;
+    processInfo_t           *proc = NULL;
+    IOReturn                result = kIOReturnSuccess;
+
+    // Take a reference on the process record. The first assertion of a
+    // process creates it, along with a dispatch handler for process exit.
+    if ( (proc = processInfoGet(pid)) ) {
+        if ((result = chargeProcessCall(proc, true)) != kIOReturnSuccess) {
+            return result;
         }
+        proc->refCnt++;
     }
     else {
-        /* If level is not set, set it to On */
-        levelInt = kIOPMAssertionLevelOn;
-        levelNum = CFNumberCreate(0, kCFNumberIntType, &levelInt);
-        CFDictionarySetValue(assertion->props, kIOPMAssertionLevelKey, levelNum);
-        CFRelease(levelNum);
-    }
+        proc_exit_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC, pid, DISPATCH_PROC_EXIT, dispatch_get_main_queue());
+        if (!proc_exit_source) {
+            return kIOReturnNoMemory;
+        }
 
-    /* Check if this is appplicable on battery power also */
-    if (assertType->flags & kAssertionTypeNotValidOnBatt) {
-        CFBooleanRef    val = NULL;
-        val = CFDictionaryGetValue(assertion->props, kIOPMAssertionAppliesToLimitedPowerKey);
-        if (isA_CFBoolean(val) && (val == kCFBooleanTrue)) {
-            assertion->state |= kAssertionStateValidOnBatt;
+        dispatch_source_set_event_handler(proc_exit_source, ^{
+            HandleProcessExit(pid);
+        });
+        
+        dispatch_source_set_cancel_handler(proc_exit_source, ^{
+            dispatch_release(proc_exit_source);
+        });
+        
+        proc = processInfoCreate(pid, proc_exit_source);
+        if (!proc) {
+            dispatch_source_cancel(proc_exit_source);
+            dispatch_resume(proc_exit_source);
+            return kIOReturnNoMemory;
         }
+        dispatch_resume(proc_exit_source);
+
+        // A new record starts with a full token bucket, and no assertions
+        chargeProcessCall(proc, true);
     }
 
-    if (assertion->kassert == kDeclareUserActivity) {
-        CFBooleanRef    val = NULL;
-        val = CFDictionaryGetValue(assertion->props, kIOPMAssertionAppliesOnLidClose);
-        if (isA_CFBoolean(val) && (val == kCFBooleanTrue)) {
-            assertion->state |= kAssertionLidStateModifier;
-        }
+    // Generate an id
+    if (!allocAssertionSlot(assertion)) {
+        processInfoRelease(pid);
+        return kIOReturnNoMemory;
     }
 
-    isFirstOne = (LIST_FIRST(&assertType->active) == NULL) && 
-                        (LIST_FIRST(&assertType->activeTimed) == NULL);
-            
-    /* Is this timed */
-    numRef = CFDictionaryGetValue(assertion->props, kIOPMAssertionTimeoutKey);
-    if (isA_CFNumber(numRef)) 
-        CFNumberGetValue(numRef, kCFNumberDoubleType, &timeout);
-    if (timeout) {
+    assertion->pid = pid;
+    proc->propBytes += assertion->propBytes;
 
-        assertion->timeout = (uint64_t)timeout+currTime; // Absolute time at which assertion expires
-        insertTimedAssertion(assertion, assertType, true);
+    return kIOReturnSuccess;
+}
+
+static void discardAssertion(assertion_t *assertion)
+{
+    processInfo_t           *proc;
+
+    if (assertion->assertionId != kIOPMNullAssertionID) {
+        freeAssertionSlot(assertion);
+        if ((proc = processInfoGet(assertion->pid)))
+            proc->propBytes -= assertion->propBytes;
+        processInfoRelease(assertion->pid);
     }
-    else {
-        /* Insert into active assertion list */
-        insertActiveAssertion(assertion, assertType);
+
+    if (assertion->props) CFRelease(assertion->props);
+    free(assertion);
+}
+
+static IOReturn commitAssertion(assertion_t *assertion, IOPMAssertionID *assertion_id)
+{
+    processInfo_t           *proc = processInfoGet(assertion->pid);
+    IOReturn                result;
+
+    result = raiseAssertion(assertion);
+    if (result != kIOReturnSuccess) {
+        discardAssertion(assertion);
+        return result;
     }
 
+    LIST_INSERT_HEAD(&proc->assertions, assertion, pidLink);
+    proc->createCnt++;
+    recordAssertionEvent(kIOPMAssertionEventCreated, assertion);
 
-    if (assertType->handler)
-        (*assertType->handler)(assertType, kAssertionOpRaise);
+    if ( (gDebugFlags & kIOPMDebugLogAssertionSynchronous) ||
+          (assertion->kassert == kDeclareUserActivity) ||
+          (assertion->kassert == kPreventSleepIndex) )
+        logASLAssertionEvent(kPMASLAssertionActionCreate, assertion);
+    else
+        queueAssertionForLog(assertion);
 
-    mt2RecordAssertionEvent(kAssertionOpRaise, assertion);
-    
-exit:
-    return kIOReturnSuccess;
+    postAssertionsChanged();
+
+    *assertion_id = assertion->assertionId;
 
+    return result;
 }
 
+/* Admits and commits an assertion from newAssertion(), or discards it */
+static IOReturn createAssertion(pid_t pid, assertion_t *assertion, IOPMAssertionID *assertion_id)
+{
+    IOReturn                result = kIOReturnSuccess;
+
+    // assertion_id will be set to kIOPMNullAssertionID on failure.
+    *assertion_id = kIOPMNullAssertionID;
+
+    if ((result = admitAssertion(pid, assertion)) != kIOReturnSuccess) {
+        discardAssertion(assertion);
+        return result;
+    }
+
+    return commitAssertion(assertion, assertion_id);
+}
 
 IOReturn doCreate(
     pid_t                   pid,
@@ -2961,76 +4175,68 @@ IOReturn doCreate(
     IOPMAssertionID         *assertion_id
 ) 
 {
-    int                     i;
-    dispatch_source_t       proc_exit_source = NULL;
     assertion_t             *assertion = NULL;
-    assertion_t             *tmp_a = NULL;
     IOReturn                result = kIOReturnSuccess;
 
-
     // assertion_id will be set to kIOPMNullAssertionID on failure.
     *assertion_id = kIOPMNullAssertionID;
 
+    if ((result = newAssertion(newProperties, &assertion)) != kIOReturnSuccess)
+        return result;
 
-    // Create a dispatch handler for process exit, if there isn't one
-    if ( !processInfoRetain(pid) ) {
+    return createAssertion(pid, assertion, assertion_id);
+}
 
-        if (( proc_exit_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC, pid, DISPATCH_PROC_EXIT, dispatch_get_main_queue()))) 
-        {
-            dispatch_source_set_event_handler(proc_exit_source, ^{
-                HandleProcessExit(pid);
-            });
-            
-            dispatch_source_set_cancel_handler(proc_exit_source, ^{
-                dispatch_release(proc_exit_source);
-            });
-            
-            processInfoCreate(pid, proc_exit_source);
-            dispatch_resume(proc_exit_source);
-        }
-    }
+/* Returns a CFNumber for an assertion level, shared for the two usual levels */
+static CFNumberRef copyLevelNumber(int level)
+{
+    static CFNumberRef  levelOn = NULL;
+    static CFNumberRef  levelOff = NULL;
+    CFNumberRef         *shared = NULL;
+
+    if (level == kIOPMAssertionLevelOn)
+        shared = &levelOn;
+    else if (level == kIOPMAssertionLevelOff)
+        shared = &levelOff;
+    else
+        return CFNumberCreate(0, kCFNumberIntType, &level);
 
-    // Generate an id
-    for (i=gNextAssertionIdx; CFDictionaryGetValueIfPresent(gAssertionsArray, 
-                              (void *)i, (const void **)&tmp_a) == true; ) {
-        i = (i+1) % kMaxAssertions;
-        if (i == gNextAssertionIdx) break;
-    }
-    if (CFDictionaryGetValueIfPresent(gAssertionsArray, (void *)i, (const void **)&tmp_a) == true) 
-        return kIOReturnNoMemory;
+    if (!*shared)
+        *shared = CFNumberCreate(0, kCFNumberIntType, &level);
 
-    assertion = calloc(1, sizeof(assertion_t));
-    if (assertion == NULL) {
-        return kIOReturnNoMemory;
-    }
-    assertion->pid = pid;
-    assertion->props = newProperties;
-    CFRetain(newProperties);
-    assertion->retainCnt = 1;
+    return *shared ? CFRetain(*shared) : NULL;
+}
 
-    assertion->assertionId = ID_FROM_INDEX(i);
-    CFDictionarySetValue(gAssertionsArray, (void *)i, (const void *)assertion);
-    gNextAssertionIdx = (i+1) % kMaxAssertions;
+/*
+ * Builds the property dictionary clients see for an assertion: what the
+ * client sent, plus the properties kept in assertion_t fields.
+ */
+static CFMutableDictionaryRef copyAssertionProperties(assertion_t *assertion)
+{
+    CFMutableDictionaryRef  dict;
+    CFNumberRef             levelNum;
+    uint64_t                uniqueID = ASSERTION_UNIQUE_ID(assertion);
 
-    result = raiseAssertion(assertion);
-    if (result != kIOReturnSuccess) {
-        CFDictionaryRemoveValue(gAssertionsArray, (void *)i);
-        CFRelease(assertion->props);
-        free(assertion);
+    dict = CFDictionaryCreateMutableCopy(0, 0, assertion->props);
+    if (!dict)
+        return NULL;
 
-        return result;
+    if ((levelNum = copyLevelNumber(assertion->level))) {
+        CFDictionarySetValue(dict, kIOPMAssertionLevelKey, levelNum);
+        CFRelease(levelNum);
     }
+    setDictNumber(dict, kIOPMAssertionGlobalUniqueIDKey, kCFNumberSInt64Type, &uniqueID);
+    if (assertion->timeoutSecs)
+        setDictNumber(dict, kIOPMAssertionTimeoutKey, kCFNumberDoubleType, &assertion->timeoutSecs);
+    setDictDate(dict, kIOPMAssertionCreateDateKey, assertion->createDate);
+    setDictDate(dict, kIOPMAssertionTimedOutDateKey, assertion->timedOutDate);
+    if (assertion->flags & kAssertionFlagAppliesToLimitedPower)
+        CFDictionarySetValue(dict, kIOPMAssertionAppliesToLimitedPowerKey, kCFBooleanTrue);
+    if (assertion->flags & kAssertionFlagAppliesOnLidClose)
+        CFDictionarySetValue(dict, kIOPMAssertionAppliesOnLidClose, kCFBooleanTrue);
+    setDictValue(dict, kIOPMAssertionProcessNameKey, processInfoGetName(assertion->pid));
 
-    if ( (gDebugFlags & kIOPMDebugLogAssertionSynchronous) ||
-          (assertion->kassert == kDeclareUserActivity) ||
-          (assertion->kassert == kPreventSleepIndex) )
-        logASLAssertionEvent(kPMASLAssertionActionCreate, assertion);
-
-    notify_post( kIOPMAssertionsAnyChangedNotifyString );
-
-    *assertion_id = assertion->assertionId;
-
-    return result;
+    return dict;
 }
 
 static void copyAssertion(assertion_t *assertion, CFMutableDictionaryRef assertionsDict)
@@ -3039,7 +4245,7 @@ static void copyAssertion(assertion_t *assertion, CFMutableDictionaryRef asserti
     CFNumberRef             pidCF = NULL;
     CFMutableDictionaryRef  processDict = NULL;
     CFMutableArrayRef       pidAssertionsArr = NULL;
-    CFStringRef             processName = NULL;
+    CFMutableDictionaryRef  props = NULL;
 
     pidCF = CFNumberCreate(0, kCFNumberIntType, &assertion->pid);
 
@@ -3066,11 +4272,10 @@ static void copyAssertion(assertion_t *assertion, CFMutableDictionaryRef asserti
         pidAssertionsArr = (CFMutableArrayRef)CFDictionaryGetValue(processDict, CFSTR("PerTaskAssertions"));
     }
 
-    processName = processInfoGetName(assertion->pid);
-    if (processName) {
-        CFDictionarySetValue(assertion->props, kIOPMAssertionProcessNameKey, processName);
+    if ((props = copyAssertionProperties(assertion))) {
+        CFArrayAppendValue(pidAssertionsArr, props);
+        CFRelease(props);
     }
-    CFArrayAppendValue(pidAssertionsArr, assertion->props);
     CFRelease(pidCF);
 
     if (created) {
@@ -3123,6 +4328,140 @@ static CFArrayRef copyPIDAssertionDictionaryFlattened(void)
     return returnArray;
 }
 
+/*
+ * Published snapshots
+ *
+ * io_pm_assertion_copy_details is served by a pool of reader threads (see
+ * pm_mig_demux()), while everything else in this file runs on the main
+ * queue. Readers of the assertion list, the aggregate status and the
+ * timed out list share a serialized reply, built on the main queue on the
+ * first read after its source changes. Publishing swaps the pointer in
+ * gPublished under gPublishedLock, and a superseded reply is freed once
+ * its last reader drops it.
+ *
+ * A reader that finds the reply older than the source generation it read
+ * waits for a rebuild, so a client always sees its own earlier changes.
+ * Readers that arrive while a rebuild is queued wait for that one, so a
+ * burst of readers costs the main queue a single rebuild, not one block
+ * per reader.
+ */
+
+static void performOnMainQueue(dispatch_block_t block)
+{
+    if (pthread_main_np())
+        block();
+    else
+        dispatch_sync(dispatch_get_main_queue(), block);
+}
+
+/* Any thread */
+static uint64_t publishedSourceGeneration(publishedKind kind)
+{
+    uint64_t        generation = 0;
+
+    switch (kind) {
+        case kPublishedAssertions:  return LOAD_GENERATION(gAssertionsGeneration);
+        case kPublishedStatus:      getAggregateAssertions(&generation); return generation;
+        case kPublishedTimedOut:    return LOAD_GENERATION(gTimedOutGeneration);
+        default:                    return 0;
+    }
+}
+
+/* Called with gPublishedLock held */
+static CFDataRef copyPublishedDataLocked(publishedKind kind, uint64_t generation)
+{
+    if (gPublished[kind].data && (gPublished[kind].generation >= generation))
+        return CFRetain(gPublished[kind].data);
+    return NULL;
+}
+
+/* Main queue only */
+static CFDataRef publishData(publishedKind kind)
+{
+    CFTypeRef       collection = NULL;
+    CFDataRef       data, old;
+    uint64_t        generation = publishedSourceGeneration(kind);
+
+    // Another reader may have got here first
+    pthread_mutex_lock(&gPublishedLock);
+    data = copyPublishedDataLocked(kind, generation);
+    pthread_mutex_unlock(&gPublishedLock);
+    if (data)
+        return data;
+
+    switch (kind) {
+        case kPublishedAssertions:  collection = copyPIDAssertionDictionaryFlattened(); break;
+        case kPublishedStatus:      collection = copyAggregateValuesDictionary(); break;
+        case kPublishedTimedOut:    collection = copyTimedOutAssertionsArray(); break;
+        default:                    break;
+    }
+    if (!collection)
+        return NULL;
+
+    data = CFPropertyListCreateData(0, collection, kCFPropertyListBinaryFormat_v1_0, 0, NULL);
+    CFRelease(collection);
+    if (!data)
+        return NULL;
+
+    CFRetain(data);
+    pthread_mutex_lock(&gPublishedLock);
+    old = gPublished[kind].data;
+    gPublished[kind].data = data;
+    gPublished[kind].generation = generation;
+    pthread_mutex_unlock(&gPublishedLock);
+
+    if (old) CFRelease(old);
+    return data;
+}
+
+/* Main queue only. Runs a rebuild queued by copyPublishedData() */
+static void rebuildPublishedData(publishedKind kind, uint64_t ticket)
+{
+    CFDataRef       data;
+
+    // Readers arriving from here on need a build that starts after them
+    pthread_mutex_lock(&gPublishedLock);
+    gPublished[kind].queued = false;
+    pthread_mutex_unlock(&gPublishedLock);
+
+    data = publishData(kind);
+    if (data) CFRelease(data);
+
+    pthread_mutex_lock(&gPublishedLock);
+    gPublished[kind].doneTicket = ticket;
+    pthread_cond_broadcast(&gPublishedCond);
+    pthread_mutex_unlock(&gPublishedLock);
+}
+
+/* Callable from any thread */
+static CFDataRef copyPublishedData(publishedKind kind)
+{
+    CFDataRef       data;
+    uint64_t        generation, ticket;
+
+    if (pthread_main_np())
+        return publishData(kind);
+
+    pthread_mutex_lock(&gPublishedLock);
+    generation = publishedSourceGeneration(kind);
+    if (!(data = copyPublishedDataLocked(kind, generation))) {
+        if (!gPublished[kind].queued) {
+            ticket = ++gPublished[kind].queuedTicket;
+            gPublished[kind].queued = true;
+            dispatch_async(dispatch_get_main_queue(), ^{ rebuildPublishedData(kind, ticket); });
+        }
+        ticket = gPublished[kind].queuedTicket;
+        while (gPublished[kind].doneTicket < ticket)
+            pthread_cond_wait(&gPublishedCond, &gPublishedLock);
+
+        // NULL only if the rebuild failed
+        data = copyPublishedDataLocked(kind, generation);
+    }
+    pthread_mutex_unlock(&gPublishedLock);
+
+    return data;
+}
+
 static IOReturn copyAssertionForID(
         pid_t inPID, int inID,
         CFMutableDictionaryRef  *outAssertion)
@@ -3141,8 +4480,9 @@ static IOReturn copyAssertionForID(
         goto exit;
     }
 
-    CFRetain(assertion->props);
-    *outAssertion = assertion->props;
+    *outAssertion = copyAssertionProperties(assertion);
+    if (!*outAssertion)
+        ret = kIOReturnNoMemory;
 
 exit:
     return ret;
@@ -3160,7 +4500,7 @@ static IOReturn doRetain(pid_t pid, IOPMAssertionID id)
     }
 
     assertion->retainCnt++;
-    notify_post( kIOPMAssertionsAnyChangedNotifyString );
+    postAssertionsChanged();
 
     return kIOReturnSuccess;
 }
@@ -3195,6 +4535,7 @@ __private_extern__ void evalAllUserActivityAssertions(unsigned int dispSlpTimer)
             assertion->timeout = currTime;
         else
             assertion->timeout += changeInSecs;
+        timedHeapUpdate(assertion);
 
         assertion = LIST_NEXT(assertion, link);
     }
@@ -3212,7 +4553,7 @@ __private_extern__ void evalAllUserActivityAssertions(unsigned int dispSlpTimer)
         insertTimedAssertion(assertion, assertType, false);
         assertion = nextAssertion;
     }
-    updateAssertionTimer(assertType);
+    armAssertionTimer();
 
     if (assertType->handler)
         (*assertType->handler)(assertType, kAssertionOpRelease);
@@ -3245,56 +4586,58 @@ static void   evaluateAssertions(void)
     logASLAssertionsAggregate();
 }
 
-__private_extern__ void setSleepServicesTimeCap(uint32_t  timeoutInMS)
-{
-    assertionType_t *assertType;
-
-    assertType = &gAssertionTypes[kPushServiceTaskIndex];
+#if !TARGET_OS_EMBEDDED
+/*
+ * IDs of assertions waiting for assertionLogger() to log their creation, in
+ * creation order. An assertion released within ASSERTION_LOG_DELAY is never
+ * logged; its ID stays queued until the logger finds it gone.
+ */
+static IOPMAssertionID  *gLogPending        = NULL;
+static uint32_t         gLogPendingCap      = 0;    // Power of 2
+static uint32_t         gLogPendingHead     = 0;
+static uint32_t         gLogPendingTail     = 0;
 
-    // Avoid duplicate resets to 0
-    if ( (timeoutInMS == 0) && (assertType->globalTimeout == 0) )
-        return;
+static void queueAssertionForLog(assertion_t *assertion)
+{
+    IOPMAssertionID     *ids;
+    uint32_t            cnt = gLogPendingTail - gLogPendingHead;
+    uint32_t            newCap, i;
 
-    resetGlobalTimer(assertType, timeoutInMS/1000);
-    if (timeoutInMS == 0) {
-       CFRunLoopPerformBlock(_getPMRunLoop(), kCFRunLoopDefaultMode, 
-                   ^{ enforceAssertionTypeTimeCap(assertType); });
-       CFRunLoopWakeUp(_getPMRunLoop());
-    }
+    if (cnt == gLogPendingCap) {
+        newCap = gLogPendingCap ? (2 * gLogPendingCap) : 256;
+        if ((ids = malloc(newCap * sizeof(IOPMAssertionID))) == NULL)
+            return;
+        for (i = 0; i < cnt; i++)
+            ids[i] = gLogPending[(gLogPendingHead + i) & (gLogPendingCap - 1)];
+        free(gLogPending);
+        gLogPending = ids;
+        gLogPendingCap = newCap;
+        gLogPendingHead = 0;
+        gLogPendingTail = cnt;
+    }
+    gLogPending[gLogPendingTail++ & (gLogPendingCap - 1)] = assertion->assertionId;
 }
 
-
-#if !TARGET_OS_EMBEDDED
 void assertionLogger( )
 {
-    static uint32_t  idxToLog = 0;
     uint64_t         currTime = getMonotonicTime();
-    uint32_t         delay = ASSERTION_LOG_DELAY;
+    uint64_t         delay = ASSERTION_LOG_DELAY;
     assertion_t     *assertion = NULL;
 
-
-    // If synchronous logging is enabled, we don't
-    // have to fo anything here.
-    if (gDebugFlags & kIOPMDebugLogAssertionSynchronous)
-        idxToLog = gNextAssertionIdx;
-
-    while (idxToLog != gNextAssertionIdx)
+    while (gLogPendingHead != gLogPendingTail)
     {
-        if ( (CFDictionaryGetValueIfPresent(gAssertionsArray, 
-                (void *)idxToLog, (const void **)&assertion) == false)
-                || (assertion->state & kAssertionStateLogged) )
-        {
-            idxToLog = (idxToLog+1) % kMaxAssertions;
-            continue;
-        }
-        
-        if ((currTime - assertion->createTime) < ASSERTION_LOG_DELAY)
+        assertion = assertionForID(gLogPending[gLogPendingHead & (gLogPendingCap - 1)]);
+        if (assertion && !(assertion->state & kAssertionStateLogged))
         {
-            delay = currTime - assertion->createTime;
-            break;
+            if ((currTime - assertion->createTime) < ASSERTION_LOG_DELAY)
+            {
+                // Come back when the oldest unlogged assertion is old enough
+                delay = ASSERTION_LOG_DELAY - (currTime - assertion->createTime);
+                break;
+            }
+            logASLAssertionEvent(kPMASLAssertionActionCreate, assertion);
         }
-        logASLAssertionEvent(kPMASLAssertionActionCreate, assertion);
-        idxToLog = (idxToLog+1) % kMaxAssertions;
+        gLogPendingHead++;
     }
 
     dispatch_source_set_timer(logDispatch,
@@ -3308,13 +4651,11 @@ void assertionLogger( )
 __private_extern__ void configAssertionType(kerAssertionType idx, bool initialConfig)
 {
    assertionHandler_f   oldHandler = NULL;
-   CFNumberRef idxRef = NULL;
    uint32_t    oldLinks = 0, newLinks = 0;
    uint32_t    oldFlags, flags, i;
-   kerAssertionType  altIdx;
 
-   // This can get called before gUserAssertionTypesDict is initialized
-   if ( !gUserAssertionTypesDict )
+   // This can get called before PMAssertions_prime()
+   if ( !gTypeTokensReady )
       return;
 
    if (!initialConfig) {
@@ -3326,16 +4667,14 @@ __private_extern__ void configAssertionType(kerAssertionType idx, bool initialCo
    switch(idx) 
    {
       case kHighPerfIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeNeedsCPU, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenNeedsCPU] = idx;
          gAssertionTypes[idx].handler = modifySettings;
          gAssertionTypes[idx].kassert = idx;
          break;
 
       case kPreventIdleIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypePreventUserIdleSystemSleep, idxRef);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeNoIdleSleep, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenPreventUserIdleSystemSleep] = idx;
+         gTypeTokenIndex[kPMWireTypeTokenNoIdleSleep] = idx;
          gAssertionTypes[idx].handler = modifySettings;
          gAssertionTypes[idx].kassert = idx;
          if (!_DWBT_enabled()) {
@@ -3344,54 +4683,47 @@ __private_extern__ void configAssertionType(kerAssertionType idx, bool initialCo
          break;
 
       case kDisableInflowIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeDisableInflow, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenDisableInflow] = idx;
          gAssertionTypes[idx].handler = handleBatteryAssertions;
          gAssertionTypes[idx].kassert = idx;
          break;
 
 
       case kInhibitChargeIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeInhibitCharging, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenInhibitCharging] = idx;
          gAssertionTypes[idx].handler = handleBatteryAssertions;
          gAssertionTypes[idx].kassert = idx;
          break;
 
       case kDisableWarningsIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeDisableLowBatteryWarnings, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenDisableLowBatteryWarnings] = idx;
          gAssertionTypes[idx].handler = handleBatteryAssertions;
          gAssertionTypes[idx].kassert = idx;
          break;
 
       case kPreventDisplaySleepIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypePreventUserIdleDisplaySleep, idxRef);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeNoDisplaySleep, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenPreventUserIdleDisplaySleep] = idx;
+         gTypeTokenIndex[kPMWireTypeTokenNoDisplaySleep] = idx;
          gAssertionTypes[idx].handler = setKernelAssertions;
          newLinks = 1 << kDeclareUserActivity;
          gAssertionTypes[idx].kassert = idx;
          break;
 
       case kEnableIdleIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeEnableIdleSleep, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenEnableIdleSleep] = idx;
          gAssertionTypes[idx].handler = enableIdleHandler;
          gAssertionTypes[idx].kassert = idx;
          break;
 
       case kNoRealPowerSourcesDebugIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeDisableRealPowerSources_Debug, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenDisableRealPowerSources] = idx;
          gAssertionTypes[idx].handler = handleBatteryAssertions;
          gAssertionTypes[idx].kassert = idx;
          break;
 
       case kPreventSleepIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypePreventSystemSleep, idxRef);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeDenySystemSleep, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenPreventSystemSleep] = idx;
+         gTypeTokenIndex[kPMWireTypeTokenDenySystemSleep] = idx;
          gAssertionTypes[idx].flags |= kAssertionTypeNotValidOnBatt;
          gAssertionTypes[idx].handler = setKernelAssertions;
          newLinks = 1 << kPushServiceTaskIndex;
@@ -3401,15 +4733,13 @@ __private_extern__ void configAssertionType(kerAssertionType idx, bool initialCo
          break;
 
       case kExternalMediaIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, _kIOPMAssertionTypeExternalMedia, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenExternalMedia] = idx;
          gAssertionTypes[idx].handler = setKernelAssertions;
          gAssertionTypes[idx].kassert = idx;
          break;
 
       case kDeclareUserActivity:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionUserIsActive, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenUserIsActive] = idx;
          gAssertionTypes[idx].handler = setKernelAssertions;
          newLinks = 1 << kPreventDisplaySleepIndex;
          gAssertionTypes[idx].kassert = idx;
@@ -3417,14 +4747,11 @@ __private_extern__ void configAssertionType(kerAssertionType idx, bool initialCo
 
       case kPushServiceTaskIndex:
          if ( isA_SleepSrvcWake() && _SS_allowed() ) {
-            idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-            CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeApplePushServiceTask, idxRef);
+            gTypeTokenIndex[kPMWireTypeTokenApplePushServiceTask] = idx;
          }
          else {
             /* Set this as an alias to BackgroundTask assertion for non-sleep srvc wakes */
-            altIdx = kBackgroundTaskIndex;
-            idxRef = CFNumberCreate(0, kCFNumberIntType, &altIdx);
-            CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeApplePushServiceTask, idxRef);
+            gTypeTokenIndex[kPMWireTypeTokenApplePushServiceTask] = kBackgroundTaskIndex;
          }
          gAssertionTypes[idx].flags |= kAssertionTypeGloballyTimed ;
          gAssertionTypes[idx].handler = setKernelAssertions;
@@ -3437,8 +4764,7 @@ __private_extern__ void configAssertionType(kerAssertionType idx, bool initialCo
          break;
 
       case kBackgroundTaskIndex:
-         idxRef = CFNumberCreate(0, kCFNumberIntType, &idx);
-         CFDictionarySetValue(gUserAssertionTypesDict, kIOPMAssertionTypeBackgroundTask, idxRef);
+         gTypeTokenIndex[kPMWireTypeTokenBackgroundTask] = idx;
          gAssertionTypes[idx].flags |= kAssertionTypeNotValidOnBatt;
          gAssertionTypes[idx].flags &= ~kAssertionTypeDisabled;
          if (_DWBT_enabled()) {
@@ -3460,8 +4786,6 @@ __private_extern__ void configAssertionType(kerAssertionType idx, bool initialCo
       default:
          return;
    }
-   if (idxRef)
-      CFRelease(idxRef);
 
    if ( (!initialConfig) && (newLinks != oldLinks) ) {
       uint32_t links = newLinks;
@@ -3511,10 +4835,28 @@ PMAssertions_prime(void)
 
     kerAssertionType  idx = 0;
 
-    gAssertionsArray = CFDictionaryCreateMutable(NULL, kMaxAssertions, NULL, NULL);
-    gProcessDict = CFDictionaryCreateMutable(0, 0, NULL, &kCFTypeDictionaryValueCallBacks);
-
-    gUserAssertionTypesDict = CFDictionaryCreateMutable(0, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    initAssertionSlots();
+
+    gTypeTokenNames[kPMWireTypeTokenNeedsCPU]                       = kIOPMAssertionTypeNeedsCPU;
+    gTypeTokenNames[kPMWireTypeTokenPreventUserIdleSystemSleep]     = kIOPMAssertionTypePreventUserIdleSystemSleep;
+    gTypeTokenNames[kPMWireTypeTokenNoIdleSleep]                    = kIOPMAssertionTypeNoIdleSleep;
+    gTypeTokenNames[kPMWireTypeTokenDisableInflow]                  = kIOPMAssertionTypeDisableInflow;
+    gTypeTokenNames[kPMWireTypeTokenInhibitCharging]                = kIOPMAssertionTypeInhibitCharging;
+    gTypeTokenNames[kPMWireTypeTokenDisableLowBatteryWarnings]      = kIOPMAssertionTypeDisableLowBatteryWarnings;
+    gTypeTokenNames[kPMWireTypeTokenPreventUserIdleDisplaySleep]    = kIOPMAssertionTypePreventUserIdleDisplaySleep;
+    gTypeTokenNames[kPMWireTypeTokenNoDisplaySleep]                 = kIOPMAssertionTypeNoDisplaySleep;
+    gTypeTokenNames[kPMWireTypeTokenEnableIdleSleep]                = kIOPMAssertionTypeEnableIdleSleep;
+    gTypeTokenNames[kPMWireTypeTokenDisableRealPowerSources]        = kIOPMAssertionTypeDisableRealPowerSources_Debug;
+    gTypeTokenNames[kPMWireTypeTokenPreventSystemSleep]             = kIOPMAssertionTypePreventSystemSleep;
+    gTypeTokenNames[kPMWireTypeTokenDenySystemSleep]                = kIOPMAssertionTypeDenySystemSleep;
+    gTypeTokenNames[kPMWireTypeTokenExternalMedia]                  = _kIOPMAssertionTypeExternalMedia;
+    gTypeTokenNames[kPMWireTypeTokenUserIsActive]                   = kIOPMAssertionUserIsActive;
+    gTypeTokenNames[kPMWireTypeTokenApplePushServiceTask]           = kIOPMAssertionTypeApplePushServiceTask;
+    gTypeTokenNames[kPMWireTypeTokenBackgroundTask]                 = kIOPMAssertionTypeBackgroundTask;
+
+    // No name is accepted until configAssertionType() maps it to a type
+    memset(gTypeTokenIndex, -1, sizeof(gTypeTokenIndex));
+    gTypeTokensReady = true;
 
 
     assertion_types_arr[kHighPerfIndex]             = kIOPMAssertionTypeNeedsCPU; 
@@ -3539,6 +4881,9 @@ PMAssertions_prime(void)
 
     // Reset kernel assertions to clear out old values from prior to powerd's crash
     sendUserAssertionsToKernel(0);
+
+    initChangeNotifier(&gAnyChangeNotifier);
+    initChangeNotifier(&gLevelChangeNotifier);
 #if TARGET_OS_EMBEDDED
     /* 
      * Disable Idle Sleep until some one comes and enables the idle sleep
@@ -3550,6 +4895,7 @@ PMAssertions_prime(void)
 
     SET_AGGREGATE_LEVEL(kEnableIdleIndex, 1); /* Idle sleep is enabled by default */
     gDebugFlags = kIOPMDebugEnableAssertionLogging;
+    startAssertionLogWriter();
 
     /* Start a dispatch source to log assertions with a delay */
     logDispatch = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
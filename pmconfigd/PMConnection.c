@@ -38,6 +38,7 @@
 #include <bsm/libbsm.h>
 #include <IOKit/pwr_mgt/IOPM.h>
 #include <libproc.h>
+#include <sys/queue.h>
 
 #include "PrivateLib.h"
 #include "PMConnection.h"
@@ -106,6 +107,11 @@ CFAbsoluteTime              ts_apo = 0; // Time at which system should go for au
 static int const kMaxConnectionIDCount = 1000*1000*1000;
 static int const kConnectionOffset = 1000;
 static double const  kPMConnectionNotifyTimeoutDefault = 25.0;
+/* A client whose queue is full gets its notification again every
+ * kPMConnectionNotifyRetryInterval, at most kPMConnectionNotifyRetryLimit times.
+ */
+static double const  kPMConnectionNotifyRetryInterval = 0.1;
+static int const kPMConnectionNotifyRetryLimit = 10;
 #if !TARGET_OS_EMBEDDED
 static int kPMSleepDurationForBT = (30*60); // Defaults to 30 mins
 #if LOG_SLEEPSERVICES
@@ -135,25 +141,48 @@ extern CFMachPortRef            pmServerMachPort;
 
 /* Bookkeeping structs */
 
+/* PMTransition
+ * One capability change from the kernel, or several merged into one while
+ * waiting in gTransitionQueue. Every kernel acknowledgement ID merged in is
+ * acknowledged once clients have been told about interestBits.
+ */
+#define kTransitionAckIDsMax        4
+
+typedef struct {
+    CFAbsoluteTime          receivedTime;       // of the first kernel message merged in
+    long                    kernelAcknowledgementIDs[kTransitionAckIDsMax];
+    int                     ackIDCount;
+    int                     fromBits;           // capabilities before the change
+    int                     interestBits;       // ...and after it
+    int                     mergedCount;        // kernel messages merged in after the first
+} PMTransition;
+
 /* PMResponseWrangler
  * While we have an outstanding notification, we have one of these guys sitting around
  *  waiting to handle the incoming responses.
  * We assert that only one PMResponseWrangler shall exist at a time - e.g. no more
  *  than one system state transition shall occur simultaneously.
+ *
+ * outstandingCount - responses not yet replied to; the wrangler completes at 0.
+ * retryHead - responses whose client's queue was full, linked through nextRetry.
+ *      retryTimer sends them again until they go through or run out of attempts.
+ * pick - earliest wake requested by any replied response, per kChoose* type.
  */
 typedef struct {
-    CFMutableArrayRef       awaitingResponses;
+    struct PMResponse       *responses;         // drawn from gResponsePool
+    struct PMResponse       *retryHead;         // notifications to send again
     CFRunLoopTimerRef       awaitingResponsesTimeout;
+    CFRunLoopTimerRef       retryTimer;
     CFAbsoluteTime          allRepliedTime;
-    long                    kernelAcknowledgementID;
+    CFAbsoluteTime          pick[kChooseWakeTypeCount];
+    PMTransition            transition;
     int                     notificationType;
-    int                     awaitingResponsesCount;
+    int                     responseCount;
+    int                     outstandingCount;
+    int                     timedOutCount;
     int                     awaitResponsesTimeoutSeconds;
     int                     completedStatus;    // status after timed out or, all acked
     bool                    completed;
-    bool                    nextIsValid;
-    long                    nextKernelAcknowledgementID;
-    int                     nextInterestBits;
 } PMResponseWrangler;
 
 
@@ -162,22 +191,38 @@ typedef struct {
  *
  * responseHandler - Should be NULL unless this connection has outstanding
  *      notifications to reply to.
+ * interestLinks - Links into gInterestLists, one per bit set in interestsBits.
+ *      Maintained by setConnectionInterests().
  */
-typedef struct {
+#define kConnectionInterestBitCount     8
+#define kConnectionInterestMask         ((1 << kConnectionInterestBitCount) - 1)
+
+typedef struct PMConnection {
+    LIST_ENTRY(PMConnection) link;
+    LIST_ENTRY(PMConnection) interestLinks[kConnectionInterestBitCount];
+    uint32_t                fanOutGeneration;
     mach_port_t             notifyPort;
     PMResponseWrangler      *responseHandler;
     CFStringRef             callerName;
     uint32_t                uniqueID;
     int                     callerPID;
     IOPMCapabilityBits      interestsBits;
+    uint32_t                notificationsSent;
+    uint32_t                notificationsDelayed;   // queue full on the first send
+    uint32_t                notificationsDropped;   // never delivered
     bool                    notifyEnable;
 } PMConnection;
 
 
 /* PMResponse 
  * represents one outstanding notification acknowledgement
+ *
+ * token - the low 16 bits are this response's index in its wrangler's
+ *      responses, so an acknowledgement finds it without a search.
  */
-typedef struct {
+#define kMessageTokenIndexMask      0xFFFF
+
+typedef struct PMResponse {
     PMConnection            *connection;
     PMResponseWrangler      *myResponseWrangler;
     IOPMConnectionMessageToken  token;
@@ -187,7 +232,9 @@ typedef struct {
     CFAbsoluteTime          timerPluginRequested;
     CFAbsoluteTime          sleepServiceRequested;
     CFStringRef             clientInfoString;
+    struct PMResponse       *nextRetry;
     int                     sleepServiceCapTimeoutMS;
+    int                     sendAttempts;
     int                     notificationType;
     bool                    replied;
     bool                    timedout;
@@ -214,21 +261,37 @@ static IOReturn createConnectionWithID(
 static PMConnection *connectionForID(
                     uint32_t findMe);
 
-static CFArrayRef createArrayOfConnectionsWithInterest(
-                    int interestBitsNotify);
+static void setConnectionInterests(
+                    PMConnection *connection,
+                    IOPMCapabilityBits interests);
+
+static bool reserveResponses(int count);
 
 static PMResponseWrangler *connectionFireNotification(
                     int notificationType,
                     long kernelAcknowledgementID);
 
-static void _sendMachMessage(
+static PMResponseWrangler *fireTransition(
+                    const PMTransition *transition);
+
+static bool dequeueTransition(PMTransition *out);
+
+static void acknowledgeTransition(const PMTransition *transition);
+
+static kern_return_t _sendMachMessage(
                     mach_port_t port, 
                     mach_msg_id_t msg_id,
                     uint32_t payload_bits,
                     uint32_t payload_messagetoken);
 
+static void sendNotifications(PMResponseWrangler *wrangler);
+
+static void retryNotifications(CFRunLoopTimerRef timer, void * info);
+
 static void checkResponses(PMResponseWrangler *wrangler);
 
+static void responseReplied(struct PMResponse *response);
+
 static void     PMScheduleWakeEventChooseBest(CFAbsoluteTime *pick);
 
 static void responsesTimedOut(CFRunLoopTimerRef timer, void * info);
@@ -272,26 +335,47 @@ void cancelAutoPowerOffTimer();
 /************************************************************************************/
 /************************************************************************************/
 
-/* CFArrayRef support structures */
+/* Globals */
 
-static Boolean _CFArrayConnectionEquality(const void *value1, const void *value2) 
-{
-    const PMConnection *v1 = (const PMConnection *)value1;
-    const PMConnection *v2 = (const PMConnection *)value2;   
-    return (v1->uniqueID == v2->uniqueID);
-}
-static CFArrayCallBacks _CFArrayConnectionCallBacks = 
-                        { 0, NULL, NULL, NULL, _CFArrayConnectionEquality };
-static CFArrayCallBacks _CFArrayVanillaCallBacks =
-                        { 0, NULL, NULL, NULL, NULL };
+static LIST_HEAD(, PMConnection) gConnections = LIST_HEAD_INITIALIZER(gConnections);
 
-/************************************************************************************/
-/************************************************************************************/
-/************************************************************************************/
+/* pointerTable_t of PMConnection, keyed by uniqueID and by notifyPort.
+ * Connections without a notifyPort are not in gConnectionsByPort.
+ */
+static uint32_t connectionIDKey(const void *c) { return ((const PMConnection *)c)->uniqueID; }
+static uint32_t connectionPortKey(const void *c) { return (uint32_t)((const PMConnection *)c)->notifyPort; }
 
-/* Globals */
+static pointerTable_t           gConnectionsByID = POINTER_TABLE_INITIALIZER(connectionIDKey);
+static pointerTable_t           gConnectionsByPort = POINTER_TABLE_INITIALIZER(connectionPortKey);
+
+/* Connections interested in each capability bit, linked through interestLinks.
+ * A notification walks only the lists of the bits that changed; each
+ * connection is stamped with gFanOutGeneration so it's notified once.
+ */
+static LIST_HEAD(, PMConnection) gInterestLists[kConnectionInterestBitCount];
+static uint32_t                 gFanOutGeneration = 0;
+
+/* PMResponse records for the one in-flight PMResponseWrangler. The pool only
+ * grows, to cover the connection count, and is reused by every transition.
+ */
+static PMResponse               *gResponsePool = NULL;
+static int                      gResponsePoolSize = 0;
 
-static CFMutableArrayRef        gConnections = NULL;
+/* Capability changes that arrived while a PMResponseWrangler was in flight,
+ * oldest first, from gTransitionQueueHead. See queueTransition().
+ */
+#define kTransitionQueueSize        8
+
+static PMTransition             gTransitionQueue[kTransitionQueueSize];
+static int                      gTransitionQueueHead = 0;
+static int                      gTransitionQueueCount = 0;
+
+/* Transition counters, and the last kIOPMConnectionTransitionHistory
+ * transitions delivered to clients, from gTransitionHistoryNext.
+ */
+static IOPMConnectionTransitionStats    gTransitionStats;
+static IOPMConnectionTransitionRecord   gTransitionHistory[kIOPMConnectionTransitionHistory];
+static uint32_t                         gTransitionHistoryNext = 0;
 
 static uint32_t                 globalConnectionIDTally = 0;
 
@@ -348,8 +432,6 @@ void PMConnection_prime()
     
     bzero(&gSleepService, sizeof(gSleepService));
 
-    gConnections = CFArrayCreateMutable(kCFAllocatorDefault, 100, &_CFArrayConnectionCallBacks);
-                                        
     // Find it
     rootDomainService = getRootDomain();
     if (IO_OBJECT_NULL == rootDomainService) {
@@ -445,7 +527,7 @@ kern_return_t _io_pm_connection_create
     }
 
     // TODO: for now, all clients are listening for all notifications
-    newConnection->interestsBits = 0xFF;
+    setConnectionInterests(newConnection, 0xFF);
 
     *connection_id = newConnection->uniqueID;
     *return_code = kIOReturnSuccess;
@@ -495,6 +577,12 @@ exit:
 
     if (!disable && (MACH_PORT_NULL == connection->notifyPort)) {
         connection->notifyPort = notify_port_in;
+        if (!pointerTableInsert(&gConnectionsByPort, connection)) {
+            connection->notifyPort = MACH_PORT_NULL;
+            mach_port_deallocate(mach_task_self(), notify_port_in);
+            *return_code = kIOReturnNoMemory;
+            goto exit;
+        }
 
         mach_port_request_notification(
                     mach_task_self(),           // task
@@ -551,29 +639,25 @@ kern_return_t _io_pm_connection_release
 
 static PMResponse *_io_pm_acknowledge_event_findOutstandingResponseForToken(PMConnection *connection, int token)
 {
-    CFMutableArrayRef   responsesTrackingList = NULL;
-    int                 responsesCount = 0;
-    PMResponse          *checkResponse = NULL;
+    PMResponseWrangler  *wrangler = NULL;
     PMResponse          *foundResponse = NULL;
-    int                 i;
-    
+    int                 index = token & kMessageTokenIndexMask;
     
     if (!connection
-        || !connection->responseHandler
-        || !(responsesTrackingList = connection->responseHandler->awaitingResponses)) 
+        || !(wrangler = connection->responseHandler)
+        || (index >= wrangler->responseCount)) 
     {
         return NULL;
     }
     
-    responsesCount = CFArrayGetCount(responsesTrackingList);
+    foundResponse = &wrangler->responses[index];
     
-    for (i=0; i<responsesCount; i++)
+    // Only the connection that was sent the token may acknowledge it, once.
+    if ((token != foundResponse->token)
+        || (connection != foundResponse->connection)
+        || foundResponse->replied)
     {
-        checkResponse = (PMResponse *)CFArrayGetValueAtIndex(responsesTrackingList, i);
-        if (checkResponse && (token == checkResponse->token)) {
-            foundResponse = checkResponse;
-            break;
-        }
+        return NULL;
     }
     
     return foundResponse;
@@ -634,7 +718,6 @@ kern_return_t _io_pm_connection_acknowledge_event
     
     *return_code = kIOReturnSuccess;
     foundResponse->repliedWhen = CFAbsoluteTimeGetCurrent();
-    foundResponse->replied = true;
     
     // Log if response time exceeds kAppResponseLogThresholdMS.
     timeIntervalMS = (int)((foundResponse->repliedWhen - foundResponse->notifiedWhen) * 1000);
@@ -729,6 +812,7 @@ kern_return_t _io_pm_connection_acknowledge_event
         CFRelease(ackOptionsDict);
     }
     
+    responseReplied(foundResponse);
     checkResponses(connection->responseHandler);
     
     
@@ -739,6 +823,88 @@ exit:
 #endif
 }
 
+kern_return_t _io_pm_connection_copy_notification_stats
+(
+    mach_port_t             server,
+    audit_token_t           token,
+    vm_offset_t             *stats,
+    mach_msg_type_number_t  *statsCnt,
+    int                     *return_code
+)
+{
+    IOPMConnectionNotificationStatsRecord   *out = NULL;
+    IOPMConnectionNotificationStatsRecord   *rec;
+    PMConnection                            *connection;
+    uint32_t                                count = 0;
+
+    *stats = 0;
+    *statsCnt = 0;
+    *return_code = kIOReturnSuccess;
+
+    if (!gConnectionsByID.count)
+        return KERN_SUCCESS;
+
+    if (KERN_SUCCESS != vm_allocate(mach_task_self(), (vm_address_t *)&out, 
+                                    gConnectionsByID.count * sizeof(IOPMConnectionNotificationStatsRecord), TRUE)) {
+        *return_code = kIOReturnNoMemory;
+        return KERN_SUCCESS;
+    }
+
+    LIST_FOREACH(connection, &gConnections, link)
+    {
+        rec = &out[count++];
+        rec->pid = connection->callerPID;
+        rec->connectionID = connection->uniqueID;
+        rec->sent = connection->notificationsSent;
+        rec->delayed = connection->notificationsDelayed;
+        rec->dropped = connection->notificationsDropped;
+        if (connection->callerName) {
+            CFStringGetCString(connection->callerName, rec->name, sizeof(rec->name), kCFStringEncodingUTF8);
+        }
+    }
+
+    *stats = (vm_offset_t)out;
+    *statsCnt = (mach_msg_type_number_t)(count * sizeof(IOPMConnectionNotificationStatsRecord));
+    return KERN_SUCCESS;
+}
+
+kern_return_t _io_pm_connection_copy_transition_stats
+(
+    mach_port_t             server,
+    audit_token_t           token,
+    vm_offset_t             *stats,
+    mach_msg_type_number_t  *statsCnt,
+    int                     *return_code
+)
+{
+    IOPMConnectionTransitionStats   *out = NULL;
+    uint32_t                        count, i;
+
+    *stats = 0;
+    *statsCnt = 0;
+
+    if (KERN_SUCCESS != vm_allocate(mach_task_self(), (vm_address_t *)&out, sizeof(*out), TRUE)) {
+        *return_code = kIOReturnNoMemory;
+        return KERN_SUCCESS;
+    }
+
+    *out = gTransitionStats;
+    out->queueDepth = gTransitionQueueCount;
+
+    // History goes out oldest first
+    count = (gTransitionHistoryNext < kIOPMConnectionTransitionHistory) ? 
+                gTransitionHistoryNext : kIOPMConnectionTransitionHistory;
+    for (i=0; i<count; i++) {
+        out->history[i] = gTransitionHistory[(gTransitionHistoryNext - count + i) % kIOPMConnectionTransitionHistory];
+    }
+    out->historyCount = count;
+
+    *stats = (vm_offset_t)out;
+    *statsCnt = (mach_msg_type_number_t)sizeof(*out);
+    *return_code = kIOReturnSuccess;
+    return KERN_SUCCESS;
+}
+
 kern_return_t _io_pm_get_capability_bits(
         mach_port_t     server,
         audit_token_t   token,
@@ -853,14 +1019,14 @@ static void cleanupConnection(PMConnection *reap)
 {
     PMResponseWrangler      *responseWrangler = NULL;
     PMResponse              *openResponse = NULL;
-    int                     allResponsesCount = 0;
     int                     i;
-    int                     index;
-    CFRange                 connectionsRange =
-                                CFRangeMake(0, CFArrayGetCount(gConnections));
+
+    setConnectionInterests(reap, 0);
 
     if (MACH_PORT_NULL != reap->notifyPort) 
     {
+        pointerTableRemove(&gConnectionsByPort, reap);
+
         // Release the send right on reap->notifyPort that we obtained 
         // when we received it as an argument to _io_pm_connection_schedule_notification.
         __MACH_PORT_DEBUG(true, "IOPMConnection cleanupConnection drop notifyPort", reap->notifyPort);
@@ -874,19 +1040,16 @@ static void cleanupConnection(PMConnection *reap)
     }
 
     responseWrangler = reap->responseHandler;
-    if (responseWrangler && responseWrangler->awaitingResponses)
+    if (responseWrangler)
     {
-        allResponsesCount = CFArrayGetCount(responseWrangler->awaitingResponses);
-
-        for (i=0; i<allResponsesCount; i++)
+        for (i=0; i<responseWrangler->responseCount; i++)
         {
-            openResponse = (PMResponse *)CFArrayGetValueAtIndex(    
-                                    responseWrangler->awaitingResponses, i);
+            openResponse = &responseWrangler->responses[i];
 
-            if (openResponse && (openResponse->connection == reap)) {
+            if (openResponse->connection == reap) {
                 openResponse->connection    = NULL;
-                openResponse->replied       = true;
                 openResponse->timedout      = true;
+                responseReplied(openResponse);
                 break;
             }
         }    
@@ -897,11 +1060,8 @@ static void cleanupConnection(PMConnection *reap)
     }
        
     // Remove our struct from gConnections
-    index = CFArrayGetFirstIndexOfValue(gConnections, connectionsRange, (void *)reap);
-
-    if (kCFNotFound != index) {
-        CFArrayRemoveValueAtIndex(gConnections, index);
-    }
+    pointerTableRemove(&gConnectionsByID, reap);
+    LIST_REMOVE(reap, link);
     
     free(reap);
 
@@ -913,59 +1073,41 @@ static void cleanupConnection(PMConnection *reap)
 
 static void cleanupResponseWrangler(PMResponseWrangler *reap)
 {
-    PMConnection    *one_connection;
-    long nextAcknowledgementID;
-    int  responseCount;
-    int  connectionsCount;
+    PMResponse  *purgeRetry;
+    PMTransition next;
     int  i;
-    int  nextInterestBits;
-    bool nextIsValid;
 
     if (!reap) 
         return;
-        
-    if (!gConnections)
-        return;
 
-    // Cache the next response fields.
-    nextInterestBits      = reap->nextInterestBits;
-    nextAcknowledgementID = reap->nextKernelAcknowledgementID;
-    nextIsValid           = reap->nextIsValid;
+    if (reap->retryTimer) {
+        CFRunLoopTimerInvalidate(reap->retryTimer);
+        reap->retryTimer = NULL;
+    }
 
-    // Loop through all connections. If any connections are referring to
-    // responseWrangler in their tracking structs, zero that out.
-    connectionsCount = CFArrayGetCount(gConnections);
-    for (i=0; i<connectionsCount; i++) 
+    // Notifications still waiting to be sent were never delivered
+    for (purgeRetry = reap->retryHead; purgeRetry; purgeRetry = purgeRetry->nextRetry)
     {
-        one_connection = (PMConnection *)CFArrayGetValueAtIndex(gConnections, i);
-        if (reap == one_connection->responseHandler) 
-        {
-            // Zero out this reference before it points to a free'd pointer
-            one_connection->responseHandler = NULL;
-        }
+        if (purgeRetry->connection)
+            purgeRetry->connection->notificationsDropped++;
     }
-        
+    reap->retryHead = NULL;
 
-    // Loop responses, destroy responses
-    if (reap->awaitingResponses)
+    // Loop responses, return them to gResponsePool. Only connections that
+    // were sent a notification refer to responseWrangler; zero that out
+    // before it points to a free'd pointer.
+    for (i=0; i<reap->responseCount; i++) 
     {
-        responseCount = CFArrayGetCount(reap->awaitingResponses);
-        if (responseCount > 0) 
-        {
-            for (i=0; i<responseCount; i++) 
-            {
-                PMResponse  *purgeMe = (PMResponse *)CFArrayGetValueAtIndex(reap->awaitingResponses, i);
-                
-                if (purgeMe->clientInfoString)
-                    CFRelease(purgeMe->clientInfoString);
-                
-                free(purgeMe);
-            }
-        }
-        CFRelease(reap->awaitingResponses);
+        PMResponse  *purgeMe = &reap->responses[i];
         
-        reap->awaitingResponses = NULL;
+        if (purgeMe->connection && (reap == purgeMe->connection->responseHandler))
+            purgeMe->connection->responseHandler = NULL;
+
+        if (purgeMe->clientInfoString)
+            CFRelease(purgeMe->clientInfoString);
     }
+    reap->responses = NULL;
+    reap->responseCount = 0;
 
     // Invalidate the pointer to the in-flight response wrangler.
     if (gLastResponseWrangler == reap) {
@@ -974,17 +1116,12 @@ static void cleanupResponseWrangler(PMResponseWrangler *reap)
 
     free(reap);
 
-    // Create a new response wrangler if the reaped wrangler has a queued
-    // notification stored. If new wrangler is NULL, make sure to ack any
-    // sleep message.
-    if (nextIsValid)
+    // Create a new response wrangler for the next queued transition. Those
+    // no client is waiting on are acknowledged right away, and we move on.
+    while (!gLastResponseWrangler && dequeueTransition(&next))
     {
-        PMResponseWrangler * resp;
-        resp = connectionFireNotification(nextInterestBits, nextAcknowledgementID);
-        if (!resp)
-        {
-            if (nextAcknowledgementID)
-                IOAllowPowerChange(gRootDomainConnect, nextAcknowledgementID);
+        if (!fireTransition(&next)) {
+            acknowledgeTransition(&next);
         }
     }
 }
@@ -994,26 +1131,11 @@ static void cleanupResponseWrangler(PMResponseWrangler *reap)
 
 __private_extern__ bool PMConnectionHandleDeadName(mach_port_t deadPort)
 {
-    PMConnection    *one_connection = NULL;;
     PMConnection    *the_connection = NULL;
-    int             connectionsCount = 0;
-    int             i;
-    
-    if (!gConnections)
-        return false;
-    
-    connectionsCount = CFArrayGetCount(gConnections);
-    
+
     // Find the PMConnection that owns this mach port
-    for (i=0; i<connectionsCount; i++) 
-    {
-        one_connection = (PMConnection *)CFArrayGetValueAtIndex(gConnections, i);
-    
-        if (one_connection && (deadPort == one_connection->notifyPort))
-        {
-            the_connection = one_connection;
-            break;
-        }
+    if (MACH_PORT_NULL != deadPort) {
+        the_connection = pointerTableFind(&gConnectionsByPort, (uint32_t)deadPort);
     }
 
     if (the_connection) {
@@ -1856,6 +1978,133 @@ static void PMConnectionPowerCallBack(
 /************************************************************************************/
 /************************************************************************************/
 
+#pragma mark -
+#pragma mark Transitions
+
+/* 1 if 'to' only gains capabilities over 'from', -1 if it only loses some, else 0 */
+static int transitionDirection(int from, int to)
+{
+    bool    gains = (0 != (to & ~from));
+    bool    losses = (0 != (from & ~to));
+
+    if (gains == losses)
+        return 0;
+    return gains ? 1 : -1;
+}
+
+/* Folds 'newer' into 'into', keeping every kernel acknowledgement ID */
+static void mergeTransition(PMTransition *into, const PMTransition *newer)
+{
+    int     i;
+
+    for (i=0; i<newer->ackIDCount; i++)
+    {
+        if (into->ackIDCount == kTransitionAckIDsMax) {
+            // No room left: let the kernel go ahead with the oldest change
+            // now, rather than never.
+            IOAllowPowerChange(gRootDomainConnect, into->kernelAcknowledgementIDs[0]);
+            memmove(&into->kernelAcknowledgementIDs[0], &into->kernelAcknowledgementIDs[1],
+                    (kTransitionAckIDsMax - 1) * sizeof(long));
+            into->ackIDCount--;
+        }
+        into->kernelAcknowledgementIDs[into->ackIDCount++] = newer->kernelAcknowledgementIDs[i];
+    }
+    into->interestBits = newer->interestBits;
+    into->mergedCount += 1 + newer->mergedCount;
+}
+
+/*
+ * Queues a capability change that arrived while a wrangler is in flight.
+ * - A change in the same direction as the last queued one, e.g. dark wake
+ *   then full wake, is merged into it: clients are told only where the
+ *   system ended up. That counts as merged.
+ * - Otherwise it gets its own entry, so clients see each reversal.
+ * - If the queue is full it's merged into the last entry regardless, and
+ *   the state in between is lost. That counts as dropped.
+ * Kernel acknowledgement IDs are never dropped, see mergeTransition().
+ */
+static void queueTransition(PMTransition *transition)
+{
+    PMTransition    *last = NULL;
+    int             direction;
+
+    transition->fromBits = gCurrentCapabilityBits;
+    if (gTransitionQueueCount) {
+        last = &gTransitionQueue[(gTransitionQueueHead + gTransitionQueueCount - 1) % kTransitionQueueSize];
+        transition->fromBits = last->interestBits;
+    }
+    direction = transitionDirection(transition->fromBits, transition->interestBits);
+
+    if (last && direction
+        && (direction == transitionDirection(last->fromBits, last->interestBits)))
+    {
+        mergeTransition(last, transition);
+        gTransitionStats.merged++;
+        return;
+    }
+
+    if (kTransitionQueueSize == gTransitionQueueCount) {
+        mergeTransition(last, transition);
+        gTransitionStats.dropped++;
+        return;
+    }
+
+    gTransitionQueue[(gTransitionQueueHead + gTransitionQueueCount) % kTransitionQueueSize] = *transition;
+    gTransitionQueueCount++;
+    if ((uint32_t)gTransitionQueueCount > gTransitionStats.queueHighWater) {
+        gTransitionStats.queueHighWater = gTransitionQueueCount;
+    }
+}
+
+static bool dequeueTransition(PMTransition *out)
+{
+    if (!gTransitionQueueCount)
+        return false;
+
+    *out = gTransitionQueue[gTransitionQueueHead];
+    gTransitionQueueHead = (gTransitionQueueHead + 1) % kTransitionQueueSize;
+    gTransitionQueueCount--;
+    return true;
+}
+
+static void acknowledgeTransition(const PMTransition *transition)
+{
+    int     i;
+
+    for (i=0; i<transition->ackIDCount; i++) {
+        IOAllowPowerChange(gRootDomainConnect, transition->kernelAcknowledgementIDs[i]);
+    }
+}
+
+/* Records the latency from the kernel message to the last client reply */
+static void recordTransition(PMResponseWrangler *wrangler)
+{
+    IOPMConnectionTransitionRecord  *rec;
+    double                          latency;
+
+    latency = wrangler->allRepliedTime - wrangler->transition.receivedTime;
+
+    rec = &gTransitionHistory[gTransitionHistoryNext++ % kIOPMConnectionTransitionHistory];
+    rec->receivedTime = wrangler->transition.receivedTime;
+    rec->latency = latency;
+    rec->capabilityBits = wrangler->transition.interestBits;
+    rec->responseCount = wrangler->responseCount;
+    rec->mergedCount = wrangler->transition.mergedCount;
+    rec->timedOutCount = wrangler->timedOutCount;
+
+    gTransitionStats.transitions++;
+    gTransitionStats.totalLatency += latency;
+    if (latency > gTransitionStats.maxLatency) {
+        gTransitionStats.maxLatency = latency;
+    }
+}
+
+/************************************************************************************/
+/************************************************************************************/
+/************************************************************************************/
+/************************************************************************************/
+/************************************************************************************/
+
 #pragma mark -
 #pragma mark Responses
 
@@ -1863,30 +2112,42 @@ static PMResponseWrangler *connectionFireNotification(
     int interestBitsNotify,
     long kernelAcknowledgementID)
 {
-    static int              lastInterestBits = 0xFFFFFFFF;
-    int                     affectedBits = 0;
-    CFArrayRef              interested = NULL;
-    PMConnection            *connection = NULL;
-    int                     interestedCount = 0;
-    uint32_t                messageToken = 0;
-    uint16_t                calloutCount = 0;
-    
-    PMResponseWrangler      *responseWrangler = NULL;
-    PMResponse              *awaitThis = NULL;
+    PMTransition            transition;
+
+    bzero(&transition, sizeof(transition));
+    transition.receivedTime = CFAbsoluteTimeGetCurrent();
+    transition.interestBits = interestBitsNotify;
+    if (kernelAcknowledgementID) {
+        transition.kernelAcknowledgementIDs[transition.ackIDCount++] = kernelAcknowledgementID;
+    }
 
     /*
-     * If a response wrangler is active, store the new notification on the
-     * active wrangler. Then wait for its completion before firing the new
-     * notification. Only the last notification is stored.
+     * If a response wrangler is active, queue the new notification, and fire
+     * it once the active wrangler completes.
      */
     if (gLastResponseWrangler)
     {
-        gLastResponseWrangler->nextIsValid = true;
-        gLastResponseWrangler->nextInterestBits = interestBitsNotify;
-        gLastResponseWrangler->nextKernelAcknowledgementID = kernelAcknowledgementID;
+        queueTransition(&transition);
         return gLastResponseWrangler;
     }
 
+    return fireTransition(&transition);
+}
+
+static PMResponseWrangler *fireTransition(
+    const PMTransition *transition)
+{
+    static int              lastInterestBits = 0xFFFFFFFF;
+    int                     interestBitsNotify = transition->interestBits;
+    int                     affectedBits = 0;
+    PMConnection            *connection = NULL;
+    int                     bit;
+    uint32_t                messageToken = 0;
+    int                     calloutCount = 0;
+    
+    PMResponseWrangler      *responseWrangler = NULL;
+    PMResponse              *awaitThis = NULL;
+
     gCurrentCapabilityBits = interestBitsNotify;
 
     // We only send state change notifications out to entities interested in the changing
@@ -1896,16 +2157,17 @@ static PMResponseWrangler *connectionFireNotification(
     //      affectedBits & InterestedBits != 0
     //  and affectedBits & InterestedBits == InterestedBits
 
-    affectedBits = interestBitsNotify ^ lastInterestBits;
+    affectedBits = (interestBitsNotify ^ lastInterestBits) & kConnectionInterestMask;
 
     lastInterestBits = interestBitsNotify;
 
-    interested = createArrayOfConnectionsWithInterest(affectedBits);
-    if (!interested) {
+    if (!affectedBits || !gConnectionsByID.count) {
         goto exit;
     }
-    interestedCount = CFArrayGetCount(interested);
-    if (0 == interestedCount) {
+
+    // No connection gets more than one response, so the pool needs at most
+    // one record per open connection.
+    if (!reserveResponses(gConnectionsByID.count)) {
         goto exit;
     }
 
@@ -1920,61 +2182,75 @@ static PMResponseWrangler *connectionFireNotification(
     }
     responseWrangler->notificationType = interestBitsNotify;
     responseWrangler->awaitResponsesTimeoutSeconds = (int)kPMConnectionNotifyTimeoutDefault;
-    responseWrangler->kernelAcknowledgementID = kernelAcknowledgementID;
+    responseWrangler->transition = *transition;
 
     
     /*
      * We will track each notification we're sending out with an individual response.
-     * Record that response in the "active response array" so we can group them
+     * Record that response in the wrangler's slice of gResponsePool so we can group them
      * all later when they acknowledge, or fail to acknowledge.
      */
-    responseWrangler->awaitingResponses = 
-                    CFArrayCreateMutable(kCFAllocatorDefault, interestedCount, &_CFArrayVanillaCallBacks);
-    responseWrangler->awaitingResponsesCount = interestedCount;
+    responseWrangler->responses = gResponsePool;
+    gFanOutGeneration++;
 
-    for (calloutCount=0; calloutCount<interestedCount; calloutCount++) 
+    for (bit=0; bit<kConnectionInterestBitCount; bit++)
     {
-        connection = (PMConnection *)CFArrayGetValueAtIndex(interested, calloutCount);
-    
-        if ((MACH_PORT_NULL == connection->notifyPort) ||
-            (false == connection->notifyEnable)) {
+        if (!(affectedBits & (1 << bit))) {
             continue;
         }
-        
-        /* We generate a messagetoken here, which the notifiee must pass 
-         * back into us when the client acknowledges. 
-         * We note the token in the PMResponse struct.
-         */
-        messageToken = (interestBitsNotify << 16)
-                            | calloutCount;
-
-        // Mark this connection with the responseWrangler that's awaiting its responses
-        connection->responseHandler = responseWrangler;
 
-        _sendMachMessage(connection->notifyPort, 
-                            0,
-                            interestBitsNotify, 
-                            messageToken);
+        LIST_FOREACH(connection, &gInterestLists[bit], interestLinks[bit])
+        {
+            // Already visited through another of the changing bits
+            if (connection->fanOutGeneration == gFanOutGeneration) {
+                continue;
+            }
+            connection->fanOutGeneration = gFanOutGeneration;
+            calloutCount++;
 
-        /* 
-         * Track the response!
-         */
-        awaitThis = calloc(1, sizeof(PMResponse));
-        if (!awaitThis) {
-            goto exit;
+            if ((MACH_PORT_NULL == connection->notifyPort) ||
+                (false == connection->notifyEnable)) {
+                continue;
+            }
+            
+            /* We generate a messagetoken here, which the notifiee must pass 
+             * back into us when the client acknowledges. 
+             * We note the token in the PMResponse struct.
+             */
+            if (responseWrangler->responseCount > kMessageTokenIndexMask) {
+                // Out of token indices
+                continue;
+            }
+            messageToken = (interestBitsNotify << 16)
+                                | responseWrangler->responseCount;
+
+            // Mark this connection with the responseWrangler that's awaiting its responses
+            connection->responseHandler = responseWrangler;
+
+            /* 
+             * Track the response! The notification itself goes out with
+             * all the others, in sendNotifications().
+             */
+            awaitThis = &responseWrangler->responses[responseWrangler->responseCount++];
+            bzero(awaitThis, sizeof(PMResponse));
+
+            awaitThis->token = messageToken;
+            awaitThis->connection = connection;
+            awaitThis->notificationType = interestBitsNotify;
+            awaitThis->myResponseWrangler = responseWrangler;
+            awaitThis->notifiedWhen = CFAbsoluteTimeGetCurrent();
+            responseWrangler->outstandingCount++;
+
+            if (gDebugFlags & kIOPMDebugLogCallbacks)
+               logASLMessageAppNotify(awaitThis->connection->callerName, interestBitsNotify );
         }
+    }
 
-        awaitThis->token = messageToken;
-        awaitThis->connection = connection;
-        awaitThis->notificationType = interestBitsNotify;
-        awaitThis->myResponseWrangler = responseWrangler;
-        awaitThis->notifiedWhen = CFAbsoluteTimeGetCurrent();
-
-        CFArrayAppendValue(responseWrangler->awaitingResponses, awaitThis);
-
-        if (gDebugFlags & kIOPMDebugLogCallbacks)
-           logASLMessageAppNotify(awaitThis->connection->callerName, interestBitsNotify );
-         
+    if (0 == calloutCount) {
+        // Nobody is interested in the changing bits
+        free(responseWrangler);
+        responseWrangler = NULL;
+        goto exit;
     }
 
     // TODO: Set off a timer to fire in xx30xx seconds 
@@ -1994,10 +2270,9 @@ static PMResponseWrangler *connectionFireNotification(
         CFRelease(responseWrangler->awaitingResponsesTimeout);
     }
 
-exit:
-    if (interested) 
-        CFRelease(interested);
+    sendNotifications(responseWrangler);
 
+exit:
     // Record the active wrangler in a global, then clear when reaped.
     if (responseWrangler)
         gLastResponseWrangler = responseWrangler;
@@ -2026,21 +2301,18 @@ static void responsesTimedOut(CFRunLoopTimerRef timer, void * info)
     // Iterate list of awaiting responses, and tattle on anyone who hasn't 
     // acknowledged yet.
     // Artificially mark them as "replied", with their reason being "timed out"
-    responsesCount = CFArrayGetCount(responseWrangler->awaitingResponses);
+    responsesCount = responseWrangler->responseCount;
     for (i=0; i<responsesCount; i++)
     {
-        one_response = (PMResponse *)CFArrayGetValueAtIndex(
-                                        responseWrangler->awaitingResponses, i);
-        if (!one_response)
-            continue;
+        one_response = &responseWrangler->responses[i];
         if (one_response->replied)
             continue;
 
         // Caught a tardy reply
         tardyCount++;
-        one_response->replied = true;
         one_response->timedout = true;
         one_response->repliedWhen = CFAbsoluteTimeGetCurrent();
+        responseReplied(one_response);
         
         int timeIntervalMS = (int)((one_response->repliedWhen - one_response->notifiedWhen) * 1000);
         CFNumberRef timeIntervalNumber = CFNumberCreate(NULL, kCFNumberIntType, &timeIntervalMS);
@@ -2071,7 +2343,7 @@ typedef struct {
     uint32_t            payload[kMsgPayloadCount];
 } IOPMMessageStructure;
  
-static void _sendMachMessage(
+static kern_return_t _sendMachMessage(
     mach_port_t         port, 
     mach_msg_id_t       msg_id,
     uint32_t            payload_bits,
@@ -2093,24 +2365,128 @@ static void _sendMachMessage(
     msg.payload[0] = payload_bits;
     msg.payload[1] = payload_messagetoken;
 
+    // Never block: with a zero timeout, a full queue fails right away
+    // with MACH_SEND_TIMED_OUT, and the caller may try again later.
     status = mach_msg(&msg.header,                  /* msg */
               MACH_SEND_MSG | MACH_SEND_TIMEOUT,    /* options */
               msg.header.msgh_size,                 /* send_size */
               0,                                    /* rcv_size */
               MACH_PORT_NULL,                       /* rcv_name */
-              MACH_MSG_TIMEOUT_NONE,                /* timeout */
+              0,                                    /* timeout */
               MACH_PORT_NULL);                      /* notify */
 
     if (status == MACH_SEND_TIMED_OUT) {
         mach_msg_destroy(&msg.header);
     }
     
-    if (status != MACH_MSG_SUCCESS)
+    return status;
+}
+
+/*
+ * Sends the notification for 'response'. Returns false if the client's queue
+ * is full and it's worth trying again. A notification that can't be delivered
+ * counts as a timed out response, so the transition doesn't wait on a client
+ * that never heard of it.
+ */
+static bool sendNotification(PMResponse *response)
+{
+    PMConnection            *connection = response->connection;
+    kern_return_t           status;
+
+    status = _sendMachMessage(connection->notifyPort, 0,
+                              response->notificationType, response->token);
+
+    if (MACH_MSG_SUCCESS == status) {
+        connection->notificationsSent++;
+        return true;
+    }
+
+    if ((MACH_SEND_TIMED_OUT == status)
+        && (response->sendAttempts++ < kPMConnectionNotifyRetryLimit))
     {
-        // Pray for the lost message.
+        if (1 == response->sendAttempts)
+            connection->notificationsDelayed++;
+        return false;
     }
 
-    return;
+    connection->notificationsDropped++;
+    response->timedout = true;
+    response->repliedWhen = CFAbsoluteTimeGetCurrent();
+    responseReplied(response);
+    return true;
+}
+
+/*
+ * Sends every notification of a new wrangler back to back, queueing those
+ * that didn't fit for retryTimer. The timer also finishes a wrangler that's
+ * left with nothing outstanding, outside of connectionFireNotification().
+ */
+static void sendNotifications(PMResponseWrangler *wrangler)
+{
+    PMResponse              *response;
+    int                     i;
+
+    for (i=0; i<wrangler->responseCount; i++)
+    {
+        response = &wrangler->responses[i];
+        if (!sendNotification(response)) {
+            response->nextRetry = wrangler->retryHead;
+            wrangler->retryHead = response;
+        }
+    }
+
+    if (!wrangler->retryHead && (0 != wrangler->outstandingCount)) {
+        return;
+    }
+
+    CFRunLoopTimerContext   retryTimerContext = 
+        { 0, (void *)wrangler, NULL, NULL, NULL };
+    wrangler->retryTimer = 
+            CFRunLoopTimerCreate(0, 
+                    CFAbsoluteTimeGetCurrent() + (wrangler->retryHead ? kPMConnectionNotifyRetryInterval : 0.0), 
+                    kPMConnectionNotifyRetryInterval, 0, 0, retryNotifications, &retryTimerContext);
+
+    if (wrangler->retryTimer)
+    {
+        CFRunLoopAddTimer(CFRunLoopGetCurrent(), 
+                            wrangler->retryTimer, 
+                            kCFRunLoopDefaultMode);
+                            
+        CFRelease(wrangler->retryTimer);
+    }
+}
+
+static void retryNotifications(CFRunLoopTimerRef timer, void * info)
+{
+    PMResponseWrangler  *wrangler = (PMResponseWrangler *)info;
+    PMResponse          *pending = NULL;
+    PMResponse          *next = NULL;
+
+    if (!wrangler)
+        return;
+
+    pending = wrangler->retryHead;
+    wrangler->retryHead = NULL;
+
+    for (; pending; pending = next)
+    {
+        next = pending->nextRetry;
+        pending->nextRetry = NULL;
+
+        // Answered for already by a dead name or the response timeout
+        if (pending->replied || sendNotification(pending))
+            continue;
+
+        pending->nextRetry = wrangler->retryHead;
+        wrangler->retryHead = pending;
+    }
+
+    if (!wrangler->retryHead) {
+        CFRunLoopTimerInvalidate(wrangler->retryTimer);
+        wrangler->retryTimer = NULL;
+    }
+
+    checkResponses(wrangler);
 }
 
 static void describeWakeEvent(
@@ -2151,17 +2527,53 @@ static void describeWakeEvent(
 #pragma mark -
 #pragma mark CheckResponses
 
+static void earlierWakePick(CFAbsoluteTime *pick, CFAbsoluteTime requested)
+{
+    if (VALID_DATE(requested) && (!VALID_DATE(*pick) || (requested < *pick)))
+    {
+        *pick = requested;
+    }
+}
+
+/* Marks 'response' replied, and folds its wake requests into the running
+ * picks of its wrangler. checkResponses() finishes the wrangler once none
+ * are outstanding.
+ */
+static void responseReplied(PMResponse *response)
+{
+    PMResponseWrangler      *wrangler = response->myResponseWrangler;
+
+    if (response->replied)
+        return;
+
+    response->replied = true;
+    wrangler->outstandingCount--;
+    if (response->timedout)
+        wrangler->timedOutCount++;
+
+    earlierWakePick(&wrangler->pick[kChooseMaintenance], response->maintenanceRequested);
+    earlierWakePick(&wrangler->pick[kChooseSleepServiceWake], response->sleepServiceRequested);
+    earlierWakePick(&wrangler->pick[kChooseTimerPlugin], response->timerPluginRequested);
+}
+
 static bool checkResponses_ScheduleWakeEvents(PMResponseWrangler *wrangler)
 {
     int                     i = 0;
-    int                     responsesCount          = 0;
-    bool                    complete                = true;
     PMResponse              *oneResponse            = NULL;
     CFMutableStringRef      allWakeEventsString     = NULL;
     CFAbsoluteTime          pick[kChooseWakeTypeCount];
 
-    bzero(pick, sizeof(pick));
-    
+    if (wrangler->outstandingCount > 0) {
+        // Some clients have not responded yet.
+        // We await more responses, or more deaths, or a timeout.
+        return false;
+    }
+
+    if (BIT_IS_SET(wrangler->notificationType, kIOPMSystemCapabilityCPU)) {
+        // Only schedule wakeup events if we're going to sleep.
+        return true;
+    }
+
     if (PMDebugEnabled(kLogWakeEvents)) {
         allWakeEventsString = CFStringCreateMutable(0, 0);
     }
@@ -2180,16 +2592,11 @@ static bool checkResponses_ScheduleWakeEvents(PMResponseWrangler *wrangler)
                           allWakeEventsString, CFSTR("BTIntervalWaitToDarkWake"), 
                           gWakeForDWBTInterval , NULL);
     }
-    responsesCount = CFArrayGetCount(wrangler->awaitingResponses);    
-    
-    for (i=0; i<responsesCount; i++)
+
+    // The picks are already up to date; only the log needs each response.
+    for (i=0; allWakeEventsString && (i<wrangler->responseCount); i++)
     {
-        oneResponse = (PMResponse *)CFArrayGetValueAtIndex(wrangler->awaitingResponses, i);
-        
-        if (!oneResponse->replied) {
-            complete = false;
-            break;
-        }
+        oneResponse = &wrangler->responses[i];
         
         if (VALID_DATE(oneResponse->maintenanceRequested)) 
         {
@@ -2213,47 +2620,19 @@ static bool checkResponses_ScheduleWakeEvents(PMResponseWrangler *wrangler)
                               oneResponse->timerPluginRequested,
                               oneResponse->clientInfoString);
         }
-        
-        if (!VALID_DATE(pick[kChooseMaintenance])
-            || (VALID_DATE(oneResponse->maintenanceRequested) && (oneResponse->maintenanceRequested < pick[kChooseMaintenance])))
-        {
-            pick[kChooseMaintenance] = oneResponse->maintenanceRequested;
-        }
-        
-        if (!VALID_DATE(pick[kChooseSleepServiceWake])
-            || (VALID_DATE(oneResponse->sleepServiceRequested) && (oneResponse->sleepServiceRequested < pick[kChooseSleepServiceWake])))
-        {
-            pick[kChooseSleepServiceWake] = oneResponse->sleepServiceRequested;
-        }
-
-        if (!VALID_DATE(pick[kChooseTimerPlugin])
-            || (VALID_DATE(oneResponse->timerPluginRequested) && (oneResponse->timerPluginRequested < pick[kChooseTimerPlugin])))
-        {
-            pick[kChooseTimerPlugin] = oneResponse->timerPluginRequested;
-        }
     }
-    
-    if (!complete) {
-        // Some clients have not responded yet.
-        // We await more responses, or more deaths, or a timeout.
-        goto exit;
-    }
-
-    if (!BIT_IS_SET(wrangler->notificationType, kIOPMSystemCapabilityCPU)) 
-    {
-        // Only schedule wakeup events if we're going to sleep.
 
-        logASLMessagePMConnectionScheduledWakeEvents(allWakeEventsString);        
-        
-        PMScheduleWakeEventChooseBest(pick);
-    } 
+    logASLMessagePMConnectionScheduledWakeEvents(allWakeEventsString);        
+    
+    // PMScheduleWakeEventChooseBest fills in the other wake types
+    bcopy(wrangler->pick, pick, sizeof(pick));
+    PMScheduleWakeEventChooseBest(pick);
     
-exit:
     if (allWakeEventsString){
         CFRelease(allWakeEventsString);
     }
 
-    return complete;
+    return true;
 }
 
 static void checkResponses(PMResponseWrangler *wrangler)
@@ -2269,11 +2648,11 @@ static void checkResponses(PMResponseWrangler *wrangler)
         wrangler->awaitingResponsesTimeout = NULL;
     }
     
+    wrangler->allRepliedTime = CFAbsoluteTimeGetCurrent();
+    recordTransition(wrangler);
+
     // Handle PowerManagement acknowledgements
-    if (wrangler->kernelAcknowledgementID) 
-    {
-        IOAllowPowerChange(gRootDomainConnect, wrangler->kernelAcknowledgementID);
-    }
+    acknowledgeTransition(&wrangler->transition);
     
     cleanupResponseWrangler(wrangler);
     
@@ -2453,36 +2832,55 @@ __private_extern__ void PMScheduleWakeEventChooseBest(CFAbsoluteTime *pickWakeEv
 /*****************************************************************************/
 /*****************************************************************************/
 
-static CFArrayRef createArrayOfConnectionsWithInterest(
-    int interestBits)
+/* Moves 'connection' onto the gInterestLists of the bits in 'interests', and
+ * off the lists of bits it no longer has.
+ */
+static void setConnectionInterests(
+    PMConnection            *connection,
+    IOPMCapabilityBits      interests)
 {
-    CFMutableArrayRef       arrayFoundInterests = NULL;
-    PMConnection            *lookee;
-    int                     gConnectionsCount;
-    int                     i;
-    
-    
-    if (0 == interestBits)
-        return NULL;
+    int                     bit;
 
-    // *********        
-    
-    arrayFoundInterests = CFArrayCreateMutable(kCFAllocatorDefault, 0, &_CFArrayConnectionCallBacks);
+    interests &= kConnectionInterestMask;
 
-    gConnectionsCount = CFArrayGetCount(gConnections);
-
-    for (i=0; i<gConnectionsCount; i++)
+    for (bit=0; bit<kConnectionInterestBitCount; bit++)
     {
-        lookee = (PMConnection *)CFArrayGetValueAtIndex(gConnections, i);
+        bool    had = (connection->interestsBits & (1 << bit));
+        bool    has = (interests & (1 << bit));
 
-        // Matching interest in this connection
-        if (interestBits & lookee->interestsBits) {
-            CFArrayAppendValue(arrayFoundInterests, lookee);
+        if (had == has)
+            continue;
+        if (has) {
+            LIST_INSERT_HEAD(&gInterestLists[bit], connection, interestLinks[bit]);
+        } else {
+            LIST_REMOVE(connection, interestLinks[bit]);
         }
     }
-    
-    return arrayFoundInterests;
-    
+    connection->interestsBits = interests;
+}
+
+/* Makes room for 'count' responses in gResponsePool.
+ * Only called while no PMResponseWrangler is in flight.
+ */
+static bool reserveResponses(int count)
+{
+    PMResponse              *grown;
+    int                     newSize;
+
+    if (count <= gResponsePoolSize)
+        return true;
+
+    newSize = gResponsePoolSize ? gResponsePoolSize : 64;
+    while (newSize < count)
+        newSize *= 2;
+
+    grown = (PMResponse *)realloc(gResponsePool, newSize * sizeof(PMResponse));
+    if (!grown)
+        return false;
+
+    gResponsePool = grown;
+    gResponsePoolSize = newSize;
+    return true;
 }
 
 /*****************************************************************************/
@@ -2508,8 +2906,13 @@ static IOReturn createConnectionWithID(PMConnection **out)
     
     ((PMConnection *)*out)->uniqueID = kConnectionOffset + globalConnectionIDTally++;
 
-    // Add new connection to the global tracking array
-    CFArrayAppendValue(gConnections, *out);
+    // Add new connection to the global tracking list and ID index
+    if (!pointerTableInsert(&gConnectionsByID, *out)) {
+        free(*out);
+        *out = NULL;
+        return kIOReturnNoMemory;
+    }
+    LIST_INSERT_HEAD(&gConnections, *out, link);
     
     return kIOReturnSuccess;
 }
@@ -2519,22 +2922,7 @@ static IOReturn createConnectionWithID(PMConnection **out)
 
 static PMConnection *connectionForID(uint32_t findMe)
 {
-    CFIndex     where = 0;
-    CFRange     theRange = CFRangeMake(0, CFArrayGetCount(gConnections));
-    PMConnection     dummy;
-    
-    // Our gConnections CFArray equality callback only checks the "uniqueID" field
-    // of the passed in PMConnection type. Searching for the value "dummy"
-    // will return the first instance with connection ID "findMe".
-
-    dummy.uniqueID = findMe;
-    where = CFArrayGetFirstIndexOfValue(gConnections, theRange, &dummy);
-
-    if (kCFNotFound == where) {
-        return NULL;
-    } else {
-        return (PMConnection *)CFArrayGetValueAtIndex(gConnections, where);
-    }
+    return pointerTableFind(&gConnectionsByID, findMe);
 }
 
 // Unclamps machine from SilentRunning if the machine is currently clamped.
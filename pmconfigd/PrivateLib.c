@@ -46,6 +46,7 @@
 #include "PrivateLib.h"
 #include "BatteryTimeRemaining.h"
 #include "PMAssertions.h"
+#include "PMAssertionWire.h"
 #include "PMSettings.h"
 #include "PMAssertions.h"
 
@@ -2135,7 +2136,6 @@ bool isA_DarkWakeState();
 void mt2RecordAssertionEvent(assertionOps action, assertion_t *theAssertion)
 {
     CFStringRef         processName;
-    CFStringRef         assertionType;
 
     if (!mt2) {
         return;
@@ -2149,14 +2149,14 @@ void mt2RecordAssertionEvent(assertionOps action, assertion_t *theAssertion)
         processName = CFSTR("Unknown");
     }
     
-    if (!(assertionType = CFDictionaryGetValue(theAssertion->props, kIOPMAssertionTypeKey))
-        || (!CFEqual(assertionType, kIOPMAssertionTypeBackgroundTask)
-         && !CFEqual(assertionType, kIOPMAssertionTypeApplePushServiceTask)))
+    // Goes by the name the client used, as ApplePushServiceTask may be an alias
+    if ( (theAssertion->typeToken != kPMWireTypeTokenBackgroundTask)
+      && (theAssertion->typeToken != kPMWireTypeTokenApplePushServiceTask) )
     {
         return;
     }
     
-    if (CFEqual(assertionType, kIOPMAssertionTypeBackgroundTask))
+    if (theAssertion->typeToken == kPMWireTypeTokenBackgroundTask)
     {
         if (kAssertionOpRaise == action) {
             if (!CFSetContainsValue(mt2->alreadyRecordedBackground, processName)) {
@@ -2167,7 +2167,7 @@ void mt2RecordAssertionEvent(assertionOps action, assertion_t *theAssertion)
             }
         }
     }
-    else if (CFEqual(assertionType, kIOPMAssertionTypeApplePushServiceTask))
+    else if (theAssertion->typeToken == kPMWireTypeTokenApplePushServiceTask)
     {
         if (kAssertionOpRaise == action) {
             if (!CFSetContainsValue(mt2->alreadyRecordedPush, processName)) {
@@ -2714,6 +2714,104 @@ exit:
     return ret;
 }
 
+/*****************************************************************************/
+
+#define kPointerTableMinSize    64
+
+static inline uint32_t pointerTableIndex(pointerTable_t *table, uint32_t key)
+{
+    return (key * 2654435761U) & (table->size - 1);
+}
+
+__private_extern__ void *pointerTableFind(pointerTable_t *table, uint32_t key)
+{
+    void            *entry;
+    uint32_t        i;
+
+    if (!table->slots)
+        return NULL;
+
+    for (i = pointerTableIndex(table, key); (entry = table->slots[i]); i = (i + 1) & (table->size - 1))
+    {
+        if (table->keyOf(entry) == key)
+            return entry;
+    }
+    return NULL;
+}
+
+static void pointerTablePlace(pointerTable_t *table, void *entry)
+{
+    uint32_t        i;
+
+    for (i = pointerTableIndex(table, table->keyOf(entry)); table->slots[i]; i = (i + 1) & (table->size - 1))
+        ;
+    table->slots[i] = entry;
+}
+
+/* Adds 'entry', growing the table first if that would leave it over half full.
+ * Returns false, with the table unchanged, if it can't grow.
+ */
+__private_extern__ bool pointerTableInsert(pointerTable_t *table, void *entry)
+{
+    void            **oldSlots = table->slots;
+    uint32_t        oldSize = table->size;
+    uint32_t        i;
+
+    if ((table->count + 1) * 2 > table->size)
+    {
+        uint32_t    newSize = oldSize ? (oldSize * 2) : kPointerTableMinSize;
+
+        if (!(table->slots = calloc(newSize, sizeof(void *)))) {
+            table->slots = oldSlots;
+            return false;
+        }
+        table->size = newSize;
+
+        for (i = 0; i < oldSize; i++) {
+            if (oldSlots[i])
+                pointerTablePlace(table, oldSlots[i]);
+        }
+        free(oldSlots);
+    }
+
+    pointerTablePlace(table, entry);
+    table->count++;
+    return true;
+}
+
+/* Removes 'entry' and shifts back any later entry of the same probe run,
+ * so lookups never need tombstones.
+ */
+__private_extern__ void pointerTableRemove(pointerTable_t *table, void *entry)
+{
+    uint32_t        mask = table->size - 1;
+    uint32_t        i, j, k;
+
+    if (!table->slots)
+        return;
+
+    for (i = pointerTableIndex(table, table->keyOf(entry)); table->slots[i] != entry; i = (i + 1) & mask)
+    {
+        if (!table->slots[i])
+            return;
+    }
+    table->slots[i] = NULL;
+
+    for (j = (i + 1) & mask; table->slots[j]; j = (j + 1) & mask)
+    {
+        k = pointerTableIndex(table, table->keyOf(table->slots[j]));
+
+        // Leave it if its home slot is cyclically within (i, j]
+        if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+            continue;
+
+        table->slots[i] = table->slots[j];
+        table->slots[j] = NULL;
+        i = j;
+    }
+    table->count--;
+}
+
 /* extern symbol defined in IOKit.framework
  * IOCFURLAccess.c
  */
@@ -179,6 +179,22 @@ typedef struct {
     unsigned int        fAutoPowerOffDelay;
 } IOPMAggressivenessFactors;
 
+/* pointerTable_t
+ *
+ * Open addressing (linear probing) table of pointers, keyed by the uint32_t
+ * that keyOf() reads from each entry. The size is a power of 2, and the table
+ * is kept at most half full. Empty slots are NULL; callers may walk 'slots'
+ * directly to visit every entry.
+ */
+typedef struct {
+    void                **slots;
+    uint32_t            size;
+    uint32_t            count;
+    uint32_t            (*keyOf)(const void *entry);
+} pointerTable_t;
+
+#define POINTER_TABLE_INITIALIZER(keyOf)    { NULL, 0, 0, (keyOf) }
+
 enum { 
     kIOHibernateMinFreeSpace                            = 750*1024ULL*1024ULL  /* 750Mb */
 };
@@ -490,5 +506,9 @@ __private_extern__ bool getAggressivenessValue(CFDictionaryRef     dict,
 __private_extern__ void                 _oneOffHacksSetup(void);
 
 __private_extern__ IOReturn getNvramArgInt(char *key, int *value);
+
+__private_extern__ void                 *pointerTableFind(pointerTable_t *table, uint32_t key);
+__private_extern__ bool                 pointerTableInsert(pointerTable_t *table, void *entry);
+__private_extern__ void                 pointerTableRemove(pointerTable_t *table, void *entry);
 #endif
 
@@ -25,6 +25,8 @@
 
 #include <syslog.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include <grp.h>
 #include <pwd.h>
 #include <mach/mach.h>
@@ -123,6 +125,19 @@ __private_extern__ CFMachPortRef     pmServerMachPort                  = NULL;
 // defined by MiG
 extern boolean_t powermanagement_server(mach_msg_header_t *, mach_msg_header_t *);
 
+/*
+ * Read-only routines, served by a pool of reader threads so that bursts of
+ * queries don't hold up the main queue. Their handlers run off the main
+ * queue, and must fetch any state other than published snapshots on it.
+ */
+static const char               *kReaderRoutineNames[] = {
+    "io_pm_assertion_copy_details"
+};
+#define kReaderRoutineCount     (sizeof(kReaderRoutineNames) / sizeof(kReaderRoutineNames[0]))
+
+static mach_msg_id_t            gReaderRoutineIDs[kReaderRoutineCount];
+static dispatch_queue_t         gReaderQueue                        = NULL;
+
 
 // foward declarations
 static void initializeESPrefsDynamicStore(void);
@@ -191,6 +206,9 @@ static void mig_server_callback(
                 CFIndex size, 
                 void *info);
 
+static void serveMIGRequest(mig_reply_error_t *bufRequest);
+static void initializeReaderRoutines(void);
+
 kern_return_t _io_pm_set_active_profile(
                 mach_port_t         server,
                 audit_token_t       token,
@@ -272,6 +290,8 @@ int main(int argc __unused, char *argv[] __unused)
                                 kIOPMServerBootstrapName, kern_result);
     }
 
+    initializeReaderRoutines();
+
     if (MACH_PORT_NULL != serverPort)
     {
         // Finish setting up mig handler callback on pmServerMachPort
@@ -952,14 +972,46 @@ pm_mig_demux(
 
 
 
+static void
+initializeReaderRoutines(void)
+{
+    static const struct {
+        const char      *name;
+        mach_msg_id_t   id;
+    } routines[] = { subsystem_to_name_map_powermanagement };
+    unsigned int        i, j;
+
+    for (i = 0; i < kReaderRoutineCount; i++) {
+        for (j = 0; j < sizeof(routines) / sizeof(routines[0]); j++) {
+            if (!strcmp(kReaderRoutineNames[i], routines[j].name)) {
+                gReaderRoutineIDs[i] = routines[j].id;
+                break;
+            }
+        }
+    }
+
+    gReaderQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+}
+
+static bool
+isReaderRoutine(mach_msg_id_t msgh_id)
+{
+    unsigned int    i;
+
+    for (i = 0; i < kReaderRoutineCount; i++) {
+        if (gReaderRoutineIDs[i] && (gReaderRoutineIDs[i] == msgh_id))
+            return true;
+    }
+    return false;
+}
+
 static void
 mig_server_callback(CFMachPortRef port, void *msg, CFIndex size, void *info)
 {
     mig_reply_error_t * bufRequest = msg;
-    mig_reply_error_t * bufReply = CFAllocatorAllocate(
-        NULL, _powermanagement_subsystem.maxsize, 0);
-    mach_msg_return_t   mr;
-    int                 options;
+    mig_reply_error_t * readerRequest = NULL;
+    mach_msg_trailer_t  *trailer;
+    size_t              requestSize;
 #if TARGET_OS_EMBEDDED
     int                 ret = 0;
     uint64_t            token;
@@ -970,7 +1022,50 @@ mig_server_callback(CFMachPortRef port, void *msg, CFIndex size, void *info)
 #if TARGET_OS_EMBEDDED
     ret = proc_importance_assertion_begin_with_msg(&bufRequest->Head, NULL, &token);
 #endif /* 1*/
-    
+
+    if (isReaderRoutine(bufRequest->Head.msgh_id))
+    {
+        // CF frees the message on return, so the reader gets its own copy,
+        // including the trailer that carries the caller's audit token.
+        trailer = (mach_msg_trailer_t *)((uint8_t *)bufRequest + round_msg(bufRequest->Head.msgh_size));
+        requestSize = round_msg(bufRequest->Head.msgh_size) + trailer->msgh_trailer_size;
+        readerRequest = malloc(requestSize);
+    }
+
+    if (readerRequest)
+    {
+        memcpy(readerRequest, bufRequest, requestSize);
+        dispatch_async(gReaderQueue, ^{
+            serveMIGRequest(readerRequest);
+            free(readerRequest);
+#if TARGET_OS_EMBEDDED
+            if (ret == 0)
+                proc_importance_assertion_complete(token);
+#endif 
+        });
+        return;
+    }
+
+    serveMIGRequest(bufRequest);
+
+#if TARGET_OS_EMBEDDED
+    if (ret == 0)
+        proc_importance_assertion_complete(token);
+#endif 
+}
+
+/*
+ * Demuxes one request and sends the reply. Called on the main queue, or on
+ * a reader thread for the routines in kReaderRoutineNames.
+ */
+static void
+serveMIGRequest(mig_reply_error_t *bufRequest)
+{
+    mig_reply_error_t * bufReply = CFAllocatorAllocate(
+        NULL, _powermanagement_subsystem.maxsize, 0);
+    mach_msg_return_t   mr;
+    int                 options;
+
     /* we have a request message */
     (void) pm_mig_demux(&bufRequest->Head, &bufReply->Head);
 
@@ -1044,10 +1139,6 @@ mig_server_callback(CFMachPortRef port, void *msg, CFIndex size, void *info)
 
 
 out:
-#if TARGET_OS_EMBEDDED
-    if (ret == 0)
-        proc_importance_assertion_complete(token);
-#endif 
     CFAllocatorDeallocate(NULL, bufReply);
     return;
 
@@ -152,6 +152,8 @@
 #define ARG_THERMLOG        "thermlog"
 #define ARG_ASSERTIONS      "assertions"
 #define ARG_ASSERTIONSLOG   "assertionslog"
+#define ARG_ASSERTIONBYTES  "assertionbytes"
+#define ARG_PMCONNECTIONS   "pmconnections"
 #define ARG_SYSLOAD         "sysload"
 #define ARG_SYSLOADLOG      "sysloadlog"
 #define ARG_ACTIVITY        "activity"
@@ -181,6 +183,7 @@
 #define ARG_RDAP            "rdap"
 #define ARG_DEBUGFLAGS      "debugflags"
 #define ARG_BTINTERVAL      "btinterval"
+#define ARG_ASSERTIONTUNABLE    "assertiontunable"
 #define ARG_MT2BOOK         "mt2book"
 
 // special system
@@ -332,6 +335,9 @@ static void show_power_sources(int which);
 static bool prevent_idle_sleep(void);
 static void show_assertions(void);
 static void log_assertions(void);
+static void show_assertion_bytes(void);
+static void show_connection_stats(void);
+static void show_transition_stats(void);
 static void show_systemload(void);
 static void log_systemload(void);
 static void show_log(void);
@@ -347,6 +353,7 @@ static void show_power_event_history_detailed(void);
 static void set_new_power_bookmark(void);
 static void set_debugFlags(char **argv);
 static void set_btInterval(char **argv);
+static void set_assertionTunable(char **argv);
 static void show_details_for_UUID(char *UUID_string);
 static void show_NULL_HID_events(void);
 static void show_root_domain_user_clients(void);
@@ -482,6 +489,8 @@ static CommandAndAction the_getters[] =
     	{kActionGetLog,         ARG_THERMLOG,       ^{ log_thermal_events(); }},
     	{kActionGetOnceNoArgs,  ARG_ASSERTIONS,     ^{ show_assertions(); }},
     	{kActionGetLog,         ARG_ASSERTIONSLOG,  ^{ log_assertions(); }},
+    	{kActionGetOnceNoArgs,  ARG_ASSERTIONBYTES, ^{ show_assertion_bytes(); }},
+    	{kActionGetOnceNoArgs,  ARG_PMCONNECTIONS,  ^{ show_connection_stats(); }},
     	{kActionGetOnceNoArgs,  ARG_SYSLOAD,        ^{ show_systemload(); }},
     	{kActionGetLog,         ARG_SYSLOADLOG,     ^{ log_systemload(); }},
     	{kActionGetOnceNoArgs,  ARG_LOG,            ^{ show_log(); }},
@@ -2788,22 +2797,241 @@ exit:
     return;
 }
 
+static const char *stringForAssertionEvent(uint16_t event)
+{
+    switch (event) {
+        case kIOPMAssertionEventCreated:        return "Created";
+        case kIOPMAssertionEventReleased:       return "Released";
+        case kIOPMAssertionEventTimedOut:       return "TimedOut";
+        case kIOPMAssertionEventTurnedOn:       return "TurnedOn";
+        case kIOPMAssertionEventTurnedOff:      return "TurnedOff";
+        case kIOPMAssertionEventProcessExited:  return "ClientDied";
+        default:                                return "Unknown";
+    }
+}
+
+/*
+ * Prints the assertion events after *cursor and advances it.
+ * Returns false if powerd dropped some of them before we could read them.
+ */
+static bool print_assertion_events(mach_port_t pm_server, uint64_t *cursor)
+{
+    IOPMAssertionEventRecord    *rec;
+    vm_offset_t                 events;
+    mach_msg_type_number_t      eventsCnt;
+    int                         overflowed = 0;
+    int                         rc = kIOReturnSuccess;
+    bool                        complete = true;
+    unsigned int                count, i;
+
+    do {
+        events = 0;
+        eventsCnt = 0;
+        if ((KERN_SUCCESS != io_pm_assertion_copy_events(pm_server, *cursor, 
+                                    &events, &eventsCnt, cursor, &overflowed, &rc))
+                || (kIOReturnSuccess != rc))
+        {
+            return false;
+        }
+        if (overflowed)
+            complete = false;
+
+        rec = (IOPMAssertionEventRecord *)events;
+        count = eventsCnt / sizeof(IOPMAssertionEventRecord);
+        for (i = 0; i < count; i++, rec++)
+        {
+            print_pretty_date(rec->time, false);
+            printf("%-10s pid %d: [0x%08x] %s named: \"%s\" level %d\n",
+                   stringForAssertionEvent(rec->event), rec->pid, rec->assertionID,
+                   rec->type, rec->name, rec->level);
+        }
+
+        if (events)
+            vm_deallocate(mach_task_self(), events, eventsCnt);
+    } while (count == kIOPMAssertionEventsMaxBatch);
+
+    return complete;
+}
+
+static int compare_property_usage(const void *a, const void *b)
+{
+    uint64_t    bytesA = ((const IOPMAssertionPropertyUsageRecord *)a)->bytes;
+    uint64_t    bytesB = ((const IOPMAssertionPropertyUsageRecord *)b)->bytes;
+
+    return (bytesA < bytesB) ? 1 : ((bytesA > bytesB) ? -1 : 0);
+}
+
+/*
+ * Shows the memory powerd holds for assertion properties, by process,
+ * largest first.
+ */
+static void show_assertion_bytes(void)
+{
+    IOPMAssertionPropertyUsageRecord    *rec;
+    mach_port_t                         pm_server = MACH_PORT_NULL;
+    vm_offset_t                         usage = 0;
+    mach_msg_type_number_t              usageCnt = 0;
+    uint64_t                            total = 0;
+    int                                 rc = kIOReturnSuccess;
+    kern_return_t                       kr;
+    unsigned int                        count, i;
+
+    if (kIOReturnSuccess != _pm_connect(&pm_server)) {
+        printf("Could not connect to powerd.\n");
+        return;
+    }
+
+    kr = io_pm_assertion_copy_property_usage(pm_server, &usage, &usageCnt, &rc);
+    _pm_disconnect(pm_server);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc)) {
+        printf("Failed to read assertion property usage. err=0x%x\n", (KERN_SUCCESS != kr) ? kr : rc);
+        return;
+    }
+
+    rec = (IOPMAssertionPropertyUsageRecord *)usage;
+    count = usageCnt / sizeof(IOPMAssertionPropertyUsageRecord);
+    qsort(rec, count, sizeof(*rec), compare_property_usage);
+
+    printf("Assertion properties by process:\n");
+    for (i = 0; i < count; i++)
+    {
+        printf("   pid %d(%s): %llu bytes in %u assertion%s, largest %u bytes [0x%08x]\n",
+               rec[i].pid, rec[i].name, (unsigned long long)rec[i].bytes,
+               rec[i].assertionCount, (rec[i].assertionCount == 1) ? "" : "s",
+               rec[i].largestBytes, rec[i].largestID);
+        total += rec[i].bytes;
+    }
+    printf("Total %llu bytes for %u process%s\n", (unsigned long long)total, count, (count == 1) ? "" : "es");
+
+    if (usage)
+        vm_deallocate(mach_task_self(), usage, usageCnt);
+}
+
+/*
+ * Shows the capability changes delivered to IOPMConnections: how many were
+ * merged or dropped while queued, and how long clients took to acknowledge.
+ */
+static void show_transition_stats(void)
+{
+    IOPMConnectionTransitionStats   *ts;
+    IOPMConnectionTransitionRecord  *rec;
+    mach_port_t                     pm_server = MACH_PORT_NULL;
+    vm_offset_t                     stats = 0;
+    mach_msg_type_number_t          statsCnt = 0;
+    int                             rc = kIOReturnSuccess;
+    kern_return_t                   kr;
+    unsigned int                    i;
+
+    if (kIOReturnSuccess != _pm_connect(&pm_server)) {
+        printf("Could not connect to powerd.\n");
+        return;
+    }
+
+    kr = io_pm_connection_copy_transition_stats(pm_server, &stats, &statsCnt, &rc);
+    _pm_disconnect(pm_server);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc) || (statsCnt < sizeof(*ts))) {
+        printf("Failed to read transition statistics. err=0x%x\n", (KERN_SUCCESS != kr) ? kr : rc);
+        if (stats)
+            vm_deallocate(mach_task_self(), stats, statsCnt);
+        return;
+    }
+
+    ts = (IOPMConnectionTransitionStats *)stats;
+    printf("Capability changes: %llu delivered, %llu merged, %llu dropped; queued %u (most %u)\n",
+           (unsigned long long)ts->transitions, (unsigned long long)ts->merged,
+           (unsigned long long)ts->dropped, ts->queueDepth, ts->queueHighWater);
+    if (ts->transitions) {
+        printf("Latency to all acknowledged: avg %.3f sec, max %.3f sec\n",
+               ts->totalLatency / ts->transitions, ts->maxLatency);
+    }
+
+    for (i = 0; (i < ts->historyCount) && (i < kIOPMConnectionTransitionHistory); i++)
+    {
+        rec = &ts->history[i];
+        printf("   ");
+        print_pretty_date(rec->receivedTime, false);
+        printf("caps=0x%02x %.3f sec: %u client%s, %u timed out, %u merged\n",
+               rec->capabilityBits, rec->latency,
+               rec->responseCount, (rec->responseCount == 1) ? "" : "s",
+               rec->timedOutCount, rec->mergedCount);
+    }
+
+    vm_deallocate(mach_task_self(), stats, statsCnt);
+}
+
+/*
+ * Shows how sleep/wake notifications were delivered to each open IOPMConnection.
+ */
+static void show_connection_stats(void)
+{
+    IOPMConnectionNotificationStatsRecord   *rec;
+    mach_port_t                             pm_server = MACH_PORT_NULL;
+    vm_offset_t                             stats = 0;
+    mach_msg_type_number_t                  statsCnt = 0;
+    int                                     rc = kIOReturnSuccess;
+    kern_return_t                           kr;
+    unsigned int                            count, i;
+
+    if (kIOReturnSuccess != _pm_connect(&pm_server)) {
+        printf("Could not connect to powerd.\n");
+        return;
+    }
+
+    kr = io_pm_connection_copy_notification_stats(pm_server, &stats, &statsCnt, &rc);
+    _pm_disconnect(pm_server);
+    if ((KERN_SUCCESS != kr) || (kIOReturnSuccess != rc)) {
+        printf("Failed to read IOPMConnection statistics. err=0x%x\n", (KERN_SUCCESS != kr) ? kr : rc);
+        return;
+    }
+
+    rec = (IOPMConnectionNotificationStatsRecord *)stats;
+    count = statsCnt / sizeof(IOPMConnectionNotificationStatsRecord);
+
+    printf("Sleep/wake notifications by IOPMConnection:\n");
+    for (i = 0; i < count; i++)
+    {
+        printf("   pid %d(%s) [%u]: %u sent, %u delayed, %u dropped\n",
+               rec[i].pid, rec[i].name, rec[i].connectionID,
+               rec[i].sent, rec[i].delayed, rec[i].dropped);
+    }
+    printf("%u connection%s\n", count, (count == 1) ? "" : "s");
+
+    if (stats)
+        vm_deallocate(mach_task_self(), stats, statsCnt);
+
+    show_transition_stats();
+}
+
 static void log_assertions(void)
 {
     int                 token;
     int                 notify_status;
+    mach_port_t         pm_server = MACH_PORT_NULL;
+    __block uint64_t    cursor = UINT64_MAX;
+
+    if (kIOReturnSuccess != _pm_connect(&pm_server)) {
+        printf("Could not connect to powerd. Exiting.\n");
+        return;
+    }
+
+    /* Start at the newest event; the summary below covers what came before */
+    print_assertion_events(pm_server, &cursor);
 
     notify_status = notify_register_dispatch(
             kIOPMAssertionsAnyChangedNotifyString, 
             &token, 
             dispatch_get_main_queue(), 
             ^(int t) {
-               show_assertions();
+               if (!print_assertion_events(pm_server, &cursor)) {
+                   printf("Some assertion events were missed. Current assertions:\n");
+                   show_assertions();
+               }
              });
 
     if (NOTIFY_STATUS_OK != notify_status) {
         printf("Could not get notification for %s. Exiting.\n",
                 kIOPMAssertionTimedOutNotifyString);
+        _pm_disconnect(pm_server);
         return;
     }
 
@@ -4469,6 +4697,10 @@ static int parseArgs(int argc,
               else
                   printf("Error: You need to specify an interval in seconds\n");
               goto exit;
+          } else if(0 == strncmp(argv[i], ARG_ASSERTIONTUNABLE, kMaxArgStringLength))
+          {
+              set_assertionTunable(&argv[i+1]);
+              goto exit;
           } else if (0 == strncmp(argv[i], ARG_MT2BOOK, kMaxArgStringLength))
           {
               mt2bookmark();
@@ -5902,6 +6134,81 @@ static void set_btInterval(char **argv)
 
 }
 
+typedef struct {
+    const char      *name;
+    int             selector;
+    const char      *units;
+} assertionTunable_t;
+
+static const assertionTunable_t kAssertionTunables[] = {
+    { "notifywindow",       kIOPMAssertionTunableNotifyWindow,      "ms" },
+    { "timedouthistory",    kIOPMAssertionTunableTimedOutHistory,   "entries" },
+    { "processlimit",       kIOPMAssertionTunableProcessLimit,      "assertions" },
+    { "processrate",        kIOPMAssertionTunableProcessRate,       "calls/s" },
+    { "processburst",       kIOPMAssertionTunableProcessBurst,      "calls" },
+    { "quotarejects",       kIOPMAssertionTunableQuotaRejects,      "creates" },
+    { "raterejects",        kIOPMAssertionTunableRateRejects,       "calls" },
+    { "propertylimit",      kIOPMAssertionTunablePropertyLimit,     "bytes" }
+};
+
+/*
+ * pmset assertiontunable                  - show all assertion tunables
+ * pmset assertiontunable <name>           - show one
+ * pmset assertiontunable <name> <value>   - change one (root only)
+ */
+static void set_assertionTunable(char **argv)
+{
+    mach_port_t     connectIt = MACH_PORT_NULL;
+    const char      *name = argv[0];
+    int             newValue = -1;
+    int             oldValue = 0;
+    int             rc = kIOReturnSuccess;
+    bool            found = false;
+    kern_return_t   kr;
+    unsigned int    i;
+
+    if (name && argv[1]) {
+        char    *end = NULL;
+
+        errno = 0;
+        newValue = (int)strtol(argv[1], &end, 0);
+        if (errno || !end || *end || (newValue < 0)) {
+            printf("Invalid argument\n");
+            return;
+        }
+    }
+
+    if (kIOReturnSuccess != _pm_connect(&connectIt)) {
+        printf("Failed to connect to powerd\n");
+        return;
+    }
+
+    for (i = 0; i < sizeof(kAssertionTunables)/sizeof(kAssertionTunables[0]); i++)
+    {
+        const assertionTunable_t *t = &kAssertionTunables[i];
+
+        if (name && strncmp(name, t->name, kMaxArgStringLength))
+            continue;
+        found = true;
+
+        kr = io_pm_assertion_set_tunable(connectIt, t->selector, newValue, &oldValue, &rc);
+        if (KERN_SUCCESS != kr)
+            rc = kr;
+
+        if (kIOReturnSuccess != rc)
+            printf("Failed to %s %s. err=0x%x\n", (newValue < 0) ? "read" : "change", t->name, rc);
+        else if (newValue < 0)
+            printf(" %-20s %d %s\n", t->name, oldValue, t->units);
+        else
+            printf("%s changed from %d %s to %d %s\n", t->name, oldValue, t->units, newValue, t->units);
+    }
+
+    if (!found)
+        printf("Unknown assertion tunable %s\n", name);
+
+    _pm_disconnect(connectIt);
+}
+
 static void set_new_power_bookmark(void) {
   char uuid[1024];
   